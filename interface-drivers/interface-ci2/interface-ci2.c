@@ -8,16 +8,23 @@
 #include <libgen.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <stdio.h>
 #include <pthread.h>
 #include <unistd.h>
 #include "mrbfs-module.h"
 #include "mrbfs-pktqueue.h"
+#include "mrbfs-options.h"
+#include "mrbfs-serial.h"
 
 // ~85 bytes per packet, and hold 512
 #define RX_PKT_BUFFER_SZ  (83 * 512)  
 
+// Most packets to gather into one transmit, and the longest one as text - ":FE->FF 41 ...;\r"
+#define CI2_TX_BATCH   32
+#define CI2_TX_PKT_SZ  64
+
 const char* mrbfsInterfaceOptionGet(MRBFSInterfaceDriver* mrbfsInterfaceDriver, const char* interfaceOptionKey, const char* defaultValue);
 
 typedef struct
@@ -27,6 +34,8 @@ typedef struct
 	MRBFSFileNode* file_pktLog;
 	char pktLogStr[RX_PKT_BUFFER_SZ];
 	MRBusPacketQueue txq;
+	MRBFSSerialConfig serialConfig;
+	MRBFSSerialLink serialLink;
 } NodeLocalStorage;
 
 int mrbfsInterfaceDriverVersionCheck(int ifaceVersion)
@@ -36,68 +45,17 @@ int mrbfsInterfaceDriverVersionCheck(int ifaceVersion)
 	return(1);
 }
 
-static void mrbfsCI2SerialClose(MRBFSInterfaceDriver* mrbfsInterfaceDriver, int fd)
-{
-	if (-1 != fd)
-	{
-		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] closing port", mrbfsInterfaceDriver->interfaceName);
-		close(fd);
-	}
-	return;
-}
-
 static int mrbfsCI2SerialOpen(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
 {
-	int fd, n;
-	struct termios options;
-	int  nbytes;       // Number of bytes read 
-	struct timeval timeout;
-	char* device = mrbfsInterfaceDriver->port;
-	const char* hwflowStr = "no";
-	
-	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] - Starting serial port setup on [%s]", mrbfsInterfaceDriver->interfaceName, device);
-
-	fd = open(device, O_RDWR | O_NOCTTY | O_NDELAY); 
-   if (fd < 0)
-	{
-		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Ser, %d", fd);
-		perror(device); 
-		return(-1); 
-	}
-	fcntl(fd, F_SETFL, O_NONBLOCK);
-	tcgetattr(fd,&options); // save current serial port settings 
-
-	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] - Serial port [%s] opened, not yet configured", mrbfsInterfaceDriver->interfaceName, device);
-
-	hwflowStr = mrbfsInterfaceOptionGet(mrbfsInterfaceDriver, "hw-flowcontrol", "on");
-
-	cfsetispeed(&options, B115200);
-	cfsetospeed(&options, B115200);
-
-   options.c_cflag &= ~CSIZE; // Mask the character size bits 
-   options.c_cflag |= CS8;    // Select 8 data bits 
-
-	if (0 == strcmp(hwflowStr, "on"))
-		options.c_cflag |= CRTSCTS;
-	else
-		options.c_cflag &= ~CRTSCTS;		
-
-	options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	int fd, nbytes;
 
-	options.c_iflag &= ~(IXON | IXOFF | IXANY | ICRNL);
-
-	options.c_oflag &= ~OPOST;
-	options.c_cc[VTIME] = 0;
-   options.c_cc[VMIN]   = 1;   // blocking read until 5 chars received
-   
-   tcflush(fd, TCIFLUSH);
-	tcsetattr(fd, TCSAFLUSH, &options);
+	if (-1 == (fd = mrbfsSerialOpen(mrbfsInterfaceDriver, &nodeLocalStorage->serialConfig)))
+		return(-1);
 
 	nbytes = write(fd, "\x0A\x0D", strlen("\x0A\x0D"));
 	nbytes = write(fd, "\x0A\x0D", strlen("\x0A\x0D"));
 
-	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] - Serial startup complete", mrbfsInterfaceDriver->interfaceName);
-
 	return(fd);
 }
 
@@ -111,6 +69,8 @@ void mrbfsInterfaceDriverInit(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
 
 	nodeLocalStorage->file_pktLog->value.valueStr = nodeLocalStorage->pktLogStr;
 	mrbusPacketQueueInitialize(&nodeLocalStorage->txq);
+	mrbfsSerialConfigure(mrbfsInterfaceDriver, &nodeLocalStorage->serialConfig, 115200, 1);
+	mrbfsSerialLinkInitialize(mrbfsInterfaceDriver, &nodeLocalStorage->serialLink, &nodeLocalStorage->txq);
 }
 
 void mrbfsInterfacePacketTransmit(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBusPacket* txPkt)
@@ -119,7 +79,14 @@ void mrbfsInterfacePacketTransmit(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MR
 	// This will be called from the main process, not the interface thread
 	// This thing probably should just enqueue the packet and let the main loop take care of it.
 	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] enqueuing pkt for transmit (src=%02X)", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->addr);
-	mrbusPacketQueuePush(&nodeLocalStorage->txq, txPkt, mrbfsInterfaceDriver->addr);
+	if (0 != mrbusPacketQueuePush(&nodeLocalStorage->txq, txPkt, mrbfsInterfaceDriver->addr))
+		mrbfsSerialTxDropped(&nodeLocalStorage->serialLink, 1);
+}
+
+int mrbfsInterfaceTxQueueDepth(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	return(mrbusPacketQueueDepth(&nodeLocalStorage->txq));
 }
 
 int trimNewlines(char* str, int trimval)
@@ -139,16 +106,7 @@ int trimNewlines(char* str, int trimval)
 
 const char* mrbfsInterfaceOptionGet(MRBFSInterfaceDriver* mrbfsInterfaceDriver, const char* interfaceOptionKey, const char* defaultValue)
 {
-	int i;
-	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Node [%s] - [%d] node options, looking for [%s]", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->interfaceOptions, interfaceOptionKey);
-
-	for(i=0; i<mrbfsInterfaceDriver->interfaceOptions; i++)
-	{
-		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Node [%s] - node option [%d], comparing key [%s] to [%s]", mrbfsInterfaceDriver->interfaceName, i, interfaceOptionKey, mrbfsInterfaceDriver->interfaceOptionList[i].key);
-		if (0 == strcmp(interfaceOptionKey, mrbfsInterfaceDriver->interfaceOptionList[i].key))
-			return(mrbfsInterfaceDriver->interfaceOptionList[i].value);
-	}
-	return(defaultValue);
+	return(mrbfsOptionGetStr(&mrbfsInterfaceDriver->interfaceOptions, interfaceOptionKey, defaultValue));
 }
 
 void mrbfsInterfaceDriverRun(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
@@ -171,17 +129,8 @@ void mrbfsInterfaceDriverRun(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
    memset(buffer, 0, sizeof(buffer));
    bufptr = buffer;
 
-	timeoutSeconds = atoi(mrbfsInterfaceOptionGet(mrbfsInterfaceDriver, "timeout", "2"));
-
-	if (timeoutSeconds < 2 || timeoutSeconds >= 120)
-	{
-		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_WARNING, "Interface [%s] - Timeout of %d not valid (range 2-120), setting to minimum of 2 seconds", mrbfsInterfaceDriver->interfaceName, timeoutSeconds);
-		timeoutSeconds = 2;
-	}
-	else
-	{
-		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_WARNING, "Interface [%s] - Setting timeout to [%d] seconds", mrbfsInterfaceDriver->interfaceName, timeoutSeconds);	
-	}
+	timeoutSeconds = mrbfsOptionGetInt(&mrbfsInterfaceDriver->interfaceOptions, "timeout", 2, 2, 119);
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] - Setting timeout to [%d] seconds", mrbfsInterfaceDriver->interfaceName, timeoutSeconds);
 
 	fd = mrbfsCI2SerialOpen(mrbfsInterfaceDriver);
 
@@ -199,20 +148,15 @@ void mrbfsInterfaceDriverRun(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
       
       if (resetSerial)
       {
-			mrbfsCI2SerialClose(mrbfsInterfaceDriver, fd);
-	      
-	      // Nothing we can do until we get our port back
-			do
-			{
-				usleep(100000);
-				fd = mrbfsCI2SerialOpen(mrbfsInterfaceDriver);
-			} while (0 == fd);
+			// Until the port is back, transmits on this bus go elsewhere if they can
+			if (-1 == (fd = mrbfsSerialReconnect(mrbfsInterfaceDriver, &nodeLocalStorage->serialLink, fd, &mrbfsCI2SerialOpen)))
+				continue;
 
 			memset(buffer, 0, sizeof(buffer));
 			bufptr = buffer;
 			processingPacket = 0;
 			resetSerial = 0;
-      }      
+      }
       
       while ((nbytes = read(fd, incomingByte, 1)) > 0)
       {
@@ -236,6 +180,7 @@ void mrbfsInterfaceDriverRun(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
 						UINT8* ptr = buffer+2;
 						memset(&rxPkt, 0, sizeof(MRBusPacket));
 						rxPkt.bus = mrbfsInterfaceDriver->bus;
+						rxPkt.srcInterface = mrbfsInterfaceDriver->interfaceId;
 						rxPkt.len = (bufptr - ptr)/2;
 						for(i=0; i<rxPkt.len; i++, ptr+=2)
 						{
@@ -322,68 +267,49 @@ void mrbfsInterfaceDriverRun(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
 
 		if ((0 == processingPacket) && mrbusPacketQueueDepth(&nodeLocalStorage->txq) )
 		{
+			// Everything queued goes out in one write, up to the transmit budget.  Packets stay
+			// queued until the write succeeds, so a port that fails mid-batch loses nothing.
 			MRBusPacket txPkt;
-			uint8_t txPktBuffer[256];
-			uint32_t txPktBufferLen=0;
+			char txPktBuffer[CI2_TX_BATCH][CI2_TX_PKT_SZ];
+			struct iovec txIov[CI2_TX_BATCH];
+			size_t txBudget = mrbfsSerialTxBudgetBytes(&nodeLocalStorage->serialConfig);
+			size_t batchBytes = 0;
+			int txPkts = 0, txDepth = mrbusPacketQueueDepth(&nodeLocalStorage->txq);
 			uint32_t i;
-			uint32_t bytesWritten = 0;
-
-			mrbusPacketQueuePop(&nodeLocalStorage->txq, &txPkt);
-			sprintf(txPktBuffer, ":%02X->%02X %02X", txPkt.pkt[MRBUS_PKT_SRC], txPkt.pkt[MRBUS_PKT_DEST], txPkt.pkt[MRBUS_PKT_TYPE]);
-			for (i=MRBUS_PKT_DATA; i<txPkt.pkt[MRBUS_PKT_LEN]; i++)
-				sprintf(txPktBuffer + strlen(txPktBuffer), " %02X", txPkt.pkt[i]);
-			sprintf(txPktBuffer + strlen(txPktBuffer), ";\x0D");
-			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface driver [%s] transmitting %d bytes", mrbfsInterfaceDriver->interfaceName, strlen(txPktBuffer)); 
-	
-			txPktBufferLen = strlen(txPktBuffer);
-			bytesWritten = 0;
-
-			processingPacket = time(NULL);
 
-			do
+			while(txPkts < CI2_TX_BATCH && txPkts < txDepth && (0 == txPkts || batchBytes < txBudget))
 			{
-				nbytes = write(fd, txPktBuffer + bytesWritten, txPktBufferLen - bytesWritten);
-				if (nbytes >= 0)
-				{
-					(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ANNOYING, "Interface driver [%s] transmitting %d bytes of %d byte packet", mrbfsInterfaceDriver->interfaceName, bytesWritten, txPktBufferLen); 
-					bytesWritten += nbytes;
-				}
-				else if (-1 == nbytes && !(EAGAIN == errno || EWOULDBLOCK == errno))
-				{
-					(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface driver [%s] got errno=%d on write of %d bytes", mrbfsInterfaceDriver->interfaceName, errno, txPktBufferLen); 
-					resetSerial = 1;
-				}
-				else if (-1 == nbytes && (EAGAIN == errno || EWOULDBLOCK == errno))
-				{
-					(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface driver [%s] delaying transmission due blocking", mrbfsInterfaceDriver->interfaceName, errno, txPktBufferLen); 
-			      usleep(50);
-				}
-				else
-				{
-					// Do nothing, really, it's 
-					(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface driver [%s] got retval=%d and errno=%d - no comprende!", mrbfsInterfaceDriver->interfaceName, nbytes, errno);
-				}
-			
-			} while (!resetSerial 
-				&& (bytesWritten < txPktBufferLen) 
-				&& ((time(NULL) - processingPacket) > timeoutSeconds));
-	
-			processingPacket = 0;
-	
-			if (bytesWritten < txPktBufferLen)
+				char* txPtr = txPktBuffer[txPkts];
+
+				mrbusPacketQueuePeek(&nodeLocalStorage->txq, txPkts, &txPkt);
+				txPtr += sprintf(txPtr, ":%02X->%02X %02X", txPkt.pkt[MRBUS_PKT_SRC], txPkt.pkt[MRBUS_PKT_DEST], txPkt.pkt[MRBUS_PKT_TYPE]);
+				for (i=MRBUS_PKT_DATA; i<txPkt.pkt[MRBUS_PKT_LEN] && i<MRBFS_MAX_PACKET_LEN; i++)
+					txPtr += sprintf(txPtr, " %02X", txPkt.pkt[i]);
+				txPtr += sprintf(txPtr, ";\x0D");
+
+				txIov[txPkts].iov_base = txPktBuffer[txPkts];
+				txIov[txPkts].iov_len = txPtr - txPktBuffer[txPkts];
+				batchBytes += txIov[txPkts].iov_len;
+				txPkts++;
+			}
+
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface driver [%s] transmitting %d packets, %d bytes", mrbfsInterfaceDriver->interfaceName, txPkts, batchBytes);
+
+			if (0 != mrbfsSerialWriteBatch(mrbfsInterfaceDriver, &nodeLocalStorage->serialConfig, fd, txIov, txPkts, timeoutSeconds * 1000))
 			{
+				// Held for after the reset, or dropped and counted then under outage-tx=drop
 				resetSerial = 1;
-				(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface driver [%s] didn't transmit enough bytes (%d != %d), resetting serial", mrbfsInterfaceDriver->interfaceName, bytesWritten, txPktBufferLen);
+				(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface driver [%s] couldn't transmit %d packets, resetting serial", mrbfsInterfaceDriver->interfaceName, txPkts);
 			}
 			else
-				(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ANNOYING, "Interface driver [%s] actually transmitted %d bytes", mrbfsInterfaceDriver->interfaceName, bytesWritten);          
+				mrbusPacketQueueDiscard(&nodeLocalStorage->txq, txPkts);
 		}
 
    }
    
 	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface driver [%s] terminating", mrbfsInterfaceDriver->interfaceName);   
-	mrbfsCI2SerialClose(mrbfsInterfaceDriver, fd);  
-	phtread_exit(NULL);
+	mrbfsSerialClose(mrbfsInterfaceDriver, fd);  
+	pthread_exit(NULL);
 }
 
 
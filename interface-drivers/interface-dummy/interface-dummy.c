@@ -74,6 +74,7 @@ void mrbfsInterfaceDriverRun(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
 			UINT8* ptr = buffer+2;
 			memset(&rxPkt, 0, sizeof(MRBusPacket));
 			rxPkt.bus = mrbfsInterfaceDriver->bus;
+			rxPkt.srcInterface = mrbfsInterfaceDriver->interfaceId;
 			rxPkt.len = (bufptr-1 - ptr)/2;
 			for(i=0; i<rxPkt.len; i++, ptr+=2)
 			{
@@ -106,7 +107,7 @@ void mrbfsInterfaceDriverRun(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
 	}
 
 	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface driver [%s] terminating", mrbfsInterfaceDriver->interfaceName);   
-	phtread_exit(NULL);
+	pthread_exit(NULL);
 }
 
 void mrbfsInterfacePacketTransmit(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBusPacket* txPkt)
@@ -118,4 +119,10 @@ void mrbfsInterfacePacketTransmit(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MR
 	mrbusPacketQueuePush(&nodeLocalStorage->txq, txPkt, mrbfsInterfaceDriver->addr);
 }
 
+int mrbfsInterfaceTxQueueDepth(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	return(mrbusPacketQueueDepth(&nodeLocalStorage->txq));
+}
+
 
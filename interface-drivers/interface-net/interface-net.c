@@ -0,0 +1,517 @@
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "mrbfs-module.h"
+#include "mrbfs-pktqueue.h"
+#include "mrbfs-options.h"
+#include "mrbfs-serial.h"
+
+/* Network gateways
+
+ Talks to a bus behind a serial-to-Ethernet bridge, in another building say,
+ instead of one on a local serial port.  The port is host:port (an IPv6
+ address goes in brackets).  Options:
+
+   transport        tcp (the default) or udp
+   framing          ci2 - the CI2's ASCII protocol, which is what a bridge in
+                    front of a CI2 carries, and the default - or raw, MRBus
+                    packets as bytes, CRC included
+   local-port       udp port to receive on, for gateways that send to a
+                    fixed port - default is any
+   connect-timeout  ms to wait for a tcp connection, default 2000
+   timeout          seconds to keep trying to write a batch of packets, default 2
+
+ Over tcp, raw packets are found in the stream by their length byte and
+ checked by CRC.  Over udp each datagram carries one packet, or one ci2 line.
+ Sockets are non-blocking, and tcp ones have Nagle turned off - packets are
+ small and each one matters now.  Queued transmits go out together, in one
+ writev() for tcp and one sendmmsg() for udp, and stay queued until that
+ succeeds - a batch cut off by a dropped connection is sent again once it's
+ back, unless outage-tx says to drop it.
+
+ A lost connection is retried the way the serial drivers retry a lost port,
+ so reconnect-min, reconnect-max and outage-tx work here too (see
+ mrbfs-serial.c), as do the outages, outageSeconds, lastOutageSeconds and
+ txDropped files.  A udp "connection" is only lost if the host can't be
+ found.  Anything that speaks the same bytes will do for testing:
+
+   socat TCP-LISTEN:4000,reuseaddr,fork /dev/ttyUSB0,raw,b115200
+*/
+
+// Most packets to gather into one transmit, and the longest one as ci2 text - ":FE->FF 41 ...;\r"
+#define NET_TX_BATCH    32
+#define NET_TX_PKT_SZ   64
+#define NET_RX_BUFFER_SZ  2048
+
+typedef enum
+{
+	NET_FRAMING_CI2 = 0,
+	NET_FRAMING_RAW
+} NetFraming;
+
+static const char* mrbfsNetTransportNames[] = { "tcp", "udp", NULL };
+static const char* mrbfsNetFramingNames[] = { "ci2", "raw", NULL };
+
+typedef struct
+{
+	UINT32 pktsReceived;
+	MRBFSFileNode* file_pktCounter;
+	MRBusPacketQueue txq;
+	MRBFSSerialConfig serialConfig;
+	MRBFSSerialLink serialLink;
+	int udp;
+	NetFraming framing;
+	int localPort;
+	int connectTimeoutMs;
+	int txTimeoutMs;
+	UINT32 openFailures;
+	UINT8 rxLine[NET_RX_BUFFER_SZ];
+	size_t rxLineLen;
+} NodeLocalStorage;
+
+int mrbfsInterfaceDriverVersionCheck(int ifaceVersion)
+{
+	if (ifaceVersion != MRBFS_INTERFACE_DRIVER_VERSION)
+		return(0);
+	return(1);
+}
+
+void mrbfsInterfaceDriverInit(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = calloc(1, sizeof(NodeLocalStorage));
+	MRBFSModuleOptionTable* options = &mrbfsInterfaceDriver->interfaceOptions;
+	mrbfsInterfaceDriver->nodeLocalStorage = (void*)nodeLocalStorage;
+
+	nodeLocalStorage->file_pktCounter = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("pktCounter", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+	mrbusPacketQueueInitialize(&nodeLocalStorage->txq);
+
+	nodeLocalStorage->udp = mrbfsOptionGetEnum(options, "transport", mrbfsNetTransportNames, 0);
+	nodeLocalStorage->framing = (NetFraming)mrbfsOptionGetEnum(options, "framing", mrbfsNetFramingNames, NET_FRAMING_CI2);
+	nodeLocalStorage->localPort = mrbfsOptionGetInt(options, "local-port", 0, 0, 65535);
+	nodeLocalStorage->connectTimeoutMs = mrbfsOptionGetInt(options, "connect-timeout", 2000, 100, 60000);
+	nodeLocalStorage->txTimeoutMs = mrbfsOptionGetInt(options, "timeout", 2, 1, 119) * 1000;
+
+	// No baud to speak of, so nothing to budget or space out - batches are just what's queued
+	nodeLocalStorage->serialConfig.txGapMs = 0;
+	mrbfsSerialLinkInitialize(mrbfsInterfaceDriver, &nodeLocalStorage->serialLink, &nodeLocalStorage->txq);
+}
+
+void mrbfsInterfacePacketTransmit(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBusPacket* txPkt)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	// This will be called from the main process, not the interface thread
+	if (0 != mrbusPacketQueuePush(&nodeLocalStorage->txq, txPkt, mrbfsInterfaceDriver->addr))
+		mrbfsSerialTxDropped(&nodeLocalStorage->serialLink, 1);
+}
+
+int mrbfsInterfaceTxQueueDepth(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	return(mrbusPacketQueueDepth(&nodeLocalStorage->txq));
+}
+
+// Splits "host:port" or "[v6 address]:port" - returns -1 if there's no port
+static int mrbfsNetSplitAddress(const char* address, char* host, size_t hostSz, const char** service)
+{
+	const char* colon = strrchr(address, ':');
+	size_t hostLen;
+
+	if (NULL == colon || 0 == colon[1])
+		return(-1);
+
+	*service = colon + 1;
+	if ('[' == address[0] && colon > address && ']' == colon[-1])
+	{
+		address++;
+		colon--;
+	}
+
+	hostLen = MIN((size_t)(colon - address), hostSz - 1);
+	memcpy(host, address, hostLen);
+	host[hostLen] = 0;
+	return(0);
+}
+
+// Connects a non-blocking socket, waiting up to timeoutMs for a tcp handshake
+static int mrbfsNetConnect(struct addrinfo* addr, int localPort, int timeoutMs)
+{
+	struct pollfd pollFd;
+	int fd, err = 0;
+	socklen_t errLen = sizeof(err);
+
+	if (-1 == (fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addr->ai_protocol)))
+		return(-1);
+
+	if (SOCK_DGRAM == addr->ai_socktype && 0 != localPort)
+	{
+		struct sockaddr_storage local;
+		int reuse = 1;
+
+		memset(&local, 0, sizeof(local));
+		local.ss_family = addr->ai_family;
+		if (AF_INET6 == addr->ai_family)
+			((struct sockaddr_in6*)&local)->sin6_port = htons(localPort);
+		else
+			((struct sockaddr_in*)&local)->sin_port = htons(localPort);
+
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		if (0 != bind(fd, (struct sockaddr*)&local, addr->ai_addrlen))
+		{
+			close(fd);
+			return(-1);
+		}
+	}
+
+	if (0 == connect(fd, addr->ai_addr, addr->ai_addrlen))
+		return(fd);
+
+	if (EINPROGRESS != errno)
+	{
+		close(fd);
+		return(-1);
+	}
+
+	pollFd.fd = fd;
+	pollFd.events = POLLOUT;
+	if (1 != poll(&pollFd, 1, timeoutMs) || 0 != getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errLen) || 0 != err)
+	{
+		close(fd);
+		errno = (0 != err) ? err : ETIMEDOUT;
+		return(-1);
+	}
+	return(fd);
+}
+
+static int mrbfsNetOpen(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	// Only the first of a run of failures is worth an error - the rest are someone reconnecting
+	mrbfsLogLevel failLevel = (0 == nodeLocalStorage->openFailures) ? MRBFS_LOG_ERROR : MRBFS_LOG_DEBUG;
+	struct addrinfo hints, *addrs, *addr;
+	const char* service = NULL;
+	char host[256];
+	int fd = -1, status, on = 1;
+
+	nodeLocalStorage->rxLineLen = 0;
+
+	if (NULL == mrbfsInterfaceDriver->port || 0 != mrbfsNetSplitAddress(mrbfsInterfaceDriver->port, host, sizeof(host), &service))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(failLevel, "Interface [%s] - Port [%s] isn't host:port", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port ? mrbfsInterfaceDriver->port : "");
+		nodeLocalStorage->openFailures++;
+		return(-1);
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = nodeLocalStorage->udp ? SOCK_DGRAM : SOCK_STREAM;
+	if (0 != (status = getaddrinfo(host, service, &hints, &addrs)))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(failLevel, "Interface [%s] - Cannot look up [%s] (%s)", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port, gai_strerror(status));
+		nodeLocalStorage->openFailures++;
+		return(-1);
+	}
+
+	for(addr = addrs; NULL != addr && -1 == fd; addr = addr->ai_next)
+		fd = mrbfsNetConnect(addr, nodeLocalStorage->localPort, nodeLocalStorage->connectTimeoutMs);
+	freeaddrinfo(addrs);
+
+	if (-1 == fd)
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(failLevel, "Interface [%s] - Cannot connect to [%s] (%s)", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port, strerror(errno));
+		nodeLocalStorage->openFailures++;
+		return(-1);
+	}
+
+	if (!nodeLocalStorage->udp)
+	{
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+	}
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] - Connected to [%s] by %s, %s framing", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port, mrbfsNetTransportNames[nodeLocalStorage->udp], mrbfsNetFramingNames[nodeLocalStorage->framing]);
+	nodeLocalStorage->openFailures = 0;
+	return(fd);
+}
+
+static void mrbfsNetDeliver(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBusPacket* rxPkt)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+
+	rxPkt->bus = mrbfsInterfaceDriver->bus;
+	rxPkt->srcInterface = mrbfsInterfaceDriver->interfaceId;
+	(*mrbfsInterfaceDriver->mrbfsPacketReceive)(rxPkt);
+
+	nodeLocalStorage->file_pktCounter->updateTime = time(NULL);
+	nodeLocalStorage->file_pktCounter->value.valueInt = ++nodeLocalStorage->pktsReceived;
+}
+
+// A ci2 line, spaces already dropped - "P:" and the packet in hex is a packet, the rest is chatter
+static void mrbfsNetCI2Line(MRBFSInterfaceDriver* mrbfsInterfaceDriver, const UINT8* line, size_t lineLen)
+{
+	MRBusPacket rxPkt;
+	size_t i;
+
+	if (lineLen < 2 || 'P' != line[0])
+	{
+		if (0 != lineLen)
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] got non-packet response [%.*s]", mrbfsInterfaceDriver->interfaceName, (int)lineLen, line);
+		return;
+	}
+
+	memset(&rxPkt, 0, sizeof(MRBusPacket));
+	rxPkt.len = MIN((lineLen - 2) / 2, MRBFS_MAX_PACKET_LEN);
+	for(i=0; i<rxPkt.len; i++)
+	{
+		char hexByte[3] = { line[2+i*2], line[3+i*2], 0 };
+		rxPkt.pkt[i] = strtol(hexByte, NULL, 16);
+	}
+	mrbfsNetDeliver(mrbfsInterfaceDriver, &rxPkt);
+}
+
+// Returns the length of the raw packet at the front of buf, 0 if more bytes are needed, or -1 if it's not one
+static int mrbfsNetRawPacket(const UINT8* buf, size_t len, MRBusPacket* rxPkt)
+{
+	UINT8 pktLen;
+	uint16_t crc;
+
+	if (len <= MRBUS_PKT_LEN)
+		return(0);
+
+	pktLen = buf[MRBUS_PKT_LEN];
+	if (pktLen <= MRBUS_PKT_TYPE || pktLen > MRBFS_MAX_PACKET_LEN)
+		return(-1);
+	if (len < pktLen)
+		return(0);
+
+	memset(rxPkt, 0, sizeof(MRBusPacket));
+	memcpy(rxPkt->pkt, buf, pktLen);
+	rxPkt->len = pktLen;
+	crc = mrbfsSerialPacketCRC(rxPkt);
+	if (rxPkt->pkt[MRBUS_PKT_CRC_L] != (crc & 0xFF) || rxPkt->pkt[MRBUS_PKT_CRC_H] != ((crc >> 8) & 0xFF))
+		return(-1);
+	return(pktLen);
+}
+
+// Handles one read's worth - for udp, one datagram
+static void mrbfsNetReceive(MRBFSInterfaceDriver* mrbfsInterfaceDriver, const UINT8* buf, size_t len)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	UINT8* line = nodeLocalStorage->rxLine;
+	MRBusPacket rxPkt;
+	size_t i, pos = 0;
+	int pktLen;
+
+	if (NET_FRAMING_CI2 == nodeLocalStorage->framing)
+	{
+		for(i=0; i<len; i++)
+		{
+			switch(buf[i])
+			{
+				case 0x00:
+				case ' ':
+				case 0x0A:
+					break;
+
+				case 0x0D:
+					mrbfsNetCI2Line(mrbfsInterfaceDriver, line, nodeLocalStorage->rxLineLen);
+					nodeLocalStorage->rxLineLen = 0;
+					break;
+
+				default:
+					// Nothing legitimate is this long - drop it and start over
+					if (nodeLocalStorage->rxLineLen >= NET_RX_BUFFER_SZ)
+						nodeLocalStorage->rxLineLen = 0;
+					line[nodeLocalStorage->rxLineLen++] = buf[i];
+					break;
+			}
+		}
+
+		// A datagram is a whole line, whether or not it ends in one
+		if (nodeLocalStorage->udp)
+		{
+			mrbfsNetCI2Line(mrbfsInterfaceDriver, line, nodeLocalStorage->rxLineLen);
+			nodeLocalStorage->rxLineLen = 0;
+		}
+		return;
+	}
+
+	if (nodeLocalStorage->udp)
+	{
+		if (mrbfsNetRawPacket(buf, len, &rxPkt) > 0)
+			mrbfsNetDeliver(mrbfsInterfaceDriver, &rxPkt);
+		else
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] dropped a %d byte datagram that isn't a packet", mrbfsInterfaceDriver->interfaceName, len);
+		return;
+	}
+
+	// Raw tcp - carry a partial packet over to the next read, slide past bytes that can't start one
+	len = MIN(len, NET_RX_BUFFER_SZ - nodeLocalStorage->rxLineLen);
+	memcpy(line + nodeLocalStorage->rxLineLen, buf, len);
+	nodeLocalStorage->rxLineLen += len;
+
+	while(pos < nodeLocalStorage->rxLineLen)
+	{
+		pktLen = mrbfsNetRawPacket(line + pos, nodeLocalStorage->rxLineLen - pos, &rxPkt);
+		if (0 == pktLen)
+			break;
+		if (pktLen < 0)
+		{
+			pos++;
+			continue;
+		}
+		mrbfsNetDeliver(mrbfsInterfaceDriver, &rxPkt);
+		pos += pktLen;
+	}
+
+	memmove(line, line + pos, nodeLocalStorage->rxLineLen - pos);
+	nodeLocalStorage->rxLineLen -= pos;
+}
+
+// Encodes one packet for the wire and returns its length
+static size_t mrbfsNetEncode(NodeLocalStorage* nodeLocalStorage, MRBusPacket* txPkt, char* txPktBuffer)
+{
+	char* txPtr = txPktBuffer;
+	uint16_t crc;
+	UINT32 i;
+
+	if (NET_FRAMING_RAW == nodeLocalStorage->framing)
+	{
+		// A ci2 computes the CRC itself, but raw packets need one
+		txPkt->pkt[MRBUS_PKT_LEN] = MIN(txPkt->pkt[MRBUS_PKT_LEN], MRBFS_MAX_PACKET_LEN);
+		crc = mrbfsSerialPacketCRC(txPkt);
+		txPkt->pkt[MRBUS_PKT_CRC_L] = (crc & 0xFF);
+		txPkt->pkt[MRBUS_PKT_CRC_H] = ((crc >> 8) & 0xFF);
+		memcpy(txPktBuffer, txPkt->pkt, txPkt->pkt[MRBUS_PKT_LEN]);
+		return(txPkt->pkt[MRBUS_PKT_LEN]);
+	}
+
+	txPtr += sprintf(txPtr, ":%02X->%02X %02X", txPkt->pkt[MRBUS_PKT_SRC], txPkt->pkt[MRBUS_PKT_DEST], txPkt->pkt[MRBUS_PKT_TYPE]);
+	for (i=MRBUS_PKT_DATA; i<txPkt->pkt[MRBUS_PKT_LEN] && i<MRBFS_MAX_PACKET_LEN; i++)
+		txPtr += sprintf(txPtr, " %02X", txPkt->pkt[i]);
+	txPtr += sprintf(txPtr, ";\x0D");
+	return(txPtr - txPktBuffer);
+}
+
+// Sends everything queued in one system call.  Returns non-zero if the connection needs resetting.
+// Packets stay queued until they're sent, so a connection that fails mid-batch loses none of them.
+static int mrbfsNetTransmitPending(MRBFSInterfaceDriver* mrbfsInterfaceDriver, int fd)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	char txPktBuffer[NET_TX_BATCH][NET_TX_PKT_SZ];
+	struct iovec txIov[NET_TX_BATCH];
+	struct mmsghdr txMsgs[NET_TX_BATCH];
+	MRBusPacket txPkt;
+	int txPkts = 0, txDepth = mrbusPacketQueueDepth(&nodeLocalStorage->txq), sent;
+
+	while(txPkts < NET_TX_BATCH && txPkts < txDepth)
+	{
+		mrbusPacketQueuePeek(&nodeLocalStorage->txq, txPkts, &txPkt);
+		txIov[txPkts].iov_base = txPktBuffer[txPkts];
+		txIov[txPkts].iov_len = mrbfsNetEncode(nodeLocalStorage, &txPkt, txPktBuffer[txPkts]);
+		txPkts++;
+	}
+
+	if (0 == txPkts)
+		return(0);
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface driver [%s] transmitting %d packets", mrbfsInterfaceDriver->interfaceName, txPkts);
+
+	if (!nodeLocalStorage->udp)
+	{
+		if (0 != mrbfsSerialWriteBatch(mrbfsInterfaceDriver, &nodeLocalStorage->serialConfig, fd, txIov, txPkts, nodeLocalStorage->txTimeoutMs))
+			return(1);
+		mrbusPacketQueueDiscard(&nodeLocalStorage->txq, txPkts);
+		return(0);
+	}
+
+	// One datagram per packet.  A datagram that can't go now isn't worth waiting on - it's dropped.
+	memset(txMsgs, 0, sizeof(txMsgs));
+	for(sent=0; sent<txPkts; sent++)
+	{
+		txMsgs[sent].msg_hdr.msg_iov = &txIov[sent];
+		txMsgs[sent].msg_hdr.msg_iovlen = 1;
+	}
+
+	sent = sendmmsg(fd, txMsgs, txPkts, 0);
+	if (sent < 0)
+	{
+		if (EAGAIN != errno && EWOULDBLOCK != errno && ECONNREFUSED != errno)
+		{
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] send failed (%s)", mrbfsInterfaceDriver->interfaceName, strerror(errno));
+			return(1);
+		}
+		sent = 0;
+	}
+	mrbusPacketQueueDiscard(&nodeLocalStorage->txq, txPkts);
+	if (sent < txPkts)
+		mrbfsSerialTxDropped(&nodeLocalStorage->serialLink, txPkts - sent);
+	return(0);
+}
+
+void mrbfsInterfaceDriverRun(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	UINT8 rxBuffer[NET_RX_BUFFER_SZ];
+	struct pollfd pollFd;
+	UINT8 resetConnection = 0;
+	int fd = -1;
+	ssize_t nbytes = 0;
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] confirms startup", mrbfsInterfaceDriver->interfaceName);
+
+	if (-1 == (fd = mrbfsNetOpen(mrbfsInterfaceDriver)))
+		resetConnection = 1;
+
+	while(!mrbfsInterfaceDriver->terminate)
+	{
+		if (resetConnection)
+		{
+			// Until the connection is back, transmits on this bus go elsewhere if they can
+			if (-1 == (fd = mrbfsSerialReconnect(mrbfsInterfaceDriver, &nodeLocalStorage->serialLink, fd, &mrbfsNetOpen)))
+				continue;
+			resetConnection = 0;
+		}
+
+		// Wake for anything arriving, or often enough to pick up queued transmits
+		pollFd.fd = fd;
+		pollFd.events = POLLIN;
+		poll(&pollFd, 1, 10);
+
+		while((nbytes = recv(fd, rxBuffer, sizeof(rxBuffer), 0)) > 0)
+			mrbfsNetReceive(mrbfsInterfaceDriver, rxBuffer, nbytes);
+
+		if (0 == nbytes && !nodeLocalStorage->udp)
+		{
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_WARNING, "Interface [%s] - [%s] closed the connection", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port);
+			resetConnection = 1;
+			continue;
+		}
+
+		// Nobody listening at the other end yet is normal for udp
+		if (nbytes < 0 && EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno && !(nodeLocalStorage->udp && ECONNREFUSED == errno))
+		{
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_WARNING, "Interface [%s] - Connection to [%s] failed (%s)", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port, strerror(errno));
+			resetConnection = 1;
+			continue;
+		}
+
+		resetConnection = mrbfsNetTransmitPending(mrbfsInterfaceDriver, fd);
+	}
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface driver [%s] terminating", mrbfsInterfaceDriver->interfaceName);
+	mrbfsSerialClose(mrbfsInterfaceDriver, fd);
+	pthread_exit(NULL);
+}
@@ -0,0 +1,279 @@
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <byteswap.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include "mrbfs-module.h"
+#include "mrbfs-pktqueue.h"
+#include "mrbfs-options.h"
+
+/* Capture replay
+
+ Feeds a capture recorded by mrbfs (capture-directory, or a copy of
+ /busN/capture) back through mrbfsPacketReceive, so node drivers can be
+ exercised and profiled against real traffic without the real layout.
+ The port is the pcap file to read.  Options:
+
+   speed       1 replays at the original timing, 10 ten times faster, and
+               0 (or "max") as fast as packets can be handed over
+   loop        start over at the end of the file, default no
+   include-tx  also replay packets mrbfs itself transmitted, default no
+
+ Packets land on this interface's bus regardless of the bus they were
+ captured on.  Anything the filesystem tries to transmit is dropped.
+ <interface>/status says whether the replay is still running, and once
+ it's done, how long it took.
+*/
+
+#define MRBFS_CAPTURE_LINKTYPE  147
+
+typedef struct
+{
+	UINT32 pktsReplayed;
+	MRBFSFileNode* file_pktCounter;
+	MRBFSFileNode* file_status;
+	char statusStr[128];
+	MRBusPacketQueue txq;
+} NodeLocalStorage;
+
+typedef struct
+{
+	FILE* file;
+	int swapped;
+	long dataStart;
+} ReplayFile;
+
+int mrbfsInterfaceDriverVersionCheck(int ifaceVersion)
+{
+	if (ifaceVersion != MRBFS_INTERFACE_DRIVER_VERSION)
+		return(0);
+	return(1);
+}
+
+void mrbfsInterfaceDriverInit(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = calloc(1, sizeof(NodeLocalStorage));
+	mrbfsInterfaceDriver->nodeLocalStorage = (void*)nodeLocalStorage;
+
+	nodeLocalStorage->file_pktCounter = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("pktCounter", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+	nodeLocalStorage->file_status = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("status", FNODE_RO_VALUE_STR, mrbfsInterfaceDriver->path);
+
+	strcpy(nodeLocalStorage->statusStr, "starting\n");
+	nodeLocalStorage->file_status->value.valueStr = nodeLocalStorage->statusStr;
+	mrbusPacketQueueInitialize(&nodeLocalStorage->txq);
+}
+
+void mrbfsInterfacePacketTransmit(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBusPacket* txPkt)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	// This will be called from the main process, not the interface thread
+	mrbusPacketQueuePush(&nodeLocalStorage->txq, txPkt, mrbfsInterfaceDriver->addr);
+}
+
+int mrbfsInterfaceTxQueueDepth(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	return(mrbusPacketQueueDepth(&nodeLocalStorage->txq));
+}
+
+static void mrbfsReplaySetStatus(MRBFSInterfaceDriver* mrbfsInterfaceDriver, const char* status)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	snprintf(nodeLocalStorage->statusStr, sizeof(nodeLocalStorage->statusStr), "%s\n", status);
+	nodeLocalStorage->file_status->updateTime = time(NULL);
+}
+
+static UINT32 mrbfsReplayWord(ReplayFile* replayFile, UINT32 word)
+{
+	return(replayFile->swapped ? bswap_32(word) : word);
+}
+
+static int mrbfsReplayOpen(MRBFSInterfaceDriver* mrbfsInterfaceDriver, ReplayFile* replayFile)
+{
+	UINT32 header[6];
+
+	memset(replayFile, 0, sizeof(ReplayFile));
+	if (NULL == (replayFile->file = fopen(mrbfsInterfaceDriver->port, "r")))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] cannot open capture [%s] (%s)", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port, strerror(errno));
+		return(-1);
+	}
+
+	if (1 != fread(header, sizeof(header), 1, replayFile->file))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] capture [%s] is too short", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port);
+		fclose(replayFile->file);
+		return(-1);
+	}
+
+	// Captures may have been written on a machine of the other endianness
+	if (0xD4C3B2A1 == header[0])
+		replayFile->swapped = 1;
+	else if (0xA1B2C3D4 != header[0])
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] capture [%s] isn't a microsecond pcap file", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port);
+		fclose(replayFile->file);
+		return(-1);
+	}
+
+	if (MRBFS_CAPTURE_LINKTYPE != mrbfsReplayWord(replayFile, header[5]))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] capture [%s] has link type %u, not an mrbfs capture", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port, mrbfsReplayWord(replayFile, header[5]));
+		fclose(replayFile->file);
+		return(-1);
+	}
+
+	replayFile->dataStart = ftell(replayFile->file);
+	return(0);
+}
+
+// Returns 1 with the next packet, 0 at the end of the file, -1 if the file is damaged
+static int mrbfsReplayNext(ReplayFile* replayFile, MRBusPacket* pkt, UINT8* direction, uint64_t* tsUsec)
+{
+	UINT32 frameHeader[4];
+	UINT8 frame[256];
+	UINT32 frameLen;
+
+	if (1 != fread(frameHeader, sizeof(frameHeader), 1, replayFile->file))
+		return(0);
+
+	frameLen = mrbfsReplayWord(replayFile, frameHeader[2]);
+	if (frameLen < 4 || frameLen > sizeof(frame) || 1 != fread(frame, frameLen, 1, replayFile->file))
+		return(-1);
+
+	*tsUsec = (uint64_t)mrbfsReplayWord(replayFile, frameHeader[0]) * 1000000 + mrbfsReplayWord(replayFile, frameHeader[1]);
+	*direction = frame[0];
+
+	memset(pkt, 0, sizeof(MRBusPacket));
+	pkt->len = MIN(frameLen - 4, MRBFS_MAX_PACKET_LEN);
+	memcpy(pkt->pkt, frame + 4, pkt->len);
+	return(1);
+}
+
+static uint64_t mrbfsReplayNow()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+// Anything a millisecond or longer waits on shutdownFd, so shutdown isn't held up
+static void mrbfsReplaySleep(MRBFSInterfaceDriver* mrbfsInterfaceDriver, uint64_t usec)
+{
+	struct pollfd pollFd;
+
+	if (usec < 1000)
+	{
+		usleep(usec);
+		return;
+	}
+
+	pollFd.fd = mrbfsInterfaceDriver->shutdownFd;
+	pollFd.events = POLLIN;
+	poll(&pollFd, 1, usec / 1000);
+}
+
+void mrbfsInterfaceDriverRun(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	const char* speedStr = mrbfsOptionGetStr(&mrbfsInterfaceDriver->interfaceOptions, "speed", "1");
+	int loop = mrbfsOptionGetBool(&mrbfsInterfaceDriver->interfaceOptions, "loop", 0);
+	int includeTx = mrbfsOptionGetBool(&mrbfsInterfaceDriver->interfaceOptions, "include-tx", 0);
+	double speed = (0 == strcmp(speedStr, "max")) ? 0.0 : strtod(speedStr, NULL);
+	uint64_t firstPktTime = 0, replayStart = 0, runStart = 0;
+	UINT32 pktsThisPass = 0;
+	ReplayFile replayFile;
+	char statusStr[128];
+	int ret = 0, finished = 0;
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] confirms startup, replaying [%s] at %s", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port, (speed > 0.0)?speedStr:"full speed");
+
+	if (speed < 0.0)
+		speed = 0.0;
+
+	if (0 != mrbfsReplayOpen(mrbfsInterfaceDriver, &replayFile))
+	{
+		mrbfsReplaySetStatus(mrbfsInterfaceDriver, "error");
+		pthread_exit(NULL);
+	}
+	mrbfsReplaySetStatus(mrbfsInterfaceDriver, "running");
+	runStart = mrbfsReplayNow();
+
+	while(!mrbfsInterfaceDriver->terminate)
+	{
+		MRBusPacket rxPkt;
+		UINT8 direction;
+		uint64_t pktTime;
+
+		// Nowhere to send anything - just keep the queue from filling
+		while(0 != mrbusPacketQueueDepth(&nodeLocalStorage->txq))
+			mrbusPacketQueuePop(&nodeLocalStorage->txq, &rxPkt);
+
+		if (finished)
+		{
+			mrbfsReplaySleep(mrbfsInterfaceDriver, 100000);
+			continue;
+		}
+
+		ret = mrbfsReplayNext(&replayFile, &rxPkt, &direction, &pktTime);
+		if (ret <= 0)
+		{
+			if (ret < 0)
+				(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_WARNING, "Interface [%s] capture [%s] is truncated or damaged", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port);
+
+			snprintf(statusStr, sizeof(statusStr), "finished, %u packets in %.3f seconds", nodeLocalStorage->pktsReplayed, (mrbfsReplayNow() - runStart) / 1000000.0);
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] %s", mrbfsInterfaceDriver->interfaceName, statusStr);
+
+			// Looping over a file with nothing to replay would just spin
+			if (!loop || ret < 0 || 0 == pktsThisPass)
+			{
+				mrbfsReplaySetStatus(mrbfsInterfaceDriver, statusStr);
+				finished = 1;
+				continue;
+			}
+
+			fseek(replayFile.file, replayFile.dataStart, SEEK_SET);
+			firstPktTime = 0;
+			pktsThisPass = 0;
+			continue;
+		}
+
+		if (MRBFS_CAPTURE_TX == direction && !includeTx)
+			continue;
+
+		// Hold each packet until its original offset from the first one, scaled by speed
+		if (0 == firstPktTime)
+		{
+			firstPktTime = pktTime;
+			replayStart = mrbfsReplayNow();
+		}
+		else if (speed > 0.0 && pktTime > firstPktTime)
+		{
+			uint64_t releaseTime = replayStart + (uint64_t)((pktTime - firstPktTime) / speed);
+			uint64_t now;
+
+			while(!mrbfsInterfaceDriver->terminate && (now = mrbfsReplayNow()) < releaseTime)
+				mrbfsReplaySleep(mrbfsInterfaceDriver, MIN(releaseTime - now, 100000));
+		}
+
+		rxPkt.bus = mrbfsInterfaceDriver->bus;
+		rxPkt.srcInterface = mrbfsInterfaceDriver->interfaceId;
+		(*mrbfsInterfaceDriver->mrbfsPacketReceive)(&rxPkt);
+
+		nodeLocalStorage->file_pktCounter->updateTime = time(NULL);
+		nodeLocalStorage->file_pktCounter->value.valueInt = ++nodeLocalStorage->pktsReplayed;
+		pktsThisPass++;
+	}
+
+	fclose(replayFile.file);
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] terminating", mrbfsInterfaceDriver->interfaceName);
+	pthread_exit(NULL);
+}
@@ -0,0 +1,356 @@
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "mrbfs-module.h"
+#include "mrbfs-options.h"
+#include "interface-shm.h"
+
+/* Shared memory bus
+
+ Exchanges packets with a simulator (or load generator) running alongside
+ mrbfs through a pair of rings in shared memory, so the core and the node
+ drivers can be driven far harder than any pty or serial port would allow.
+ The port is the path of a unix socket the simulator connects to for the
+ memory and its eventfds - interface-shm.h has the layout and the rules
+ for the simulator's side.  A stale socket left there is replaced; anything
+ else at that path is left alone and the interface doesn't start.  The
+ socket is only accessible to the user mrbfs runs as, since whoever
+ connects can write the rings.  Options:
+
+   ring-size  slots in each ring, a power of two, default 65536
+
+ The memory outlives simulators: one can disconnect, and the next one to
+ connect picks up the same rings.  Packets from the simulator go to
+ mrbfsPacketReceive in batches of whatever has arrived.  Packets from
+ mrbfs are dropped if the simulator isn't keeping up, and counted in
+ <interface>/txDropped.  <interface>/pktCounter counts what's received,
+ updated once per batch.
+*/
+
+typedef struct
+{
+	UINT32 pktsReceived;
+	UINT32 txDropped;
+	MRBFSFileNode* file_pktCounter;
+	MRBFSFileNode* file_txDropped;
+	pthread_mutex_t txLock;     // Transmits come from any thread, but the ring wants one producer
+	UINT32 ringSize;
+	size_t mapSize;
+	int memFd;
+	int toBusEvent;
+	int fromBusEvent;
+	int listenFd;
+	MRBFSShmHeader* header;
+	MRBFSShmRing* toBus;
+	MRBFSShmRing* fromBus;
+} NodeLocalStorage;
+
+int mrbfsInterfaceDriverVersionCheck(int ifaceVersion)
+{
+	if (ifaceVersion != MRBFS_INTERFACE_DRIVER_VERSION)
+		return(0);
+	return(1);
+}
+
+static size_t mrbfsShmRingBytes(UINT32 ringSize)
+{
+	return(sizeof(MRBFSShmRing) + (size_t)ringSize * sizeof(MRBFSShmPacket));
+}
+
+static int mrbfsShmCreate(MRBFSInterfaceDriver* mrbfsInterfaceDriver, NodeLocalStorage* nodeLocalStorage)
+{
+	size_t ringBytes = mrbfsShmRingBytes(nodeLocalStorage->ringSize);
+	void* map;
+
+	nodeLocalStorage->mapSize = sizeof(MRBFSShmHeader) + 2 * ringBytes;
+
+	// Sealed at its size - a simulator that could shrink it would take mrbfs down with SIGBUS
+	if (-1 == (nodeLocalStorage->memFd = memfd_create(mrbfsInterfaceDriver->interfaceName, MFD_CLOEXEC | MFD_ALLOW_SEALING))
+		|| 0 != ftruncate(nodeLocalStorage->memFd, nodeLocalStorage->mapSize)
+		|| 0 != fcntl(nodeLocalStorage->memFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+		|| MAP_FAILED == (map = mmap(NULL, nodeLocalStorage->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, nodeLocalStorage->memFd, 0)))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] cannot set up %u bytes of shared memory (%s)", mrbfsInterfaceDriver->interfaceName, nodeLocalStorage->mapSize, strerror(errno));
+		return(-1);
+	}
+
+	nodeLocalStorage->toBusEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	nodeLocalStorage->fromBusEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (-1 == nodeLocalStorage->toBusEvent || -1 == nodeLocalStorage->fromBusEvent)
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] cannot create eventfds (%s)", mrbfsInterfaceDriver->interfaceName, strerror(errno));
+		return(-1);
+	}
+
+	// A fresh memfd is all zeros, so the rings start out empty
+	nodeLocalStorage->header = (MRBFSShmHeader*)map;
+	nodeLocalStorage->header->version = MRBFS_SHM_VERSION;
+	nodeLocalStorage->header->ringSize = nodeLocalStorage->ringSize;
+	nodeLocalStorage->header->toBusOffset = sizeof(MRBFSShmHeader);
+	nodeLocalStorage->header->fromBusOffset = sizeof(MRBFSShmHeader) + ringBytes;
+	nodeLocalStorage->header->bus = mrbfsInterfaceDriver->bus;
+	nodeLocalStorage->toBus = (MRBFSShmRing*)((UINT8*)map + nodeLocalStorage->header->toBusOffset);
+	nodeLocalStorage->fromBus = (MRBFSShmRing*)((UINT8*)map + nodeLocalStorage->header->fromBusOffset);
+	__atomic_store_n(&nodeLocalStorage->header->magic, MRBFS_SHM_MAGIC, __ATOMIC_RELEASE);
+	return(0);
+}
+
+void mrbfsInterfaceDriverInit(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = calloc(1, sizeof(NodeLocalStorage));
+	pthread_mutexattr_t lockAttr;
+	UINT32 ringSize;
+	mrbfsInterfaceDriver->nodeLocalStorage = (void*)nodeLocalStorage;
+
+	nodeLocalStorage->file_pktCounter = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("pktCounter", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+	nodeLocalStorage->file_txDropped = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("txDropped", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+
+	pthread_mutexattr_init(&lockAttr);
+	pthread_mutexattr_settype(&lockAttr, PTHREAD_MUTEX_ADAPTIVE_NP);
+	pthread_mutex_init(&nodeLocalStorage->txLock, &lockAttr);
+	pthread_mutexattr_destroy(&lockAttr);
+
+	// Round down to a power of two
+	ringSize = mrbfsOptionGetInt(&mrbfsInterfaceDriver->interfaceOptions, "ring-size", 65536, 64, 1<<24);
+	for(nodeLocalStorage->ringSize = 64; nodeLocalStorage->ringSize * 2 <= ringSize; nodeLocalStorage->ringSize *= 2);
+
+	nodeLocalStorage->memFd = nodeLocalStorage->toBusEvent = nodeLocalStorage->fromBusEvent = nodeLocalStorage->listenFd = -1;
+	if (0 != mrbfsShmCreate(mrbfsInterfaceDriver, nodeLocalStorage))
+		nodeLocalStorage->header = NULL;
+}
+
+void mrbfsInterfacePacketTransmit(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBusPacket* txPkt)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	MRBFSShmRing* ring = nodeLocalStorage->fromBus;
+	MRBFSShmPacket* slot;
+	UINT32 head, tail;
+	eventfd_t wake = 1;
+
+	if (NULL == nodeLocalStorage->header)
+		return;
+
+	// This will be called from the main process, not the interface thread
+	pthread_mutex_lock(&nodeLocalStorage->txLock);
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (head - tail >= nodeLocalStorage->ringSize)
+	{
+		pthread_mutex_unlock(&nodeLocalStorage->txLock);
+		nodeLocalStorage->file_txDropped->value.valueInt = __atomic_add_fetch(&nodeLocalStorage->txDropped, 1, __ATOMIC_RELAXED);
+		nodeLocalStorage->file_txDropped->updateTime = time(NULL);
+		return;
+	}
+
+	slot = &ring->slots[head & (nodeLocalStorage->ringSize - 1)];
+	slot->len = MIN(txPkt->len ? txPkt->len : txPkt->pkt[MRBUS_PKT_LEN], MIN(MRBFS_MAX_PACKET_LEN, MRBFS_SHM_PKT_SZ));
+	memcpy(slot->pkt, txPkt->pkt, slot->len);
+	if (0 != mrbfsInterfaceDriver->addr && 0 == slot->pkt[MRBUS_PKT_SRC])
+		slot->pkt[MRBUS_PKT_SRC] = mrbfsInterfaceDriver->addr;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&nodeLocalStorage->txLock);
+
+	if (__atomic_load_n(&ring->consumerWaiting, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&ring->consumerWaiting, 0, __ATOMIC_SEQ_CST))
+	{
+		if (sizeof(wake) != write(nodeLocalStorage->fromBusEvent, &wake, sizeof(wake)))
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] couldn't wake the simulator (%s)", mrbfsInterfaceDriver->interfaceName, strerror(errno));
+	}
+}
+
+int mrbfsInterfaceTxQueueDepth(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	if (NULL == nodeLocalStorage->header)
+		return(0);
+	return(__atomic_load_n(&nodeLocalStorage->fromBus->head, __ATOMIC_RELAXED) - __atomic_load_n(&nodeLocalStorage->fromBus->tail, __ATOMIC_RELAXED));
+}
+
+// Removes a stale socket left at the port, refusing to touch anything that isn't one
+static int mrbfsShmUnlinkSocket(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	struct stat st;
+
+	if (0 != lstat(mrbfsInterfaceDriver->port, &st))
+		return((ENOENT == errno)?0:-1);
+
+	if (!S_ISSOCK(st.st_mode))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] port [%s] exists and isn't a socket, not removing it", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port);
+		errno = EEXIST;
+		return(-1);
+	}
+	return(unlink(mrbfsInterfaceDriver->port));
+}
+
+static int mrbfsShmListen(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	struct sockaddr_un addr;
+	int fd = -1;
+
+	if (NULL == mrbfsInterfaceDriver->port || strlen(mrbfsInterfaceDriver->port) >= sizeof(addr.sun_path))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] needs the path of a socket to listen on as its port", mrbfsInterfaceDriver->interfaceName);
+		return(-1);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, mrbfsInterfaceDriver->port);
+
+	// Connecting hands over write access to the rings, so only our own user gets to.  On
+	// Linux the socket file takes the socket's mode at bind(), so there's no window to race.
+	if (0 != mrbfsShmUnlinkSocket(mrbfsInterfaceDriver)
+		|| -1 == (fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))
+		|| 0 != fchmod(fd, S_IRUSR | S_IWUSR)
+		|| 0 != bind(fd, (struct sockaddr*)&addr, sizeof(addr))
+		|| 0 != listen(fd, 4))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] cannot listen on [%s] (%s)", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port, strerror(errno));
+		if (-1 != fd)
+			close(fd);
+		return(-1);
+	}
+	return(fd);
+}
+
+// Hands a newly connected simulator the memory and eventfds
+static void mrbfsShmAccept(MRBFSInterfaceDriver* mrbfsInterfaceDriver, NodeLocalStorage* nodeLocalStorage)
+{
+	MRBFSShmHello hello;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr* cmsg;
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	int fds[3] = { nodeLocalStorage->memFd, nodeLocalStorage->toBusEvent, nodeLocalStorage->fromBusEvent };
+	int clientFd;
+
+	while(-1 != (clientFd = accept4(nodeLocalStorage->listenFd, NULL, NULL, SOCK_CLOEXEC)))
+	{
+		memset(&hello, 0, sizeof(hello));
+		hello.magic = MRBFS_SHM_MAGIC;
+		hello.version = MRBFS_SHM_VERSION;
+		hello.mapSize = nodeLocalStorage->mapSize;
+		iov.iov_base = &hello;
+		iov.iov_len = sizeof(hello);
+
+		memset(&msg, 0, sizeof(msg));
+		memset(control, 0, sizeof(control));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+		if (sizeof(hello) == sendmsg(clientFd, &msg, MSG_NOSIGNAL))
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] simulator connected", mrbfsInterfaceDriver->interfaceName);
+		else
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_WARNING, "Interface [%s] couldn't hand shared memory to a simulator (%s)", mrbfsInterfaceDriver->interfaceName, strerror(errno));
+		close(clientFd);
+	}
+}
+
+// Delivers everything waiting in toBus, returns how many packets that was
+static UINT32 mrbfsShmReceive(MRBFSInterfaceDriver* mrbfsInterfaceDriver, NodeLocalStorage* nodeLocalStorage)
+{
+	MRBFSShmRing* ring = nodeLocalStorage->toBus;
+	UINT32 tail = ring->tail, head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	UINT32 received = head - tail;
+	MRBusPacket rxPkt;
+
+	if (0 == received)
+		return(0);
+
+	// More than the ring holds means the simulator wrote a bad head - take a ring's worth, not garbage
+	if (received > nodeLocalStorage->ringSize)
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_WARNING, "Interface [%s] simulator claims %u packets waiting in a %u slot ring", mrbfsInterfaceDriver->interfaceName, received, nodeLocalStorage->ringSize);
+		received = nodeLocalStorage->ringSize;
+		tail = head - received;
+	}
+
+	for(; tail != head; tail++)
+	{
+		MRBFSShmPacket* slot = &ring->slots[tail & (nodeLocalStorage->ringSize - 1)];
+
+		memset(&rxPkt, 0, sizeof(MRBusPacket));
+		rxPkt.bus = mrbfsInterfaceDriver->bus;
+		rxPkt.srcInterface = mrbfsInterfaceDriver->interfaceId;
+		rxPkt.len = MIN(slot->len, MRBFS_MAX_PACKET_LEN);
+		memcpy(rxPkt.pkt, slot->pkt, rxPkt.len);
+		(*mrbfsInterfaceDriver->mrbfsPacketReceive)(&rxPkt);
+
+		// Free slots as we go, so a fast simulator isn't held up by a long batch
+		__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	nodeLocalStorage->pktsReceived += received;
+	nodeLocalStorage->file_pktCounter->value.valueInt = nodeLocalStorage->pktsReceived;
+	nodeLocalStorage->file_pktCounter->updateTime = time(NULL);
+	return(received);
+}
+
+void mrbfsInterfaceDriverRun(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	struct pollfd pollFds[3];
+	eventfd_t events;
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] confirms startup", mrbfsInterfaceDriver->interfaceName);
+
+	if (NULL == nodeLocalStorage->header || -1 == (nodeLocalStorage->listenFd = mrbfsShmListen(mrbfsInterfaceDriver)))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] giving up", mrbfsInterfaceDriver->interfaceName);
+		pthread_exit(NULL);
+	}
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] waiting for simulators on [%s], %u packet rings", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->port, nodeLocalStorage->ringSize);
+
+	while(!mrbfsInterfaceDriver->terminate)
+	{
+		if (0 != mrbfsShmReceive(mrbfsInterfaceDriver, nodeLocalStorage))
+			continue;
+
+		// Nothing waiting - tell the simulator to wake us, and make sure nothing slipped in meanwhile
+		__atomic_store_n(&nodeLocalStorage->toBus->consumerWaiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&nodeLocalStorage->toBus->head, __ATOMIC_SEQ_CST) != nodeLocalStorage->toBus->tail)
+		{
+			__atomic_store_n(&nodeLocalStorage->toBus->consumerWaiting, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		pollFds[0].fd = nodeLocalStorage->toBusEvent;
+		pollFds[0].events = POLLIN;
+		pollFds[1].fd = nodeLocalStorage->listenFd;
+		pollFds[1].events = POLLIN;
+		pollFds[2].fd = mrbfsInterfaceDriver->shutdownFd;
+		pollFds[2].events = POLLIN;
+		poll(pollFds, 3, 100);
+
+		if (pollFds[0].revents & POLLIN)
+			while(sizeof(events) == read(nodeLocalStorage->toBusEvent, &events, sizeof(events)));
+		if (pollFds[1].revents & POLLIN)
+			mrbfsShmAccept(mrbfsInterfaceDriver, nodeLocalStorage);
+	}
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface driver [%s] terminating", mrbfsInterfaceDriver->interfaceName);
+	close(nodeLocalStorage->listenFd);
+	mrbfsShmUnlinkSocket(mrbfsInterfaceDriver);
+	pthread_exit(NULL);
+}
@@ -0,0 +1,79 @@
+#ifndef _INTERFACE_SHM_H
+#define _INTERFACE_SHM_H
+
+#include <stdint.h>
+
+/* Shared memory layout for interface-shm
+
+ Everything a simulator needs to talk to interface-shm - include this
+ rather than mrbfs's own headers.
+
+ Connect a SOCK_SEQPACKET unix socket to the interface's port.  mrbfs
+ answers with one message holding an MRBFSShmHello and, as SCM_RIGHTS,
+ three file descriptors in this order:
+
+   the memfd to mmap (MRBFSShmHello.mapSize bytes, read/write, shared -
+   it's sealed, so don't try to resize it)
+   an eventfd to write 1 to after adding packets to toBus
+   an eventfd to poll for packets added to fromBus
+
+ The mapping is an MRBFSShmHeader followed by the toBus ring, then the
+ fromBus ring, each MRBFSShmRing.ringSize slots at the offsets in the
+ header.  Rings are single producer, single consumer: the simulator
+ produces into toBus and consumes fromBus.  head and tail run freely and
+ wrap at 2^32 - slot i is at index i & (ringSize-1).  A ring is full when
+ head - tail == ringSize.
+
+ The producer fills the slot at head, then stores head + 1 with release
+ ordering.  The consumer reads head with acquire ordering, reads the slot,
+ then stores tail + 1.  To save a system call per packet, the eventfd is
+ only needed when the consumer has said it's going to sleep: after
+ publishing, the producer checks consumerWaiting (sequentially
+ consistent) and, if it's set, clears it and writes the eventfd.  A
+ consumer about to sleep sets consumerWaiting, then checks the ring once
+ more before it blocks.
+
+ mrbfs drops packets it can't fit into fromBus.  A simulator that finds
+ toBus full should wait for the tail to move.
+*/
+
+#define MRBFS_SHM_MAGIC    0x5342524D  // "MRBS"
+#define MRBFS_SHM_VERSION  1
+#define MRBFS_SHM_PKT_SZ   31
+
+typedef struct
+{
+	uint8_t len;
+	uint8_t pkt[MRBFS_SHM_PKT_SZ];
+} MRBFSShmPacket;
+
+// head and tail get a cache line each, so producer and consumer don't contend for one
+typedef struct
+{
+	uint32_t head;
+	uint32_t consumerWaiting;
+	uint8_t padHead[56];
+	uint32_t tail;
+	uint8_t padTail[60];
+	MRBFSShmPacket slots[];
+} MRBFSShmRing;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t ringSize;
+	uint32_t toBusOffset;
+	uint32_t fromBusOffset;
+	uint8_t bus;
+	uint8_t pad[43];
+} MRBFSShmHeader;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t mapSize;
+} MRBFSShmHello;
+
+#endif
@@ -8,6 +8,7 @@
 #include <libgen.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <signal.h>
 #include <stdio.h>
@@ -15,92 +16,98 @@
 #include <unistd.h>
 #include "mrbfs-module.h"
 #include "mrbfs-pktqueue.h"
+#include "mrbfs-options.h"
+#include "mrbfs-serial.h"
 
 // ~85 bytes per packet, and hold 512
 #define RX_PKT_BUFFER_SZ  (83 * 512)  
 
+// Link quality per remote node, kept up as frames arrive and only turned into text
+// when the rssi file is read.  Loss is estimated from gaps in a node's status ('S')
+// packets, against a running average of how often it sends them.
+#define XBEE_RSSI_LINE_SZ  160
+
 typedef struct
 {
 	int dBm;
+	int minDBm;
+	int maxDBm;
+	int ewmaDBm16;          // Moving average, 1/16 dB units, each frame weighted 1/8
+	UINT32 frames;
+	UINT32 statusSeen;
+	UINT32 statusMissed;
+	UINT32 statusIntervalMs;  // Moving average of the time between status packets
+	uint64_t lastStatusMs;
 	time_t lastUpdate;
 } NodeRxRSSI;
 
+// Radio addresses learned from receive frames, per MRBus address, so packets
+// for a node can go to its radio rather than being broadcast to everyone.
+// A series 1 radio without a 16 bit address (0xFFFE) is sent to by its 64 bit one.
+#define XBEE_ADDR16_NONE  0xFFFE
+
+typedef struct
+{
+	UINT8 has16;
+	UINT8 has64;
+	uint16_t addr16;
+	uint64_t addr64;
+	time_t lastUpdate;
+} NodeRadioAddress;
+
+// Transmits awaiting a 0x89 TX status frame from the radio, or waiting to be retried,
+// indexed by frame ID (1-255 - 0 asks the radio not to send a status)
+#define XBEE_TX_FRAME_IDS  256
+
+// Most frames to send in one write - tx-window can't go higher - and the largest
+// escaped frame: a 64 bit address header, the packet and checksum, every byte escaped
+#define XBEE_TX_BATCH     32
+#define XBEE_TX_FRAME_SZ  96
+
+typedef struct
+{
+	UINT8 inUse;
+	UINT8 awaitingStatus;
+	UINT8 retries;
+	MRBusPacket pkt;
+	uint64_t deadlineUsec;  // When to give up on a status if awaitingStatus, when to resend if not
+} XbeeTxFrame;
+
 typedef struct
 {
 	UINT32 pktsReceived;
 	MRBFSFileNode* file_pktCounter;
 	MRBFSFileNode* file_pktLog;
 	MRBFSFileNode* file_nodeRSSI;
+	MRBFSFileNode* file_addresses;
+	MRBFSFileNode* file_txUnicast;
+	MRBFSFileNode* file_txBroadcast;
 	char pktLogStr[RX_PKT_BUFFER_SZ];
 	MRBusPacketQueue txq;
+	MRBFSSerialConfig serialConfig;
+	MRBFSSerialLink serialLink;
 	NodeRxRSSI rssi[256];
+	NodeRadioAddress radioAddress[256];
 	char* nodeRSSIStr;
+	pthread_mutex_t rssiLock;   // Keeps a read of the rssi file from catching a node's stats half updated
+	pthread_mutex_t addressLock;  // The same for radioAddress and the addresses file
+	UINT8 unicast;
+	int addressTimeout;
+	XbeeTxFrame txFrames[XBEE_TX_FRAME_IDS];
+	UINT8 nextFrameId;
+	int txOutstanding;
+	int txWindow;
+	int txRetries;
+	int txRetryDelayMs;
+	int txStatusTimeoutMs;
+	MRBFSFileNode* file_txDelivered;
+	MRBFSFileNode* file_txFailed;
+	MRBFSFileNode* file_txRetried;
 } NodeLocalStorage;
 
-const uint8_t MRBus_CRC16_HighTable[16] =
-{
-	0x00, 0xA0, 0xE0, 0x40, 0x60, 0xC0, 0x80, 0x20,
-	0xC0, 0x60, 0x20, 0x80, 0xA0, 0x00, 0x40, 0xE0
-};
-const uint8_t MRBus_CRC16_LowTable[16] =
-{
-	0x00, 0x01, 0x03, 0x02, 0x07, 0x06, 0x04, 0x05,
-	0x0E, 0x0F, 0x0D, 0x0C, 0x09, 0x08, 0x0A, 0x0B
-};
-
-uint16_t mrbusCRC16Update(uint16_t crc, uint8_t a)
-{
-	uint8_t t;
-	uint8_t i = 0;
-
-	uint8_t W;
-	uint8_t crc16_high = (crc >> 8) & 0xFF;
-	uint8_t crc16_low = crc & 0xFF;
-
-	while (i < 2)
-	{
-		if (i)
-		{
-			W = ((crc16_high << 4) & 0xF0) | ((crc16_high >> 4) & 0x0F);
-			W = W ^ a;
-			W = W & 0x0F;
-			t = W;
-		}
-		else
-		{
-			W = crc16_high;
-			W = W ^ a;
-			W = W & 0xF0;
-			t = W;
-			t = ((t << 4) & 0xF0) | ((t >> 4) & 0x0F);
-		}
-
-		crc16_high = crc16_high << 4; 
-		crc16_high |= (crc16_low >> 4);
-		crc16_low = crc16_low << 4;
-
-		crc16_high = crc16_high ^ MRBus_CRC16_HighTable[t];
-		crc16_low = crc16_low ^ MRBus_CRC16_LowTable[t];
-
-		i++;
-	}
-
-	return ( ((crc16_high << 8) & 0xFF00) + crc16_low );
-}
-
-
 const char* mrbfsInterfaceOptionGet(MRBFSInterfaceDriver* mrbfsInterfaceDriver, const char* interfaceOptionKey, const char* defaultValue)
 {
-	int i;
-	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Node [%s] - [%d] node options, looking for [%s]", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->interfaceOptions, interfaceOptionKey);
-
-	for(i=0; i<mrbfsInterfaceDriver->interfaceOptions; i++)
-	{
-		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Node [%s] - node option [%d], comparing key [%s] to [%s]", mrbfsInterfaceDriver->interfaceName, i, interfaceOptionKey, mrbfsInterfaceDriver->interfaceOptionList[i].key);
-		if (0 == strcmp(interfaceOptionKey, mrbfsInterfaceDriver->interfaceOptionList[i].key))
-			return(mrbfsInterfaceDriver->interfaceOptionList[i].value);
-	}
-	return(defaultValue);
+	return(mrbfsOptionGetStr(&mrbfsInterfaceDriver->interfaceOptions, interfaceOptionKey, defaultValue));
 }
 
 int mrbfsInterfaceDriverVersionCheck(int ifaceVersion)
@@ -110,106 +117,68 @@ int mrbfsInterfaceDriverVersionCheck(int ifaceVersion)
 	return(1);
 }
 
-static void mrbfsXbeeSerialClose(MRBFSInterfaceDriver* mrbfsInterfaceDriver, int fd)
+static int mrbfsXbeeSerialOpen(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
 {
-	if (-1 != fd)
-	{
-		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] closing port", mrbfsInterfaceDriver->interfaceName);
-		close(fd);
-	}
-	return;
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	return(mrbfsSerialOpen(mrbfsInterfaceDriver, &nodeLocalStorage->serialConfig));
 }
 
-typedef struct
+// Renders the rssi file into a buffer of its own, which the caller frees - NULL if there's no memory
+static char* mrbfsXbeeRenderRSSI(NodeLocalStorage* nodeLocalStorage)
 {
-	const char* baudRateStr;
-	speed_t baudRate;
-} BaudDef;
+	char* render = malloc(256 * XBEE_RSSI_LINE_SZ);
+	char* renderPtr = render;
+	UINT32 i = 0;
 
-int getBaudFromString(const char* baudRateStr, speed_t* baudRate)
-{
-	BaudDef BaudDefinitions[] = 
-	{ 
-		{ "115200", B115200 },
-		{  "57600",  B57600 },
-		{  "38400",  B38400 },
-		{  "19200",  B19200 },
-		{   "9600",   B9600 }
-	};	
-	int i;
-	
-	for (i=0; i<sizeof(BaudDefinitions)/sizeof(BaudDef); i++)
+	if (NULL == render)
+		return(NULL);
+
+	*renderPtr = 0;
+	pthread_mutex_lock(&nodeLocalStorage->rssiLock);
+	for(i=0; i < 0xFF; i++)
 	{
-		if (0 == strcmp(baudRateStr, BaudDefinitions[i].baudRateStr))
-		{
-			*baudRate = BaudDefinitions[i].baudRate;
-			return(0);
-		}
+		NodeRxRSSI* rssi = &nodeLocalStorage->rssi[i];
+
+		if (0 == rssi->lastUpdate)
+			continue;
+
+		renderPtr += sprintf(renderPtr, "0x%02X: %d dBm, avg %.1f min %d max %d, %u frames", (unsigned int)i, rssi->dBm, rssi->ewmaDBm16 / 16.0, rssi->minDBm, rssi->maxDBm, rssi->frames);
+		if (0 != rssi->statusIntervalMs)
+			renderPtr += sprintf(renderPtr, ", status every %.1fs, %.1f%% lost", rssi->statusIntervalMs / 1000.0, 100.0 * rssi->statusMissed / (rssi->statusSeen + rssi->statusMissed));
+		renderPtr += sprintf(renderPtr, "\n");
 	}
-	
-	*baudRate = B57600;
-	return(1);
+	pthread_mutex_unlock(&nodeLocalStorage->rssiLock);
+	return(render);
 }
 
-static int mrbfsXbeeSerialOpen(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+// Renders the addresses file into a buffer of its own, which the caller frees - NULL if there's no memory
+static char* mrbfsXbeeRenderAddresses(NodeLocalStorage* nodeLocalStorage)
 {
-	int fd, n, status;
-	struct termios options;
-	int  nbytes;       // Number of bytes read 
-	struct timeval timeout;
-	char* device = mrbfsInterfaceDriver->port;
-	const char* baudRateStr = "";
-	speed_t baudRate = B115200;
-	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] - Starting serial port setup on [%s]", mrbfsInterfaceDriver->interfaceName, device);
-
-	fd = open(device, O_RDWR | O_NOCTTY | O_NDELAY); 
-	if (fd < 0)
-	{
-		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] - Cannot open %s, err=%d", mrbfsInterfaceDriver->interfaceName, device, fd);
-		perror(device); 
-		return(-1); 
-	}
-
-	fcntl(fd, F_SETOWN, getpid());
-	fcntl(fd, F_SETFL, O_NONBLOCK);
-	tcgetattr(fd, &options); // save current serial port settings 
+	char* render = malloc(64 * 256);  // Enough for every node at under 64 bytes per
+	char* renderPtr = render;
+	time_t currentTime = time(NULL);
+	UINT32 i = 0;
 
-	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] - Serial port [%s] opened, not yet configured", mrbfsInterfaceDriver->interfaceName, device);
+	if (NULL == render)
+		return(NULL);
 
-	baudRateStr = mrbfsInterfaceOptionGet(mrbfsInterfaceDriver, "baud", "115200");
-
-	status = getBaudFromString(baudRateStr, &baudRate);
-	if (status)
+	*renderPtr = 0;
+	pthread_mutex_lock(&nodeLocalStorage->addressLock);
+	for(i=0; i < 0xFF; i++)
 	{
-		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] - Baud rate of [%s] is unsupported, defaulting to 115200", mrbfsInterfaceDriver->interfaceName, baudRateStr);
-		baudRate = B115200;
-	} else {
-		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] - Setting baud rate to [%s]", mrbfsInterfaceDriver->interfaceName, baudRateStr);
+		NodeRadioAddress* radioAddress = &nodeLocalStorage->radioAddress[i];
+		if (0 == radioAddress->lastUpdate)
+			continue;
+
+		renderPtr += sprintf(renderPtr, "0x%02X:", (unsigned int)i);
+		if (radioAddress->has16)
+			renderPtr += sprintf(renderPtr, " 16-bit 0x%04X", radioAddress->addr16);
+		if (radioAddress->has64)
+			renderPtr += sprintf(renderPtr, " 64-bit 0x%016llX", (unsigned long long)radioAddress->addr64);
+		renderPtr += sprintf(renderPtr, " %lds ago\n", (long)(currentTime - radioAddress->lastUpdate));
 	}
-
-	if (B115200 == baudRate)
-		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] - WARNING:  XBees are known to be unhappy at 115200, please consider a lower baud rate like 57600", mrbfsInterfaceDriver->interfaceName);
-
-
-	cfsetispeed(&options, baudRate);
-	cfsetospeed(&options, baudRate);
-
-	options.c_cflag &= ~CSIZE; // Mask the character size bits 
-	options.c_cflag |= CS8;    // Select 8 data bits 
-
-	options.c_cflag &= ~CRTSCTS;
-	options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
-	options.c_iflag &= ~(IXON | IXOFF | IXANY | ICRNL);
-	options.c_oflag &= ~OPOST;
-	options.c_cc[VTIME] = 0;
-	options.c_cc[VMIN]   = 1;   // blocking read until 5 chars received
-   
-	tcflush(fd, TCIFLUSH);
-	tcsetattr(fd, TCSAFLUSH, &options);
-
-	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] - Serial startup complete", mrbfsInterfaceDriver->interfaceName);
-
-	return(fd);
+	pthread_mutex_unlock(&nodeLocalStorage->addressLock);
+	return(render);
 }
 
 size_t mrbfsFileNodeRead(MRBFSFileNode* mrbfsFileNode, char *buf, size_t size, off_t offset)
@@ -223,25 +192,11 @@ size_t mrbfsFileNodeRead(MRBFSFileNode* mrbfsFileNode, char *buf, size_t size, o
 	char *respBufferPtr = NULL;
 	size_t len=0;
 
+	// Rendered for each read, so readers never share a buffer - it's only a line per node
 	if (mrbfsFileNode == nodeLocalStorage->file_nodeRSSI)
-	{
-		responseBuffer = (char*)alloca(20 * 256); // Enough for any/all RSSI nodes at 14 bytes per
-		if (NULL != responseBuffer)
-		{
-			UINT32 i = 0;
-			
-			respBufferPtr = responseBuffer;
-			
-			for(i=0; i < 0xFF; i++)
-			{
-				if (0 != nodeLocalStorage->rssi[i].lastUpdate)
-				{
-					respBufferPtr += sprintf(respBufferPtr, "0x%02X: %d dBm\n", (unsigned int)i, nodeLocalStorage->rssi[i].dBm);
-				}
-			}
-		}
-		
-	}
+		responseBuffer = mrbfsXbeeRenderRSSI(nodeLocalStorage);
+	else if (mrbfsFileNode == nodeLocalStorage->file_addresses)
+		responseBuffer = mrbfsXbeeRenderAddresses(nodeLocalStorage);
 
 	(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] responding to readback on [%s] with [%s]", mrbfsNode->interfaceName, mrbfsFileNode->fileName, responseBuffer);
 
@@ -259,6 +214,7 @@ size_t mrbfsFileNodeRead(MRBFSFileNode* mrbfsFileNode, char *buf, size_t size, o
 	} else
 		size = 0;		
 
+	free(responseBuffer);
 	return(size);
 }
 
@@ -266,6 +222,7 @@ size_t mrbfsFileNodeRead(MRBFSFileNode* mrbfsFileNode, char *buf, size_t size, o
 void mrbfsInterfaceDriverInit(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
 {
 	NodeLocalStorage* nodeLocalStorage = calloc(1, sizeof(NodeLocalStorage));
+	pthread_mutexattr_t lockAttr;
 	mrbfsInterfaceDriver->nodeLocalStorage = (void*)nodeLocalStorage;
 
 	nodeLocalStorage->file_pktCounter = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("pktCounter", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
@@ -277,6 +234,42 @@ void mrbfsInterfaceDriverInit(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
 	nodeLocalStorage->file_nodeRSSI->nodeLocalStorage = (void*)mrbfsInterfaceDriver;  // Associate this node's memory with the filenode's local storage
 	nodeLocalStorage->file_nodeRSSI->value.valueStr = nodeLocalStorage->nodeRSSIStr;
 	nodeLocalStorage->file_nodeRSSI->mrbfsFileNodeRead = &mrbfsFileNodeRead;
+
+	pthread_mutexattr_init(&lockAttr);
+	pthread_mutexattr_settype(&lockAttr, PTHREAD_MUTEX_ADAPTIVE_NP);
+	pthread_mutex_init(&nodeLocalStorage->rssiLock, &lockAttr);
+	pthread_mutex_init(&nodeLocalStorage->addressLock, &lockAttr);
+	pthread_mutexattr_destroy(&lockAttr);
+
+	nodeLocalStorage->file_addresses = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("addresses", FNODE_RO_VALUE_READBACK, mrbfsInterfaceDriver->path);
+	nodeLocalStorage->file_addresses->nodeLocalStorage = (void*)mrbfsInterfaceDriver;
+	nodeLocalStorage->file_addresses->mrbfsFileNodeRead = &mrbfsFileNodeRead;
+
+	nodeLocalStorage->file_txUnicast = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("txUnicast", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+	nodeLocalStorage->file_txBroadcast = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("txBroadcast", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+
+	// unicast sends packets for nodes we've heard from straight to their radio,
+	// until address-timeout seconds pass without hearing from them again
+	nodeLocalStorage->unicast = mrbfsOptionGetBool(&mrbfsInterfaceDriver->interfaceOptions, "unicast", 1);
+	nodeLocalStorage->addressTimeout = mrbfsOptionGetInt(&mrbfsInterfaceDriver->interfaceOptions, "address-timeout", 600, 0, 86400);
+
+	// Up to tx-window packets are out waiting on the radio's delivery report at once.  One
+	// that isn't acknowledged is sent again up to tx-retries times, tx-retry-delay ms later,
+	// doubling each time.  No report in tx-status-timeout ms counts as not acknowledged.
+	nodeLocalStorage->txWindow = mrbfsOptionGetInt(&mrbfsInterfaceDriver->interfaceOptions, "tx-window", 4, 1, 32);
+	nodeLocalStorage->txRetries = mrbfsOptionGetInt(&mrbfsInterfaceDriver->interfaceOptions, "tx-retries", 3, 0, 10);
+	nodeLocalStorage->txRetryDelayMs = mrbfsOptionGetInt(&mrbfsInterfaceDriver->interfaceOptions, "tx-retry-delay", 50, 1, 5000);
+	nodeLocalStorage->txStatusTimeoutMs = mrbfsOptionGetInt(&mrbfsInterfaceDriver->interfaceOptions, "tx-status-timeout", 1000, 100, 30000);
+
+	mrbfsSerialConfigure(mrbfsInterfaceDriver, &nodeLocalStorage->serialConfig, 115200, 0);
+	if (nodeLocalStorage->serialConfig.baud >= 115200)
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] - WARNING:  XBees are known to be unhappy at 115200 and up, please consider a lower baud rate like 57600", mrbfsInterfaceDriver->interfaceName);
+	mrbfsSerialLinkInitialize(mrbfsInterfaceDriver, &nodeLocalStorage->serialLink, &nodeLocalStorage->txq);
+	nodeLocalStorage->nextFrameId = 1;
+
+	nodeLocalStorage->file_txDelivered = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("txDelivered", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+	nodeLocalStorage->file_txFailed = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("txFailed", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+	nodeLocalStorage->file_txRetried = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("txRetried", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
 	
 	mrbusPacketQueueInitialize(&nodeLocalStorage->txq);
 }
@@ -287,7 +280,304 @@ void mrbfsInterfacePacketTransmit(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MR
 	// This will be called from the main process, not the interface thread
 	// This thing probably should just enqueue the packet and let the main loop take care of it.
 	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] enqueuing pkt for transmit (src=%02X)", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->addr);
-	mrbusPacketQueuePush(&nodeLocalStorage->txq, txPkt, mrbfsInterfaceDriver->addr);
+	if (0 != mrbusPacketQueuePush(&nodeLocalStorage->txq, txPkt, mrbfsInterfaceDriver->addr))
+		mrbfsSerialTxDropped(&nodeLocalStorage->serialLink, 1);
+}
+
+int mrbfsInterfaceTxQueueDepth(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	return(mrbusPacketQueueDepth(&nodeLocalStorage->txq));
+}
+
+// Notes which radio a received packet came from, for sending back to it unicast
+static void mrbfsXbeeLearnAddress(NodeLocalStorage* nodeLocalStorage, const uint8_t* frame, unsigned int pktDataOffset, time_t currentTime)
+{
+	UINT8 srcAddr = frame[pktDataOffset + MRBUS_PKT_SRC];
+	NodeRadioAddress* radioAddress = &nodeLocalStorage->radioAddress[srcAddr];
+	int i;
+
+	if (0xFF == srcAddr)
+		return;
+
+	if (0x80 == frame[0])
+	{
+		uint64_t addr64 = 0;
+		for(i=0; i<8; i++)
+			addr64 = (addr64 << 8) | frame[1+i];
+		radioAddress->addr64 = addr64;
+		radioAddress->has64 = 1;
+	}
+	else
+	{
+		uint16_t addr16 = (((uint16_t)frame[1])<<8) | frame[2];
+		if (XBEE_ADDR16_NONE == addr16)
+			return;
+		radioAddress->addr16 = addr16;
+		radioAddress->has16 = 1;
+	}
+	radioAddress->lastUpdate = currentTime;
+}
+
+// Starts a transmit API frame for txPkt at frame - to the destination node's radio if we know
+// it, broadcast otherwise.  Returns a pointer to where the MRBus packet goes.
+static uint8_t* mrbfsXbeeTxFrameHeader(NodeLocalStorage* nodeLocalStorage, MRBusPacket* txPkt, UINT8 frameId, uint8_t* frame, int* unicast)
+{
+	NodeRadioAddress* radioAddress = &nodeLocalStorage->radioAddress[txPkt->pkt[MRBUS_PKT_DEST]];
+	uint8_t* framePtr = frame;
+	int i;
+
+	*framePtr++ = 0x7E;     // 0 - Start 
+	*framePtr++ = 0x00;     // 1 - Len MSB, filled in once we know it
+	*framePtr++ = 0x00;     // 2 - Len LSB
+
+	if (nodeLocalStorage->unicast
+		&& 0xFF != txPkt->pkt[MRBUS_PKT_DEST]
+		&& 0 != radioAddress->lastUpdate
+		&& (0 == nodeLocalStorage->addressTimeout || (time(NULL) - radioAddress->lastUpdate) <= nodeLocalStorage->addressTimeout))
+	{
+		if (radioAddress->has16)
+		{
+			*framePtr++ = 0x01;  // 3 - API being called - transmit by 16 bit address
+			*framePtr++ = frameId;  // 4 - Frame identifier
+			*framePtr++ = (radioAddress->addr16 >> 8) & 0xFF;
+			*framePtr++ = radioAddress->addr16 & 0xFF;
+		}
+		else
+		{
+			*framePtr++ = 0x00;  // 3 - API being called - transmit by 64 bit address
+			*framePtr++ = frameId;  // 4 - Frame identifier
+			for(i=7; i>=0; i--)
+				*framePtr++ = (radioAddress->addr64 >> (8*i)) & 0xFF;
+		}
+		*framePtr++ = 0x00;     // Transmit options
+		*unicast = 1;
+		return(framePtr);
+	}
+
+	*framePtr++ = 0x01;     // 3 - API being called - transmit by 16 bit address
+	*framePtr++ = frameId;  // 4 - Frame identifier
+	*framePtr++ = 0xFF;     // 5 - MSB of dest address - broadcast 0xFFFF
+	*framePtr++ = 0xFF;     // 6 - LSB of dest address - broadcast 0xFFFF
+	*framePtr++ = 0x00;     // 7 - Transmit options
+	*unicast = 0;
+	return(framePtr);
+}
+
+static void mrbfsXbeeCount(MRBFSFileNode* fileNode)
+{
+	fileNode->value.valueInt++;
+	fileNode->updateTime = time(NULL);
+}
+
+static uint64_t mrbfsXbeeNowUsec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+// Encodes one transmit into txPktBufferEscaped (XBEE_TX_FRAME_SZ bytes) and returns its length
+static size_t mrbfsXbeeEncodeFrame(MRBFSInterfaceDriver* mrbfsInterfaceDriver, XbeeTxFrame* txFrame, UINT8 frameId, uint8_t* txPktBufferEscaped)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	MRBusPacket* txPkt = &txFrame->pkt;
+	uint8_t txPktBuffer[XBEE_TX_FRAME_SZ/2];
+	uint8_t *txPktPtr, *txPktEscapedPtr;
+	uint8_t txPktLenWithEscapes=0;
+	uint16_t crc16_value = 0;
+	UINT8 xbeeChecksum = 0;
+	UINT32 i = 0;
+	int unicast = 0;
+
+	// First, calculate MRBus CRC16 
+	crc16_value = mrbfsSerialPacketCRC(txPkt);
+	txPkt->pkt[MRBUS_PKT_CRC_L] = (crc16_value & 0xFF);
+	txPkt->pkt[MRBUS_PKT_CRC_H] = ((crc16_value >> 8) & 0xFF);			
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] CRC = %02X %02X", mrbfsInterfaceDriver->interfaceName, txPkt->pkt[MRBUS_PKT_CRC_H], txPkt->pkt[MRBUS_PKT_CRC_L]);
+
+	memset(txPktBuffer, 0, sizeof(txPktBuffer));
+	txPktPtr = mrbfsXbeeTxFrameHeader(nodeLocalStorage, txPkt, frameId, txPktBuffer, &unicast);
+	if (0 == txFrame->retries)
+		mrbfsXbeeCount(unicast ? nodeLocalStorage->file_txUnicast : nodeLocalStorage->file_txBroadcast);
+
+	// Copy over actual packet			
+	for(i=0; i<txPkt->pkt[MRBUS_PKT_LEN] && i<MRBFS_MAX_PACKET_LEN; i++)
+		*txPktPtr++ = txPkt->pkt[i];
+
+	// Length of the frame data segment, before escaping
+	txPktBuffer[2] = (txPktPtr - txPktBuffer) - 3;
+	
+	xbeeChecksum = 0;
+	// Add up checksum
+	for(i=3; i<(txPktPtr - txPktBuffer); i++)
+		xbeeChecksum += txPktBuffer[i];
+
+	xbeeChecksum = 0xFF - xbeeChecksum;
+	*txPktPtr++ = xbeeChecksum;
+	
+	txPktEscapedPtr = txPktBufferEscaped;
+
+	*txPktEscapedPtr++ = txPktBuffer[0];
+	for(i=1; i<(txPktPtr - txPktBuffer); i++)
+	{
+		switch(txPktBuffer[i])
+		{
+			case 0x7E:
+			case 0x7D:
+			case 0x11:
+			case 0x13:
+				*txPktEscapedPtr++ = 0x7D;
+				*txPktEscapedPtr++ = 0x20 ^ txPktBuffer[i];
+				break;
+			
+			default:
+				*txPktEscapedPtr++ = txPktBuffer[i];
+				break;
+		}
+	}
+
+	{
+		char buffer[1024];
+		memset(buffer, 0, sizeof(buffer));
+		for (i = 0; i < txPktEscapedPtr - txPktBufferEscaped; i++)
+		{
+			sprintf(buffer+i*3, "%02X ", txPktBufferEscaped[i]);
+		}			
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] txPkt = [%s]", mrbfsInterfaceDriver->interfaceName, buffer);
+	}
+
+	return(txPktEscapedPtr - txPktBufferEscaped);
+}
+
+// A transmit wasn't acknowledged - schedule it to go again, or give up on it
+static void mrbfsXbeeTxFailed(MRBFSInterfaceDriver* mrbfsInterfaceDriver, UINT8 frameId, const char* reason)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	XbeeTxFrame* txFrame = &nodeLocalStorage->txFrames[frameId];
+	UINT8 destAddr = txFrame->pkt.pkt[MRBUS_PKT_DEST];
+
+	if (txFrame->retries < nodeLocalStorage->txRetries)
+	{
+		txFrame->retries++;
+		txFrame->awaitingStatus = 0;
+		txFrame->deadlineUsec = mrbfsXbeeNowUsec() + ((uint64_t)nodeLocalStorage->txRetryDelayMs * 1000 << (txFrame->retries - 1));
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] frame %d to 0x%02X %s, retry %d", mrbfsInterfaceDriver->interfaceName, frameId, destAddr, reason, txFrame->retries);
+		return;
+	}
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_WARNING, "Interface [%s] giving up on packet to 0x%02X after %d retries (%s)", mrbfsInterfaceDriver->interfaceName, destAddr, txFrame->retries, reason);
+	mrbfsXbeeCount(nodeLocalStorage->file_txFailed);
+
+	// The node may have moved to another radio - broadcast to it until we hear from it again
+	pthread_mutex_lock(&nodeLocalStorage->addressLock);
+	nodeLocalStorage->radioAddress[destAddr].lastUpdate = 0;
+	pthread_mutex_unlock(&nodeLocalStorage->addressLock);
+
+	txFrame->inUse = 0;
+	nodeLocalStorage->txOutstanding--;
+}
+
+// Handles a 0x89 TX status frame
+static void mrbfsXbeeTxStatus(MRBFSInterfaceDriver* mrbfsInterfaceDriver, UINT8 frameId, UINT8 status)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	XbeeTxFrame* txFrame = &nodeLocalStorage->txFrames[frameId];
+	const char* statusStr[] = { "delivered", "not acknowledged", "channel busy", "purged" };
+
+	// Late reports for frames we've already given up waiting on are dropped
+	if (0 == frameId || !txFrame->inUse || !txFrame->awaitingStatus)
+		return;
+
+	if (0 == status)
+	{
+		mrbfsXbeeCount(nodeLocalStorage->file_txDelivered);
+		txFrame->inUse = 0;
+		nodeLocalStorage->txOutstanding--;
+		return;
+	}
+
+	mrbfsXbeeTxFailed(mrbfsInterfaceDriver, frameId, (status < 4) ? statusStr[status] : "failed");
+}
+
+// Resends what's due and starts new packets while the window has room, all in one write.
+// Returns non-zero if the port needs resetting.
+static int mrbfsXbeeTransmitPending(MRBFSInterfaceDriver* mrbfsInterfaceDriver, int fd)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	uint8_t txBatch[XBEE_TX_BATCH][XBEE_TX_FRAME_SZ];
+	struct iovec txIov[XBEE_TX_BATCH];
+	size_t txBudget = mrbfsSerialTxBudgetBytes(&nodeLocalStorage->serialConfig);
+	size_t batchBytes = 0;
+	uint64_t now = mrbfsXbeeNowUsec();
+	int frameId, txFrames = 0;
+
+	// Retries first - every frame here is inside the window, so they always fit in the batch
+	for(frameId=1; frameId<XBEE_TX_FRAME_IDS && 0 != nodeLocalStorage->txOutstanding && txFrames < XBEE_TX_BATCH; frameId++)
+	{
+		XbeeTxFrame* txFrame = &nodeLocalStorage->txFrames[frameId];
+
+		if (!txFrame->inUse || now < txFrame->deadlineUsec)
+			continue;
+
+		if (txFrame->awaitingStatus)
+		{
+			mrbfsXbeeTxFailed(mrbfsInterfaceDriver, frameId, "no status from radio");
+			continue;
+		}
+
+		mrbfsXbeeCount(nodeLocalStorage->file_txRetried);
+		txIov[txFrames].iov_base = txBatch[txFrames];
+		txIov[txFrames].iov_len = mrbfsXbeeEncodeFrame(mrbfsInterfaceDriver, txFrame, frameId, txBatch[txFrames]);
+		batchBytes += txIov[txFrames++].iov_len;
+		txFrame->awaitingStatus = 1;
+		txFrame->deadlineUsec = now + (uint64_t)nodeLocalStorage->txStatusTimeoutMs * 1000;
+	}
+
+	while(nodeLocalStorage->txOutstanding < nodeLocalStorage->txWindow && txFrames < XBEE_TX_BATCH
+		&& (0 == txFrames || batchBytes < txBudget) && mrbusPacketQueueDepth(&nodeLocalStorage->txq))
+	{
+		XbeeTxFrame* txFrame;
+
+		// Frame IDs go round 1-255, skipping any still outstanding
+		while(nodeLocalStorage->txFrames[nodeLocalStorage->nextFrameId].inUse || 0 == nodeLocalStorage->nextFrameId)
+			nodeLocalStorage->nextFrameId++;
+		frameId = nodeLocalStorage->nextFrameId++;
+
+		txFrame = &nodeLocalStorage->txFrames[frameId];
+		memset(txFrame, 0, sizeof(XbeeTxFrame));
+		mrbusPacketQueuePop(&nodeLocalStorage->txq, &txFrame->pkt);
+		txFrame->inUse = 1;
+		txFrame->awaitingStatus = 1;
+		txFrame->deadlineUsec = now + (uint64_t)nodeLocalStorage->txStatusTimeoutMs * 1000;
+		nodeLocalStorage->txOutstanding++;
+
+		txIov[txFrames].iov_base = txBatch[txFrames];
+		txIov[txFrames].iov_len = mrbfsXbeeEncodeFrame(mrbfsInterfaceDriver, txFrame, frameId, txBatch[txFrames]);
+		batchBytes += txIov[txFrames++].iov_len;
+	}
+
+	if (0 == txFrames)
+		return(0);
+
+	// Anything that doesn't make it out is sent again once the port is back
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface driver [%s] transmitting %d frames, %d bytes", mrbfsInterfaceDriver->interfaceName, txFrames, batchBytes);
+	return(0 != mrbfsSerialWriteBatch(mrbfsInterfaceDriver, &nodeLocalStorage->serialConfig, fd, txIov, txFrames, nodeLocalStorage->txStatusTimeoutMs));
+}
+
+// After a port reset the radio won't report on anything sent before it - send it all again
+static void mrbfsXbeeTxRestart(NodeLocalStorage* nodeLocalStorage)
+{
+	int frameId;
+
+	for(frameId=1; frameId<XBEE_TX_FRAME_IDS; frameId++)
+	{
+		if (nodeLocalStorage->txFrames[frameId].inUse)
+		{
+			nodeLocalStorage->txFrames[frameId].awaitingStatus = 0;
+			nodeLocalStorage->txFrames[frameId].deadlineUsec = 0;
+		}
+	}
 }
 
 int trimNewlines(char* str, int trimval)
@@ -305,27 +595,268 @@ int trimNewlines(char* str, int trimval)
 	return(newlines);
 }
 
+/* API frame parsing
+
+ Frames are 0x7E, a two byte length, that many bytes of frame data (API
+ identifier first) and a checksum, with 0x7E, 0x7D, 0x11 and 0x13 escaped
+ as 0x7D followed by the byte xor 0x20.
+
+ mrbfsXbeeParse() takes a whole read() at a time.  Frame data is unescaped
+ in place, into the front of the bytes it came from, so a frame that
+ arrived within one read is handed back as a pointer into the read buffer
+ without being copied.  Only a frame still incomplete at the end of a read
+ is copied aside, into the parser, to be finished from the next one.  The
+ checksum is kept as bytes arrive.  A 0x7E always starts a new frame - an
+ unescaped one can't occur inside a frame - so the parser resyncs on the
+ next frame after any garbage or truncation.
+*/
+
+#define XBEE_MAX_FRAME_DATA  256
+
+enum
+{
+	XBEE_PARSE_HUNT = 0,
+	XBEE_PARSE_LEN_MSB,
+	XBEE_PARSE_LEN_LSB,
+	XBEE_PARSE_DATA,
+	XBEE_PARSE_CHECKSUM
+};
+
+typedef struct
+{
+	UINT8 state;
+	UINT8 escapeNext;
+	UINT8 checksum;
+	UINT8 carrying;      // Frame so far is in carry[] rather than the read buffer
+	uint16_t frameLen;
+	uint16_t have;
+	uint8_t* dataStart;
+	UINT32 badChecksums;
+	UINT32 truncated;
+	uint8_t carry[XBEE_MAX_FRAME_DATA];
+} XbeeFrameParser;
+
+// Picks up in buf at *pos.  Returns 1 with a frame's data (API identifier first, checksum removed)
+// in *frame and *frameLen, or 0 once buf is used up.  *frame is good until buf is next filled.
+static int mrbfsXbeeParse(XbeeFrameParser* parser, uint8_t* buf, size_t len, size_t* pos, uint8_t** frame, size_t* frameLen)
+{
+	while (*pos < len)
+	{
+		uint8_t c = buf[(*pos)++];
+
+		if (0x7E == c)
+		{
+			if (XBEE_PARSE_HUNT != parser->state)
+				parser->truncated++;
+			parser->state = XBEE_PARSE_LEN_MSB;
+			parser->escapeNext = 0;
+			continue;
+		}
+
+		if (XBEE_PARSE_HUNT == parser->state)
+			continue;
+
+		if (0x7D == c)
+		{
+			parser->escapeNext = 1;
+			continue;
+		}
+
+		if (parser->escapeNext)
+		{
+			c ^= 0x20;
+			parser->escapeNext = 0;
+		}
+
+		switch(parser->state)
+		{
+			case XBEE_PARSE_LEN_MSB:
+				parser->frameLen = ((uint16_t)c) << 8;
+				parser->state = XBEE_PARSE_LEN_LSB;
+				break;
+
+			case XBEE_PARSE_LEN_LSB:
+				parser->frameLen |= c;
+				if (0 == parser->frameLen || parser->frameLen > XBEE_MAX_FRAME_DATA)
+				{
+					parser->truncated++;
+					parser->state = XBEE_PARSE_HUNT;
+					break;
+				}
+				parser->have = 0;
+				parser->checksum = 0;
+				parser->carrying = 0;
+				parser->dataStart = buf + *pos;
+				parser->state = XBEE_PARSE_DATA;
+				break;
+
+			case XBEE_PARSE_DATA:
+				// Escapes only ever shrink the data, so this never passes the read position
+				if (parser->carrying)
+					parser->carry[parser->have++] = c;
+				else
+					parser->dataStart[parser->have++] = c;
+				parser->checksum += c;
+				if (parser->have == parser->frameLen)
+					parser->state = XBEE_PARSE_CHECKSUM;
+				break;
+
+			case XBEE_PARSE_CHECKSUM:
+				parser->state = XBEE_PARSE_HUNT;
+				if (0xFF != (UINT8)(parser->checksum + c))
+				{
+					parser->badChecksums++;
+					break;
+				}
+				*frame = parser->carrying ? parser->carry : parser->dataStart;
+				*frameLen = parser->frameLen;
+				return(1);
+		}
+	}
+
+	// Out of bytes partway into a frame - buf is about to be reused, so keep what's there
+	if ((XBEE_PARSE_DATA == parser->state || XBEE_PARSE_CHECKSUM == parser->state) && !parser->carrying)
+	{
+		memcpy(parser->carry, parser->dataStart, parser->have);
+		parser->carrying = 1;
+	}
+	return(0);
+}
+
+static void mrbfsXbeeUpdateRSSI(NodeRxRSSI* rssi, int dBm, UINT8 pktType, time_t currentTime)
+{
+	if (0 == rssi->frames++)
+	{
+		rssi->minDBm = rssi->maxDBm = dBm;
+		rssi->ewmaDBm16 = dBm * 16;
+	}
+	rssi->dBm = dBm;
+	rssi->minDBm = MIN(rssi->minDBm, dBm);
+	rssi->maxDBm = MAX(rssi->maxDBm, dBm);
+	rssi->ewmaDBm16 += (dBm * 16 - rssi->ewmaDBm16) / 8;
+	rssi->lastUpdate = currentTime;
+
+	if ('S' == pktType)
+	{
+		uint64_t nowMs = mrbfsXbeeNowUsec() / 1000;
+		UINT32 gapMs = (UINT32)MIN(nowMs - rssi->lastStatusMs, 0xFFFFFFFF);
+
+		if (1 == ++rssi->statusSeen)
+			rssi->statusIntervalMs = 0;  // Nothing to measure a gap from yet
+		else if (0 == rssi->statusIntervalMs)
+			rssi->statusIntervalMs = gapMs;
+		else if (gapMs > rssi->statusIntervalMs * 3 / 2)
+		{
+			// Count what should have arrived in the gap as lost.  Long gaps still pull the
+			// average a little, so a node that's slowed down for good isn't lossy forever.
+			rssi->statusMissed += (gapMs + rssi->statusIntervalMs / 2) / rssi->statusIntervalMs - 1;
+			rssi->statusIntervalMs += ((int64_t)gapMs - rssi->statusIntervalMs) / 32;
+		}
+		else
+			rssi->statusIntervalMs += ((int64_t)gapMs - rssi->statusIntervalMs) / 8;
+
+		rssi->lastStatusMs = nowMs;
+	}
+}
+
+static void mrbfsXbeeHandleFrame(MRBFSInterfaceDriver* mrbfsInterfaceDriver, uint8_t* frame, size_t frameLen)
+{
+	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
+	unsigned int pktDataOffset = 5;
+	int i;
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] got pkt with good checksum, API frame type 0x%02X", mrbfsInterfaceDriver->interfaceName, frame[0]);
+
+	switch(frame[0]) // Handle different API frame types
+	{
+		// Various packet receive frames, based on address type
+		case 0x80: // 64 bit addressing frame
+			pktDataOffset = 11;
+			// Intentional fall-through
+		case 0x81: // 16 bit addressing frame
+			{
+				// It's a data packet
+				// Give it back to the control thread
+				time_t currentTime = time(NULL);
+				MRBusPacket rxPkt;
+
+				if (frameLen < pktDataOffset + MRBUS_PKT_TYPE + 1)
+				{
+					(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] got receive frame too short for a packet, ignoring", mrbfsInterfaceDriver->interfaceName);
+					break;
+				}
+
+				memset(&rxPkt, 0, sizeof(MRBusPacket));
+				rxPkt.bus = mrbfsInterfaceDriver->bus;
+				rxPkt.srcInterface = mrbfsInterfaceDriver->interfaceId;
+				rxPkt.len = MIN(MIN(frame[pktDataOffset + MRBUS_PKT_LEN], frameLen - pktDataOffset), MRBFS_MAX_PACKET_LEN);
+				for(i=0; i<rxPkt.len; i++)
+					rxPkt.pkt[i] = frame[pktDataOffset + i];
+				
+				pthread_mutex_lock(&nodeLocalStorage->rssiLock);
+				mrbfsXbeeUpdateRSSI(&nodeLocalStorage->rssi[frame[pktDataOffset + MRBUS_PKT_SRC]], -(frame[pktDataOffset - 2]), frame[pktDataOffset + MRBUS_PKT_TYPE], currentTime);
+				pthread_mutex_unlock(&nodeLocalStorage->rssiLock);
+				pthread_mutex_lock(&nodeLocalStorage->addressLock);
+				mrbfsXbeeLearnAddress(nodeLocalStorage, frame, pktDataOffset, currentTime);
+				pthread_mutex_unlock(&nodeLocalStorage->addressLock);
+				
+				// Store the packet in the receive queue
+				{
+					char *newStart = nodeLocalStorage->pktLogStr;
+					size_t rxPacketLen = strlen(nodeLocalStorage->pktLogStr), newLen=rxPacketLen, newRemaining=RX_PKT_BUFFER_SZ-rxPacketLen;
+					char timeString[64];
+					char newPacket[100];
+					int b;
+					size_t timeSize=0;
+					struct tm pktTimeTM;
+
+					localtime_r(&currentTime, &pktTimeTM);
+					memset(newPacket, 0, sizeof(newPacket));
+					strftime(newPacket, sizeof(newPacket), "[%Y%m%d %H%M%S] R ", &pktTimeTM);
+	
+					for(b=0; b<rxPkt.len; b++)
+						sprintf(newPacket + 20 + b*3, "%02X ", rxPkt.pkt[b]);
+					*(newPacket + 20 + b*3-1) = '\n';
+					*(newPacket + 20 + b*3) = 0;
+					newLen = 20 + b*3;
+
+					// Trim rear of existing string
+					trimNewlines(nodeLocalStorage->pktLogStr, 511);
+
+					memmove(nodeLocalStorage->pktLogStr + newLen, nodeLocalStorage->pktLogStr, strlen(nodeLocalStorage->pktLogStr));
+					memcpy(nodeLocalStorage->pktLogStr, newPacket, newLen);
+					nodeLocalStorage->file_pktLog->updateTime = currentTime;
+
+					nodeLocalStorage->file_pktCounter->updateTime = currentTime;
+					nodeLocalStorage->file_pktCounter->value.valueInt = ++nodeLocalStorage->pktsReceived;
+				}
+				(*mrbfsInterfaceDriver->mrbfsPacketReceive)(&rxPkt);
+			}
+			break;
+		
+		case 0x89: // TX status
+			if (frameLen >= 3)
+				mrbfsXbeeTxStatus(mrbfsInterfaceDriver, frame[1], frame[2]);
+			break;
+
+		default:
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] got API frame 0x%02X, ignoring", mrbfsInterfaceDriver->interfaceName, frame[0]);
+			break;
+	}
+}
+
 void mrbfsInterfaceDriverRun(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
 {
-	uint8_t buffer[256];
-	uint8_t *bufptr;      // Current char in buffer 
-   uint8_t pktBuf[256];
-   uint8_t incomingByte[2];
-	const char* device="/dev/ttyUSB0";
+	uint8_t rxBuffer[1024];
+	XbeeFrameParser parser;
 	NodeLocalStorage* nodeLocalStorage = (NodeLocalStorage*)mrbfsInterfaceDriver->nodeLocalStorage;
-	struct termios options;
-	struct timeval timeout;
-	struct sigaction saio;
 	int processingPacket=0;
-	int fd = -1, nbytes=0, i=0;	
-	UINT32 expectedPktLen = 0;
-	UINT8 escapeNextByte = 0;
+	int fd = -1, nbytes=0;	
 	UINT8 resetSerial = 0;
 			
 	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] confirms startup", mrbfsInterfaceDriver->interfaceName);
 
-   memset(buffer, 0, sizeof(buffer));
-   bufptr = buffer;
+	memset(&parser, 0, sizeof(parser));
 
 	fd = mrbfsXbeeSerialOpen(mrbfsInterfaceDriver);
 
@@ -343,252 +874,39 @@ void mrbfsInterfaceDriverRun(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
       
       if (resetSerial)
       {
-	      mrbfsXbeeSerialClose(mrbfsInterfaceDriver, fd);    
-	      
-	      // Nothing we can do until we get our port back
-			do
-			{
-   			memset(buffer, 0, sizeof(buffer));
-			   bufptr = buffer;
-			   escapeNextByte = 0;
-		      usleep(100000);
-		      fd = mrbfsXbeeSerialOpen(mrbfsInterfaceDriver);
-			} while (0 == fd);
-			resetSerial = 0;
+	      // Until the port is back, transmits on this bus go elsewhere if they can
+	      if (-1 == (fd = mrbfsSerialReconnect(mrbfsInterfaceDriver, &nodeLocalStorage->serialLink, fd, &mrbfsXbeeSerialOpen)))
+	         continue;
+
+	      memset(&parser, 0, sizeof(parser));
+	      resetSerial = 0;
+	      mrbfsXbeeTxRestart(nodeLocalStorage);
       }
       
-      while ((nbytes = read(fd, incomingByte, 1)) > 0)
+      while ((nbytes = read(fd, rxBuffer, sizeof(rxBuffer))) > 0)
       {
-			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] got byte [0x%02X]", mrbfsInterfaceDriver->interfaceName, incomingByte[0]);
-
-         switch(incomingByte[0])
-         {
-            case 0x7E:
-					// Start of API frame
-               memset(buffer, 0, sizeof(buffer));
-               bufptr = buffer;
-               *bufptr++ = incomingByte[0];               
-					processingPacket = 1;
-					expectedPktLen = 0;
-					escapeNextByte = 0;
-					(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] starting packet parse on 0x7E", mrbfsInterfaceDriver->interfaceName);
-               break;
-               
-				case 0x7D:
-					// Escape character
-					(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] setting escape", mrbfsInterfaceDriver->interfaceName);
-					escapeNextByte = 1;
-					break;
-					
-            default:
-					if (escapeNextByte)
-						incomingByte[0] ^= 0x20;
-					escapeNextByte = 0;
-
-					processingPacket = 1;
-               *bufptr++ = incomingByte[0];
-               if (bufptr >= buffer + sizeof(buffer))
-               {
-						processingPacket = 0;
-						memset(buffer, 0, sizeof(buffer));	                
-						bufptr = buffer;
-						break;
-               }
-
-		        (*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] buffer len is %d, looking for %d", mrbfsInterfaceDriver->interfaceName, bufptr - buffer, expectedPktLen);
-
-					if (3 == (bufptr - buffer))
-						expectedPktLen = (((unsigned int)buffer[1])<<8) + buffer[2] + 4; // length is 3 bytes of header + 1 byte of check + data len
-
-					if ((bufptr - buffer) == expectedPktLen) 
-					{
-						// Theoretical end of packet
-						unsigned char pktChecksum = 0;
-						for (i=3; i<expectedPktLen; i++)
-							pktChecksum += buffer[i];
-						
-						if (0xFF != pktChecksum)
-						{
-							(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] got pkt with bad checksum - actual=0x%02X rcvd=0x%02X", mrbfsInterfaceDriver->interfaceName, pktChecksum, buffer[expectedPktLen-1]);
-						}
-						else
-						{
-							unsigned int pktDataOffset = 8;
-							// Finished packet, good checksum
-							(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] got pkt with good checksum, API frame type 0x%02X", mrbfsInterfaceDriver->interfaceName, buffer[3]);
-							
-							switch(buffer[3]) // Handle different API frame types
-							{
-								// Various packet receive frames, based on address type
-								case 0x80: // 64 bit addressing frame
-									pktDataOffset = 14;
-									// Intentional fall-through
-								case 0x81: // 16 bit addressing frame
-									{
-				                  // It's a data packet
-										// Give it back to the control thread
-										time_t currentTime = time(NULL);
-										MRBusPacket rxPkt;
-
-										memset(&rxPkt, 0, sizeof(MRBusPacket));
-										rxPkt.bus = mrbfsInterfaceDriver->bus;
-										rxPkt.len = buffer[pktDataOffset + MRBUS_PKT_LEN];
-										for(i=0; i<rxPkt.len; i++)
-											rxPkt.pkt[i] = buffer[pktDataOffset + i];
-										
-										nodeLocalStorage->rssi[buffer[pktDataOffset + MRBUS_PKT_SRC]].dBm = -(buffer[pktDataOffset - 2]);
-										nodeLocalStorage->rssi[buffer[pktDataOffset + MRBUS_PKT_SRC]].lastUpdate = currentTime;
-										
-										// Store the packet in the receive queue
-										{
-											char *newStart = nodeLocalStorage->pktLogStr;
-											size_t rxPacketLen = strlen(nodeLocalStorage->pktLogStr), newLen=rxPacketLen, newRemaining=RX_PKT_BUFFER_SZ-rxPacketLen;
-											char timeString[64];
-											char newPacket[100];
-											int b;
-											size_t timeSize=0;
-											struct tm pktTimeTM;
-
-											localtime_r(&currentTime, &pktTimeTM);
-											memset(newPacket, 0, sizeof(newPacket));
-											strftime(newPacket, sizeof(newPacket), "[%Y%m%d %H%M%S] R ", &pktTimeTM);
-	
-											for(b=0; b<rxPkt.len; b++)
-												sprintf(newPacket + 20 + b*3, "%02X ", rxPkt.pkt[b]);
-											*(newPacket + 20 + b*3-1) = '\n';
-											*(newPacket + 20 + b*3) = 0;
-											newLen = 20 + b*3;
-
-											// Trim rear of existing string
-											trimNewlines(nodeLocalStorage->pktLogStr, 511);
-
-											memmove(nodeLocalStorage->pktLogStr + newLen, nodeLocalStorage->pktLogStr, strlen(nodeLocalStorage->pktLogStr));
-											memcpy(nodeLocalStorage->pktLogStr, newPacket, newLen);
-											nodeLocalStorage->file_pktLog->updateTime = currentTime;
-
-											nodeLocalStorage->file_pktCounter->updateTime = currentTime;
-											nodeLocalStorage->file_pktCounter->value.valueInt = ++nodeLocalStorage->pktsReceived;
-										}
-										(*mrbfsInterfaceDriver->mrbfsPacketReceive)(&rxPkt);											
-											
-											
-									}
-									break;
-								
-								default:
-									(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] got API frame 0x%02X, ignoring", mrbfsInterfaceDriver->interfaceName, buffer[3]);
-									break;
-							}
-							
-						}
-						memset(buffer, 0, sizeof(buffer));
-						bufptr = buffer;
-						expectedPktLen = 0;
-						processingPacket = 0;
-					}
-					break;
-				}
+			size_t rxPos = 0, frameLen = 0;
+			uint8_t* frame = NULL;
+			UINT32 badChecksums = parser.badChecksums;
+
+			while (mrbfsXbeeParse(&parser, rxBuffer, nbytes, &rxPos, &frame, &frameLen))
+				mrbfsXbeeHandleFrame(mrbfsInterfaceDriver, frame, frameLen);
+
+			if (badChecksums != parser.badChecksums)
+				(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] dropped %u frames with bad checksums", mrbfsInterfaceDriver->interfaceName, parser.badChecksums - badChecksums);
       }
+      processingPacket = (XBEE_PARSE_HUNT != parser.state);
       
       if (nbytes < -1)
       	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] error = %d", mrbfsInterfaceDriver->interfaceName, nbytes);
 
-		if (!processingPacket && mrbusPacketQueueDepth(&nodeLocalStorage->txq) )
-		{
-			MRBusPacket txPkt;
-			uint8_t txPktBuffer[32];
-			uint8_t txPktBufferEscaped[64];
-			uint8_t *txPktPtr, *txPktEscapedPtr;
-			uint8_t txPktLen=0, txPktLenWithEscapes=0;
-			uint16_t crc16_value = 0;
-			UINT8 xbeeChecksum = 0;
-			UINT32 i = 0;
-
-			mrbusPacketQueuePop(&nodeLocalStorage->txq, &txPkt);
-
-			// First, calculate MRBus CRC16 
-			for (i = 0; i < txPkt.pkt[MRBUS_PKT_LEN]; i++)
-			{
-				if ((i != MRBUS_PKT_CRC_H) && (i != MRBUS_PKT_CRC_L))
-					crc16_value = mrbusCRC16Update(crc16_value, txPkt.pkt[i]);
-			}			
-			txPkt.pkt[MRBUS_PKT_CRC_L] = (crc16_value & 0xFF);
-			txPkt.pkt[MRBUS_PKT_CRC_H] = ((crc16_value >> 8) & 0xFF);			
-			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] CRC = %02X %02X", mrbfsInterfaceDriver->interfaceName, txPkt.pkt[MRBUS_PKT_CRC_H], txPkt.pkt[MRBUS_PKT_CRC_L]);
-
-			// Now figure out the length of the data segment, before escaping
-			txPktLen = txPkt.pkt[MRBUS_PKT_LEN] + 5; 
-
-			txPktPtr = txPktBuffer;
-			memset(txPktBuffer, 0, sizeof(txPktBuffer));
-			
-			
-			*txPktPtr++ = 0x7E;     // 0 - Start 
-			*txPktPtr++ = 0x00;     // 1 - Len MSB
-			*txPktPtr++ = txPktLen; // 2 - Len LSB
-			*txPktPtr++ = 0x01;     // 3 - API being called - transmit by 16 bit address
-			*txPktPtr++ = 0x00;     // 4 - Frame identifier
-			*txPktPtr++ = 0xFF;     // 5 - MSB of dest address - broadcast 0xFFFF
-			*txPktPtr++ = 0xFF;     // 6 - LSB of dest address - broadcast 0xFFFF
-			*txPktPtr++ = 0x00; 	// 7 - Transmit options
-
-			// Copy over actual packet			
-			for(i=0; i<txPkt.pkt[MRBUS_PKT_LEN]; i++)
-				*txPktPtr++ = txPkt.pkt[i];
-			
-			xbeeChecksum = 0;
-			// Add up checksum
-			for(i=3; i<(txPktPtr - txPktBuffer); i++)
-				xbeeChecksum += txPktBuffer[i];
-
-			xbeeChecksum = 0xFF - xbeeChecksum;
-			*txPktPtr++ = xbeeChecksum;
-			
-			memset(txPktBufferEscaped, 0, sizeof(txPktBufferEscaped));
-			txPktEscapedPtr = txPktBufferEscaped;
-
-			*txPktEscapedPtr++ = txPktBuffer[0];
-			for(i=1; i<(txPktPtr - txPktBuffer); i++)
-			{
-				switch(txPktBuffer[i])
-				{
-					case 0x7E:
-					case 0x7D:
-					case 0x11:
-					case 0x13:
-						*txPktEscapedPtr++ = 0x7D;
-						*txPktEscapedPtr++ = 0x20 ^ txPktBuffer[i];
-						break;
-					
-					default:
-						*txPktEscapedPtr++ = txPktBuffer[i];
-						break;
-				}
-			}
-
-//			*txPktEscapedPtr++ = 0;
-			
-			{
-				char buffer[1024];
-				memset(buffer, 0, sizeof(buffer));
-				for (i = 0; i < txPktEscapedPtr - txPktBufferEscaped; i++)
-				{
-					sprintf(buffer+i*3, "%02X ", txPktBufferEscaped[i]);
-				}			
-				(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] txPkt = [%s]", mrbfsInterfaceDriver->interfaceName, buffer);
-			}
-
-			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface driver [%s] transmitting %d bytes", mrbfsInterfaceDriver->interfaceName, txPktEscapedPtr - txPktBufferEscaped); 
-			nbytes  = write(fd, txPktBufferEscaped, txPktEscapedPtr - txPktBufferEscaped);
-			if (nbytes < 0)
-				resetSerial = 1;
-		}
-
+		if (!processingPacket)
+			resetSerial |= mrbfsXbeeTransmitPending(mrbfsInterfaceDriver, fd);
    }
    
 	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface driver [%s] terminating", mrbfsInterfaceDriver->interfaceName);
-	mrbfsXbeeSerialClose(mrbfsInterfaceDriver, fd);	
-	phtread_exit(NULL);
+	mrbfsSerialClose(mrbfsInterfaceDriver, fd);	
+	pthread_exit(NULL);
 }
 
 
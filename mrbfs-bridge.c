@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <unistd.h>
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-log.h"
+#include "mrbfs-filesys.h"
+#include "mrbfs-bridge.h"
+
+/* Bus bridging
+
+ Each bridge section forwards packets received on one bus out onto another,
+ so one mrbfs can join a wired bus and an XBee bus into one network:
+
+   bridge wired-to-radio
+   {
+      from-bus = 0
+      to-bus = 1
+      source = "0x10-0x2F,0x40"
+      destination = "any"
+      type = "S,A"
+      rate-limit = 20
+   }
+
+ source, destination and type are "any" or a comma separated list of values
+ and ranges.  A single character stands for itself, so type = "S" is the
+ same as type = "0x53".  rate-limit caps packets per second through the rule,
+ with up to a second's worth let through in a burst.  Every matching rule
+ forwards, so both directions take two sections.
+
+ Rules don't chain - a packet forwarded onto bus 1 isn't fed back through
+ the rules for bus 1.  What does loop is a packet coming back to us from
+ the bus it was forwarded onto (another bridge on the same pair of buses,
+ or an interface that hears its own transmissions).  Each bus remembers
+ what was recently forwarded onto it, and anything heard on that bus that
+ matches within bridge-loop-window milliseconds isn't forwarded again (0
+ turns that off).  The table works like the duplicate one in mrbfs-dedup.c,
+ keyed on the packet less its CRC, since the interface sending it
+ regenerates that.
+
+ Forwarding happens in mrbfsPacketReceive on the receiving interface's
+ thread, after duplicates are dropped and before node dispatch, for every
+ packet - including those from nodes mrbfs has no driver for.  The received
+ packet is handed to mrbfsPacketTransmit as is, with only its bus changed
+ for the duration of the call.  Packets whose length byte is out of range
+ or doesn't match what was received are never forwarded.
+
+ /bridge/<rule>/ has forwarded, rateLimited and loopsBlocked counts.
+*/
+
+static uint64_t mrbfsBridgeNowUsec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+// Sets the bits in matchBits for a match list, returns -1 if it doesn't parse
+static int mrbfsBridgeParseMatch(const char* matchStr, UINT32* matchBits)
+{
+	char* list = strdupa(matchStr);
+	char* token;
+
+	memset(matchBits, 0, 8 * sizeof(UINT32));
+
+	if (0 == strcasecmp(matchStr, "any"))
+	{
+		memset(matchBits, 0xFF, 8 * sizeof(UINT32));
+		return(0);
+	}
+
+	for(token = strsep(&list, ","); NULL != token; token = strsep(&list, ","))
+	{
+		long first, last;
+		char* end;
+		int i;
+
+		while(isspace(*token))
+			token++;
+		for(i=strlen(token); i>0 && isspace(token[i-1]); i--)
+			token[i-1] = 0;
+
+		if (0 == *token)
+			continue;
+
+		if (1 == strlen(token) && !isdigit(token[0]))
+			first = last = (UINT8)token[0];
+		else
+		{
+			first = last = strtol(token, &end, 0);
+			if ('-' == *end)
+				last = strtol(end+1, &end, 0);
+			if (0 != *end || first < 0 || last > 255 || first > last)
+				return(-1);
+		}
+
+		for(i=first; i<=last; i++)
+			matchBits[i/32] |= 1u << (i%32);
+	}
+	return(0);
+}
+
+static int mrbfsBridgeMatches(UINT32* matchBits, UINT8 value)
+{
+	return(0 != (matchBits[value/32] & (1u << (value%32))));
+}
+
+static MRBFSFileNode* mrbfsBridgeAddCounter(const char* fileName, const char* rulePath)
+{
+	MRBFSFileNode* fileNode = mrbfsFilesystemAddFile(fileName, FNODE_RO_VALUE_INT, rulePath);
+	if (NULL != fileNode)
+		fileNode->value.valueInt = 0;
+	return(fileNode);
+}
+
+static void mrbfsBridgeCount(UINT32* counter, MRBFSFileNode* fileNode)
+{
+	UINT32 count = __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+	if (NULL == fileNode)
+		return;
+	fileNode->value.valueInt = count;
+	fileNode->updateTime = time(NULL);
+}
+
+void mrbfsBridgeInitialize()
+{
+	int rules = cfg_size(gMrbfsConfig->cfgParms, "bridge");
+	int i;
+
+	gMrbfsConfig->bridgeLoopWindowMs = MAX(0, cfg_getint(gMrbfsConfig->cfgParms, "bridge-loop-window"));
+
+	if (0 == rules)
+		return;
+
+	gMrbfsConfig->bridgeRules = calloc(rules, sizeof(MRBFSBridgeRule));
+	if (NULL == gMrbfsConfig->bridgeRules)
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Calloc() failed on bridge setup, not bridging");
+		return;
+	}
+	mrbfsFilesystemAddFile("bridge", FNODE_DIR, "/");
+
+	for(i=0; i<rules; i++)
+	{
+		cfg_t* cfgBridge = cfg_getnsec(gMrbfsConfig->cfgParms, "bridge", i);
+		MRBFSBridgeRule* rule = &gMrbfsConfig->bridgeRules[gMrbfsConfig->bridgeRuleCount];
+		const char* ruleName = cfg_title(cfgBridge);
+		long fromBus = cfg_getint(cfgBridge, "from-bus");
+		long toBus = cfg_getint(cfgBridge, "to-bus");
+		pthread_mutexattr_t lockAttr;
+		char* rulePath = NULL;
+
+		if (fromBus < 0 || fromBus >= MRBFS_MAX_BUS_NODES || toBus < 0 || toBus >= MRBFS_MAX_BUS_NODES || fromBus == toBus)
+		{
+			mrbfsLogMessage(MRBFS_LOG_ERROR, "Bridge [%s] - from-bus [%ld] and to-bus [%ld] must be different buses, skipping", ruleName, fromBus, toBus);
+			continue;
+		}
+
+		if (0 != mrbfsBridgeParseMatch(cfg_getstr(cfgBridge, "source"), rule->srcMatch)
+			|| 0 != mrbfsBridgeParseMatch(cfg_getstr(cfgBridge, "destination"), rule->destMatch)
+			|| 0 != mrbfsBridgeParseMatch(cfg_getstr(cfgBridge, "type"), rule->typeMatch))
+		{
+			mrbfsLogMessage(MRBFS_LOG_ERROR, "Bridge [%s] - can't make sense of source, destination or type, skipping", ruleName);
+			continue;
+		}
+
+		// Rules are set up before the interfaces, so their buses may not exist yet
+		mrbfsAddBus(fromBus);
+		mrbfsAddBus(toBus);
+
+		rule->ruleName = strdup(ruleName);
+		rule->fromBus = fromBus;
+		rule->toBus = toBus;
+		rule->rateLimit = MAX(0, cfg_getint(cfgBridge, "rate-limit"));
+		rule->tokens = rule->rateLimit;
+		rule->lastRefillUsec = mrbfsBridgeNowUsec();
+
+		pthread_mutexattr_init(&lockAttr);
+		pthread_mutexattr_settype(&lockAttr, PTHREAD_MUTEX_ADAPTIVE_NP);
+		pthread_mutex_init(&rule->rateLock, &lockAttr);
+		pthread_mutexattr_destroy(&lockAttr);
+
+		mrbfsFilesystemAddFile(rule->ruleName, FNODE_DIR, "/bridge");
+		if (asprintf(&rulePath, "/bridge/%s", rule->ruleName) >= 0)
+		{
+			rule->file_forwarded = mrbfsBridgeAddCounter("forwarded", rulePath);
+			rule->file_rateLimited = mrbfsBridgeAddCounter("rateLimited", rulePath);
+			rule->file_loopsBlocked = mrbfsBridgeAddCounter("loopsBlocked", rulePath);
+			free(rulePath);
+		}
+
+		gMrbfsConfig->bridgeRuleCount++;
+		mrbfsLogMessage(MRBFS_LOG_INFO, "Bridge [%s] forwarding bus [%d] to bus [%d]%s", rule->ruleName, rule->fromBus, rule->toBus, rule->rateLimit?", rate limited":"");
+	}
+}
+
+// Hash of the packet less its CRC, which the transmitting interface regenerates
+static uint64_t mrbfsBridgeHash(MRBusPacket* pkt)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	int i, len = MIN(pkt->pkt[MRBUS_PKT_LEN], MRBFS_MAX_PACKET_LEN);
+
+	for(i=0; i<len; i++)
+	{
+		if (MRBUS_PKT_CRC_L == i || MRBUS_PKT_CRC_H == i)
+			continue;
+		hash = (hash ^ pkt->pkt[i]) * 1099511628211ULL;
+	}
+	return(hash);
+}
+
+// Non-zero if the bridge forwarded this packet onto this bus within the loop window
+static int mrbfsBridgeIsEcho(MRBFSBus* bus, uint64_t hash, UINT32 nowMs)
+{
+	uint64_t slotValue = __atomic_load_n(&bus->bridgedSlots[hash & (MRBFS_DEDUP_SLOTS-1)], __ATOMIC_ACQUIRE);
+
+	if (0 == gMrbfsConfig->bridgeLoopWindowMs)
+		return(0);
+
+	return(0 != slotValue
+		&& (UINT32)(hash >> 32) == (UINT32)(slotValue >> 32)
+		&& (UINT32)(nowMs - (UINT32)slotValue) <= gMrbfsConfig->bridgeLoopWindowMs);
+}
+
+static void mrbfsBridgeNoteForwarded(MRBFSBus* bus, uint64_t hash, UINT32 nowMs)
+{
+	uint64_t entry = (hash & 0xFFFFFFFF00000000ULL) | nowMs;
+	__atomic_store_n(&bus->bridgedSlots[hash & (MRBFS_DEDUP_SLOTS-1)], entry, __ATOMIC_RELEASE);
+}
+
+// Token bucket - non-zero if the rule may forward another packet now
+static int mrbfsBridgeRateOk(MRBFSBridgeRule* rule, uint64_t nowUsec)
+{
+	int ok = 0;
+
+	if (0 == rule->rateLimit)
+		return(1);
+
+	pthread_mutex_lock(&rule->rateLock);
+	rule->tokens = MIN((double)rule->rateLimit, rule->tokens + (nowUsec - rule->lastRefillUsec) * rule->rateLimit / 1000000.0);
+	rule->lastRefillUsec = nowUsec;
+	if (rule->tokens >= 1.0)
+	{
+		rule->tokens -= 1.0;
+		ok = 1;
+	}
+	pthread_mutex_unlock(&rule->rateLock);
+	return(ok);
+}
+
+void mrbfsBridgePacket(MRBusPacket* rxPkt)
+{
+	uint64_t hash = 0, nowUsec = 0;
+	UINT32 nowMs = 0;
+	UINT8 rxBus = rxPkt->bus;
+	int i, echo = -1;
+
+	if (0 == gMrbfsConfig->bridgeRuleCount)
+		return;
+
+	// Interfaces only bound rxPkt->len - the length byte is whatever came off the wire, and
+	// mrbfsPacketTransmit trusts it
+	if (rxPkt->pkt[MRBUS_PKT_LEN] > MRBFS_MAX_PACKET_LEN || rxPkt->pkt[MRBUS_PKT_LEN] <= MRBUS_PKT_TYPE || rxPkt->pkt[MRBUS_PKT_LEN] != rxPkt->len)
+	{
+		mrbfsLogMessage(MRBFS_LOG_DEBUG, "Bridge not forwarding malformed packet from bus [%d], length byte %d, received %d bytes", rxBus, rxPkt->pkt[MRBUS_PKT_LEN], rxPkt->len);
+		return;
+	}
+
+	for(i=0; i<gMrbfsConfig->bridgeRuleCount; i++)
+	{
+		MRBFSBridgeRule* rule = &gMrbfsConfig->bridgeRules[i];
+
+		if (rule->fromBus != rxBus
+			|| !mrbfsBridgeMatches(rule->srcMatch, rxPkt->pkt[MRBUS_PKT_SRC])
+			|| !mrbfsBridgeMatches(rule->destMatch, rxPkt->pkt[MRBUS_PKT_DEST])
+			|| !mrbfsBridgeMatches(rule->typeMatch, rxPkt->pkt[MRBUS_PKT_TYPE]))
+			continue;
+
+		// Only work out the hash and time once some rule wants the packet
+		if (-1 == echo)
+		{
+			hash = mrbfsBridgeHash(rxPkt);
+			nowUsec = mrbfsBridgeNowUsec();
+			nowMs = (UINT32)(nowUsec / 1000);
+			echo = mrbfsBridgeIsEcho(gMrbfsConfig->bus[rxBus], hash, nowMs);
+		}
+
+		if (echo)
+		{
+			mrbfsBridgeCount(&rule->loopsBlocked, rule->file_loopsBlocked);
+			mrbfsLogMessage(MRBFS_LOG_DEBUG, "Bridge [%s] not forwarding packet from [%d/0x%02X], it came from the bridge", rule->ruleName, rxBus, rxPkt->pkt[MRBUS_PKT_SRC]);
+			continue;
+		}
+
+		if (!mrbfsBridgeRateOk(rule, nowUsec))
+		{
+			mrbfsBridgeCount(&rule->rateLimited, rule->file_rateLimited);
+			continue;
+		}
+
+		mrbfsLogMessage(MRBFS_LOG_DEBUG, "Bridge [%s] forwarding packet from [%d/0x%02X] to bus [%d]", rule->ruleName, rxBus, rxPkt->pkt[MRBUS_PKT_SRC], rule->toBus);
+		mrbfsBridgeNoteForwarded(gMrbfsConfig->bus[rule->toBus], hash, nowMs);
+		rxPkt->bus = rule->toBus;
+		mrbfsPacketTransmit(rxPkt);
+		rxPkt->bus = rxBus;
+		mrbfsBridgeCount(&rule->forwarded, rule->file_forwarded);
+	}
+}
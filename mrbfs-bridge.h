@@ -0,0 +1,7 @@
+#ifndef _MRBFS_BRIDGE_H
+#define _MRBFS_BRIDGE_H
+
+void mrbfsBridgeInitialize();
+void mrbfsBridgePacket(MRBusPacket* rxPkt);
+
+#endif
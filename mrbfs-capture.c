@@ -0,0 +1,416 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-log.h"
+#include "mrbfs-filesys.h"
+#include "mrbfs-poll.h"
+#include "mrbfs-capture.h"
+#include "mrbfs-shutdown.h"
+
+/* Packet capture
+
+ Every packet received or transmitted on a bus is recorded, with a
+ microsecond timestamp, in pcap format so bus timing can be looked at with
+ tcpdump, tshark, wireshark and friends.  The pktLog files on the
+ interfaces are still there for a quick look.
+
+ Captures are pcap (not pcapng) with link type LINKTYPE_USER0 (147).  Each
+ frame is a 4 byte pseudo-header followed by the raw MRBus packet:
+
+   byte 0   direction, 0 = received, 1 = transmitted
+   byte 1   bus number
+   byte 2   source interface (received packets only)
+   byte 3   reserved, 0
+
+ Recording is cheap for the packet path - packets go into a per-bus ring
+ and nothing else.  Two things read the rings:
+
+  - /busN/capture streams a pcap file of everything from open() on.  Reads
+    block like the watch files do, and a reader that falls a whole ring
+    behind silently skips ahead (pcap has nowhere to say so).
+  - With capture-directory set, a writer thread drains the rings into
+    <capture-directory>/busN.pcap through a stdio buffer, flushing once
+    the bus goes quiet.  At capture-rotate-size megabytes the file becomes
+    busN.pcap.1 (and .1 becomes .2 and so on, keeping capture-keep old
+    files).  Packets the writer falls too far behind on are counted and
+    logged rather than holding up the bus.
+*/
+
+#define MRBFS_CAPTURE_LINKTYPE      147
+#define MRBFS_CAPTURE_SNAPLEN       (4 + MRBFS_MAX_PACKET_LEN)
+#define MRBFS_CAPTURE_FRAME_MAX     (16 + MRBFS_CAPTURE_SNAPLEN)
+#define MRBFS_CAPTURE_WRITE_BATCH   256
+
+typedef struct
+{
+	UINT32 magic;
+	uint16_t versionMajor;
+	uint16_t versionMinor;
+	int32_t thisZone;
+	UINT32 sigFigs;
+	UINT32 snapLen;
+	UINT32 linkType;
+} MRBFSPcapHeader;
+
+static const MRBFSPcapHeader mrbfsPcapHeader =
+{
+	.magic = 0xA1B2C3D4,
+	.versionMajor = 2,
+	.versionMinor = 4,
+	.thisZone = 0,
+	.sigFigs = 0,
+	.snapLen = MRBFS_CAPTURE_SNAPLEN,
+	.linkType = MRBFS_CAPTURE_LINKTYPE,
+};
+
+// Must be called before the filesystem daemonizes, since relative paths are resolved here
+void mrbfsCaptureInitialize()
+{
+	const char* captureDirectory = cfg_getstr(gMrbfsConfig->cfgParms, "capture-directory");
+	char resolvedPath[PATH_MAX];
+
+	gMrbfsConfig->captureDirectory = NULL;
+	gMrbfsConfig->captureRotateBytes = (size_t)MAX(1, cfg_getint(gMrbfsConfig->cfgParms, "capture-rotate-size")) * 1024 * 1024;
+	gMrbfsConfig->captureKeep = MAX(0, cfg_getint(gMrbfsConfig->cfgParms, "capture-keep"));
+
+	if (NULL == captureDirectory || 0 == strlen(captureDirectory))
+	{
+		mrbfsLogMessage(MRBFS_LOG_INFO, "No capture-directory configured, packets only captured to the capture files");
+		return;
+	}
+
+	if ((0 != mkdir(captureDirectory, 0755) && EEXIST != errno) || NULL == realpath(captureDirectory, resolvedPath))
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Capture directory [%s] cannot be created (%s), packet capture files disabled", captureDirectory, strerror(errno));
+		return;
+	}
+
+	gMrbfsConfig->captureDirectory = strdup(resolvedPath);
+	mrbfsLogMessage(MRBFS_LOG_INFO, "Packet captures stored in [%s]", gMrbfsConfig->captureDirectory);
+}
+
+static size_t mrbfsCaptureFrame(MRBFSCaptureRecord* record, UINT8 bus, UINT8* frame)
+{
+	UINT32 frameHeader[4];
+
+	frameHeader[0] = record->tsSec;
+	frameHeader[1] = record->tsUsec;
+	frameHeader[2] = frameHeader[3] = 4 + record->len;
+	memcpy(frame, frameHeader, sizeof(frameHeader));
+
+	frame[16] = record->direction;
+	frame[17] = bus;
+	frame[18] = record->srcInterface;
+	frame[19] = 0;
+	memcpy(frame + 20, record->pkt, record->len);
+	return(20 + record->len);
+}
+
+void mrbfsCapturePacket(UINT8 direction, MRBusPacket* pkt)
+{
+	MRBFSCapture* capture = gMrbfsConfig->busCapture[pkt->bus];
+	MRBFSCaptureRecord* record;
+	struct timespec now;
+	UINT8 len;
+
+	if (NULL == capture)
+		return;
+
+	// Interfaces fill in len on receive, packets built for transmit only have the MRBus length byte
+	len = (MRBFS_CAPTURE_RX == direction) ? pkt->len : pkt->pkt[MRBUS_PKT_LEN];
+	len = MIN(len, MRBFS_MAX_PACKET_LEN);
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	pthread_mutex_lock(&capture->captureLock);
+	record = &capture->records[capture->nextSeq & (MRBFS_CAPTURE_RING_SIZE-1)];
+	record->seq = capture->nextSeq++;
+	record->tsSec = now.tv_sec;
+	record->tsUsec = now.tv_nsec / 1000;
+	record->direction = direction;
+	record->srcInterface = (MRBFS_CAPTURE_RX == direction) ? pkt->srcInterface : 0;
+	record->len = len;
+	memcpy(record->pkt, pkt->pkt, len);
+	pthread_cond_broadcast(&capture->captureCond);
+	pthread_mutex_unlock(&capture->captureLock);
+
+	mrbfsPollNotify(capture->file_capture);
+}
+
+// Moves busN.pcap to busN.pcap.1, .1 to .2 and so on, dropping whatever falls off the end
+static void mrbfsCaptureRotate(MRBFSCapture* capture)
+{
+	char fromPath[PATH_MAX], toPath[PATH_MAX];
+	int i;
+
+	if (0 == gMrbfsConfig->captureKeep)
+	{
+		unlink(capture->filePath);
+		return;
+	}
+
+	for(i=gMrbfsConfig->captureKeep - 1; i>=1; i--)
+	{
+		snprintf(fromPath, sizeof(fromPath), "%s.%d", capture->filePath, i);
+		snprintf(toPath, sizeof(toPath), "%s.%d", capture->filePath, i+1);
+		rename(fromPath, toPath);
+	}
+	snprintf(toPath, sizeof(toPath), "%s.1", capture->filePath);
+	rename(capture->filePath, toPath);
+}
+
+static int mrbfsCaptureFileOpen(MRBFSCapture* capture)
+{
+	if (NULL == capture->filePath)
+	{
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/bus%d.pcap", gMrbfsConfig->captureDirectory, capture->bus);
+		capture->filePath = strdup(path);
+	}
+
+	// Every run starts a new file, the last run's becomes .1
+	mrbfsCaptureRotate(capture);
+
+	if (NULL == (capture->file = fopen(capture->filePath, "w")))
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Capture file [%s] cannot be opened (%s)", capture->filePath, strerror(errno));
+		return(-1);
+	}
+
+	setvbuf(capture->file, NULL, _IOFBF, 65536);
+	fwrite(&mrbfsPcapHeader, sizeof(mrbfsPcapHeader), 1, capture->file);
+	capture->fileBytes = sizeof(mrbfsPcapHeader);
+	return(0);
+}
+
+// Writes out whatever the bus has recorded since last time, returns how many records that was
+static int mrbfsCaptureDrain(MRBFSCapture* capture)
+{
+	MRBFSCaptureRecord batch[MRBFS_CAPTURE_WRITE_BATCH];
+	uint64_t lost = 0;
+	int i, batchUsed = 0;
+
+	pthread_mutex_lock(&capture->captureLock);
+	if (capture->nextSeq > MRBFS_CAPTURE_RING_SIZE && capture->writtenSeq < capture->nextSeq - MRBFS_CAPTURE_RING_SIZE)
+	{
+		lost = (capture->nextSeq - MRBFS_CAPTURE_RING_SIZE) - capture->writtenSeq;
+		capture->dropped += lost;
+		capture->writtenSeq = capture->nextSeq - MRBFS_CAPTURE_RING_SIZE;
+	}
+	for(; batchUsed < MRBFS_CAPTURE_WRITE_BATCH && capture->writtenSeq < capture->nextSeq; capture->writtenSeq++)
+		batch[batchUsed++] = capture->records[capture->writtenSeq & (MRBFS_CAPTURE_RING_SIZE-1)];
+	pthread_mutex_unlock(&capture->captureLock);
+
+	if (0 != lost)
+		mrbfsLogMessage(MRBFS_LOG_WARNING, "Capture writer fell behind on bus %d, %llu packets not written", capture->bus, (unsigned long long)lost);
+
+	if (0 == batchUsed || (NULL == capture->file && 0 != mrbfsCaptureFileOpen(capture)))
+		return(batchUsed);
+
+	for(i=0; i<batchUsed; i++)
+	{
+		UINT8 frame[MRBFS_CAPTURE_FRAME_MAX];
+		size_t frameLen = mrbfsCaptureFrame(&batch[i], capture->bus, frame);
+
+		if (1 != fwrite(frame, frameLen, 1, capture->file))
+		{
+			mrbfsLogMessage(MRBFS_LOG_ERROR, "Capture file [%s] write failed (%s), reopening", capture->filePath, strerror(errno));
+			fclose(capture->file);
+			capture->file = NULL;
+			break;
+		}
+		capture->fileBytes += frameLen;
+
+		if (capture->fileBytes >= gMrbfsConfig->captureRotateBytes)
+		{
+			fclose(capture->file);
+			capture->file = NULL;
+			if (0 != mrbfsCaptureFileOpen(capture))
+				break;
+		}
+	}
+	return(batchUsed);
+}
+
+static void mrbfsCaptureWriter()
+{
+	int busNumber;
+
+	while(!gMrbfsConfig->terminate)
+	{
+		int written = 0;
+
+		for(busNumber=0; busNumber<MRBFS_MAX_BUS_NODES; busNumber++)
+		{
+			if (NULL != gMrbfsConfig->busCapture[busNumber])
+				written += mrbfsCaptureDrain(gMrbfsConfig->busCapture[busNumber]);
+		}
+
+		if (0 != written)
+			continue;
+
+		// Quiet - get what's buffered onto disk, then wait for more
+		for(busNumber=0; busNumber<MRBFS_MAX_BUS_NODES; busNumber++)
+		{
+			if (NULL != gMrbfsConfig->busCapture[busNumber] && NULL != gMrbfsConfig->busCapture[busNumber]->file)
+				fflush(gMrbfsConfig->busCapture[busNumber]->file);
+		}
+		mrbfsShutdownWait(100);
+	}
+
+	// Whatever the interfaces managed to capture before stopping
+	for(busNumber=0; busNumber<MRBFS_MAX_BUS_NODES; busNumber++)
+	{
+		if (NULL != gMrbfsConfig->busCapture[busNumber])
+			while(0 != mrbfsCaptureDrain(gMrbfsConfig->busCapture[busNumber]));
+	}
+
+	for(busNumber=0; busNumber<MRBFS_MAX_BUS_NODES; busNumber++)
+	{
+		if (NULL != gMrbfsConfig->busCapture[busNumber] && NULL != gMrbfsConfig->busCapture[busNumber]->file)
+			fclose(gMrbfsConfig->busCapture[busNumber]->file);
+	}
+	mrbfsLogMessage(MRBFS_LOG_INFO, "Capture writer terminating");
+}
+
+void mrbfsCaptureStart()
+{
+	if (NULL == gMrbfsConfig->captureDirectory)
+		return;
+
+	// Joined at shutdown, once it's closed the files
+	pthread_create(&gMrbfsConfig->captureThread, NULL, (void*)&mrbfsCaptureWriter, NULL);
+	mrbfsLogMessage(MRBFS_LOG_INFO, "Capture writer running");
+}
+
+// Sets up the bus's capture ring and its /busN/capture file
+MRBFSFileNode* mrbfsCaptureAddBus(UINT8 bus, const char* insertionPath)
+{
+	MRBFSCapture* capture = calloc(1, sizeof(MRBFSCapture));
+	pthread_mutexattr_t lockAttr;
+
+	if (NULL == capture)
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Calloc() failed on bus [%d] capture ring, packet capture disabled", bus);
+		return(NULL);
+	}
+
+	capture->bus = bus;
+	pthread_mutexattr_init(&lockAttr);
+	pthread_mutexattr_settype(&lockAttr, PTHREAD_MUTEX_ADAPTIVE_NP);
+	pthread_mutex_init(&capture->captureLock, &lockAttr);
+	pthread_mutexattr_destroy(&lockAttr);
+	pthread_cond_init(&capture->captureCond, NULL);
+
+	capture->file_capture = mrbfsFilesystemAddFile("capture", FNODE_RO_PACKET_STREAM, insertionPath);
+	if (NULL != capture->file_capture)
+		capture->file_capture->nodeLocalStorage = (void*)capture;
+
+	gMrbfsConfig->busCapture[bus] = capture;
+	return(capture->file_capture);
+}
+
+// Readers only see what happens after they open
+MRBFSCaptureCursor* mrbfsCaptureOpen(MRBFSFileNode* mrbfsFileNode)
+{
+	MRBFSCapture* capture = (MRBFSCapture*)mrbfsFileNode->nodeLocalStorage;
+	MRBFSCaptureCursor* cursor;
+
+	if (NULL == capture || NULL == (cursor = calloc(1, sizeof(MRBFSCaptureCursor))))
+		return(NULL);
+
+	cursor->capture = capture;
+	pthread_mutex_lock(&capture->captureLock);
+	cursor->cursor = capture->nextSeq;
+	pthread_mutex_unlock(&capture->captureLock);
+
+	return(cursor);
+}
+
+void mrbfsCaptureRelease(MRBFSCaptureCursor* cursor)
+{
+	free(cursor);
+}
+
+// Non-blocking check for poll()
+int mrbfsCapturePending(MRBFSCaptureCursor* cursor)
+{
+	int pending;
+
+	if (NULL == cursor)
+		return(0);
+	if (!cursor->headerSent)
+		return(1);
+
+	pthread_mutex_lock(&cursor->capture->captureLock);
+	pending = (cursor->cursor < cursor->capture->nextSeq);
+	pthread_mutex_unlock(&cursor->capture->captureLock);
+	return(pending);
+}
+
+int mrbfsCaptureRead(MRBFSCaptureCursor* cursor, char* buf, size_t size)
+{
+	MRBFSCapture* capture;
+	size_t copied = 0;
+	int retval = 0;
+
+	if (NULL == cursor)
+		return(-EBADF);
+	capture = cursor->capture;
+
+	// Frames are never split across reads, so a read has to hold at least one
+	if (size < MAX(sizeof(mrbfsPcapHeader), MRBFS_CAPTURE_FRAME_MAX))
+		return(-EINVAL);
+
+	if (!cursor->headerSent)
+	{
+		memcpy(buf, &mrbfsPcapHeader, sizeof(mrbfsPcapHeader));
+		cursor->headerSent = 1;
+		return(sizeof(mrbfsPcapHeader));
+	}
+
+	pthread_mutex_lock(&capture->captureLock);
+
+	while(1)
+	{
+		if (capture->nextSeq > MRBFS_CAPTURE_RING_SIZE && cursor->cursor < capture->nextSeq - MRBFS_CAPTURE_RING_SIZE)
+			cursor->cursor = capture->nextSeq - MRBFS_CAPTURE_RING_SIZE;
+
+		for(; cursor->cursor < capture->nextSeq && copied + MRBFS_CAPTURE_FRAME_MAX <= size; cursor->cursor++)
+			copied += mrbfsCaptureFrame(&capture->records[cursor->cursor & (MRBFS_CAPTURE_RING_SIZE-1)], capture->bus, (UINT8*)buf + copied);
+
+		if (0 != copied || gMrbfsConfig->terminate)
+			break;
+
+		if (fuse_interrupted())
+		{
+			retval = -EINTR;
+			break;
+		}
+
+		// Wake up periodically to notice interrupts and shutdown
+		{
+			struct timespec waitUntil;
+			clock_gettime(CLOCK_REALTIME, &waitUntil);
+			waitUntil.tv_sec += 1;
+			pthread_cond_timedwait(&capture->captureCond, &capture->captureLock, &waitUntil);
+		}
+	}
+
+	pthread_mutex_unlock(&capture->captureLock);
+
+	if (0 != retval)
+		return(retval);
+	return((int)copied);
+}
@@ -0,0 +1,13 @@
+#ifndef _MRBFS_CAPTURE_H
+#define _MRBFS_CAPTURE_H
+
+void mrbfsCaptureInitialize();
+void mrbfsCaptureStart();
+MRBFSFileNode* mrbfsCaptureAddBus(UINT8 bus, const char* insertionPath);
+void mrbfsCapturePacket(UINT8 direction, MRBusPacket* pkt);
+MRBFSCaptureCursor* mrbfsCaptureOpen(MRBFSFileNode* mrbfsFileNode);
+int mrbfsCapturePending(MRBFSCaptureCursor* cursor);
+int mrbfsCaptureRead(MRBFSCaptureCursor* cursor, char* buf, size_t size);
+void mrbfsCaptureRelease(MRBFSCaptureCursor* cursor);
+
+#endif
@@ -55,14 +55,41 @@ cfg_opt_t clock_opts[] =
 	CFG_END()
 };
 
+cfg_opt_t bus_opts[] =
+{
+	CFG_STR("transmit-policy", "all", CFGF_NONE),
+	CFG_END()
+};
+
+cfg_opt_t bridge_opts[] =
+{
+	CFG_INT("from-bus", 0, CFGF_NONE),
+	CFG_INT("to-bus", 1, CFGF_NONE),
+	CFG_STR("source", "any", CFGF_NONE),
+	CFG_STR("destination", "any", CFGF_NONE),
+	CFG_STR("type", "any", CFGF_NONE),
+	CFG_INT("rate-limit", 0, CFGF_NONE),
+	CFG_END()
+};
+
 cfg_opt_t opts[] =
 {
 	CFG_STR("log-file", "mrbfs.log", CFGF_NONE),
 	CFG_INT("log-level", 1, CFGF_NONE),
 	CFG_STR("module-directory", "modules/", CFGF_NONE),
+	CFG_STR("history-directory", "", CFGF_NONE),
+	CFG_BOOL("kernel-cache", cfg_false, CFGF_NONE),
+	CFG_STR("capture-directory", "", CFGF_NONE),
+	CFG_INT("capture-rotate-size", 64, CFGF_NONE),
+	CFG_INT("capture-keep", 4, CFGF_NONE),
+	CFG_INT("duplicate-window", 100, CFGF_NONE),
+	CFG_INT("bridge-loop-window", 1000, CFGF_NONE),
+	CFG_INT("shutdown-timeout", 2000, CFGF_NONE),
 	CFG_SEC("interface", interface_opts, CFGF_MULTI | CFGF_TITLE),
 	CFG_SEC("node", node_opts, CFGF_MULTI | CFGF_TITLE),	
 	CFG_SEC("clock", clock_opts, CFGF_MULTI | CFGF_TITLE),
+	CFG_SEC("bus", bus_opts, CFGF_MULTI | CFGF_TITLE),
+	CFG_SEC("bridge", bridge_opts, CFGF_MULTI | CFGF_TITLE),
    CFG_END()
 };
 
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <unistd.h>
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-log.h"
+#include "mrbfs-filesys.h"
+#include "mrbfs-dedup.h"
+
+/* Duplicate suppression
+
+ Two interfaces on the same bus number (a CI2 and an XBee for coverage,
+ say) both hand every packet they hear to mrbfsPacketReceive.  Without
+ this, every node would process every packet twice.
+
+ Each bus remembers recent packets in a small direct-mapped table, keyed on
+ a hash of the packet bytes (CRC included).  A packet is dropped if the same
+ bytes arrived from a different interface within duplicate-window
+ milliseconds.  The same packet twice from one interface is left alone -
+ that's the node sending it twice.
+
+ A slot is one 64 bit word, updated with compare-and-swap, so interface
+ threads never wait on each other here:
+
+   bits 63-40  hash tag    bits 39-32  interfaceId    bits 31-0  time, ms
+
+ Two packets landing in the same slot just evict each other, which at worst
+ lets a duplicate through.  /stats/rxPackets and /stats/rxDuplicates count
+ what came in and what was dropped.
+*/
+
+void mrbfsDedupInitialize()
+{
+	gMrbfsConfig->dedupWindowMs = MAX(0, cfg_getint(gMrbfsConfig->cfgParms, "duplicate-window"));
+
+	gMrbfsConfig->file_rxPackets = mrbfsFilesystemAddFile("rxPackets", FNODE_RO_VALUE_INT, "/stats");
+	gMrbfsConfig->file_rxDuplicates = mrbfsFilesystemAddFile("rxDuplicates", FNODE_RO_VALUE_INT, "/stats");
+
+	if (0 == gMrbfsConfig->dedupWindowMs)
+		mrbfsLogMessage(MRBFS_LOG_INFO, "Duplicate packet suppression disabled");
+	else
+		mrbfsLogMessage(MRBFS_LOG_INFO, "Suppressing duplicate packets from other interfaces within %u ms", gMrbfsConfig->dedupWindowMs);
+}
+
+static void mrbfsDedupCount(MRBFSFileNode* fileNode)
+{
+	if (NULL == fileNode)
+		return;
+	__atomic_add_fetch(&fileNode->value.valueInt, 1, __ATOMIC_RELAXED);
+	fileNode->updateTime = time(NULL);
+}
+
+// Returns non-zero if rxPkt is a copy of a packet another interface already delivered
+int mrbfsDedupCheck(MRBFSBus* bus, MRBusPacket* rxPkt)
+{
+	uint64_t hash = 14695981039346656037ULL, entry, slotValue, *slot;
+	struct timespec now;
+	UINT32 nowMs, tag;
+	int i;
+
+	mrbfsDedupCount(gMrbfsConfig->file_rxPackets);
+
+	if (0 == gMrbfsConfig->dedupWindowMs || 0 == rxPkt->srcInterface)
+		return(0);
+
+	for(i=0; i<rxPkt->len && i<MRBFS_MAX_PACKET_LEN; i++)
+		hash = (hash ^ rxPkt->pkt[i]) * 1099511628211ULL;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	nowMs = (UINT32)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+	tag = (hash >> 8) & 0xFFFFFF;
+	entry = ((uint64_t)tag << 40) | ((uint64_t)rxPkt->srcInterface << 32) | nowMs;
+
+	slot = &bus->dedupSlots[hash & (MRBFS_DEDUP_SLOTS-1)];
+	slotValue = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	do
+	{
+		if (0 != slotValue
+			&& tag == (slotValue >> 40)
+			&& rxPkt->srcInterface != ((slotValue >> 32) & 0xFF)
+			&& (UINT32)(nowMs - (UINT32)slotValue) <= gMrbfsConfig->dedupWindowMs)
+		{
+			mrbfsDedupCount(gMrbfsConfig->file_rxDuplicates);
+			return(1);
+		}
+	} while(!__atomic_compare_exchange_n(slot, &slotValue, entry, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	return(0);
+}
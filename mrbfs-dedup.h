@@ -0,0 +1,7 @@
+#ifndef _MRBFS_DEDUP_H
+#define _MRBFS_DEDUP_H
+
+void mrbfsDedupInitialize();
+int mrbfsDedupCheck(MRBFSBus* bus, MRBusPacket* rxPkt);
+
+#endif
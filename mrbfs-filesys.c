@@ -15,6 +15,13 @@
 #include <fuse.h>
 #include "mrbfs.h"
 #include "mrbfs-filesys.h"
+#include "mrbfs-watch.h"
+#include "mrbfs-poll.h"
+#include "mrbfs-seqlock.h"
+#include "mrbfs-query.h"
+#include "mrbfs-capture.h"
+#include "mrbfs-history.h"
+#include "mrbfs-snapshot.h"
 
 /* Filesystem Model 
 
@@ -29,6 +36,15 @@
 /bus0/
 */
 
+// Whether a file type's reads may go through the kernel page cache.  Dynamic files
+// (readbacks, streams) always go straight to us, and so do writable files -
+// what a write puts in the page cache isn't what a later read should return.
+static const UINT8 mrbfsKernelCachePolicy[FNODE_END_OF_LIST] =
+{
+	[FNODE_RO_VALUE_STR]      = 1,
+	[FNODE_RO_VALUE_INT]      = 1,
+};
+
 MRBFSFileNode* mrbfsTraversePath(const char* inputPath, MRBFSFileNode* rootNode, MRBFSFileNode** parentDirectoryNode)
 {
 	char* dirpath = dirname(strdupa(inputPath));
@@ -155,7 +171,7 @@ MRBFSFileNode* mrbfsAddFileNode(const char* insertionPath, MRBFSFileNode* addNod
 	
 	if (NULL == insertionNode || (insertionNode->fileType != FNODE_DIR && insertionNode->fileType != FNODE_DIR_NODE))
 	{
-		mrbfsLogMessage(MRBFS_LOG_ERROR, "Cannot insert node [%s] into [%s]", insertionNode->fileName, insertionPath);
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Cannot insert node [%s] into [%s]", addNode->fileName, insertionPath);
 		return(NULL);
 	}
 
@@ -261,7 +277,7 @@ int mrbfsGetattr(const char *path, struct stat *stbuf)
 		case FNODE_RO_VALUE_INT:
 			stbuf->st_mode = S_IFREG | 0444;
 			stbuf->st_nlink = 1;
-			stbuf->st_size = 1;
+			stbuf->st_size = snprintf(NULL, 0, "%d\n", fileNode->value.valueInt);
 			retval = 0;			
 			break;
 
@@ -282,7 +298,7 @@ int mrbfsGetattr(const char *path, struct stat *stbuf)
 				stbuf->st_mode = S_IFREG | 0444;
 
 			stbuf->st_nlink = 1;
-			stbuf->st_size = 1;
+			stbuf->st_size = snprintf(NULL, 0, "%d\n", fileNode->value.valueInt);
 			retval = 0;			
 			break;
 
@@ -297,6 +313,41 @@ int mrbfsGetattr(const char *path, struct stat *stbuf)
 			stbuf->st_size = 1;
 			retval = 0;			
 			break;
+
+		case FNODE_RO_VALUE_STREAM:
+			stbuf->st_mode = S_IFREG | 0444;
+			stbuf->st_nlink = 1;
+			stbuf->st_size = 0;
+			retval = 0;
+			break;
+
+		case FNODE_RO_PACKET_STREAM:
+			stbuf->st_mode = S_IFREG | 0444;
+			stbuf->st_nlink = 1;
+			stbuf->st_size = 0;
+			retval = 0;
+			break;
+
+		case FNODE_RW_VALUE_QUERY:
+			stbuf->st_mode = S_IFREG | 0666;
+			stbuf->st_nlink = 1;
+			stbuf->st_size = 0;
+			retval = 0;
+			break;
+
+		case FNODE_RW_VALUE_HISTORY:
+			stbuf->st_mode = S_IFREG | 0664;
+			stbuf->st_nlink = 1;
+			stbuf->st_size = 0;
+			retval = 0;
+			break;
+
+		case FNODE_RO_VALUE_SNAPSHOT:
+			stbuf->st_mode = S_IFREG | 0444;
+			stbuf->st_nlink = 1;
+			stbuf->st_size = 0;
+			retval = 0;
+			break;
 					
 		case FNODE_END_OF_LIST:
 			return(retval);
@@ -336,6 +387,7 @@ int mrbfsOpen(const char *path, struct fuse_file_info *fi)
 {
 	int retval = -ENOENT;
 	MRBFSFileNode *parentNode, *fileNode = mrbfsTraversePath(path, gMrbfsConfig->rootNode, &parentNode);
+	MRBFSOpenFile* openFile = NULL;
 
 	if (NULL == fileNode)
 	{
@@ -345,24 +397,162 @@ int mrbfsOpen(const char *path, struct fuse_file_info *fi)
 	mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsOpen(%s) found file", path);
 
 	if ( ((fi->flags & (O_RDONLY|O_WRONLY|O_RDWR)) != O_RDONLY)
+		&& FNODE_RW_VALUE_QUERY != fileNode->fileType
+		&& FNODE_RW_VALUE_HISTORY != fileNode->fileType
 		&& ( (fileNode->fileType != FNODE_RW_VALUE_STR && fileNode->fileType != FNODE_RW_VALUE_INT && fileNode->fileType != FNODE_RW_VALUE_READBACK) || (NULL == fileNode->mrbfsFileNodeWrite)) )
 	{
 		mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsOpen(%s) rejected - not writable node", path);
 		return -EACCES;
 	}
-	mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsOpen(%s) successful", path);
-	fi->direct_io = 1;
+
+	if (NULL == (openFile = calloc(1, sizeof(MRBFSOpenFile))))
+		return -ENOMEM;
+	openFile->fileNode = fileNode;
+
+	// Stream files get a per-open cursor
+	if (FNODE_RO_VALUE_STREAM == fileNode->fileType)
+	{
+		if (NULL == (openFile->watchCursor = mrbfsWatchOpen(fileNode)))
+		{
+			free(openFile);
+			return -ENOENT;
+		}
+		fi->nonseekable = 1;
+	}
+
+	if (FNODE_RO_PACKET_STREAM == fileNode->fileType)
+	{
+		if (NULL == (openFile->captureCursor = mrbfsCaptureOpen(fileNode)))
+		{
+			free(openFile);
+			return -ENOENT;
+		}
+		fi->nonseekable = 1;
+	}
+
+	// Query files hold the request and its answers per open
+	if (FNODE_RW_VALUE_QUERY == fileNode->fileType && NULL == (openFile->query = mrbfsQueryOpen()))
+	{
+		free(openFile);
+		return -ENOMEM;
+	}
+
+	// History files keep their time range and read position per open
+	if (FNODE_RW_VALUE_HISTORY == fileNode->fileType && NULL == (openFile->historyCursor = mrbfsHistoryOpen(fileNode)))
+	{
+		free(openFile);
+		return -ENOMEM;
+	}
+
+	// Snapshot files render their document per open, so concurrent readers don't share one
+	if (FNODE_RO_VALUE_SNAPSHOT == fileNode->fileType && NULL == (openFile->snapshot = mrbfsSnapshotOpen(fileNode)))
+	{
+		free(openFile);
+		return -ENOMEM;
+	}
+
+	mrbfsPollOpen(openFile);
+	fi->fh = (uint64_t)(uintptr_t)openFile;
+
+	// Cached pages can only be dropped at open(), so anyone holding the file open to
+	// re-read it (poll() users, for one) should open with O_DIRECT
+	if (gMrbfsConfig->kernelCache && mrbfsKernelCachePolicy[fileNode->fileType] && !(fi->flags & O_DIRECT))
+	{
+		// Reads are served from the page cache, which is kept across opens for as long as the value doesn't change
+		fi->direct_io = 0;
+		fi->keep_cache = mrbfsPollKeepCache(openFile);
+	}
+	else
+		fi->direct_io = 1;
+
+	mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsOpen(%s) successful, %s", path, fi->direct_io?"direct":(fi->keep_cache?"cached":"cache refreshed"));
 	return 0;
 }
 
+int mrbfsRelease(const char *path, struct fuse_file_info *fi)
+{
+	MRBFSOpenFile* openFile = (MRBFSOpenFile*)(uintptr_t)fi->fh;
+
+	if (NULL == openFile)
+		return(0);
+
+	mrbfsPollRelease(openFile);
+	if (NULL != openFile->watchCursor)
+		mrbfsWatchRelease(openFile->watchCursor);
+	if (NULL != openFile->query)
+		mrbfsQueryRelease(openFile->query);
+	if (NULL != openFile->captureCursor)
+		mrbfsCaptureRelease(openFile->captureCursor);
+	if (NULL != openFile->historyCursor)
+		mrbfsHistoryRelease(openFile->historyCursor);
+	if (NULL != openFile->snapshot)
+		mrbfsSnapshotRelease(openFile->snapshot);
+	free(openFile);
+	fi->fh = 0;
+	return(0);
+}
+
+int mrbfsPollFile(const char *path, struct fuse_file_info *fi, struct fuse_pollhandle *ph, unsigned *reventsp)
+{
+	MRBFSOpenFile* openFile = (MRBFSOpenFile*)(uintptr_t)fi->fh;
+
+	if (NULL == openFile)
+	{
+		if (NULL != ph)
+			fuse_pollhandle_destroy(ph);
+		return -EBADF;
+	}
+
+	return(mrbfsPoll(openFile, ph, reventsp));
+}
+
+// Copies a string value out consistently with the rest of its node's values.  copyBuf starts out
+// as a caller supplied buffer and is malloc'd larger if needed - free it if it changed.
+static size_t mrbfsCopyValueStr(MRBFSFileNode* fileNode, char** copyBuf, size_t* copyBufSz, char* localBuf)
+{
+	size_t len;
+	UINT32 seq = 0;
+
+	for(;;)
+	{
+		if (NULL != fileNode->valueSeq)
+			seq = mrbfsSeqLockReadBegin(fileNode->valueSeq);
+
+		len = strlen(fileNode->value.valueStr);
+		if (len > *copyBufSz)
+		{
+			char* newBuf = malloc(len + 1);
+			if (NULL == newBuf)
+				return(0);
+			if (*copyBuf != localBuf)
+				free(*copyBuf);
+			*copyBuf = newBuf;
+			*copyBufSz = len;
+			// Start over - the value may have changed while we were allocating
+			continue;
+		}
+		memcpy(*copyBuf, fileNode->value.valueStr, len);
+
+		if (NULL == fileNode->valueSeq || !mrbfsSeqLockReadRetry(fileNode->valueSeq, seq))
+			break;
+	}
+
+	return(len);
+}
+
 int mrbfsRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
 {
+	MRBFSOpenFile* openFile = (MRBFSOpenFile*)(uintptr_t)fi->fh;
 	MRBFSFileNode *parentNode, *fileNode = mrbfsTraversePath(path, gMrbfsConfig->rootNode, &parentNode);
 	if (NULL == fileNode)
 	{
 		mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsRead(%s) - path [%s] not valid", path);
 		return(-ENOENT);
 	}
+
+	// Re-reading from the top clears poll() readiness for this handle
+	if (NULL != openFile && 0 == offset)
+		mrbfsPollRead(openFile);
 	
 	switch(fileNode->fileType)
 	{
@@ -375,9 +565,18 @@ int mrbfsRead(const char *path, char *buf, size_t size, off_t offset, struct fus
 			{
 				char intval[32];
 				size_t len=0;
-				
+				int valueInt;
+				UINT32 seq = 0;
+
+				do
+				{
+					if (NULL != fileNode->valueSeq)
+						seq = mrbfsSeqLockReadBegin(fileNode->valueSeq);
+					valueInt = fileNode->value.valueInt;
+				} while (NULL != fileNode->valueSeq && mrbfsSeqLockReadRetry(fileNode->valueSeq, seq));
+
 				memset(intval, 0, sizeof(intval));	
-				sprintf(intval, "%d\n", fileNode->value.valueInt);
+				sprintf(intval, "%d\n", valueInt);
 		
 				len = strlen(intval);
 				mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsRead(%s) - string[%s], len[%d], offset[%d], size[%d]", fileNode->fileName, intval, len, offset, size);
@@ -395,21 +594,26 @@ int mrbfsRead(const char *path, char *buf, size_t size, off_t offset, struct fus
 		case FNODE_RW_VALUE_STR:		
 			{
 				size_t len=0;
-				
-				len = strlen(fileNode->value.valueStr);
+				char localBuf[256];
+				char* valueCopy = localBuf;
+				size_t valueCopySz = sizeof(localBuf) - 1;
+
+				len = mrbfsCopyValueStr(fileNode, &valueCopy, &valueCopySz, localBuf);
+				valueCopy[len] = 0;
 				mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsRead(%s) - string value, len[%d], offset[%d], size[%d]", fileNode->fileName, len, offset, size);
 
 				if (offset < len) 
 				{
 					if (offset + size > len)
 						size = len - offset;
-					memcpy(buf, fileNode->value.valueStr + offset, size);
+					memcpy(buf, valueCopy + offset, size);
 				} else
 					size = 0;		
 
+				mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsRead(%s) - reading str, value [%s]", fileNode->fileName, valueCopy);		
 
-
-				mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsRead(%s) - reading str, value [%s]", fileNode->fileName, fileNode->value.valueStr);		
+				if (valueCopy != localBuf)
+					free(valueCopy);
 			}
 			break;
 
@@ -424,6 +628,33 @@ int mrbfsRead(const char *path, char *buf, size_t size, off_t offset, struct fus
 			else
 				mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsRead(%s) - readback error, size=%d", fileNode->fileName, size);
 			break;
+
+		case FNODE_RO_VALUE_STREAM:
+			// Blocks until there's something to return
+			if (NULL == openFile || NULL == openFile->watchCursor)
+				return(-EBADF);
+			return(mrbfsWatchRead(openFile->watchCursor, buf, size));
+
+		case FNODE_RO_PACKET_STREAM:
+			// Blocks until there's something to return
+			if (NULL == openFile || NULL == openFile->captureCursor)
+				return(-EBADF);
+			return(mrbfsCaptureRead(openFile->captureCursor, buf, size));
+
+		case FNODE_RW_VALUE_QUERY:
+			if (NULL == openFile || NULL == openFile->query)
+				return(-EBADF);
+			return(mrbfsQueryRead(openFile->query, buf, size, offset));
+
+		case FNODE_RW_VALUE_HISTORY:
+			if (NULL == openFile || NULL == openFile->historyCursor)
+				return(-EBADF);
+			return(mrbfsHistoryRead(openFile->historyCursor, buf, size, offset));
+
+		case FNODE_RO_VALUE_SNAPSHOT:
+			if (NULL == openFile || NULL == openFile->snapshot)
+				return(-EBADF);
+			return(mrbfsSnapshotRead(openFile->snapshot, buf, size, offset));
 	}
 	
 	return(size);
@@ -437,6 +668,10 @@ int mrbfsTruncate(const char *path, off_t offset)
 		mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsTruncate(%s) - path [%s] not valid", path);
 		return(-ENOENT);
 	}
+
+	// Query requests and history ranges live with the open file - O_TRUNC has nothing to clear
+	if (FNODE_RW_VALUE_QUERY == fileNode->fileType || FNODE_RW_VALUE_HISTORY == fileNode->fileType)
+		return 0;
 	
 	if (!(fileNode->fileType == FNODE_RW_VALUE_STR || fileNode->fileType == FNODE_RW_VALUE_INT || fileNode->fileType == FNODE_RW_VALUE_READBACK) || (NULL == fileNode->mrbfsFileNodeWrite))
 	{
@@ -455,6 +690,22 @@ int mrbfsWrite(const char *path, const char *buf, size_t size, off_t offset, str
 		mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsWrite(%s) - path [%s] not valid", path);
 		return(-ENOENT);
 	}
+
+	if (FNODE_RW_VALUE_QUERY == fileNode->fileType)
+	{
+		MRBFSOpenFile* openFile = (MRBFSOpenFile*)(uintptr_t)fi->fh;
+		if (NULL == openFile || NULL == openFile->query)
+			return(-EBADF);
+		return(mrbfsQueryWrite(openFile->query, buf, size, offset));
+	}
+
+	if (FNODE_RW_VALUE_HISTORY == fileNode->fileType)
+	{
+		MRBFSOpenFile* openFile = (MRBFSOpenFile*)(uintptr_t)fi->fh;
+		if (NULL == openFile || NULL == openFile->historyCursor)
+			return(-EBADF);
+		return(mrbfsHistoryWrite(openFile->historyCursor, buf, size));
+	}
 	
 	if (!(fileNode->fileType == FNODE_RW_VALUE_STR || fileNode->fileType == FNODE_RW_VALUE_INT || fileNode->fileType == FNODE_RW_VALUE_READBACK) || (NULL == fileNode->mrbfsFileNodeWrite))
 	{
@@ -474,6 +725,7 @@ int mrbfsWrite(const char *path, const char *buf, size_t size, off_t offset, str
 			{
 				fileNode->mrbfsFileNodeWrite(fileNode, buf, size);
 				mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsWrite(%s) - write string[%s], len[%d]", fileNode->fileName, buf, size);
+				mrbfsPollFileChanged(fileNode);
 			}
 			break;
 	}
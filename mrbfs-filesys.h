@@ -4,6 +4,8 @@
 int mrbfsGetattr(const char *path, struct stat *stbuf);
 int mrbfsReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi);
 int mrbfsOpen(const char *path, struct fuse_file_info *fi);
+int mrbfsRelease(const char *path, struct fuse_file_info *fi);
+int mrbfsPollFile(const char *path, struct fuse_file_info *fi, struct fuse_pollhandle *ph, unsigned *reventsp);
 int mrbfsRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
 int mrbfsWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
 int mrbfsTruncate(const char *path, off_t offset);
@@ -0,0 +1,553 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <unistd.h>
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-log.h"
+#include "mrbfs-filesys.h"
+#include "mrbfs-history.h"
+#include "mrbfs-rollup.h"
+#include "mrbfs-options.h"
+#include "mrbfs-watch.h"
+
+/* Sensor value history
+
+ Drivers attach a history series to any of their numeric value files and then
+ publish every sample they decode.  Each series is an append-only file of
+ fixed size MRBFSHistoryRecords behind a small header, mmap'd by the core, so
+ publishing a sample is a couple of stores into shared memory - no syscalls
+ unless the file needs to grow.
+
+ On disk, series live at <history-directory>/busN/0xAA-nodename/<file>.hist
+ In the filesystem, they show up as <node>/history/<file>, which reads back as
+ "time,value" CSV.  Writing "start end" (epoch seconds) to an open history
+ file limits the time range that file handle reads back from offset 0 - open
+ it read/write, write the range, then read from the start.  A negative start
+ is relative to now, so "-3600" gives the last hour.  Writing "0" resets to
+ the full history.  Each handle renders records as it reads through them, so
+ readers don't share or hold a copy of the range.
+
+ Samples are kept in time order (a clock stepping backwards is clamped to the
+ last sample time), so range lookups are a binary search.
+
+ Each series also feeds the minute/hour rollups in mrbfs-rollup.c.  Those
+ don't need a history-directory, so a series may exist with no store behind
+ it.  Nodes opt out with option history = no and/or option rollups = no.
+*/
+
+static int mrbfsHistoryMakePath(const char* path)
+{
+	char* tmpPath = strdupa(path);
+	char* ptr;
+
+	for(ptr = tmpPath + 1; 0 != *ptr; ptr++)
+	{
+		if ('/' != *ptr)
+			continue;
+		*ptr = 0;
+		if (0 != mkdir(tmpPath, 0755) && EEXIST != errno)
+			return(-1);
+		*ptr = '/';
+	}
+	if (0 != mkdir(tmpPath, 0755) && EEXIST != errno)
+		return(-1);
+	return(0);
+}
+
+// Must be called before the filesystem daemonizes, since relative paths are resolved here
+void mrbfsHistoryInitialize()
+{
+	const char* historyDirectory = cfg_getstr(gMrbfsConfig->cfgParms, "history-directory");
+	char resolvedPath[PATH_MAX];
+
+	gMrbfsConfig->historyDirectory = NULL;
+
+	if (NULL == historyDirectory || 0 == strlen(historyDirectory))
+	{
+		mrbfsLogMessage(MRBFS_LOG_INFO, "No history-directory configured, value history disabled");
+		return;
+	}
+
+	if (0 != mrbfsHistoryMakePath(historyDirectory) || NULL == realpath(historyDirectory, resolvedPath))
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "History directory [%s] cannot be created (%s), value history disabled", historyDirectory, strerror(errno));
+		return;
+	}
+
+	gMrbfsConfig->historyDirectory = strdup(resolvedPath);
+	mrbfsLogMessage(MRBFS_LOG_INFO, "Value history stored in [%s]", gMrbfsConfig->historyDirectory);
+}
+
+static MRBFSHistoryRecord* mrbfsHistoryRecords(MRBFSHistorySeries* series)
+{
+	return((MRBFSHistoryRecord*)((char*)series->header + series->header->headerSize));
+}
+
+static int mrbfsHistoryGrow(MRBFSHistorySeries* series)
+{
+	uint64_t newCapacity = series->capacity + MRBFS_HISTORY_GROW_RECORDS;
+	size_t newMapSize = MRBFS_HISTORY_HEADER_SZ + newCapacity * sizeof(MRBFSHistoryRecord);
+	void* newMap;
+
+	if (0 != ftruncate(series->fd, newMapSize))
+		return(-1);
+
+	newMap = mremap(series->header, series->mapSize, newMapSize, MREMAP_MAYMOVE);
+	if (MAP_FAILED == newMap)
+		return(-1);
+
+	series->header = (MRBFSHistoryFileHeader*)newMap;
+	series->mapSize = newMapSize;
+	series->capacity = newCapacity;
+	return(0);
+}
+
+static void mrbfsHistoryPublish(MRBFSHistorySeries* series, double value)
+{
+	MRBFSHistoryRecord* records;
+	struct timespec now;
+	int64_t sampleTime;
+	uint64_t recordNum;
+	int i;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	sampleTime = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+	if (NULL != series->node)
+		mrbfsWatchPublish(series->node->bus, series->node->address, "%s/%s %.10g", series->node->path, series->file_value->fileName, value);
+
+	pthread_mutex_lock(&series->seriesLock);
+
+	if (sampleTime < series->lastSampleTime)
+		sampleTime = series->lastSampleTime;
+	series->lastSampleTime = sampleTime;
+
+	for(i=0; i<MRBFS_ROLLUP_LEVELS; i++)
+	{
+		if (NULL != series->rollup[i].completed)
+			mrbfsRollupAddSample(&series->rollup[i], sampleTime, value);
+	}
+
+	if (NULL == series->header)
+	{
+		pthread_mutex_unlock(&series->seriesLock);
+		return;
+	}
+
+	recordNum = series->header->records;
+	if (recordNum >= series->capacity && 0 != mrbfsHistoryGrow(series))
+	{
+		pthread_mutex_unlock(&series->seriesLock);
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "History [%s] - cannot grow store (%s), dropping sample", series->seriesName, strerror(errno));
+		return;
+	}
+
+	records = mrbfsHistoryRecords(series);
+	if (recordNum > 0 && sampleTime < records[recordNum-1].sampleTime)
+		sampleTime = records[recordNum-1].sampleTime;
+
+	records[recordNum].sampleTime = sampleTime;
+	records[recordNum].value = value;
+
+	// Record first, count second - anything else mapping the file never sees a half written sample
+	__atomic_store_n(&series->header->records, recordNum + 1, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&series->seriesLock);
+}
+
+// First record with sampleTime >= t
+static uint64_t mrbfsHistoryLowerBound(MRBFSHistoryRecord* records, uint64_t count, int64_t t)
+{
+	uint64_t lo = 0, hi = count;
+	while(lo < hi)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (records[mid].sampleTime < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return(lo);
+}
+
+// Starts a read pass over the cursor's range, with whatever records there are right now
+static void mrbfsHistoryRewind(MRBFSHistoryCursor* cursor)
+{
+	MRBFSHistorySeries* series = cursor->series;
+	MRBFSHistoryRecord* records = mrbfsHistoryRecords(series);
+	uint64_t count = series->header->records;
+
+	cursor->nextRecord = 0;
+	cursor->lastRecord = count;
+	if (0 != cursor->rangeStart)
+		cursor->nextRecord = mrbfsHistoryLowerBound(records, count, cursor->rangeStart);
+	if (0 != cursor->rangeEnd)
+		cursor->lastRecord = mrbfsHistoryLowerBound(records, count, cursor->rangeEnd + 1);
+	if (cursor->lastRecord < cursor->nextRecord)
+		cursor->lastRecord = cursor->nextRecord;
+
+	cursor->offset = 0;
+	cursor->lineLen = sprintf(cursor->line, "time,value\n");
+	cursor->linePos = 0;
+}
+
+static int mrbfsHistoryNextLine(MRBFSHistoryCursor* cursor)
+{
+	MRBFSHistoryRecord* record;
+	int64_t sampleTime;
+
+	if (cursor->nextRecord >= cursor->lastRecord)
+		return(0);
+
+	record = mrbfsHistoryRecords(cursor->series) + cursor->nextRecord++;
+	sampleTime = record->sampleTime;
+	cursor->lineLen = snprintf(cursor->line, sizeof(cursor->line), "%" PRId64 ".%03d,%.10g\n", sampleTime / 1000, (int)(sampleTime % 1000), record->value);
+	cursor->lineLen = MIN(cursor->lineLen, (int)sizeof(cursor->line) - 1);
+	cursor->linePos = 0;
+	return(1);
+}
+
+MRBFSHistoryCursor* mrbfsHistoryOpen(MRBFSFileNode* mrbfsFileNode)
+{
+	MRBFSHistorySeries* series = (MRBFSHistorySeries*)mrbfsFileNode->nodeLocalStorage;
+	MRBFSHistoryCursor* cursor;
+
+	if (NULL == series || NULL == (cursor = calloc(1, sizeof(MRBFSHistoryCursor))))
+		return(NULL);
+
+	cursor->series = series;
+	pthread_mutex_lock(&series->seriesLock);
+	mrbfsHistoryRewind(cursor);
+	pthread_mutex_unlock(&series->seriesLock);
+	return(cursor);
+}
+
+// Records are rendered a line at a time as the reader gets to them, so a long history
+// costs a line of memory per open file rather than a copy of the whole range
+int mrbfsHistoryRead(MRBFSHistoryCursor* cursor, char* buf, size_t size, off_t offset)
+{
+	MRBFSHistorySeries* series = cursor->series;
+	size_t copied = 0;
+
+	pthread_mutex_lock(&series->seriesLock);
+
+	// A read pass starts at offset 0, and a reader seeking backwards starts one over
+	if (0 == offset || offset < cursor->offset)
+		mrbfsHistoryRewind(cursor);
+
+	while(copied < size || cursor->offset < offset)
+	{
+		size_t n;
+
+		if (cursor->linePos == cursor->lineLen && !mrbfsHistoryNextLine(cursor))
+			break;
+
+		n = cursor->lineLen - cursor->linePos;
+		if (cursor->offset < offset)
+		{
+			// Seeked forward - render through what it skipped
+			n = MIN(n, offset - cursor->offset);
+		}
+		else
+		{
+			n = MIN(n, size - copied);
+			memcpy(buf + copied, cursor->line + cursor->linePos, n);
+			copied += n;
+		}
+		cursor->linePos += n;
+		cursor->offset += n;
+	}
+
+	pthread_mutex_unlock(&series->seriesLock);
+	return(copied);
+}
+
+int mrbfsHistoryWrite(MRBFSHistoryCursor* cursor, const char* buf, size_t size)
+{
+	MRBFSHistorySeries* series = cursor->series;
+	char rangeStr[64];
+	double rangeStart = 0.0, rangeEnd = 0.0;
+	int fields;
+
+	memset(rangeStr, 0, sizeof(rangeStr));
+	memcpy(rangeStr, buf, MIN(size, sizeof(rangeStr)-1));
+	fields = sscanf(rangeStr, "%lf %lf", &rangeStart, &rangeEnd);
+	if (fields < 1)
+	{
+		mrbfsLogMessage(MRBFS_LOG_WARNING, "History [%s] - range [%s] not understood, expected \"start [end]\"", series->seriesName, rangeStr);
+		return(size);
+	}
+
+	if (rangeStart < 0.0)
+		rangeStart += (double)time(NULL);
+
+	pthread_mutex_lock(&series->seriesLock);
+	cursor->rangeStart = (int64_t)(rangeStart * 1000.0);
+	cursor->rangeEnd = (fields > 1) ? (int64_t)(rangeEnd * 1000.0) : 0;
+	mrbfsHistoryRewind(cursor);
+	mrbfsLogMessage(MRBFS_LOG_DEBUG, "History [%s] - range set to [%" PRId64 " - %" PRId64 "] ms", series->seriesName, cursor->rangeStart, cursor->rangeEnd);
+	pthread_mutex_unlock(&series->seriesLock);
+
+	return(size);
+}
+
+void mrbfsHistoryRelease(MRBFSHistoryCursor* cursor)
+{
+	free(cursor);
+}
+
+static int mrbfsHistoryOpenStore(MRBFSHistorySeries* series, const char* storePath)
+{
+	struct stat info;
+	int fd;
+
+	if (-1 == (fd = open(storePath, O_RDWR | O_CREAT | O_CLOEXEC, 0644)))
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "History [%s] - cannot open [%s] (%s)", series->seriesName, storePath, strerror(errno));
+		return(-1);
+	}
+
+	if (0 != fstat(fd, &info))
+	{
+		close(fd);
+		return(-1);
+	}
+
+	if (info.st_size < MRBFS_HISTORY_HEADER_SZ)
+	{
+		// New store
+		info.st_size = MRBFS_HISTORY_HEADER_SZ + MRBFS_HISTORY_GROW_RECORDS * sizeof(MRBFSHistoryRecord);
+		if (0 != ftruncate(fd, info.st_size))
+		{
+			mrbfsLogMessage(MRBFS_LOG_ERROR, "History [%s] - cannot size [%s] (%s)", series->seriesName, storePath, strerror(errno));
+			close(fd);
+			return(-1);
+		}
+	}
+
+	series->header = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == series->header)
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "History [%s] - cannot map [%s] (%s)", series->seriesName, storePath, strerror(errno));
+		series->header = NULL;
+		close(fd);
+		return(-1);
+	}
+
+	if (0 == series->header->magic)
+	{
+		series->header->magic = MRBFS_HISTORY_MAGIC;
+		series->header->version = MRBFS_HISTORY_FILE_VERSION;
+		series->header->headerSize = MRBFS_HISTORY_HEADER_SZ;
+		series->header->recordSize = sizeof(MRBFSHistoryRecord);
+		series->header->records = 0;
+	}
+	else if (MRBFS_HISTORY_MAGIC != series->header->magic
+		|| MRBFS_HISTORY_FILE_VERSION != series->header->version
+		|| MRBFS_HISTORY_HEADER_SZ != series->header->headerSize
+		|| sizeof(MRBFSHistoryRecord) != series->header->recordSize)
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "History [%s] - [%s] is not a compatible history store, not recording", series->seriesName, storePath);
+		munmap(series->header, info.st_size);
+		series->header = NULL;
+		close(fd);
+		return(-1);
+	}
+
+	series->fd = fd;
+	series->mapSize = info.st_size;
+	series->capacity = (info.st_size - MRBFS_HISTORY_HEADER_SZ) / sizeof(MRBFSHistoryRecord);
+
+	// The count can't be trusted past the end of a file someone truncated underneath us
+	if (series->header->records > series->capacity)
+		series->header->records = series->capacity;
+
+	mrbfsLogMessage(MRBFS_LOG_INFO, "History [%s] - opened [%s] with %" PRIu64 " samples", series->seriesName, storePath, (uint64_t)series->header->records);
+	return(0);
+}
+
+static void mrbfsHistorySeriesFree(MRBFSHistorySeries* series)
+{
+	int i;
+	for(i=0; i<MRBFS_ROLLUP_LEVELS; i++)
+		mrbfsRollupFree(&series->rollup[i]);
+	pthread_mutex_destroy(&series->seriesLock);
+	free(series->seriesName);
+	free(series);
+}
+
+// Whether an earlier series on the node already created <node>/history - the first store to open
+// does, which needn't be the node's first series
+static int mrbfsHistoryDirCreated(MRBFSBusNode* mrbfsNode)
+{
+	MRBFSHistorySeries* series;
+
+	for(series = mrbfsNode->historySeries; NULL != series; series = series->next)
+		if (NULL != series->file_history)
+			return(1);
+	return(0);
+}
+
+// Opens the on-disk store and adds <node>/history/<file>.  A failure here just means no raw history,
+// the series (and its rollups) still work.
+static void mrbfsHistoryAttachStore(MRBFSBusNode* mrbfsNode, MRBFSHistorySeries* series)
+{
+	char* historyPath = NULL;
+	char* storePath = NULL;
+	int ret;
+
+	ret = asprintf(&storePath, "%s%s", gMrbfsConfig->historyDirectory, mrbfsNode->path);
+	if (0 != mrbfsHistoryMakePath(storePath))
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "History [%s] - cannot create [%s] (%s)", series->seriesName, storePath, strerror(errno));
+		free(storePath);
+		return;
+	}
+	free(storePath);
+
+	ret = asprintf(&storePath, "%s%s/%s.hist", gMrbfsConfig->historyDirectory, mrbfsNode->path, series->file_value->fileName);
+	ret = mrbfsHistoryOpenStore(series, storePath);
+	free(storePath);
+	if (0 != ret)
+		return;
+
+	if (!mrbfsHistoryDirCreated(mrbfsNode))
+		mrbfsFilesystemAddFile("history", FNODE_DIR, mrbfsNode->path);
+
+	ret = asprintf(&historyPath, "%s/history", mrbfsNode->path);
+	series->file_history = mrbfsFilesystemAddFile(series->file_value->fileName, FNODE_RW_VALUE_HISTORY, historyPath);
+	free(historyPath);
+	if (NULL != series->file_history)
+		series->file_history->nodeLocalStorage = (void*)series;
+}
+
+// Called by nodes (through mrbfsNode->mrbfsHistoryAttach) for each numeric value file they publish
+MRBFSHistorySeries* mrbfsHistoryAttach(MRBFSBusNode* mrbfsNode, MRBFSFileNode* valueFile)
+{
+	MRBFSHistorySeries* series = NULL;
+	char* rollupPath = NULL;
+	int firstSeries = (NULL == mrbfsNode->historySeries);
+	int recordHistory, recordRollups;
+
+	if (NULL == valueFile)
+		return(NULL);
+
+	if (NULL != valueFile->history)
+		return(valueFile->history);
+
+	recordHistory = (NULL != gMrbfsConfig->historyDirectory) && mrbfsOptionGetBool(&mrbfsNode->nodeOptions, "history", 1);
+	recordRollups = mrbfsOptionGetBool(&mrbfsNode->nodeOptions, "rollups", 1);
+	if (!recordHistory && !recordRollups)
+		return(NULL);
+
+	if (NULL == (series = calloc(1, sizeof(MRBFSHistorySeries))))
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Calloc() failed on history series for node [%s]", mrbfsNode->nodeName);
+		return(NULL);
+	}
+
+	if (asprintf(&series->seriesName, "%s/%s", mrbfsNode->nodeName, valueFile->fileName) < 0)
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Asprintf() failed on history series for node [%s]", mrbfsNode->nodeName);
+		free(series);
+		return(NULL);
+	}
+	series->node = mrbfsNode;
+	series->file_value = valueFile;
+	series->fd = -1;
+
+	{
+		pthread_mutexattr_t lockAttr;
+		pthread_mutexattr_init(&lockAttr);
+		pthread_mutexattr_settype(&lockAttr, PTHREAD_MUTEX_ADAPTIVE_NP);
+		pthread_mutex_init(&series->seriesLock, &lockAttr);
+		pthread_mutexattr_destroy(&lockAttr);
+	}
+
+	if (recordRollups)
+	{
+		if (0 != mrbfsRollupInitialize(&series->rollup[MRBFS_ROLLUP_MINUTE], series, 60 * 1000, MRBFS_ROLLUP_MINUTE_KEEP)
+			|| 0 != mrbfsRollupInitialize(&series->rollup[MRBFS_ROLLUP_HOUR], series, 3600 * 1000, MRBFS_ROLLUP_HOUR_KEEP))
+		{
+			mrbfsLogMessage(MRBFS_LOG_ERROR, "Calloc() failed on rollups for [%s]", series->seriesName);
+			mrbfsHistorySeriesFree(series);
+			return(NULL);
+		}
+
+		if (firstSeries && asprintf(&rollupPath, "%s/rollup", mrbfsNode->path) >= 0)
+		{
+			mrbfsFilesystemAddFile("rollup", FNODE_DIR, mrbfsNode->path);
+			mrbfsFilesystemAddFile("minute", FNODE_DIR, rollupPath);
+			mrbfsFilesystemAddFile("hour", FNODE_DIR, rollupPath);
+			free(rollupPath);
+		}
+
+		if (asprintf(&rollupPath, "%s/rollup/minute", mrbfsNode->path) >= 0)
+		{
+			mrbfsRollupAddFile(&series->rollup[MRBFS_ROLLUP_MINUTE], valueFile->fileName, rollupPath);
+			free(rollupPath);
+		}
+		if (asprintf(&rollupPath, "%s/rollup/hour", mrbfsNode->path) >= 0)
+		{
+			mrbfsRollupAddFile(&series->rollup[MRBFS_ROLLUP_HOUR], valueFile->fileName, rollupPath);
+			free(rollupPath);
+		}
+	}
+
+	if (recordHistory)
+		mrbfsHistoryAttachStore(mrbfsNode, series);
+
+	series->mrbfsHistoryPublish = &mrbfsHistoryPublish;
+	series->next = mrbfsNode->historySeries;
+	mrbfsNode->historySeries = series;
+	valueFile->history = series;
+
+	return(series);
+}
+
+// Flushes and closes every series the node attached
+void mrbfsHistoryNodeRelease(MRBFSBusNode* mrbfsNode)
+{
+	MRBFSHistorySeries* series = mrbfsNode->historySeries;
+
+	while(NULL != series)
+	{
+		MRBFSHistorySeries* nextSeries = series->next;
+
+		if (NULL != series->file_value)
+			series->file_value->history = NULL;
+
+		if (NULL != series->file_history)
+		{
+			series->file_history->mrbfsFileNodeRead = NULL;
+			series->file_history->mrbfsFileNodeWrite = NULL;
+			series->file_history->nodeLocalStorage = NULL;
+		}
+
+		pthread_mutex_lock(&series->seriesLock);
+		if (NULL != series->header)
+		{
+			msync(series->header, series->mapSize, MS_ASYNC);
+			munmap(series->header, series->mapSize);
+			series->header = NULL;
+			close(series->fd);
+		}
+		pthread_mutex_unlock(&series->seriesLock);
+
+		mrbfsHistorySeriesFree(series);
+		series = nextSeries;
+	}
+	mrbfsNode->historySeries = NULL;
+}
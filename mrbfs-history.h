@@ -0,0 +1,12 @@
+#ifndef _MRBFS_HISTORY_H
+#define _MRBFS_HISTORY_H
+
+void mrbfsHistoryInitialize();
+MRBFSHistorySeries* mrbfsHistoryAttach(MRBFSBusNode* mrbfsNode, MRBFSFileNode* valueFile);
+void mrbfsHistoryNodeRelease(MRBFSBusNode* mrbfsNode);
+MRBFSHistoryCursor* mrbfsHistoryOpen(MRBFSFileNode* mrbfsFileNode);
+int mrbfsHistoryRead(MRBFSHistoryCursor* cursor, char* buf, size_t size, off_t offset);
+int mrbfsHistoryWrite(MRBFSHistoryCursor* cursor, const char* buf, size_t size);
+void mrbfsHistoryRelease(MRBFSHistoryCursor* cursor);
+
+#endif
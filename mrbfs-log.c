@@ -88,3 +88,11 @@ void mrbfsSingleInitLogging()
 	
 }
 
+// Gets everything logged so far onto disk, for shutdown
+void mrbfsLogSync()
+{
+	pthread_mutex_lock(&gMrbfsConfig->logLock);
+	fflush(gMrbfsConfig->logFile);
+	fsync(fileno(gMrbfsConfig->logFile));
+	pthread_mutex_unlock(&gMrbfsConfig->logLock);
+}
@@ -2,5 +2,6 @@
 #define _MRBFS_LOG_H
 int mrbfsLogMessage(mrbfsLogLevel logLevel, const char* format, ...);
 void mrbfsSingleInitLogging();
+void mrbfsLogSync();
 #endif
 
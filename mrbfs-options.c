@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include "mrbfs-module.h"
+#include "mrbfs-options.h"
+
+/* Module option tables
+
+ Node and interface options come out of the config file as a flat key/value
+ list.  Drivers look them up by key during init - some of them (node-h2o, for
+ one) do so a hundred times - so the core indexes each list once with an
+ open-addressed FNV-1a hash table.  Lookups mark the option as referenced, so
+ after the driver's init has run the core can warn about keys nobody asked
+ for (usually typos in the config).
+
+ This file is compiled into both the core and the driver modules.
+*/
+
+static UINT32 mrbfsOptionHash(const char* key)
+{
+	UINT32 hash = 2166136261u;
+	while(0 != *key)
+	{
+		hash ^= (UINT8)*key++;
+		hash *= 16777619u;
+	}
+	return(hash);
+}
+
+int mrbfsOptionTableBuild(MRBFSModuleOptionTable* table, const char* ownerName, int (*mrbfsLogMessage)(mrbfsLogLevel, const char*, ...))
+{
+	UINT32 hashSize = 8;
+	int i;
+
+	table->ownerName = ownerName;
+	table->mrbfsLogMessage = mrbfsLogMessage;
+
+	// Keep the table at most half full so probe sequences stay short
+	while(hashSize < 2 * (UINT32)table->options)
+		hashSize <<= 1;
+
+	table->hashMask = hashSize - 1;
+	table->hashIndex = calloc(hashSize, sizeof(int));
+	if (NULL == table->hashIndex)
+	{
+		if (NULL != table->mrbfsLogMessage)
+			(*table->mrbfsLogMessage)(MRBFS_LOG_ERROR, "[%s] - cannot allocate option index", table->ownerName);
+		table->hashMask = 0;
+		return(-1);
+	}
+
+	for(i=0; i<table->options; i++)
+	{
+		MRBFSModuleOption* option = &table->optionList[i];
+		UINT32 slot;
+
+		option->keyHash = mrbfsOptionHash(option->key);
+		option->referenced = 0;
+
+		for(slot = option->keyHash & table->hashMask; 0 != table->hashIndex[slot]; slot = (slot + 1) & table->hashMask)
+		{
+			MRBFSModuleOption* existing = &table->optionList[table->hashIndex[slot] - 1];
+			if (existing->keyHash == option->keyHash && 0 == strcmp(existing->key, option->key))
+				break;
+		}
+
+		if (0 != table->hashIndex[slot])
+		{
+			// Same behaviour as the old linear scan - the first definition wins
+			if (NULL != table->mrbfsLogMessage)
+				(*table->mrbfsLogMessage)(MRBFS_LOG_WARNING, "[%s] - option [%s] defined more than once, ignoring value [%s]", table->ownerName, option->key, option->value);
+			option->referenced = 1;
+			continue;
+		}
+
+		table->hashIndex[slot] = i + 1;
+	}
+
+	return(0);
+}
+
+void mrbfsOptionTableFree(MRBFSModuleOptionTable* table)
+{
+	int i;
+	for(i=0; i<table->options; i++)
+	{
+		free(table->optionList[i].key);
+		free(table->optionList[i].value);
+	}
+	free(table->optionList);
+	free(table->hashIndex);
+	table->optionList = NULL;
+	table->hashIndex = NULL;
+	table->hashMask = 0;
+	table->options = 0;
+}
+
+// Warns about every option the driver never looked up, returns how many there were
+int mrbfsOptionTableReportUnused(MRBFSModuleOptionTable* table)
+{
+	int i, unused=0;
+	for(i=0; i<table->options; i++)
+	{
+		if (table->optionList[i].referenced)
+			continue;
+		unused++;
+		if (NULL != table->mrbfsLogMessage)
+			(*table->mrbfsLogMessage)(MRBFS_LOG_WARNING, "[%s] - option [%s] is not used by this driver, check for typos", table->ownerName, table->optionList[i].key);
+	}
+	return(unused);
+}
+
+MRBFSModuleOption* mrbfsOptionLookup(MRBFSModuleOptionTable* table, const char* key)
+{
+	UINT32 hash, slot;
+
+	if (NULL == table->hashIndex || NULL == key)
+		return(NULL);
+
+	hash = mrbfsOptionHash(key);
+	for(slot = hash & table->hashMask; 0 != table->hashIndex[slot]; slot = (slot + 1) & table->hashMask)
+	{
+		MRBFSModuleOption* option = &table->optionList[table->hashIndex[slot] - 1];
+		if (option->keyHash == hash && 0 == strcmp(option->key, key))
+		{
+			option->referenced = 1;
+			return(option);
+		}
+	}
+	return(NULL);
+}
+
+const char* mrbfsOptionGetStr(MRBFSModuleOptionTable* table, const char* key, const char* defaultValue)
+{
+	MRBFSModuleOption* option = mrbfsOptionLookup(table, key);
+	if (NULL == option)
+		return(defaultValue);
+	return(option->value);
+}
+
+int mrbfsOptionGetInt(MRBFSModuleOptionTable* table, const char* key, int defaultValue, int minValue, int maxValue)
+{
+	MRBFSModuleOption* option = mrbfsOptionLookup(table, key);
+	const char* valueStr;
+	char* endPtr = NULL;
+	long value;
+
+	if (NULL == option)
+		return(defaultValue);
+
+	valueStr = option->value;
+	while(' ' == *valueStr || '\t' == *valueStr)
+		valueStr++;
+
+	errno = 0;
+	if ('0' == valueStr[0] && ('x' == valueStr[1] || 'X' == valueStr[1]))
+		value = strtol(valueStr, &endPtr, 16);
+	else
+		value = strtol(valueStr, &endPtr, 10);
+
+	while(NULL != endPtr && (' ' == *endPtr || '\t' == *endPtr))
+		endPtr++;
+
+	if (0 != errno || endPtr == valueStr || 0 != *endPtr)
+	{
+		if (NULL != table->mrbfsLogMessage)
+			(*table->mrbfsLogMessage)(MRBFS_LOG_WARNING, "[%s] - option [%s] value [%s] is not an integer, using default %d", table->ownerName, key, option->value, defaultValue);
+		return(defaultValue);
+	}
+
+	if (value < minValue || value > maxValue)
+	{
+		if (NULL != table->mrbfsLogMessage)
+			(*table->mrbfsLogMessage)(MRBFS_LOG_WARNING, "[%s] - option [%s] value %ld out of range (%d-%d), using default %d", table->ownerName, key, value, minValue, maxValue, defaultValue);
+		return(defaultValue);
+	}
+
+	return((int)value);
+}
+
+int mrbfsOptionGetBool(MRBFSModuleOptionTable* table, const char* key, int defaultValue)
+{
+	const char* const trueNames[] = { "yes", "on", "true", "1", NULL };
+	const char* const falseNames[] = { "no", "off", "false", "0", NULL };
+	MRBFSModuleOption* option = mrbfsOptionLookup(table, key);
+	int i;
+
+	if (NULL == option)
+		return(defaultValue);
+
+	for(i=0; NULL != trueNames[i]; i++)
+	{
+		if (0 == strcasecmp(option->value, trueNames[i]))
+			return(1);
+		if (0 == strcasecmp(option->value, falseNames[i]))
+			return(0);
+	}
+
+	if (NULL != table->mrbfsLogMessage)
+		(*table->mrbfsLogMessage)(MRBFS_LOG_WARNING, "[%s] - option [%s] value [%s] is not yes/no, using default %s", table->ownerName, key, option->value, defaultValue?"yes":"no");
+	return(defaultValue);
+}
+
+// names is a NULL terminated list of accepted values, returns the index of the match
+int mrbfsOptionGetEnum(MRBFSModuleOptionTable* table, const char* key, const char* const* names, int defaultValue)
+{
+	MRBFSModuleOption* option = mrbfsOptionLookup(table, key);
+	int i;
+
+	if (NULL == option)
+		return(defaultValue);
+
+	for(i=0; NULL != names[i]; i++)
+	{
+		if (0 == strcmp(option->value, names[i]))
+			return(i);
+	}
+
+	if (NULL != table->mrbfsLogMessage)
+		(*table->mrbfsLogMessage)(MRBFS_LOG_WARNING, "[%s] - option [%s] value [%s] not recognized, using default [%s]", table->ownerName, key, option->value, names[defaultValue]);
+	return(defaultValue);
+}
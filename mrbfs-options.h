@@ -0,0 +1,14 @@
+#ifndef _MRBFS_OPTIONS_H
+#define _MRBFS_OPTIONS_H
+
+int mrbfsOptionTableBuild(MRBFSModuleOptionTable* table, const char* ownerName, int (*mrbfsLogMessage)(mrbfsLogLevel, const char*, ...));
+void mrbfsOptionTableFree(MRBFSModuleOptionTable* table);
+int mrbfsOptionTableReportUnused(MRBFSModuleOptionTable* table);
+MRBFSModuleOption* mrbfsOptionLookup(MRBFSModuleOptionTable* table, const char* key);
+
+const char* mrbfsOptionGetStr(MRBFSModuleOptionTable* table, const char* key, const char* defaultValue);
+int mrbfsOptionGetInt(MRBFSModuleOptionTable* table, const char* key, int defaultValue, int minValue, int maxValue);
+int mrbfsOptionGetBool(MRBFSModuleOptionTable* table, const char* key, int defaultValue);
+int mrbfsOptionGetEnum(MRBFSModuleOptionTable* table, const char* key, const char* const* names, int defaultValue);
+
+#endif
@@ -24,15 +24,21 @@ int mrbusPacketQueueDepth(MRBusPacketQueue* q)
 	int depth = 0;
 	
 	pthread_mutex_lock(&q->queueLock);
-	depth = (q->headIdx - q->tailIdx) % MRBUS_PACKET_QUEUE_SIZE; 
+	depth = (q->headIdx + MRBUS_PACKET_QUEUE_SIZE - q->tailIdx) % MRBUS_PACKET_QUEUE_SIZE;
 	pthread_mutex_unlock(&q->queueLock);
 
 	return(depth);
 }
 
-void mrbusPacketQueuePush(MRBusPacketQueue* q, MRBusPacket* txPkt, UINT8 srcAddress)
+// Returns -1 without queueing if the queue is full - wrapping would empty it
+int mrbusPacketQueuePush(MRBusPacketQueue* q, MRBusPacket* txPkt, UINT8 srcAddress)
 {
 	pthread_mutex_lock(&q->queueLock);
+	if ((q->headIdx + 1) % MRBUS_PACKET_QUEUE_SIZE == q->tailIdx)
+	{
+		pthread_mutex_unlock(&q->queueLock);
+		return(-1);
+	}
 
 	memcpy(&q->pkts[q->headIdx], txPkt, sizeof(MRBusPacket));
 	if (0 != srcAddress && 0 == txPkt->pkt[MRBUS_PKT_SRC])
@@ -42,6 +48,7 @@ void mrbusPacketQueuePush(MRBusPacketQueue* q, MRBusPacket* txPkt, UINT8 srcAddr
 		q->headIdx = 0;
 
 	pthread_mutex_unlock(&q->queueLock);
+	return(0);
 }
 
 MRBusPacket* mrbusPacketQueuePop(MRBusPacketQueue* q, MRBusPacket* pkt)
@@ -53,3 +60,18 @@ MRBusPacket* mrbusPacketQueuePop(MRBusPacketQueue* q, MRBusPacket* pkt)
 	return(pkt);
 }
 
+// Copies the packet n places from the front, leaving it queued.  Like Pop, only for the
+// thread taking packets off the queue, and n must be less than the depth.
+MRBusPacket* mrbusPacketQueuePeek(MRBusPacketQueue* q, int n, MRBusPacket* pkt)
+{
+	memcpy(pkt, &q->pkts[(q->tailIdx + n) % MRBUS_PACKET_QUEUE_SIZE], sizeof(MRBusPacket));
+	return(pkt);
+}
+
+// Removes the first n packets once whatever was Peek'd has been dealt with
+void mrbusPacketQueueDiscard(MRBusPacketQueue* q, int n)
+{
+	pthread_mutex_lock(&q->queueLock);
+	q->tailIdx = (q->tailIdx + n) % MRBUS_PACKET_QUEUE_SIZE;
+	pthread_mutex_unlock(&q->queueLock);
+}
@@ -3,7 +3,9 @@
 
 void mrbusPacketQueueInitialize(MRBusPacketQueue* q);
 int mrbusPacketQueueDepth(MRBusPacketQueue* q);
-void mrbusPacketQueuePush(MRBusPacketQueue* q, MRBusPacket* txPkt, UINT8 srcAddress);
+int mrbusPacketQueuePush(MRBusPacketQueue* q, MRBusPacket* txPkt, UINT8 srcAddress);
 MRBusPacket* mrbusPacketQueuePop(MRBusPacketQueue* q, MRBusPacket* pkt);
+MRBusPacket* mrbusPacketQueuePeek(MRBusPacketQueue* q, int n, MRBusPacket* pkt);
+void mrbusPacketQueueDiscard(MRBusPacketQueue* q, int n);
 
 #endif
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-log.h"
+#include "mrbfs-filesys.h"
+#include "mrbfs-watch.h"
+#include "mrbfs-capture.h"
+#include "mrbfs-poll.h"
+
+/* poll() support
+
+ Lets consumers sleep on value files (select/poll/epoll) instead of spinning
+ on mtimes.  A value file polls readable once it has changed since that file
+ handle last read it from offset 0.  Watch files poll readable when they
+ have records waiting.  With kernel-cache turned on, open value files you
+ poll O_DIRECT - otherwise the re-read after a wakeup comes from the page
+ cache, and returns the value from when the file was opened.
+
+ Drivers keep writing their value buffers and updateTime directly, so the
+ core works out what changed.  After every packet a node handles (and every
+ tick that changed its valueGeneration), the node's files that somebody is
+ polling get a cheap fingerprint of value + updateTime.  If it moved, the
+ pending poll handles are notified.  When nobody is polling, this all comes
+ down to checking one counter.
+
+ The same fingerprint drives kernel page caching (see mrbfsOpen).  The
+ high-level FUSE 2.x API doesn't hand us the kernel's node ids to invalidate,
+ so instead an open only keeps cached pages when the value hasn't changed
+ since the open that read them in.
+
+ Everything here is under gMrbfsConfig->pollLock.
+*/
+
+void mrbfsPollInitialize()
+{
+	pthread_mutexattr_t lockAttr;
+
+	pthread_mutexattr_init(&lockAttr);
+	pthread_mutexattr_settype(&lockAttr, PTHREAD_MUTEX_ADAPTIVE_NP);
+	pthread_mutex_init(&gMrbfsConfig->pollLock, &lockAttr);
+	pthread_mutexattr_destroy(&lockAttr);
+
+	gMrbfsConfig->pollersActive = 0;
+}
+
+static UINT32 mrbfsPollFingerprint(MRBFSFileNode* fileNode)
+{
+	UINT32 hash = 2166136261u;
+	const UINT8* ptr;
+	size_t i;
+
+	for(ptr = (const UINT8*)&fileNode->updateTime, i=0; i<sizeof(fileNode->updateTime); i++)
+		hash = (hash ^ ptr[i]) * 16777619u;
+
+	switch(fileNode->fileType)
+	{
+		case FNODE_RO_VALUE_INT:
+		case FNODE_RW_VALUE_INT:
+			for(ptr = (const UINT8*)&fileNode->value.valueInt, i=0; i<sizeof(fileNode->value.valueInt); i++)
+				hash = (hash ^ ptr[i]) * 16777619u;
+			break;
+
+		case FNODE_RO_VALUE_STR:
+		case FNODE_RW_VALUE_STR:
+			for(ptr = (const UINT8*)fileNode->value.valueStr; NULL != ptr && 0 != *ptr; ptr++)
+				hash = (hash ^ *ptr) * 16777619u;
+			break;
+
+		default:
+			break;
+	}
+	return(hash);
+}
+
+// Bumps changeGeneration if the file's value moved since the last look, returns non-zero if it did
+static int mrbfsPollRefresh(MRBFSFileNode* fileNode)
+{
+	UINT32 fingerprint;
+
+	if (FNODE_RO_VALUE_STREAM == fileNode->fileType || FNODE_RO_PACKET_STREAM == fileNode->fileType)
+		return(0);
+
+	fingerprint = mrbfsPollFingerprint(fileNode);
+	if (fingerprint == fileNode->changeFingerprint)
+		return(0);
+
+	fileNode->changeFingerprint = fingerprint;
+	fileNode->changeGeneration++;
+	return(1);
+}
+
+static void mrbfsPollNotifyLocked(MRBFSFileNode* fileNode)
+{
+	MRBFSOpenFile* openFile;
+
+	for(openFile = fileNode->pollers; NULL != openFile; openFile = openFile->nextPoller)
+	{
+		if (NULL == openFile->pollHandle)
+			continue;
+		fuse_notify_poll(openFile->pollHandle);
+		fuse_pollhandle_destroy(openFile->pollHandle);
+		openFile->pollHandle = NULL;
+	}
+}
+
+void mrbfsPollOpen(MRBFSOpenFile* openFile)
+{
+	pthread_mutex_lock(&gMrbfsConfig->pollLock);
+	mrbfsPollRefresh(openFile->fileNode);
+	openFile->changeSeen = openFile->fileNode->changeGeneration;
+	pthread_mutex_unlock(&gMrbfsConfig->pollLock);
+}
+
+// Decides whether an open can keep the kernel's cached pages for the file - only
+// if nothing changed since the open that filled them.  Otherwise the kernel drops them.
+int mrbfsPollKeepCache(MRBFSOpenFile* openFile)
+{
+	MRBFSFileNode* fileNode = openFile->fileNode;
+	int keepCache;
+
+	pthread_mutex_lock(&gMrbfsConfig->pollLock);
+	mrbfsPollRefresh(fileNode);
+	keepCache = fileNode->cacheValid && (fileNode->cacheGeneration == fileNode->changeGeneration);
+	fileNode->cacheGeneration = fileNode->changeGeneration;
+	fileNode->cacheValid = 1;
+	pthread_mutex_unlock(&gMrbfsConfig->pollLock);
+
+	return(keepCache);
+}
+
+// A read from offset 0 is the reader picking up the current value
+void mrbfsPollRead(MRBFSOpenFile* openFile)
+{
+	pthread_mutex_lock(&gMrbfsConfig->pollLock);
+	mrbfsPollRefresh(openFile->fileNode);
+	openFile->changeSeen = openFile->fileNode->changeGeneration;
+	pthread_mutex_unlock(&gMrbfsConfig->pollLock);
+}
+
+void mrbfsPollRelease(MRBFSOpenFile* openFile)
+{
+	MRBFSOpenFile** pollerPtr;
+
+	pthread_mutex_lock(&gMrbfsConfig->pollLock);
+	if (openFile->polling)
+	{
+		for(pollerPtr = &openFile->fileNode->pollers; NULL != *pollerPtr; pollerPtr = &(*pollerPtr)->nextPoller)
+		{
+			if (*pollerPtr == openFile)
+			{
+				*pollerPtr = openFile->nextPoller;
+				break;
+			}
+		}
+		openFile->polling = 0;
+		gMrbfsConfig->pollersActive--;
+	}
+
+	if (NULL != openFile->pollHandle)
+	{
+		fuse_pollhandle_destroy(openFile->pollHandle);
+		openFile->pollHandle = NULL;
+	}
+	pthread_mutex_unlock(&gMrbfsConfig->pollLock);
+}
+
+int mrbfsPoll(MRBFSOpenFile* openFile, struct fuse_pollhandle* ph, unsigned* reventsp)
+{
+	MRBFSFileNode* fileNode = openFile->fileNode;
+	int ready, changed = 0;
+
+	pthread_mutex_lock(&gMrbfsConfig->pollLock);
+
+	// Register before checking, so a change landing in between still finds the handle
+	if (NULL != ph)
+	{
+		// Only the latest handle for a given open file matters
+		if (NULL != openFile->pollHandle)
+			fuse_pollhandle_destroy(openFile->pollHandle);
+		openFile->pollHandle = ph;
+
+		if (!openFile->polling)
+		{
+			openFile->nextPoller = fileNode->pollers;
+			fileNode->pollers = openFile;
+			openFile->polling = 1;
+			gMrbfsConfig->pollersActive++;
+		}
+	}
+
+	if (FNODE_RO_VALUE_STREAM == fileNode->fileType)
+		ready = mrbfsWatchPending(openFile->watchCursor);
+	else if (FNODE_RO_PACKET_STREAM == fileNode->fileType)
+		ready = mrbfsCapturePending(openFile->captureCursor);
+	else
+	{
+		changed = mrbfsPollRefresh(fileNode);
+		ready = (openFile->changeSeen != fileNode->changeGeneration);
+	}
+
+	// Readiness is only this handle's business - it's answered now, so there's nothing to notify it of later
+	if (ready)
+	{
+		*reventsp |= POLLIN | POLLRDNORM;
+		if (NULL != openFile->pollHandle)
+		{
+			fuse_pollhandle_destroy(openFile->pollHandle);
+			openFile->pollHandle = NULL;
+		}
+	}
+
+	// Unless this is the first anyone has seen of a change, the other pollers were told when it happened
+	if (changed)
+		mrbfsPollNotifyLocked(fileNode);
+
+	pthread_mutex_unlock(&gMrbfsConfig->pollLock);
+	return(0);
+}
+
+void mrbfsPollNotify(MRBFSFileNode* fileNode)
+{
+	// Unlocked peek - nearly every file has nobody polling it
+	if (NULL == fileNode || NULL == fileNode->pollers)
+		return;
+
+	pthread_mutex_lock(&gMrbfsConfig->pollLock);
+	mrbfsPollNotifyLocked(fileNode);
+	pthread_mutex_unlock(&gMrbfsConfig->pollLock);
+}
+
+// Re-check one file that may have just been changed (written to, for example)
+void mrbfsPollFileChanged(MRBFSFileNode* fileNode)
+{
+	if (NULL == fileNode || NULL == fileNode->pollers)
+		return;
+
+	pthread_mutex_lock(&gMrbfsConfig->pollLock);
+	if (mrbfsPollRefresh(fileNode))
+		mrbfsPollNotifyLocked(fileNode);
+	pthread_mutex_unlock(&gMrbfsConfig->pollLock);
+}
+
+static void mrbfsPollCheckTree(MRBFSFileNode* dirNode)
+{
+	MRBFSFileNode* fileNode;
+
+	for(fileNode = dirNode->childPtr; NULL != fileNode; fileNode = fileNode->siblingPtr)
+	{
+		if (FNODE_DIR == fileNode->fileType || FNODE_DIR_NODE == fileNode->fileType)
+			mrbfsPollCheckTree(fileNode);
+		else if (NULL != fileNode->pollers && mrbfsPollRefresh(fileNode))
+			mrbfsPollNotifyLocked(fileNode);
+	}
+}
+
+// Called by the core after a node may have changed any of its values
+void mrbfsPollNodeChanged(MRBFSBusNode* mrbfsNode)
+{
+	if (0 == gMrbfsConfig->pollersActive || NULL == mrbfsNode->baseFileNode)
+		return;
+
+	pthread_mutex_lock(&gMrbfsConfig->pollLock);
+	mrbfsPollCheckTree(mrbfsNode->baseFileNode);
+	pthread_mutex_unlock(&gMrbfsConfig->pollLock);
+}
@@ -0,0 +1,14 @@
+#ifndef _MRBFS_POLL_H
+#define _MRBFS_POLL_H
+
+void mrbfsPollInitialize();
+void mrbfsPollOpen(MRBFSOpenFile* openFile);
+int mrbfsPollKeepCache(MRBFSOpenFile* openFile);
+void mrbfsPollRead(MRBFSOpenFile* openFile);
+void mrbfsPollRelease(MRBFSOpenFile* openFile);
+int mrbfsPoll(MRBFSOpenFile* openFile, struct fuse_pollhandle* ph, unsigned* reventsp);
+void mrbfsPollNotify(MRBFSFileNode* fileNode);
+void mrbfsPollFileChanged(MRBFSFileNode* fileNode);
+void mrbfsPollNodeChanged(MRBFSBusNode* mrbfsNode);
+
+#endif
@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-log.h"
+#include "mrbfs-filesys.h"
+#include "mrbfs-seqlock.h"
+#include "mrbfs-query.h"
+
+/* Batch queries
+
+ /query lets a collector fetch many values in one round trip instead of an
+ open/read/close per file.  Write a list of paths, one per line, then read
+ the answers back from offset 0 on the same file handle:
+
+   /bus0/0x10-shed/temperature
+   /bus0/0x20-yard/input?
+
+ comes back as
+
+   /bus0/0x10-shed/temperature	41.2 F
+   /bus0/0x20-yard/input0	1
+   /bus0/0x20-yard/input1	0
+
+ Lines are fnmatch() patterns (so '*' stops at '/'), blank lines and lines
+ starting with '#' are skipped.  Only value files are answered - readbacks
+ and streams never match.  A pattern that matches nothing comes back as the
+ pattern with "!ENOENT" as its value.  Values are returned on one line, with
+ trailing newlines dropped and embedded ones turned into spaces.
+
+ The request stays with the file handle, so every read from offset 0 runs it
+ again against current values.  A write at offset 0 starts a new request.
+
+ All of the answers come from one instant.  Values are collected without
+ waiting on any node's seqlock, noting each node's sequence on the way.  If
+ any node was being updated, or updated since, the whole pass is thrown out
+ and run again.  Should the bus be too busy for that to ever work out, the
+ last pass waits on each node in turn instead, so every value is at least
+ consistent with the rest of its own node.
+*/
+
+#define MRBFS_QUERY_MAX_REQUEST  65536
+#define MRBFS_QUERY_ATTEMPTS     8
+
+typedef struct
+{
+	MRBFSSeqLock* seqLock;
+	UINT32 seq;
+} MRBFSQuerySeq;
+
+typedef struct
+{
+	MRBFSQuery* query;
+	MRBFSQuerySeq* seqs;
+	int seqsUsed;
+	int seqsSz;
+	UINT8 torn;
+	UINT8 waitForWriters;
+} MRBFSQueryPass;
+
+static int mrbfsQueryAppend(MRBFSQuery* query, const char* fmt, ...)
+{
+	va_list args;
+	int needed;
+
+	while(1)
+	{
+		va_start(args, fmt);
+		needed = vsnprintf(query->response + query->responseLen, query->responseSz - query->responseLen, fmt, args);
+		va_end(args);
+
+		if (needed < 0)
+			return(-1);
+
+		if (query->responseLen + needed < query->responseSz)
+		{
+			query->responseLen += needed;
+			return(0);
+		}
+
+		{
+			size_t newSz = MAX(query->responseSz * 2, query->responseLen + needed + 256);
+			char* newBuf = realloc(query->response, newSz);
+			if (NULL == newBuf)
+				return(-1);
+			query->response = newBuf;
+			query->responseSz = newSz;
+		}
+	}
+}
+
+// Notes the node's sequence the first time one of its values is read in this pass
+static void mrbfsQueryNoteSeq(MRBFSQueryPass* pass, MRBFSSeqLock* seqLock)
+{
+	int i, busy = 0;
+
+	for(i=0; i<pass->seqsUsed; i++)
+	{
+		if (pass->seqs[i].seqLock == seqLock)
+			return;
+	}
+
+	if (pass->seqsUsed == pass->seqsSz)
+	{
+		int newSz = MAX(pass->seqsSz * 2, 16);
+		MRBFSQuerySeq* newSeqs = realloc(pass->seqs, newSz * sizeof(MRBFSQuerySeq));
+		if (NULL == newSeqs)
+		{
+			pass->torn = 1;
+			return;
+		}
+		pass->seqs = newSeqs;
+		pass->seqsSz = newSz;
+	}
+
+	pass->seqs[pass->seqsUsed].seqLock = seqLock;
+	pass->seqs[pass->seqsUsed].seq = mrbfsSeqLockReadPeek(seqLock, &busy);
+	pass->seqsUsed++;
+	if (busy)
+		pass->torn = 1;
+}
+
+static void mrbfsQueryAppendValue(MRBFSQueryPass* pass, MRBFSFileNode* fileNode, const char* path)
+{
+	MRBFSQuery* query = pass->query;
+	size_t mark = query->responseLen;
+	UINT32 seq = 0;
+
+	if (NULL != fileNode->valueSeq && !pass->waitForWriters)
+		mrbfsQueryNoteSeq(pass, fileNode->valueSeq);
+
+	do
+	{
+		query->responseLen = mark;
+		if (NULL != fileNode->valueSeq && pass->waitForWriters)
+			seq = mrbfsSeqLockReadBegin(fileNode->valueSeq);
+
+		mrbfsQueryAppend(query, "%s\t", path);
+		if (FNODE_RO_VALUE_INT == fileNode->fileType || FNODE_RW_VALUE_INT == fileNode->fileType)
+			mrbfsQueryAppend(query, "%d", fileNode->value.valueInt);
+		else if (NULL != fileNode->value.valueStr)
+		{
+			size_t valueStart = query->responseLen, i;
+			mrbfsQueryAppend(query, "%s", fileNode->value.valueStr);
+
+			while(query->responseLen > valueStart && NULL != strchr("\r\n ", query->response[query->responseLen - 1]))
+				query->responseLen--;
+			for(i=valueStart; i<query->responseLen; i++)
+			{
+				if ('\n' == query->response[i] || '\r' == query->response[i])
+					query->response[i] = ' ';
+			}
+		}
+		mrbfsQueryAppend(query, "\n");
+	} while (NULL != fileNode->valueSeq && pass->waitForWriters && mrbfsSeqLockReadRetry(fileNode->valueSeq, seq));
+}
+
+// Answers every value file under dirNode matching pattern, returns how many did
+static int mrbfsQueryMatchTree(MRBFSQueryPass* pass, MRBFSFileNode* dirNode, char* path, size_t pathLen, const char* pattern)
+{
+	MRBFSFileNode* fileNode;
+	int matches = 0;
+
+	for(fileNode = dirNode->childPtr; NULL != fileNode; fileNode = fileNode->siblingPtr)
+	{
+		size_t nameLen = strlen(fileNode->fileName);
+
+		if (pathLen + 1 + nameLen >= PATH_MAX)
+			continue;
+		path[pathLen] = '/';
+		memcpy(path + pathLen + 1, fileNode->fileName, nameLen + 1);
+
+		switch(fileNode->fileType)
+		{
+			case FNODE_DIR:
+			case FNODE_DIR_NODE:
+				matches += mrbfsQueryMatchTree(pass, fileNode, path, pathLen + 1 + nameLen, pattern);
+				break;
+
+			case FNODE_RO_VALUE_STR:
+			case FNODE_RW_VALUE_STR:
+			case FNODE_RO_VALUE_INT:
+			case FNODE_RW_VALUE_INT:
+				if (0 == fnmatch(pattern, path, FNM_PATHNAME))
+				{
+					mrbfsQueryAppendValue(pass, fileNode, path);
+					matches++;
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+	path[pathLen] = 0;
+	return(matches);
+}
+
+static void mrbfsQueryRunPass(MRBFSQueryPass* pass)
+{
+	MRBFSQuery* query = pass->query;
+	char path[PATH_MAX];
+	char* request, *line;
+	int i;
+
+	query->responseLen = 0;
+	pass->seqsUsed = 0;
+	pass->torn = 0;
+
+	if (0 == query->requestLen)
+		return;
+	request = strndupa(query->request, query->requestLen);
+
+	pthread_mutex_lock(&gMrbfsConfig->fsLock);
+	for(line = strsep(&request, "\n"); NULL != line; line = strsep(&request, "\n"))
+	{
+		char* pattern = line;
+		size_t patternLen;
+
+		while(' ' == *pattern || '\t' == *pattern)
+			pattern++;
+		patternLen = strlen(pattern);
+		while(patternLen > 0 && NULL != strchr("\r\t ", pattern[patternLen - 1]))
+			pattern[--patternLen] = 0;
+
+		if (0 == patternLen || '#' == pattern[0])
+			continue;
+
+		// Relative patterns are taken from the root
+		if ('/' != pattern[0])
+		{
+			char* rootedPattern = alloca(patternLen + 2);
+			rootedPattern[0] = '/';
+			memcpy(rootedPattern + 1, pattern, patternLen + 1);
+			pattern = rootedPattern;
+		}
+
+		path[0] = 0;
+		if (0 == mrbfsQueryMatchTree(pass, gMrbfsConfig->rootNode, path, 0, pattern))
+			mrbfsQueryAppend(query, "%s\t!ENOENT\n", pattern);
+	}
+	pthread_mutex_unlock(&gMrbfsConfig->fsLock);
+
+	// Nodes updated since their first value was read invalidate the pass
+	for(i=0; !pass->torn && i<pass->seqsUsed; i++)
+	{
+		if (mrbfsSeqLockReadRetry(pass->seqs[i].seqLock, pass->seqs[i].seq))
+			pass->torn = 1;
+	}
+}
+
+static void mrbfsQueryRun(MRBFSQuery* query)
+{
+	MRBFSQueryPass pass;
+	int attempt;
+
+	memset(&pass, 0, sizeof(pass));
+	pass.query = query;
+
+	for(attempt=0; attempt<MRBFS_QUERY_ATTEMPTS; attempt++)
+	{
+		mrbfsQueryRunPass(&pass);
+		if (!pass.torn)
+			break;
+	}
+
+	if (pass.torn)
+	{
+		mrbfsLogMessage(MRBFS_LOG_DEBUG, "Query couldn't get a consistent pass in %d attempts, settling for per-node consistency", MRBFS_QUERY_ATTEMPTS);
+		pass.waitForWriters = 1;
+		mrbfsQueryRunPass(&pass);
+	}
+
+	free(pass.seqs);
+}
+
+MRBFSQuery* mrbfsQueryOpen()
+{
+	return(calloc(1, sizeof(MRBFSQuery)));
+}
+
+MRBFSFileNode* mrbfsQueryAddFile(const char* insertionPath)
+{
+	return(mrbfsFilesystemAddFile("query", FNODE_RW_VALUE_QUERY, insertionPath));
+}
+
+int mrbfsQueryWrite(MRBFSQuery* query, const char* buf, size_t size, off_t offset)
+{
+	size_t newLen;
+
+	// Writing from the top replaces the request, anything else appends to it
+	if (0 == offset)
+		query->requestLen = 0;
+	else if (offset != query->requestLen)
+		return(-EINVAL);
+
+	newLen = query->requestLen + size;
+	if (newLen > MRBFS_QUERY_MAX_REQUEST)
+		return(-EFBIG);
+
+	if (newLen > query->requestSz)
+	{
+		size_t newSz = MAX(query->requestSz * 2, newLen);
+		char* newBuf = realloc(query->request, newSz);
+		if (NULL == newBuf)
+			return(-ENOMEM);
+		query->request = newBuf;
+		query->requestSz = newSz;
+	}
+
+	memcpy(query->request + query->requestLen, buf, size);
+	query->requestLen = newLen;
+	return(size);
+}
+
+int mrbfsQueryRead(MRBFSQuery* query, char* buf, size_t size, off_t offset)
+{
+	// A read pass starts at offset 0 - answer the request then, and serve the rest of the pass from the copy
+	if (0 == offset || NULL == query->response)
+		mrbfsQueryRun(query);
+
+	if (NULL != query->response && offset < query->responseLen)
+	{
+		if (offset + size > query->responseLen)
+			size = query->responseLen - offset;
+		memcpy(buf, query->response + offset, size);
+	} else
+		size = 0;
+
+	return(size);
+}
+
+void mrbfsQueryRelease(MRBFSQuery* query)
+{
+	free(query->request);
+	free(query->response);
+	free(query);
+}
@@ -0,0 +1,10 @@
+#ifndef _MRBFS_QUERY_H
+#define _MRBFS_QUERY_H
+
+MRBFSFileNode* mrbfsQueryAddFile(const char* insertionPath);
+MRBFSQuery* mrbfsQueryOpen();
+int mrbfsQueryWrite(MRBFSQuery* query, const char* buf, size_t size, off_t offset);
+int mrbfsQueryRead(MRBFSQuery* query, char* buf, size_t size, off_t offset);
+void mrbfsQueryRelease(MRBFSQuery* query);
+
+#endif
@@ -0,0 +1,163 @@
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-log.h"
+#include "mrbfs-registry.h"
+
+/* Node driver module registry
+
+ Every node stanza in the config names a driver module, and a layout will
+ typically have dozens of nodes sharing a handful of drivers.  The registry
+ keeps one entry per module path, so each module is only stat'ed, dlopen'ed
+ and symbol-resolved once.  Nodes hold a reference to the entry and call
+ through its (const) driver entry points.  When the last node using a module
+ releases it, the module is dlclose'd.
+*/
+
+void mrbfsNodeModuleRegistryInitialize()
+{
+	pthread_mutexattr_t lockAttr;
+
+	pthread_mutexattr_init(&lockAttr);
+	pthread_mutexattr_settype(&lockAttr, PTHREAD_MUTEX_ADAPTIVE_NP);
+	pthread_mutex_init(&gMrbfsConfig->moduleLock, &lockAttr);
+	pthread_mutexattr_destroy(&lockAttr);
+
+	gMrbfsConfig->nodeModules = NULL;
+}
+
+static MRBFSNodeModule* mrbfsNodeModuleLoad(const char* modulePath)
+{
+	struct stat info;
+	void* moduleHandle = NULL;
+	int (*mrbfsNodeDriverVersionCheck)(int);
+	MRBFSNodeModule* nodeModule = NULL;
+
+	// First, test if the driver module exists
+	if (0 != stat(modulePath, &info))
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Module [%s] not found", modulePath);
+		return(NULL);
+	}
+
+	// Test to make sure the dynamic linker can open it
+	if (NULL == (moduleHandle = dlopen(modulePath, RTLD_LAZY)))
+	{
+		const char* err = dlerror();
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Module [%s] failed dlopen [%s]", modulePath, NULL!=err?err:"");
+		return(NULL);
+	}
+
+	// Now do some cursory version checks
+	mrbfsNodeDriverVersionCheck = dlsym(moduleHandle, "mrbfsNodeDriverVersionCheck");
+	if(NULL == mrbfsNodeDriverVersionCheck || !(*mrbfsNodeDriverVersionCheck)(MRBFS_NODE_DRIVER_VERSION))
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Module [%s] version check failed", modulePath);
+		dlclose(moduleHandle);
+		return(NULL);
+	}
+
+	if (NULL == (nodeModule = calloc(1, sizeof(MRBFSNodeModule))))
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Calloc() failed on allocating module [%s]", modulePath);
+		dlclose(moduleHandle);
+		return(NULL);
+	}
+
+	nodeModule->modulePath = strdup(modulePath);
+	nodeModule->moduleHandle = moduleHandle;
+	nodeModule->refCount = 0;
+	nodeModule->driver.mrbfsNodeInit = dlsym(moduleHandle, "mrbfsNodeInit");
+	nodeModule->driver.mrbfsNodeDestroy = dlsym(moduleHandle, "mrbfsNodeDestroy");
+	nodeModule->driver.mrbfsNodeRxPacket = dlsym(moduleHandle, "mrbfsNodeRxPacket");
+	nodeModule->driver.mrbfsNodeTick = dlsym(moduleHandle, "mrbfsNodeTick");
+
+	if (NULL == nodeModule->driver.mrbfsNodeInit)
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Module [%s] doesn't have an init function", modulePath);
+		dlclose(moduleHandle);
+		free(nodeModule->modulePath);
+		free(nodeModule);
+		return(NULL);
+	}
+
+	mrbfsLogMessage(MRBFS_LOG_DEBUG, "Module [%s] - dynamic library sanity checks pass", modulePath);
+	return(nodeModule);
+}
+
+// Returns the registry entry for modulePath, loading it on first use.  Every
+// successful acquire must be balanced with a mrbfsNodeModuleRelease().
+MRBFSNodeModule* mrbfsNodeModuleAcquire(const char* modulePath)
+{
+	MRBFSNodeModule* nodeModule = NULL;
+
+	pthread_mutex_lock(&gMrbfsConfig->moduleLock);
+
+	for(nodeModule = gMrbfsConfig->nodeModules; NULL != nodeModule; nodeModule = nodeModule->next)
+	{
+		if (0 == strcmp(nodeModule->modulePath, modulePath))
+			break;
+	}
+
+	if (NULL == nodeModule)
+	{
+		mrbfsLogMessage(MRBFS_LOG_INFO, "Module [%s] - loading", modulePath);
+		nodeModule = mrbfsNodeModuleLoad(modulePath);
+		if (NULL != nodeModule)
+		{
+			nodeModule->next = gMrbfsConfig->nodeModules;
+			gMrbfsConfig->nodeModules = nodeModule;
+		}
+	}
+
+	if (NULL != nodeModule)
+	{
+		nodeModule->refCount++;
+		mrbfsLogMessage(MRBFS_LOG_DEBUG, "Module [%s] - acquired, %d users", modulePath, nodeModule->refCount);
+	}
+
+	pthread_mutex_unlock(&gMrbfsConfig->moduleLock);
+	return(nodeModule);
+}
+
+void mrbfsNodeModuleRelease(MRBFSNodeModule* nodeModule)
+{
+	MRBFSNodeModule** modulePtr;
+
+	if (NULL == nodeModule)
+		return;
+
+	pthread_mutex_lock(&gMrbfsConfig->moduleLock);
+
+	if (--nodeModule->refCount > 0)
+	{
+		mrbfsLogMessage(MRBFS_LOG_DEBUG, "Module [%s] - released, %d users", nodeModule->modulePath, nodeModule->refCount);
+		pthread_mutex_unlock(&gMrbfsConfig->moduleLock);
+		return;
+	}
+
+	// Last user is gone, unlink it from the registry and unload
+	for(modulePtr = &gMrbfsConfig->nodeModules; NULL != *modulePtr; modulePtr = &(*modulePtr)->next)
+	{
+		if (*modulePtr == nodeModule)
+		{
+			*modulePtr = nodeModule->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&gMrbfsConfig->moduleLock);
+
+	mrbfsLogMessage(MRBFS_LOG_INFO, "Module [%s] - no users left, unloading", nodeModule->modulePath);
+	dlclose(nodeModule->moduleHandle);
+	free(nodeModule->modulePath);
+	free(nodeModule);
+}
@@ -0,0 +1,8 @@
+#ifndef _MRBFS_REGISTRY_H
+#define _MRBFS_REGISTRY_H
+
+void mrbfsNodeModuleRegistryInitialize();
+MRBFSNodeModule* mrbfsNodeModuleAcquire(const char* modulePath);
+void mrbfsNodeModuleRelease(MRBFSNodeModule* nodeModule);
+
+#endif
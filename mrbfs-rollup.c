@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-log.h"
+#include "mrbfs-filesys.h"
+#include "mrbfs-rollup.h"
+
+/* Value rollups
+
+ Every history series also keeps min/max/mean/count over tumbling minute and
+ hour windows.  Windows are aligned to the epoch (so minute windows start on
+ the wall clock minute), and each sample only touches the open window -
+ when a sample lands past the end of it, the open window is closed into a
+ small ring and a new one started.  Nothing ever rescans raw samples.
+
+ Windows with no samples are simply absent.  The rollups are in memory only
+ and start empty on each mount.
+
+ They show up as <node>/rollup/minute/<file> and <node>/rollup/hour/<file>,
+ which read back as CSV of the retained closed windows followed by the
+ window still in progress.
+
+ All of this runs under the owning series' seriesLock.
+*/
+
+int mrbfsRollupInitialize(MRBFSRollup* rollup, struct MRBFSHistorySeries* series, int64_t windowMs, int keepWindows)
+{
+	memset(rollup, 0, sizeof(MRBFSRollup));
+	rollup->series = series;
+	rollup->windowMs = windowMs;
+	rollup->completed = calloc(keepWindows, sizeof(MRBFSRollupWindow));
+	if (NULL == rollup->completed)
+		return(-1);
+	rollup->completedSz = keepWindows;
+	return(0);
+}
+
+void mrbfsRollupFree(MRBFSRollup* rollup)
+{
+	if (NULL != rollup->file_rollup)
+	{
+		rollup->file_rollup->mrbfsFileNodeRead = NULL;
+		rollup->file_rollup->nodeLocalStorage = NULL;
+	}
+	free(rollup->completed);
+	rollup->completed = NULL;
+	rollup->completedSz = 0;
+}
+
+// O(1) per sample - sampleTime never goes backwards, the history publish path clamps it
+void mrbfsRollupAddSample(MRBFSRollup* rollup, int64_t sampleTime, double value)
+{
+	MRBFSRollupWindow* current = &rollup->current;
+	int64_t windowStart = sampleTime - (sampleTime % rollup->windowMs);
+
+	if (0 != current->count && windowStart != current->windowStart)
+	{
+		// Close out the open window
+		if (rollup->completedSz > 0)
+		{
+			rollup->completed[rollup->completedHead] = *current;
+			rollup->completedHead = (rollup->completedHead + 1) % rollup->completedSz;
+			if (rollup->completedUsed < rollup->completedSz)
+				rollup->completedUsed++;
+		}
+		current->count = 0;
+	}
+
+	if (0 == current->count)
+	{
+		current->windowStart = windowStart;
+		current->min = current->max = current->sum = value;
+		current->count = 1;
+		return;
+	}
+
+	if (value < current->min)
+		current->min = value;
+	if (value > current->max)
+		current->max = value;
+	current->sum += value;
+	current->count++;
+}
+
+static char* mrbfsRollupRenderWindow(char* ptr, MRBFSRollupWindow* window)
+{
+	return(ptr + sprintf(ptr, "%" PRId64 ",%u,%.10g,%.10g,%.10g\n", window->windowStart / 1000, window->count,
+		window->min, window->max, window->sum / (double)window->count));
+}
+
+static size_t mrbfsRollupFileRead(MRBFSFileNode* mrbfsFileNode, char *buf, size_t size, off_t offset)
+{
+	MRBFSRollup* rollup = (MRBFSRollup*)mrbfsFileNode->nodeLocalStorage;
+	char* rollupStr = NULL;
+	char* ptr;
+	size_t len;
+	int i;
+
+	if (NULL == rollup)
+		return(0);
+
+	// Bounded by the ring size, so just render the whole thing every time
+	if (NULL == (rollupStr = malloc(64 + (rollup->completedSz + 1) * 96)))
+		return(0);
+
+	ptr = rollupStr;
+	ptr += sprintf(ptr, "window_start,count,min,max,mean\n");
+
+	pthread_mutex_lock(&rollup->series->seriesLock);
+	for(i=0; i<rollup->completedUsed; i++)
+	{
+		int idx = (rollup->completedHead - rollup->completedUsed + i + rollup->completedSz) % rollup->completedSz;
+		ptr = mrbfsRollupRenderWindow(ptr, &rollup->completed[idx]);
+	}
+	if (0 != rollup->current.count)
+		ptr = mrbfsRollupRenderWindow(ptr, &rollup->current);
+	pthread_mutex_unlock(&rollup->series->seriesLock);
+
+	len = ptr - rollupStr;
+	if (offset < len)
+	{
+		if (offset + size > len)
+			size = len - offset;
+		memcpy(buf, rollupStr + offset, size);
+	} else
+		size = 0;
+
+	free(rollupStr);
+	return(size);
+}
+
+MRBFSFileNode* mrbfsRollupAddFile(MRBFSRollup* rollup, const char* fileName, const char* insertionPath)
+{
+	rollup->file_rollup = mrbfsFilesystemAddFile(fileName, FNODE_RO_VALUE_READBACK, insertionPath);
+	if (NULL != rollup->file_rollup)
+	{
+		rollup->file_rollup->mrbfsFileNodeRead = &mrbfsRollupFileRead;
+		rollup->file_rollup->nodeLocalStorage = (void*)rollup;
+	}
+	return(rollup->file_rollup);
+}
@@ -0,0 +1,9 @@
+#ifndef _MRBFS_ROLLUP_H
+#define _MRBFS_ROLLUP_H
+
+int mrbfsRollupInitialize(MRBFSRollup* rollup, struct MRBFSHistorySeries* series, int64_t windowMs, int keepWindows);
+void mrbfsRollupFree(MRBFSRollup* rollup);
+void mrbfsRollupAddSample(MRBFSRollup* rollup, int64_t sampleTime, double value);
+MRBFSFileNode* mrbfsRollupAddFile(MRBFSRollup* rollup, const char* fileName, const char* insertionPath);
+
+#endif
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-seqlock.h"
+
+/* Per-node value sequence locks
+
+ Drivers update several value files per packet (temperature, humidity and
+ voltage from one status packet, say) under their nodeLock, but the FUSE
+ read path copies value buffers without any lock.  Without something in
+ between, a reader can see half of an snprintf, or a temperature from one
+ packet next to a humidity from the one before.
+
+ Rather than make readers take nodeLock (and stall packet handling behind a
+ slow reader), each node has a sequence count.  The core brackets packet
+ dispatch and ticks with mrbfsSeqLockWriteBegin/End.  Readers note the
+ sequence, copy, and retry if a writer was active or finished meanwhile.
+ Writers never wait.  Write callbacks aren't bracketed - some of them sit in
+ a transmit-and-wait-for-reply for seconds, and they only touch the file
+ being written anyway.
+
+ More than one writer can be in a node at once (packets arriving on two
+ interfaces, or a packet and a tick), so instead of the classic odd/even
+ count there's a count of active writers, and seq only moves when a writer
+ is done.
+*/
+
+void mrbfsSeqLockWriteBegin(MRBFSSeqLock* seqLock)
+{
+	__atomic_add_fetch(&seqLock->writers, 1, __ATOMIC_SEQ_CST);
+}
+
+void mrbfsSeqLockWriteEnd(MRBFSSeqLock* seqLock)
+{
+	__atomic_add_fetch(&seqLock->seq, 1, __ATOMIC_SEQ_CST);
+	__atomic_sub_fetch(&seqLock->writers, 1, __ATOMIC_SEQ_CST);
+}
+
+// Waits out any writer in progress, returns the sequence to hand to mrbfsSeqLockReadRetry()
+UINT32 mrbfsSeqLockReadBegin(MRBFSSeqLock* seqLock)
+{
+	int spins = 0;
+
+	while(0 != __atomic_load_n(&seqLock->writers, __ATOMIC_SEQ_CST))
+	{
+		if (++spins > 100)
+			sched_yield();
+	}
+	return(__atomic_load_n(&seqLock->seq, __ATOMIC_SEQ_CST));
+}
+
+// Like mrbfsSeqLockReadBegin() but never waits - for readers that can't spin (holding fsLock, say)
+// and would rather retry.  Returns non-zero in *busy if a writer is already in.
+UINT32 mrbfsSeqLockReadPeek(MRBFSSeqLock* seqLock, int* busy)
+{
+	*busy = (0 != __atomic_load_n(&seqLock->writers, __ATOMIC_SEQ_CST));
+	return(__atomic_load_n(&seqLock->seq, __ATOMIC_SEQ_CST));
+}
+
+// Non-zero if what was read since mrbfsSeqLockReadBegin() may be torn
+int mrbfsSeqLockReadRetry(MRBFSSeqLock* seqLock, UINT32 seq)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (0 != __atomic_load_n(&seqLock->writers, __ATOMIC_SEQ_CST))
+		return(1);
+	return(seq != __atomic_load_n(&seqLock->seq, __ATOMIC_SEQ_CST));
+}
+
+// Points every file under dirNode at the node's seqlock, run once the driver has created its files
+void mrbfsSeqLockAttachTree(MRBFSFileNode* dirNode, MRBFSSeqLock* seqLock)
+{
+	MRBFSFileNode* fileNode;
+
+	for(fileNode = dirNode->childPtr; NULL != fileNode; fileNode = fileNode->siblingPtr)
+	{
+		fileNode->valueSeq = seqLock;
+		if (FNODE_DIR == fileNode->fileType || FNODE_DIR_NODE == fileNode->fileType)
+			mrbfsSeqLockAttachTree(fileNode, seqLock);
+	}
+}
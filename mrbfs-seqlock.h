@@ -0,0 +1,11 @@
+#ifndef _MRBFS_SEQLOCK_H
+#define _MRBFS_SEQLOCK_H
+
+void mrbfsSeqLockWriteBegin(MRBFSSeqLock* seqLock);
+void mrbfsSeqLockWriteEnd(MRBFSSeqLock* seqLock);
+UINT32 mrbfsSeqLockReadBegin(MRBFSSeqLock* seqLock);
+UINT32 mrbfsSeqLockReadPeek(MRBFSSeqLock* seqLock, int* busy);
+int mrbfsSeqLockReadRetry(MRBFSSeqLock* seqLock, UINT32 seq);
+void mrbfsSeqLockAttachTree(MRBFSFileNode* dirNode, MRBFSSeqLock* seqLock);
+
+#endif
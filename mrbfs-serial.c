@@ -0,0 +1,471 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <asm/termbits.h>
+#include <linux/serial.h>
+#include <pthread.h>
+#include "mrbfs-module.h"
+#include "mrbfs-pktqueue.h"
+#include "mrbfs-options.h"
+#include "mrbfs-serial.h"
+
+/* Serial port setup
+
+ Shared by the serial interface drivers.  The port is set up through the
+ termios2 ioctls with BOTHER, so any rate the adapter can generate works -
+ 230400, 460800 or 1000000 for USB-CDC bridges, not just the handful of
+ Bxxxx constants.  (That's also why this file can't include termios.h.)
+ Options, read once during driver init:
+
+   baud            bits per second, default depends on the driver
+   hw-flowcontrol  RTS/CTS handshaking, default depends on the driver
+   low-latency     ask the serial driver to hand over received bytes
+                   immediately (ASYNC_LOW_LATENCY - FTDI adapters otherwise
+                   batch them up for 16ms), default yes
+   vmin, vtime     the termios read thresholds, defaults 1 and 0
+   serial-number   open the adapter whose /dev/serial/by-id name contains
+                   this, wherever udev put it this time, instead of port
+   tx-budget       how long, in ms at the configured baud, one batch of
+                   transmitted packets may take on the wire - default 100
+   tx-gap          ms of idle line between transmitted packets, default 0
+
+ With vtime 0 the port is non-blocking, as the drivers always had it.  With
+ vtime set it's left blocking, so a read waits up to vtime tenths of a
+ second for vmin bytes instead of the driver polling - but packets queued
+ to transmit then wait for that read to return, too.  Use vmin 0 with it:
+ otherwise the timer only starts at the first byte, and a quiet bus holds
+ the read (and everything queued behind it) indefinitely.
+
+ Drivers send everything they have queued, up to tx-budget's worth, as one
+ batch through mrbfsSerialWriteBatch - a single writev() rather than a write
+ per packet.  With tx-gap set each packet is written, drained out of the
+ UART and followed by the gap instead.  RTS/CTS flow control is left to the
+ kernel: while the other end holds the port off, writes wait for it.
+
+ When the port goes away (a USB adapter unplugged, usually) the driver's run
+ loop hands it to mrbfsSerialReconnect, which marks the interface down for
+ transmit and then tries to reopen it, reconnect-min ms later (default 100),
+ doubling the wait after each failure up to reconnect-max (default 30000).
+ Between attempts it returns -1 straight away, so the driver keeps running.
+ outage-tx decides what happens to packets queued for the port meanwhile:
+
+   hold  keep them until it's back (the default) - once the queue is full,
+         new ones are dropped
+   drop  throw them away as they arrive
+
+ <interface>/outages, outageSeconds and lastOutageSeconds count how often
+ and how long the port has been gone, and txDropped the packets lost to it.
+
+ mrbfsSerialPacketCRC is the MRBus CRC16 the drivers that build their own
+ packets (xbee, net) check and fill in.
+
+ This file is compiled into the driver modules.
+*/
+
+static const char* mrbfsSerialOutageTxNames[] = { "hold", "drop", NULL };
+
+static uint64_t mrbfsSerialNowMs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+void mrbfsSerialConfigure(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBFSSerialConfig* serialConfig, int defaultBaud, int defaultFlowControl)
+{
+	MRBFSModuleOptionTable* options = &mrbfsInterfaceDriver->interfaceOptions;
+
+	serialConfig->baud = mrbfsOptionGetInt(options, "baud", defaultBaud, 50, 4000000);
+	serialConfig->hwFlowControl = mrbfsOptionGetBool(options, "hw-flowcontrol", defaultFlowControl);
+	serialConfig->lowLatency = mrbfsOptionGetBool(options, "low-latency", 1);
+	serialConfig->vmin = mrbfsOptionGetInt(options, "vmin", 1, 0, 255);
+	serialConfig->vtime = mrbfsOptionGetInt(options, "vtime", 0, 0, 255);
+	serialConfig->serialNumber = mrbfsOptionGetStr(options, "serial-number", "");
+	serialConfig->txBudgetMs = mrbfsOptionGetInt(options, "tx-budget", 100, 1, 10000);
+	serialConfig->txGapMs = mrbfsOptionGetInt(options, "tx-gap", 0, 0, 1000);
+
+	if (0 != serialConfig->vtime && 0 != serialConfig->vmin)
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_WARNING, "Interface [%s] - vtime with a non-zero vmin blocks until a byte arrives, consider vmin 0", mrbfsInterfaceDriver->interfaceName);
+}
+
+static void mrbfsSerialLowLatency(MRBFSInterfaceDriver* mrbfsInterfaceDriver, int fd)
+{
+	struct serial_struct serial;
+
+	// Plenty of adapters (and ptys) don't do this - not worth more than a debug message
+	if (0 != ioctl(fd, TIOCGSERIAL, &serial))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] - Port doesn't support low latency mode (%s)", mrbfsInterfaceDriver->interfaceName, strerror(errno));
+		return;
+	}
+
+	serial.flags |= ASYNC_LOW_LATENCY;
+	if (0 != ioctl(fd, TIOCSSERIAL, &serial))
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] - Cannot set low latency mode (%s)", mrbfsInterfaceDriver->interfaceName, strerror(errno));
+	else
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] - Low latency mode set", mrbfsInterfaceDriver->interfaceName);
+}
+
+// Finds the device node for the adapter with the configured serial number, or returns -1
+static int mrbfsSerialFindDevice(const char* serialNumber, char* device, size_t deviceSz)
+{
+	const char* byIdPath = "/dev/serial/by-id";
+	char linkPath[PATH_MAX];
+	struct dirent* entry;
+	DIR* dir;
+	int found = -1;
+
+	if (NULL == (dir = opendir(byIdPath)))
+		return(-1);
+
+	while(-1 == found && NULL != (entry = readdir(dir)))
+	{
+		if (NULL == strstr(entry->d_name, serialNumber))
+			continue;
+		snprintf(linkPath, sizeof(linkPath), "%s/%s", byIdPath, entry->d_name);
+		if (NULL != realpath(linkPath, device))
+			found = 0;
+	}
+
+	closedir(dir);
+	return(found);
+}
+
+int mrbfsSerialOpen(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBFSSerialConfig* serialConfig)
+{
+	struct termios2 options;
+	char deviceBuffer[PATH_MAX];
+	char* device = mrbfsInterfaceDriver->port;
+	// Only the first of a run of failures is worth an error - the rest are someone reconnecting
+	mrbfsLogLevel failLevel = (0 == serialConfig->openFailures) ? MRBFS_LOG_ERROR : MRBFS_LOG_DEBUG;
+	int fd;
+
+	if (0 != serialConfig->serialNumber[0])
+	{
+		if (0 != mrbfsSerialFindDevice(serialConfig->serialNumber, deviceBuffer, sizeof(deviceBuffer)))
+		{
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(failLevel, "Interface [%s] - No adapter with serial number [%s] in /dev/serial/by-id", mrbfsInterfaceDriver->interfaceName, serialConfig->serialNumber);
+			serialConfig->openFailures++;
+			return(-1);
+		}
+		device = deviceBuffer;
+	}
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)((0 == serialConfig->openFailures) ? MRBFS_LOG_INFO : MRBFS_LOG_DEBUG, "Interface [%s] - Starting serial port setup on [%s]", mrbfsInterfaceDriver->interfaceName, device);
+
+	fd = open(device, O_RDWR | O_NOCTTY | O_NDELAY);
+	if (fd < 0)
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(failLevel, "Interface [%s] - Cannot open %s (%s)", mrbfsInterfaceDriver->interfaceName, device, strerror(errno));
+		serialConfig->openFailures++;
+		return(-1);
+	}
+
+	fcntl(fd, F_SETOWN, getpid());
+	fcntl(fd, F_SETFL, (0 == serialConfig->vtime) ? O_NONBLOCK : 0);
+
+	if (0 != ioctl(fd, TCGETS2, &options))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(failLevel, "Interface [%s] - [%s] isn't a serial port (%s)", mrbfsInterfaceDriver->interfaceName, device, strerror(errno));
+		serialConfig->openFailures++;
+		close(fd);
+		return(-1);
+	}
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Interface [%s] - Serial port [%s] opened, not yet configured", mrbfsInterfaceDriver->interfaceName, device);
+
+	options.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+	options.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+	options.c_ispeed = serialConfig->baud;
+	options.c_ospeed = serialConfig->baud;
+
+	options.c_cflag &= ~CSIZE; // Mask the character size bits
+	options.c_cflag |= CS8;    // Select 8 data bits
+
+	if (serialConfig->hwFlowControl)
+		options.c_cflag |= CRTSCTS;
+	else
+		options.c_cflag &= ~CRTSCTS;
+
+	options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
+	options.c_iflag &= ~(IXON | IXOFF | IXANY | ICRNL);
+	options.c_oflag &= ~OPOST;
+	options.c_cc[VMIN] = serialConfig->vmin;
+	options.c_cc[VTIME] = serialConfig->vtime;
+
+	ioctl(fd, TCFLSH, TCIFLUSH);
+	if (0 != ioctl(fd, TCSETS2, &options))
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(failLevel, "Interface [%s] - Cannot configure [%s] for %d baud (%s)", mrbfsInterfaceDriver->interfaceName, device, serialConfig->baud, strerror(errno));
+		serialConfig->openFailures++;
+		close(fd);
+		return(-1);
+	}
+
+	// Drivers are free to round to a rate they can actually make
+	if (0 == ioctl(fd, TCGETS2, &options) && options.c_ospeed != serialConfig->baud)
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_WARNING, "Interface [%s] - Asked for %d baud, port is running at %u", mrbfsInterfaceDriver->interfaceName, serialConfig->baud, options.c_ospeed);
+	else
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] - Serial port running at %d baud", mrbfsInterfaceDriver->interfaceName, serialConfig->baud);
+
+	if (serialConfig->lowLatency)
+		mrbfsSerialLowLatency(mrbfsInterfaceDriver, fd);
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] - Serial startup complete", mrbfsInterfaceDriver->interfaceName);
+
+	serialConfig->openFailures = 0;
+	return(fd);
+}
+
+// How many bytes a batch of transmits can hold before it takes longer than tx-budget to send
+size_t mrbfsSerialTxBudgetBytes(MRBFSSerialConfig* serialConfig)
+{
+	// 10 bits on the wire per byte
+	return((size_t)serialConfig->baud / 10 * serialConfig->txBudgetMs / 1000);
+}
+
+// Writes all of iov, waiting for the port while it's full, until deadlineMs.  Advances iov as it goes.
+static int mrbfsSerialWritev(MRBFSInterfaceDriver* mrbfsInterfaceDriver, int fd, struct iovec* iov, int iovcnt, uint64_t deadlineMs)
+{
+	while(iovcnt > 0)
+	{
+		ssize_t nbytes = writev(fd, iov, iovcnt);
+
+		if (nbytes < 0)
+		{
+			struct pollfd pollFd;
+			uint64_t nowMs;
+
+			if (EINTR == errno)
+				continue;
+			if (EAGAIN != errno && EWOULDBLOCK != errno)
+			{
+				(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] write failed (%s)", mrbfsInterfaceDriver->interfaceName, strerror(errno));
+				return(-1);
+			}
+			if ((nowMs = mrbfsSerialNowMs()) >= deadlineMs)
+			{
+				(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Interface [%s] timed out waiting to transmit", mrbfsInterfaceDriver->interfaceName);
+				return(-1);
+			}
+
+			pollFd.fd = fd;
+			pollFd.events = POLLOUT;
+			poll(&pollFd, 1, MIN(deadlineMs - nowMs, 100));
+			continue;
+		}
+
+		// Skip past whatever made it out - which may end partway through an iovec
+		while(iovcnt > 0 && (size_t)nbytes >= iov->iov_len)
+		{
+			nbytes -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			iov->iov_base = (UINT8*)iov->iov_base + nbytes;
+			iov->iov_len -= nbytes;
+		}
+	}
+	return(0);
+}
+
+// Sends a batch of encoded packets, one per iovec.  Returns -1 if the port needs resetting.
+int mrbfsSerialWriteBatch(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBFSSerialConfig* serialConfig, int fd, struct iovec* iov, int iovcnt, UINT32 timeoutMs)
+{
+	uint64_t deadlineMs = mrbfsSerialNowMs() + timeoutMs;
+	int i;
+
+	if (0 == serialConfig->txGapMs)
+		return(mrbfsSerialWritev(mrbfsInterfaceDriver, fd, iov, iovcnt, deadlineMs));
+
+	for(i=0; i<iovcnt; i++)
+	{
+		if (0 != mrbfsSerialWritev(mrbfsInterfaceDriver, fd, &iov[i], 1, deadlineMs))
+			return(-1);
+		if (i+1 < iovcnt)
+		{
+			// The gap has to start once the packet is on the wire, not in the kernel's buffer
+			ioctl(fd, TCSBRK, 1);
+			usleep(serialConfig->txGapMs * 1000);
+		}
+	}
+	return(0);
+}
+
+void mrbfsSerialClose(MRBFSInterfaceDriver* mrbfsInterfaceDriver, int fd)
+{
+	if (-1 != fd)
+	{
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] closing port", mrbfsInterfaceDriver->interfaceName);
+		close(fd);
+	}
+}
+
+void mrbfsSerialLinkInitialize(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBFSSerialLink* serialLink, MRBusPacketQueue* txq)
+{
+	MRBFSModuleOptionTable* options = &mrbfsInterfaceDriver->interfaceOptions;
+
+	memset(serialLink, 0, sizeof(MRBFSSerialLink));
+	serialLink->txq = txq;
+	serialLink->outageTx = (MRBFSSerialOutageTx)mrbfsOptionGetEnum(options, "outage-tx", mrbfsSerialOutageTxNames, MRBFS_SERIAL_OUTAGE_HOLD);
+	serialLink->reconnectMinMs = mrbfsOptionGetInt(options, "reconnect-min", 100, 10, 60000);
+	serialLink->reconnectMaxMs = mrbfsOptionGetInt(options, "reconnect-max", 30000, serialLink->reconnectMinMs, 3600000);
+
+	serialLink->file_outages = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("outages", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+	serialLink->file_outageSeconds = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("outageSeconds", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+	serialLink->file_lastOutageSeconds = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("lastOutageSeconds", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+	serialLink->file_txDropped = (*mrbfsInterfaceDriver->mrbfsFilesystemAddFile)("txDropped", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+}
+
+static void mrbfsSerialSetCounter(MRBFSFileNode* fileNode, UINT32 value)
+{
+	if (NULL == fileNode)
+		return;
+	fileNode->value.valueInt = value;
+	fileNode->updateTime = time(NULL);
+}
+
+void mrbfsSerialTxDropped(MRBFSSerialLink* serialLink, UINT32 pkts)
+{
+	mrbfsSerialSetCounter(serialLink->file_txDropped, __atomic_add_fetch(&serialLink->txDropped, pkts, __ATOMIC_RELAXED));
+}
+
+// Called from the driver's run loop with the port that failed (or -1 if there
+// isn't one) until it returns something other than -1
+int mrbfsSerialReconnect(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBFSSerialLink* serialLink, int fd, int (*serialOpen)(MRBFSInterfaceDriver*))
+{
+	uint64_t nowMs = mrbfsSerialNowMs();
+	UINT32 outageMs;
+
+	if (!serialLink->down)
+	{
+		mrbfsSerialClose(mrbfsInterfaceDriver, fd);
+		(*mrbfsInterfaceDriver->mrbfsInterfaceReportHealth)(mrbfsInterfaceDriver, 0);
+		(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_WARNING, "Interface [%s] lost its port, reconnecting", mrbfsInterfaceDriver->interfaceName);
+
+		serialLink->down = 1;
+		serialLink->attempts = 0;
+		serialLink->downSinceMs = nowMs;
+		serialLink->backoffMs = serialLink->reconnectMinMs;
+		serialLink->nextAttemptMs = nowMs + serialLink->backoffMs;
+		mrbfsSerialSetCounter(serialLink->file_outages, ++serialLink->outages);
+	}
+
+	if (MRBFS_SERIAL_OUTAGE_DROP == serialLink->outageTx && NULL != serialLink->txq)
+	{
+		MRBusPacket txPkt;
+		UINT32 dropped = 0;
+
+		while(0 != mrbusPacketQueueDepth(serialLink->txq))
+		{
+			mrbusPacketQueuePop(serialLink->txq, &txPkt);
+			dropped++;
+		}
+		if (0 != dropped)
+			mrbfsSerialTxDropped(serialLink, dropped);
+	}
+
+	// Don't sleep so long the driver can't notice it's being told to terminate
+	if (nowMs < serialLink->nextAttemptMs)
+	{
+		usleep(MIN(serialLink->nextAttemptMs - nowMs, 100) * 1000);
+		return(-1);
+	}
+
+	serialLink->attempts++;
+	if (-1 == (fd = (*serialOpen)(mrbfsInterfaceDriver)))
+	{
+		if (serialLink->backoffMs < serialLink->reconnectMaxMs && serialLink->backoffMs * 2 >= serialLink->reconnectMaxMs)
+			(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_WARNING, "Interface [%s] still can't reopen its port after %u tries, now trying every %u ms", mrbfsInterfaceDriver->interfaceName, serialLink->attempts, serialLink->reconnectMaxMs);
+		serialLink->backoffMs = MIN(serialLink->backoffMs * 2, serialLink->reconnectMaxMs);
+		serialLink->nextAttemptMs = mrbfsSerialNowMs() + serialLink->backoffMs;
+		return(-1);
+	}
+
+	outageMs = (UINT32)(mrbfsSerialNowMs() - serialLink->downSinceMs);
+	serialLink->down = 0;
+	serialLink->outageSeconds += (outageMs + 500) / 1000;
+	mrbfsSerialSetCounter(serialLink->file_outageSeconds, serialLink->outageSeconds);
+	mrbfsSerialSetCounter(serialLink->file_lastOutageSeconds, (outageMs + 500) / 1000);
+
+	(*mrbfsInterfaceDriver->mrbfsLogMessage)(MRBFS_LOG_INFO, "Interface [%s] port back after %u.%03u seconds and %u tries", mrbfsInterfaceDriver->interfaceName, outageMs / 1000, outageMs % 1000, serialLink->attempts);
+	(*mrbfsInterfaceDriver->mrbfsInterfaceReportHealth)(mrbfsInterfaceDriver, 1);
+	return(fd);
+}
+
+static const uint8_t MRBus_CRC16_HighTable[16] =
+{
+	0x00, 0xA0, 0xE0, 0x40, 0x60, 0xC0, 0x80, 0x20,
+	0xC0, 0x60, 0x20, 0x80, 0xA0, 0x00, 0x40, 0xE0
+};
+static const uint8_t MRBus_CRC16_LowTable[16] =
+{
+	0x00, 0x01, 0x03, 0x02, 0x07, 0x06, 0x04, 0x05,
+	0x0E, 0x0F, 0x0D, 0x0C, 0x09, 0x08, 0x0A, 0x0B
+};
+
+static uint16_t mrbusCRC16Update(uint16_t crc, uint8_t a)
+{
+	uint8_t t;
+	uint8_t i = 0;
+
+	uint8_t W;
+	uint8_t crc16_high = (crc >> 8) & 0xFF;
+	uint8_t crc16_low = crc & 0xFF;
+
+	while (i < 2)
+	{
+		if (i)
+		{
+			W = ((crc16_high << 4) & 0xF0) | ((crc16_high >> 4) & 0x0F);
+			W = W ^ a;
+			W = W & 0x0F;
+			t = W;
+		}
+		else
+		{
+			W = crc16_high;
+			W = W ^ a;
+			W = W & 0xF0;
+			t = W;
+			t = ((t << 4) & 0xF0) | ((t >> 4) & 0x0F);
+		}
+
+		crc16_high = crc16_high << 4; 
+		crc16_high |= (crc16_low >> 4);
+		crc16_low = crc16_low << 4;
+
+		crc16_high = crc16_high ^ MRBus_CRC16_HighTable[t];
+		crc16_low = crc16_low ^ MRBus_CRC16_LowTable[t];
+
+		i++;
+	}
+
+	return ( ((crc16_high << 8) & 0xFF00) + crc16_low );
+}
+
+// The MRBus CRC16 over a packet's LEN bytes, leaving out the CRC bytes themselves
+uint16_t mrbfsSerialPacketCRC(MRBusPacket* pkt)
+{
+	uint16_t crc16_value = 0;
+	int i;
+
+	for (i = 0; i < pkt->pkt[MRBUS_PKT_LEN] && i < MRBFS_MAX_PACKET_LEN; i++)
+	{
+		if ((i != MRBUS_PKT_CRC_H) && (i != MRBUS_PKT_CRC_L))
+			crc16_value = mrbusCRC16Update(crc16_value, pkt->pkt[i]);
+	}
+	return(crc16_value);
+}
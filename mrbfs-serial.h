@@ -0,0 +1,14 @@
+#ifndef _MRBFS_SERIAL_H
+#define _MRBFS_SERIAL_H
+
+void mrbfsSerialConfigure(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBFSSerialConfig* serialConfig, int defaultBaud, int defaultFlowControl);
+int mrbfsSerialOpen(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBFSSerialConfig* serialConfig);
+size_t mrbfsSerialTxBudgetBytes(MRBFSSerialConfig* serialConfig);
+int mrbfsSerialWriteBatch(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBFSSerialConfig* serialConfig, int fd, struct iovec* iov, int iovcnt, UINT32 timeoutMs);
+void mrbfsSerialClose(MRBFSInterfaceDriver* mrbfsInterfaceDriver, int fd);
+void mrbfsSerialLinkInitialize(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBFSSerialLink* serialLink, MRBusPacketQueue* txq);
+void mrbfsSerialTxDropped(MRBFSSerialLink* serialLink, UINT32 pkts);
+int mrbfsSerialReconnect(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBFSSerialLink* serialLink, int fd, int (*serialOpen)(MRBFSInterfaceDriver*));
+uint16_t mrbfsSerialPacketCRC(MRBusPacket* pkt);
+
+#endif
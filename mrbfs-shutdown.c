@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <unistd.h>
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-log.h"
+#include "mrbfs-options.h"
+#include "mrbfs-shutdown.h"
+
+/* Shutdown
+
+ Unmounting the filesystem (fuse turns SIGINT and SIGTERM into one) ends
+ in mrbfsDestroy, which comes here:
+
+   1. Healthy interfaces that export mrbfsInterfaceTxQueueDepth get to
+      send what they still have queued - for up to half the deadline, and
+      only while their queues keep shrinking.  One that's down, or whose
+      queue hasn't moved in MRBFS_SHUTDOWN_STALL_MS, won't drain in time.
+   2. terminate is set and shutdownFd, an eventfd, is signalled.  The
+      ticker and capture writer wait on it instead of sleeping, and
+      interface drivers can poll mrbfsInterfaceDriver->shutdownFd along
+      with their own descriptors.  Drivers that don't still see terminate
+      on their next pass round their loop.
+   3. The ticker, capture writer and interface threads are joined.
+
+ All of that shares one deadline, shutdown-timeout milliseconds (default
+ 2000), and the flush leaves at least half of it for the joins.  A thread
+ still running at the deadline is cancelled.  If even that doesn't stop
+ it, its interface is abandoned rather than freed out from under it.  The eventfd is never read, so it stays readable once signalled.
+
+ Startup and shutdown times go to the log at SYSTEM level, for timing
+ restarts.
+*/
+
+#define MRBFS_SHUTDOWN_CANCEL_MS  100
+#define MRBFS_SHUTDOWN_STALL_MS   100
+
+static uint64_t mrbfsStartupMs = 0;
+
+static uint64_t mrbfsShutdownNowMs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+void mrbfsShutdownInitialize()
+{
+	mrbfsStartupMs = mrbfsShutdownNowMs();
+	gMrbfsConfig->shutdownTimeoutMs = MAX(0, cfg_getint(gMrbfsConfig->cfgParms, "shutdown-timeout"));
+
+	// poll() ignores a -1 fd, so without the eventfd everything just notices shutdown on its next timeout
+	if (-1 == (gMrbfsConfig->shutdownFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)))
+		mrbfsLogMessage(MRBFS_LOG_WARNING, "Cannot create shutdown eventfd (%s), shutdown will be slower", strerror(errno));
+}
+
+void mrbfsShutdownStartupComplete()
+{
+	mrbfsLogMessage(MRBFS_LOG_SYSTEM, "MRBFS startup complete in %u ms", (UINT32)(mrbfsShutdownNowMs() - mrbfsStartupMs));
+}
+
+// Sleeps for up to timeoutMs, returning 1 early if shutdown has started
+int mrbfsShutdownWait(int timeoutMs)
+{
+	struct pollfd pollFd;
+
+	pollFd.fd = gMrbfsConfig->shutdownFd;
+	pollFd.events = POLLIN;
+	if (poll(&pollFd, 1, timeoutMs) > 0)
+		return(1);
+	return(gMrbfsConfig->terminate);
+}
+
+static int mrbfsShutdownJoin(pthread_t thread, uint64_t deadlineMs)
+{
+	uint64_t nowMs = mrbfsShutdownNowMs();
+	uint64_t remainingMs = (deadlineMs > nowMs) ? deadlineMs - nowMs : 0;
+	struct timespec deadline;
+
+	// pthread_timedjoin_np wants a CLOCK_REALTIME deadline
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += remainingMs / 1000;
+	deadline.tv_nsec += (remainingMs % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	return(pthread_timedjoin_np(thread, NULL, &deadline));
+}
+
+// Returns 0 once the thread is gone, -1 if it couldn't be stopped
+static int mrbfsShutdownStopThread(pthread_t thread, const char* name, uint64_t deadlineMs)
+{
+	if (0 == mrbfsShutdownJoin(thread, deadlineMs))
+		return(0);
+
+	mrbfsLogMessage(MRBFS_LOG_WARNING, "Thread [%s] didn't stop by the shutdown deadline, cancelling it", name);
+	pthread_cancel(thread);
+	if (0 == mrbfsShutdownJoin(thread, mrbfsShutdownNowMs() + MRBFS_SHUTDOWN_CANCEL_MS))
+		return(0);
+
+	mrbfsLogMessage(MRBFS_LOG_ERROR, "Thread [%s] won't stop, abandoning it", name);
+	return(-1);
+}
+
+static int mrbfsShutdownTxQueued()
+{
+	int i, queued = 0;
+
+	for(i = 0; i < gMrbfsConfig->mrbfsUsedInterfaces; i++)
+	{
+		MRBFSInterfaceDriver* mrbfsInterfaceDriver = gMrbfsConfig->mrbfsInterfaceDrivers[i];
+		if (mrbfsInterfaceDriver->threadRunning && NULL != mrbfsInterfaceDriver->mrbfsInterfaceTxQueueDepth
+			&& __atomic_load_n(&mrbfsInterfaceDriver->txHealthy, __ATOMIC_ACQUIRE))
+			queued += (*mrbfsInterfaceDriver->mrbfsInterfaceTxQueueDepth)(mrbfsInterfaceDriver);
+	}
+	return(queued);
+}
+
+void mrbfsShutdown()
+{
+	uint64_t startMs = mrbfsShutdownNowMs();
+	uint64_t deadlineMs = startMs + gMrbfsConfig->shutdownTimeoutMs;
+	uint64_t flushDeadlineMs = startMs + gMrbfsConfig->shutdownTimeoutMs / 2;
+	uint64_t progressMs = startMs, nowMs;
+	int i, queued, lowestQueued, stopped = 0;
+	int interfaces = gMrbfsConfig->mrbfsUsedInterfaces;
+
+	mrbfsLogMessage(MRBFS_LOG_SYSTEM, "MRBFS shutting down");
+
+	// Queued transmits need the interfaces still running to go anywhere
+	lowestQueued = queued = mrbfsShutdownTxQueued();
+	while(0 != queued && (nowMs = mrbfsShutdownNowMs()) < flushDeadlineMs && nowMs - progressMs < MRBFS_SHUTDOWN_STALL_MS)
+	{
+		usleep(1000);
+		if ((queued = mrbfsShutdownTxQueued()) < lowestQueued)
+		{
+			lowestQueued = queued;
+			progressMs = mrbfsShutdownNowMs();
+		}
+	}
+	if (0 != queued)
+		mrbfsLogMessage(MRBFS_LOG_WARNING, "Shutdown dropping %d packets still queued for transmit", queued);
+
+	gMrbfsConfig->terminate = 1;
+	for(i = 0; i < gMrbfsConfig->mrbfsUsedInterfaces; i++)
+		gMrbfsConfig->mrbfsInterfaceDrivers[i]->terminate = 1;
+	if (-1 != gMrbfsConfig->shutdownFd)
+		eventfd_write(gMrbfsConfig->shutdownFd, 1);
+
+	mrbfsShutdownStopThread(gMrbfsConfig->tickerThread, "ticker", deadlineMs);
+	if (NULL != gMrbfsConfig->captureDirectory)
+		mrbfsShutdownStopThread(gMrbfsConfig->captureThread, "capture writer", deadlineMs);
+
+	for(i = 0; i < gMrbfsConfig->mrbfsUsedInterfaces; i++)
+	{
+		MRBFSInterfaceDriver* mrbfsInterfaceDriver = gMrbfsConfig->mrbfsInterfaceDrivers[i];
+
+		if (!mrbfsInterfaceDriver->threadRunning || 0 == mrbfsShutdownStopThread(mrbfsInterfaceDriver->interfaceThread, mrbfsInterfaceDriver->interfaceName, deadlineMs))
+		{
+			mrbfsInterfaceDriver->threadRunning = 0;
+			stopped++;
+		}
+	}
+
+	// An abandoned thread may still be delivering packets, which walks every interface
+	if (stopped == interfaces)
+	{
+		for(i = 0; i < interfaces; i++)
+		{
+			MRBFSInterfaceDriver* mrbfsInterfaceDriver = gMrbfsConfig->mrbfsInterfaceDrivers[i];
+
+			// Deallocate its storage
+			free(mrbfsInterfaceDriver->interfaceName);
+			free(mrbfsInterfaceDriver->port);
+			mrbfsOptionTableFree(&mrbfsInterfaceDriver->interfaceOptions);
+			free(mrbfsInterfaceDriver);
+			gMrbfsConfig->mrbfsInterfaceDrivers[i] = NULL;
+		}
+		gMrbfsConfig->mrbfsUsedInterfaces = 0;
+	}
+
+	mrbfsLogMessage(MRBFS_LOG_SYSTEM, "MRBFS shutdown complete in %u ms, %d of %d interfaces stopped", (UINT32)(mrbfsShutdownNowMs() - startMs), stopped, interfaces);
+	mrbfsLogSync();
+}
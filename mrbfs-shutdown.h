@@ -0,0 +1,9 @@
+#ifndef _MRBFS_SHUTDOWN_H
+#define _MRBFS_SHUTDOWN_H
+
+void mrbfsShutdownInitialize();
+void mrbfsShutdownStartupComplete();
+int mrbfsShutdownWait(int timeoutMs);
+void mrbfsShutdown();
+
+#endif
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-log.h"
+#include "mrbfs-filesys.h"
+#include "mrbfs-snapshot.h"
+
+/* Value snapshots
+
+ /snapshot.json and /busN/snapshot.json render every node's current values
+ in one read, so dashboards don't need a FUSE round trip per value file.
+ The output looks like this:
+
+   {"bus":0,"timestamp":1700000000,"nodes":{
+    "0x10-shed":{"name":"shed","address":"0x10","generation":12,"values":{
+     "temperature":{"value":41.2,"units":"F","updated":1699999998}, ...}}}}
+
+ The root file wraps the per-bus objects in "buses":[...].
+
+ Values that start with a number are split into "value" and "units", for
+ example "41.2 F\n".  Anything else ("No Data") is passed through as a string.
+ Readback files are left out since they're generated on demand.
+
+ Each node keeps its own rendered fragment.  A fragment is only rebuilt when
+ the node's valueGeneration has moved since the last render.  The core bumps
+ valueGeneration for every packet it hands to the node, and drivers bump it
+ through mrbfsNodeValuesChanged() when they change values on their own (receive
+ timeouts).  A document render is then mostly memcpy of cached fragments.
+ Each open() gets its own copy of the document, rendered whenever that
+ reader asks for offset 0, so collectors reading at the same time never see
+ pieces of each other's renders.
+*/
+
+static int mrbfsSnapshotAppend(char** buf, size_t* len, size_t* sz, const char* fmt, ...)
+{
+	va_list args;
+	int needed;
+
+	while(1)
+	{
+		va_start(args, fmt);
+		needed = vsnprintf(*buf + *len, *sz - *len, fmt, args);
+		va_end(args);
+
+		if (needed < 0)
+			return(-1);
+
+		if (*len + needed < *sz)
+		{
+			*len += needed;
+			return(0);
+		}
+
+		{
+			size_t newSz = MAX(*sz * 2, *len + needed + 256);
+			char* newBuf = realloc(*buf, newSz);
+			if (NULL == newBuf)
+				return(-1);
+			*buf = newBuf;
+			*sz = newSz;
+		}
+	}
+}
+
+static int mrbfsSnapshotAppendStr(char** buf, size_t* len, size_t* sz, const char* str, size_t strLen)
+{
+	size_t i;
+	int ret = mrbfsSnapshotAppend(buf, len, sz, "\"");
+
+	for(i=0; 0 == ret && i<strLen; i++)
+	{
+		unsigned char c = (unsigned char)str[i];
+		if ('"' == c || '\\' == c)
+			ret = mrbfsSnapshotAppend(buf, len, sz, "\\%c", c);
+		else if (c < 0x20)
+			ret = mrbfsSnapshotAppend(buf, len, sz, "\\u%04x", c);
+		else
+			ret = mrbfsSnapshotAppend(buf, len, sz, "%c", c);
+	}
+
+	if (0 == ret)
+		ret = mrbfsSnapshotAppend(buf, len, sz, "\"");
+	return(ret);
+}
+
+static void mrbfsSnapshotRenderValue(MRBFSBusNode* mrbfsNode, MRBFSFileNode* fileNode)
+{
+	char** buf = &mrbfsNode->snapshotJson;
+	size_t* len = &mrbfsNode->snapshotJsonLen;
+	size_t* sz = &mrbfsNode->snapshotJsonSz;
+
+	if (FNODE_RO_VALUE_INT == fileNode->fileType || FNODE_RW_VALUE_INT == fileNode->fileType)
+	{
+		mrbfsSnapshotAppend(buf, len, sz, "{\"value\":%d", fileNode->value.valueInt);
+	}
+	else
+	{
+		const char* valueStr = fileNode->value.valueStr;
+		size_t valueLen;
+		char* endPtr = NULL;
+		double value;
+
+		if (NULL == valueStr)
+			valueStr = "";
+
+		valueLen = strlen(valueStr);
+		while(valueLen > 0 && (' ' == valueStr[valueLen-1] || '\t' == valueStr[valueLen-1] || '\n' == valueStr[valueLen-1] || '\r' == valueStr[valueLen-1]))
+			valueLen--;
+
+		value = strtod(valueStr, &endPtr);
+		if (endPtr != valueStr && endPtr <= valueStr + valueLen && isfinite(value)
+			&& (endPtr == valueStr + valueLen || ' ' == *endPtr || '\t' == *endPtr))
+		{
+			const char* unitsStr = endPtr;
+			while(unitsStr < valueStr + valueLen && (' ' == *unitsStr || '\t' == *unitsStr))
+				unitsStr++;
+
+			mrbfsSnapshotAppend(buf, len, sz, "{\"value\":%.10g", value);
+			if (unitsStr < valueStr + valueLen)
+			{
+				mrbfsSnapshotAppend(buf, len, sz, ",\"units\":");
+				mrbfsSnapshotAppendStr(buf, len, sz, unitsStr, valueStr + valueLen - unitsStr);
+			}
+		}
+		else
+		{
+			mrbfsSnapshotAppend(buf, len, sz, "{\"value\":");
+			mrbfsSnapshotAppendStr(buf, len, sz, valueStr, valueLen);
+		}
+	}
+
+	mrbfsSnapshotAppend(buf, len, sz, ",\"updated\":%ld}", (long)fileNode->updateTime);
+}
+
+static int mrbfsSnapshotRenderFiles(MRBFSBusNode* mrbfsNode, MRBFSFileNode* dirNode, const char* prefix, int valuesRendered)
+{
+	MRBFSFileNode* fileNode;
+
+	for(fileNode = dirNode->childPtr; NULL != fileNode; fileNode = fileNode->siblingPtr)
+	{
+		switch(fileNode->fileType)
+		{
+			case FNODE_DIR:
+			case FNODE_DIR_NODE:
+				{
+					char* subPrefix = NULL;
+					if (asprintf(&subPrefix, "%s%s/", prefix, fileNode->fileName) < 0)
+						break;
+					valuesRendered = mrbfsSnapshotRenderFiles(mrbfsNode, fileNode, subPrefix, valuesRendered);
+					free(subPrefix);
+				}
+				break;
+
+			case FNODE_RO_VALUE_STR:
+			case FNODE_RW_VALUE_STR:
+			case FNODE_RO_VALUE_INT:
+			case FNODE_RW_VALUE_INT:
+				{
+					char* valueName = NULL;
+					if (asprintf(&valueName, "%s%s", prefix, fileNode->fileName) < 0)
+						break;
+					mrbfsSnapshotAppend(&mrbfsNode->snapshotJson, &mrbfsNode->snapshotJsonLen, &mrbfsNode->snapshotJsonSz, "%s\n   ", valuesRendered?",":"");
+					mrbfsSnapshotAppendStr(&mrbfsNode->snapshotJson, &mrbfsNode->snapshotJsonLen, &mrbfsNode->snapshotJsonSz, valueName, strlen(valueName));
+					mrbfsSnapshotAppend(&mrbfsNode->snapshotJson, &mrbfsNode->snapshotJsonLen, &mrbfsNode->snapshotJsonSz, ":");
+					mrbfsSnapshotRenderValue(mrbfsNode, fileNode);
+					free(valueName);
+					valuesRendered++;
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+	return(valuesRendered);
+}
+
+// Must be called with the node's nodeLock held
+static void mrbfsSnapshotRenderNode(MRBFSBusNode* mrbfsNode)
+{
+	UINT32 valueGeneration = __atomic_load_n(&mrbfsNode->valueGeneration, __ATOMIC_ACQUIRE);
+
+	if (NULL != mrbfsNode->snapshotJson && valueGeneration == mrbfsNode->snapshotGeneration)
+		return;
+
+	mrbfsNode->snapshotJsonLen = 0;
+	mrbfsSnapshotAppendStr(&mrbfsNode->snapshotJson, &mrbfsNode->snapshotJsonLen, &mrbfsNode->snapshotJsonSz,
+		mrbfsNode->baseFileNode->fileName, strlen(mrbfsNode->baseFileNode->fileName));
+	mrbfsSnapshotAppend(&mrbfsNode->snapshotJson, &mrbfsNode->snapshotJsonLen, &mrbfsNode->snapshotJsonSz, ":{\"name\":");
+	mrbfsSnapshotAppendStr(&mrbfsNode->snapshotJson, &mrbfsNode->snapshotJsonLen, &mrbfsNode->snapshotJsonSz,
+		mrbfsNode->nodeName, strlen(mrbfsNode->nodeName));
+	mrbfsSnapshotAppend(&mrbfsNode->snapshotJson, &mrbfsNode->snapshotJsonLen, &mrbfsNode->snapshotJsonSz,
+		",\"address\":\"0x%02X\",\"generation\":%u,\"values\":{", mrbfsNode->address, valueGeneration);
+	mrbfsSnapshotRenderFiles(mrbfsNode, mrbfsNode->baseFileNode, "", 0);
+	mrbfsSnapshotAppend(&mrbfsNode->snapshotJson, &mrbfsNode->snapshotJsonLen, &mrbfsNode->snapshotJsonSz, "}}");
+
+	mrbfsNode->snapshotGeneration = valueGeneration;
+}
+
+static void mrbfsSnapshotRenderBus(MRBFSSnapshot* snapshot, MRBFSBus* bus, time_t currentTime)
+{
+	int nodeNumber, nodesRendered = 0;
+
+	mrbfsSnapshotAppend(&snapshot->json, &snapshot->jsonLen, &snapshot->jsonSz, "{\"bus\":%d,", bus->bus);
+	if (snapshot->snapshotFile->bus >= 0)
+		mrbfsSnapshotAppend(&snapshot->json, &snapshot->jsonLen, &snapshot->jsonSz, "\"timestamp\":%ld,", (long)currentTime);
+	mrbfsSnapshotAppend(&snapshot->json, &snapshot->jsonLen, &snapshot->jsonSz, "\"nodes\":{");
+
+	pthread_mutex_lock(&bus->busLock);
+	for(nodeNumber=0; nodeNumber<MRBFS_MAX_BUS_NODES; nodeNumber++)
+	{
+		MRBFSBusNode* node = bus->node[nodeNumber];
+		if (NULL == node || NULL == node->baseFileNode)
+			continue;
+
+		pthread_mutex_lock(&node->nodeLock);
+		mrbfsSnapshotRenderNode(node);
+		if (NULL != node->snapshotJson)
+		{
+			mrbfsSnapshotAppend(&snapshot->json, &snapshot->jsonLen, &snapshot->jsonSz, "%s\n  %.*s",
+				nodesRendered?",":"", (int)node->snapshotJsonLen, node->snapshotJson);
+			nodesRendered++;
+		}
+		pthread_mutex_unlock(&node->nodeLock);
+	}
+	pthread_mutex_unlock(&bus->busLock);
+
+	mrbfsSnapshotAppend(&snapshot->json, &snapshot->jsonLen, &snapshot->jsonSz, "}}");
+}
+
+static void mrbfsSnapshotRender(MRBFSSnapshot* snapshot)
+{
+	MRBFSSnapshotFile* snapshotFile = snapshot->snapshotFile;
+	time_t currentTime = time(NULL);
+	int busNumber, busesRendered = 0;
+
+	snapshot->jsonLen = 0;
+
+	if (snapshotFile->bus >= 0)
+	{
+		if (NULL != gMrbfsConfig->bus[snapshotFile->bus])
+			mrbfsSnapshotRenderBus(snapshot, gMrbfsConfig->bus[snapshotFile->bus], currentTime);
+		mrbfsSnapshotAppend(&snapshot->json, &snapshot->jsonLen, &snapshot->jsonSz, "\n");
+		return;
+	}
+
+	mrbfsSnapshotAppend(&snapshot->json, &snapshot->jsonLen, &snapshot->jsonSz, "{\"timestamp\":%ld,\"buses\":[", (long)currentTime);
+	for(busNumber=0; busNumber<MRBFS_MAX_BUS_NODES; busNumber++)
+	{
+		if (NULL == gMrbfsConfig->bus[busNumber])
+			continue;
+		mrbfsSnapshotAppend(&snapshot->json, &snapshot->jsonLen, &snapshot->jsonSz, "%s\n ", busesRendered?",":"");
+		mrbfsSnapshotRenderBus(snapshot, gMrbfsConfig->bus[busNumber], currentTime);
+		busesRendered++;
+	}
+	mrbfsSnapshotAppend(&snapshot->json, &snapshot->jsonLen, &snapshot->jsonSz, "]}\n");
+}
+
+MRBFSSnapshot* mrbfsSnapshotOpen(MRBFSFileNode* mrbfsFileNode)
+{
+	MRBFSSnapshot* snapshot;
+
+	if (NULL == mrbfsFileNode->nodeLocalStorage || NULL == (snapshot = calloc(1, sizeof(MRBFSSnapshot))))
+		return(NULL);
+	snapshot->snapshotFile = (MRBFSSnapshotFile*)mrbfsFileNode->nodeLocalStorage;
+	return(snapshot);
+}
+
+int mrbfsSnapshotRead(MRBFSSnapshot* snapshot, char* buf, size_t size, off_t offset)
+{
+	// A read pass starts at offset 0 - render once then, and serve the rest of the pass from the copy
+	if (0 == offset || NULL == snapshot->json)
+		mrbfsSnapshotRender(snapshot);
+
+	if (NULL != snapshot->json && offset < snapshot->jsonLen)
+	{
+		if (offset + size > snapshot->jsonLen)
+			size = snapshot->jsonLen - offset;
+		memcpy(buf, snapshot->json + offset, size);
+	} else
+		size = 0;
+
+	return(size);
+}
+
+void mrbfsSnapshotRelease(MRBFSSnapshot* snapshot)
+{
+	free(snapshot->json);
+	free(snapshot);
+}
+
+// Adds snapshot.json at insertionPath, covering one bus, or everything if bus is -1
+MRBFSFileNode* mrbfsSnapshotAddFile(int bus, const char* insertionPath)
+{
+	MRBFSSnapshotFile* snapshotFile = calloc(1, sizeof(MRBFSSnapshotFile));
+	MRBFSFileNode* fileNode = NULL;
+
+	if (NULL == snapshotFile)
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Calloc() failed on snapshot file at [%s]", insertionPath);
+		return(NULL);
+	}
+
+	snapshotFile->bus = bus;
+	fileNode = mrbfsFilesystemAddFile("snapshot.json", FNODE_RO_VALUE_SNAPSHOT, insertionPath);
+	if (NULL == fileNode)
+	{
+		free(snapshotFile);
+		return(NULL);
+	}
+
+	fileNode->nodeLocalStorage = (void*)snapshotFile;
+	return(fileNode);
+}
+
+void mrbfsSnapshotNodeRelease(MRBFSBusNode* mrbfsNode)
+{
+	free(mrbfsNode->snapshotJson);
+	mrbfsNode->snapshotJson = NULL;
+	mrbfsNode->snapshotJsonLen = mrbfsNode->snapshotJsonSz = 0;
+}
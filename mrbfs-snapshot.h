@@ -0,0 +1,10 @@
+#ifndef _MRBFS_SNAPSHOT_H
+#define _MRBFS_SNAPSHOT_H
+
+MRBFSFileNode* mrbfsSnapshotAddFile(int bus, const char* insertionPath);
+MRBFSSnapshot* mrbfsSnapshotOpen(MRBFSFileNode* mrbfsFileNode);
+int mrbfsSnapshotRead(MRBFSSnapshot* snapshot, char* buf, size_t size, off_t offset);
+void mrbfsSnapshotRelease(MRBFSSnapshot* snapshot);
+void mrbfsSnapshotNodeRelease(MRBFSBusNode* mrbfsNode);
+
+#endif
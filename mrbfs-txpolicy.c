@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <unistd.h>
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-log.h"
+#include "mrbfs-filesys.h"
+#include "mrbfs-txpolicy.h"
+
+/* Transmit policies
+
+ Which of a bus's interfaces a packet goes out on, set per bus in the config:
+
+   bus 0
+   {
+      transmit-policy = "failover"
+   }
+
+   all           every interface sends every packet (the default, and how
+                 mrbfs always behaved)
+   failover      the first interface configured for the bus sends everything,
+                 the next one takes over while it's down
+   round-robin   interfaces take turns
+   least-queued  whichever has the fewest packets waiting to go out, for
+                 drivers that export mrbfsInterfaceTxQueueDepth - the rest
+                 count as empty
+
+ An interface is down from when its driver calls mrbfsInterfaceReportHealth
+ with 0 (the serial drivers do when they reset their port) until it calls it
+ again with 1.  Drivers that never report are always up.  If every interface
+ on the bus is down, the first one gets the packet anyway, to be sent once it
+ comes back.  Packets already queued in a driver when it goes down stay there.
+
+ <interface>/txPackets counts what each interface was handed to send, and
+ <interface>/txStatus says whether it's up.
+*/
+
+static const char* mrbfsTxPolicyNames[] = { "all", "failover", "round-robin", "least-queued", NULL };
+
+void mrbfsTxPolicyConfigureBus(MRBFSBus* bus)
+{
+	char title[8];
+	const char* policyStr;
+	cfg_t* cfgBus;
+	int i;
+
+	bus->txPolicy = MRBFS_TX_POLICY_ALL;
+
+	sprintf(title, "%d", bus->bus);
+	if (NULL == (cfgBus = cfg_gettsec(gMrbfsConfig->cfgParms, "bus", title)))
+		return;
+
+	policyStr = cfg_getstr(cfgBus, "transmit-policy");
+	for(i=0; NULL != mrbfsTxPolicyNames[i]; i++)
+	{
+		if (0 == strcmp(policyStr, mrbfsTxPolicyNames[i]))
+		{
+			bus->txPolicy = (MRBFSTxPolicy)i;
+			mrbfsLogMessage(MRBFS_LOG_INFO, "Bus [%d] transmit policy is [%s]", bus->bus, policyStr);
+			return;
+		}
+	}
+
+	mrbfsLogMessage(MRBFS_LOG_WARNING, "Bus [%d] has unknown transmit-policy [%s], transmitting on all interfaces", bus->bus, policyStr);
+}
+
+void mrbfsTxPolicyAddInterface(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	mrbfsInterfaceDriver->txHealthy = 1;
+	mrbfsInterfaceDriver->mrbfsInterfaceReportHealth = &mrbfsTxPolicyReportHealth;
+
+	mrbfsInterfaceDriver->file_txPackets = mrbfsFilesystemAddFile("txPackets", FNODE_RO_VALUE_INT, mrbfsInterfaceDriver->path);
+	mrbfsInterfaceDriver->file_txStatus = mrbfsFilesystemAddFile("txStatus", FNODE_RO_VALUE_STR, mrbfsInterfaceDriver->path);
+	if (NULL != mrbfsInterfaceDriver->file_txStatus)
+		mrbfsInterfaceDriver->file_txStatus->value.valueStr = "up\n";
+}
+
+void mrbfsTxPolicyReportHealth(MRBFSInterfaceDriver* mrbfsInterfaceDriver, int healthy)
+{
+	healthy = healthy ? 1 : 0;
+	if (healthy == __atomic_exchange_n(&mrbfsInterfaceDriver->txHealthy, healthy, __ATOMIC_ACQ_REL))
+		return;
+
+	mrbfsLogMessage(healthy?MRBFS_LOG_INFO:MRBFS_LOG_WARNING, "Interface [%s] on bus [%d] is %s for transmit", mrbfsInterfaceDriver->interfaceName, mrbfsInterfaceDriver->bus, healthy?"back up":"down");
+
+	if (NULL != mrbfsInterfaceDriver->file_txStatus)
+	{
+		mrbfsInterfaceDriver->file_txStatus->value.valueStr = healthy ? "up\n" : "down\n";
+		mrbfsInterfaceDriver->file_txStatus->updateTime = time(NULL);
+	}
+}
+
+static void mrbfsTxPolicySend(MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBusPacket* txPkt)
+{
+	UINT32 txPackets;
+
+	mrbfsLogMessage(MRBFS_LOG_DEBUG, "Transmit queueing pkt on Interface [%s], bus[%d]", mrbfsInterfaceDriver->interfaceName, txPkt->bus);
+	(*mrbfsInterfaceDriver->mrbfsInterfacePacketTransmit)(mrbfsInterfaceDriver, txPkt);
+
+	txPackets = __atomic_add_fetch(&mrbfsInterfaceDriver->txPackets, 1, __ATOMIC_RELAXED);
+	if (NULL != mrbfsInterfaceDriver->file_txPackets)
+	{
+		mrbfsInterfaceDriver->file_txPackets->value.valueInt = txPackets;
+		mrbfsInterfaceDriver->file_txPackets->updateTime = time(NULL);
+	}
+}
+
+static int mrbfsTxPolicyQueueDepth(MRBFSInterfaceDriver* mrbfsInterfaceDriver)
+{
+	if (NULL == mrbfsInterfaceDriver->mrbfsInterfaceTxQueueDepth)
+		return(0);
+	return((*mrbfsInterfaceDriver->mrbfsInterfaceTxQueueDepth)(mrbfsInterfaceDriver));
+}
+
+// Picks the interface for one packet from the bus's transmitting interfaces, in config order
+static MRBFSInterfaceDriver* mrbfsTxPolicyChoose(MRBFSBus* bus, MRBFSInterfaceDriver** candidates, int numCandidates)
+{
+	MRBFSInterfaceDriver* chosen = NULL;
+	int i, start = 0, bestDepth = 0;
+
+	if (MRBFS_TX_POLICY_FAILOVER != bus->txPolicy)
+		start = __atomic_fetch_add(&bus->txNext, 1, __ATOMIC_RELAXED) % numCandidates;
+
+	for(i=0; i<numCandidates; i++)
+	{
+		MRBFSInterfaceDriver* candidate = candidates[(start + i) % numCandidates];
+		int depth;
+
+		if (!__atomic_load_n(&candidate->txHealthy, __ATOMIC_ACQUIRE))
+			continue;
+
+		if (MRBFS_TX_POLICY_LEAST_QUEUED != bus->txPolicy)
+			return(candidate);
+
+		// Ties go to whoever is next in the rotation
+		depth = mrbfsTxPolicyQueueDepth(candidate);
+		if (NULL == chosen || depth < bestDepth)
+		{
+			chosen = candidate;
+			bestDepth = depth;
+		}
+	}
+
+	return(chosen);
+}
+
+int mrbfsTxPolicyTransmit(MRBusPacket* txPkt)
+{
+	MRBFSBus* bus = gMrbfsConfig->bus[txPkt->bus];
+	MRBFSInterfaceDriver* candidates[MRBFS_MAX_INTERFACES];
+	MRBFSInterfaceDriver* chosen;
+	int i, numCandidates = 0;
+	UINT8 prevActive;
+
+	for(i=0; i<gMrbfsConfig->mrbfsUsedInterfaces; i++)
+	{
+		MRBFSInterfaceDriver* mrbfsInterfaceDriver = gMrbfsConfig->mrbfsInterfaceDrivers[i];
+
+		if (NULL == mrbfsInterfaceDriver->mrbfsInterfacePacketTransmit)
+			mrbfsLogMessage(MRBFS_LOG_DEBUG, "Non-transmitting interface [%s], skipping", mrbfsInterfaceDriver->interfaceName);
+		else if (txPkt->bus == mrbfsInterfaceDriver->bus)
+			candidates[numCandidates++] = mrbfsInterfaceDriver;
+		else
+			mrbfsLogMessage(MRBFS_LOG_DEBUG, "Transmit skipping interface [%s], bus[%d]", mrbfsInterfaceDriver->interfaceName, txPkt->bus);
+	}
+
+	if (0 == numCandidates || NULL == bus)
+	{
+		mrbfsLogMessage(MRBFS_LOG_DEBUG, "No interface can transmit on bus [%d], dropping packet", txPkt->bus);
+		return(0);
+	}
+
+	if (MRBFS_TX_POLICY_ALL == bus->txPolicy)
+	{
+		for(i=0; i<numCandidates; i++)
+			mrbfsTxPolicySend(candidates[i], txPkt);
+		return(0);
+	}
+
+	if (NULL == (chosen = mrbfsTxPolicyChoose(bus, candidates, numCandidates)))
+	{
+		chosen = candidates[0];
+		mrbfsLogMessage(MRBFS_LOG_WARNING, "Every interface on bus [%d] is down, queueing on [%s] anyway", txPkt->bus, chosen->interfaceName);
+	}
+
+	prevActive = __atomic_exchange_n(&bus->txActive, chosen->interfaceId, __ATOMIC_RELAXED);
+	if (MRBFS_TX_POLICY_FAILOVER == bus->txPolicy && 0 != prevActive && prevActive != chosen->interfaceId)
+		mrbfsLogMessage(MRBFS_LOG_WARNING, "Bus [%d] transmit moving from interface [%s] to [%s]", txPkt->bus, gMrbfsConfig->mrbfsInterfaceDrivers[prevActive-1]->interfaceName, chosen->interfaceName);
+
+	mrbfsTxPolicySend(chosen, txPkt);
+	return(0);
+}
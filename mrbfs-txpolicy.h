@@ -0,0 +1,9 @@
+#ifndef _MRBFS_TXPOLICY_H
+#define _MRBFS_TXPOLICY_H
+
+void mrbfsTxPolicyConfigureBus(MRBFSBus* bus);
+void mrbfsTxPolicyAddInterface(MRBFSInterfaceDriver* mrbfsInterfaceDriver);
+void mrbfsTxPolicyReportHealth(MRBFSInterfaceDriver* mrbfsInterfaceDriver, int healthy);
+int mrbfsTxPolicyTransmit(MRBusPacket* txPkt);
+
+#endif
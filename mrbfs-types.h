@@ -19,8 +19,8 @@
 
 #define MRBFS_VERSION "0.0.1"
 
-#define MRBFS_INTERFACE_DRIVER_VERSION   0x01000001
-#define MRBFS_NODE_DRIVER_VERSION        0x02000001
+#define MRBFS_INTERFACE_DRIVER_VERSION   0x01000005
+#define MRBFS_NODE_DRIVER_VERSION        0x0200000B
 
 typedef uint32_t UINT32 ;
 typedef uint8_t UINT8 ;
@@ -46,13 +46,27 @@ typedef struct
 {
 	char* key;
 	char* value;
+	UINT32 keyHash;
+	UINT8 referenced;
 } MRBFSModuleOption;
 
+// Options for a node or interface, hash indexed once at load time
+// hashIndex holds (optionList index + 1), with 0 marking an empty slot
+typedef struct
+{
+	int options;
+	MRBFSModuleOption* optionList;
+	UINT32 hashMask;
+	int* hashIndex;
+	const char* ownerName;
+	int (*mrbfsLogMessage)(mrbfsLogLevel, const char*, ...);
+} MRBFSModuleOptionTable;
+
 typedef struct
 {
 	UINT8 bus;
 	UINT8 len;
-	UINT8 srcInterface;
+	UINT8 srcInterface;   // Receiving interface's interfaceId, 0 if unknown
 	UINT8 pkt[MRBFS_MAX_PACKET_LEN];
 } MRBusPacket;
 
@@ -94,9 +108,24 @@ typedef enum
 	FNODE_RW_VALUE_INT      = 6,
 	FNODE_RO_VALUE_READBACK = 7,
 	FNODE_RW_VALUE_READBACK = 8,
+	FNODE_RO_VALUE_STREAM   = 9,
+	FNODE_RW_VALUE_QUERY    = 10,
+	FNODE_RO_PACKET_STREAM  = 11,
+	FNODE_RW_VALUE_HISTORY  = 12,
+	FNODE_RO_VALUE_SNAPSHOT = 13,
 	FNODE_END_OF_LIST
 } MRBFSFileNodeType;
 
+struct MRBFSHistorySeries;
+struct MRBFSOpenFile;
+
+// Sequence count guarding a node's value buffers - see mrbfs-seqlock.c
+typedef struct
+{
+	UINT32 seq;       // Bumped as each writer finishes
+	UINT32 writers;   // Writers currently updating values
+} MRBFSSeqLock;
+
 typedef struct MRBFSFileNode
 {
 	char* fileName;
@@ -110,16 +139,166 @@ typedef struct MRBFSFileNode
 	void (*mrbfsFileNodeWrite)(struct MRBFSFileNode*, const char* data, int dataSz);
 	size_t (*mrbfsFileNodeRead)(struct MRBFSFileNode* mrbfsFileNode, char *buf, size_t size, off_t offset);
 	void* nodeLocalStorage;
+	struct MRBFSHistorySeries* history;
+	MRBFSSeqLock* valueSeq;        // The owning node's, NULL for files outside of nodes
+	UINT32 changeGeneration;       // Maintained by the core for poll(), only while someone is polling
+	UINT32 changeFingerprint;
+	UINT32 cacheGeneration;        // changeGeneration the kernel's cached pages were read at
+	UINT8 cacheValid;
+	struct MRBFSOpenFile* pollers;
 	struct MRBFSFileNode* childPtr;
 	struct MRBFSFileNode* siblingPtr;
 } MRBFSFileNode;
 
+// Serial port settings for the serial interface drivers - see mrbfs-serial.c
+typedef struct
+{
+	int baud;
+	int hwFlowControl;
+	int lowLatency;
+	int vmin;
+	int vtime;
+	const char* serialNumber;  // Find the adapter under /dev/serial/by-id instead of using port
+	int txBudgetMs;            // Longest a batch of transmits should hold the port, at baud
+	int txGapMs;               // Idle time between packets, 0 to write a batch all at once
+	UINT32 openFailures;
+} MRBFSSerialConfig;
+
+// Reconnection state for a serial interface driver's port - see mrbfs-serial.c
+typedef enum
+{
+	MRBFS_SERIAL_OUTAGE_HOLD = 0,
+	MRBFS_SERIAL_OUTAGE_DROP
+} MRBFSSerialOutageTx;
+
+typedef struct
+{
+	MRBusPacketQueue* txq;
+	MRBFSSerialOutageTx outageTx;
+	UINT32 reconnectMinMs;
+	UINT32 reconnectMaxMs;
+	int down;
+	UINT32 backoffMs;
+	UINT32 attempts;
+	uint64_t downSinceMs;
+	uint64_t nextAttemptMs;
+	UINT32 outages;
+	UINT32 outageSeconds;
+	UINT32 txDropped;
+	MRBFSFileNode* file_outages;
+	MRBFSFileNode* file_outageSeconds;
+	MRBFSFileNode* file_lastOutageSeconds;
+	MRBFSFileNode* file_txDropped;
+} MRBFSSerialLink;
+
 typedef void (*mrbfsFileNodeWriteCallback)(struct MRBFSFileNode*, const char* data, int dataSz);
 typedef size_t (*mrbfsFileNodeReadCallback)(struct MRBFSFileNode* mrbfsFileNode, char *buf, size_t size, off_t offset);
 
+struct MRBFSBusNode;
+
+// On-disk history record - files are a MRBFSHistoryFileHeader followed by an append-only array of these
+typedef struct
+{
+	int64_t sampleTime;  // Milliseconds since the epoch
+	double value;
+} MRBFSHistoryRecord;
+
+#define MRBFS_HISTORY_MAGIC          0x4842524D
+#define MRBFS_HISTORY_FILE_VERSION   1
+#define MRBFS_HISTORY_HEADER_SZ      64
+#define MRBFS_HISTORY_GROW_RECORDS   4096
+
+typedef struct
+{
+	UINT32 magic;
+	UINT32 version;
+	UINT32 headerSize;
+	UINT32 recordSize;
+	uint64_t records;
+} MRBFSHistoryFileHeader;
+
+// Tumbling window aggregates kept alongside each history series
+#define MRBFS_ROLLUP_MINUTE        0
+#define MRBFS_ROLLUP_HOUR          1
+#define MRBFS_ROLLUP_LEVELS        2
+#define MRBFS_ROLLUP_MINUTE_KEEP   60
+#define MRBFS_ROLLUP_HOUR_KEEP     48
+
+typedef struct
+{
+	int64_t windowStart;  // ms since the epoch, aligned to the window length
+	UINT32 count;
+	double min;
+	double max;
+	double sum;
+} MRBFSRollupWindow;
+
+typedef struct
+{
+	int64_t windowMs;
+	MRBFSRollupWindow current;
+	MRBFSRollupWindow* completed;  // Ring of the most recently closed windows
+	int completedSz;
+	int completedHead;
+	int completedUsed;
+	struct MRBFSHistorySeries* series;
+	MRBFSFileNode* file_rollup;
+} MRBFSRollup;
+
+typedef struct MRBFSHistorySeries
+{
+	char* seriesName;
+	pthread_mutex_t seriesLock;
+	int fd;
+	MRBFSHistoryFileHeader* header;  // NULL when no history-directory is configured - rollups still run
+	size_t mapSize;
+	uint64_t capacity;
+	int64_t lastSampleTime;
+	struct MRBFSBusNode* node;
+	MRBFSFileNode* file_value;
+	MRBFSFileNode* file_history;
+	MRBFSRollup rollup[MRBFS_ROLLUP_LEVELS];
+	void (*mrbfsHistoryPublish)(struct MRBFSHistorySeries* series, double value);
+	struct MRBFSHistorySeries* next;
+} MRBFSHistorySeries;
+
+// Per open() reader state for <node>/history/<file> - the time range it asked for, and
+// how far through rendering the CSV it has got
+typedef struct
+{
+	MRBFSHistorySeries* series;
+	int64_t rangeStart;   // In ms - 0 means unbounded
+	int64_t rangeEnd;
+	uint64_t nextRecord;  // Next record to render
+	uint64_t lastRecord;  // End of the current read pass, fixed when the pass starts
+	off_t offset;         // CSV offset of line[linePos]
+	char line[64];        // Worst case is "-9223372036854775.808,-1.7976931348623157e+308\n"
+	int lineLen;
+	int linePos;
+} MRBFSHistoryCursor;
+
+// Entry points exported by a node driver module, resolved once per module
+typedef struct
+{
+	int (*mrbfsNodeInit)(struct MRBFSBusNode*);
+	int (*mrbfsNodeTick)(struct MRBFSBusNode*, time_t currentTime);
+	int (*mrbfsNodeRxPacket)(struct MRBFSBusNode* mrbfsNode, MRBusPacket* rxPkt);
+	int (*mrbfsNodeDestroy)(struct MRBFSBusNode*);
+} MRBFSNodeDriver;
+
+typedef struct MRBFSNodeModule
+{
+	char* modulePath;
+	void* moduleHandle;
+	UINT32 refCount;
+	MRBFSNodeDriver driver;
+	struct MRBFSNodeModule* next;
+} MRBFSNodeModule;
+
 typedef struct MRBFSBusNode
 {
-	void* nodeDriverHandle;
+	MRBFSNodeModule* nodeModule;
+	const MRBFSNodeDriver* nodeDriver;
 	char* nodeName;
   	pthread_mutex_t nodeLock;
 	UINT8 bus;
@@ -127,8 +306,18 @@ typedef struct MRBFSBusNode
 	void* nodeLocalStorage;
 	char* path;
 	MRBFSFileNode* baseFileNode;
-	int nodeOptions;
-	MRBFSModuleOption* nodeOptionList;
+	MRBFSModuleOptionTable nodeOptions;
+	MRBFSHistorySeries* historySeries;
+	MRBFSFileNode* file_watch;
+
+	// Bumped (atomically) whenever the node's values may have changed, snapshot.json only
+	// re-renders a node's fragment when this moves past snapshotGeneration
+	UINT32 valueGeneration;
+	UINT32 snapshotGeneration;
+	MRBFSSeqLock valueSeq;
+	char* snapshotJson;
+	size_t snapshotJsonLen;
+	size_t snapshotJsonSz;
 	
 
 	// Function pointers from main to the node module
@@ -136,22 +325,36 @@ typedef struct MRBFSBusNode
 	MRBFSNode* (*mrbfsGetNode)(UINT8);
 	MRBFSFileNode* (*mrbfsFilesystemAddFile)(const char* fileName, MRBFSFileNodeType fileType, const char* insertionPath);
 	int (*mrbfsNodeTxPacket)(MRBusPacket* txPkt);
+	MRBFSHistorySeries* (*mrbfsHistoryAttach)(struct MRBFSBusNode* mrbfsNode, MRBFSFileNode* valueFile);
 
-	// Function pointers from the node to main
-	int (*mrbfsNodeInit)(struct MRBFSBusNode*);
-	int (*mrbfsNodeTick)(struct MRBFSBusNode*, time_t currentTime);	
-	int (*mrbfsNodeRxPacket)(struct MRBFSBusNode* mrbfsNode, MRBusPacket* rxPkt);
-	int (*mrbfsNodeDestroy)(struct MRBFSBusNode*);
-	
+	// Function pointers from the node to main live in nodeDriver, shared by every node using the module
 } MRBFSBusNode;
 
 
 
+// Recently received packets, for dropping the copies redundant receivers hand in - see mrbfs-dedup.c
+// Note: MRBFS_DEDUP_SLOTS must be a power of 2
+#define MRBFS_DEDUP_SLOTS  256
+
+// How a bus with several interfaces picks the one to send each packet on - see mrbfs-txpolicy.c
+typedef enum
+{
+	MRBFS_TX_POLICY_ALL = 0,
+	MRBFS_TX_POLICY_FAILOVER,
+	MRBFS_TX_POLICY_ROUND_ROBIN,
+	MRBFS_TX_POLICY_LEAST_QUEUED
+} MRBFSTxPolicy;
+
 typedef struct
 {
 	UINT8 bus;
 	MRBFSBusNode* node[MRBFS_MAX_BUS_NODES];
   	pthread_mutex_t busLock;
+	uint64_t dedupSlots[MRBFS_DEDUP_SLOTS];
+	MRBFSTxPolicy txPolicy;
+	UINT32 txNext;        // Round robin position
+	UINT8 txActive;       // interfaceId last transmitted on, for noticing failovers
+	uint64_t bridgedSlots[MRBFS_DEDUP_SLOTS];  // Packets the bridge recently sent onto this bus
 } MRBFSBus;
 
 
@@ -164,10 +367,12 @@ typedef struct MRBFSInterfaceDriver
 	char* port;
 	UINT8 bus;
 	UINT8 addr;
+	UINT8 interfaceId;  // Slot + 1, stamped into srcInterface of received packets
 	UINT8 terminate;
+	UINT8 threadRunning;
+	int shutdownFd;     // Becomes readable when terminate is set, for drivers to poll() on
 
-	int interfaceOptions;
-	MRBFSModuleOption* interfaceOptionList;
+	MRBFSModuleOptionTable interfaceOptions;
 
 	char* path;
 	MRBFSFileNode* baseFileNode;
@@ -183,10 +388,41 @@ typedef struct MRBFSInterfaceDriver
 	void (*mrbfsInterfaceDriverInit)(struct MRBFSInterfaceDriver* mrbfsInterfaceDriver);
 	void (*mrbfsInterfaceDriverRun)(struct MRBFSInterfaceDriver* mrbfsInterfaceDriver);
 	void (*mrbfsInterfacePacketTransmit)(struct MRBFSInterfaceDriver* mrbfsInterfaceDriver, MRBusPacket* txPkt);
+	int (*mrbfsInterfaceTxQueueDepth)(struct MRBFSInterfaceDriver* mrbfsInterfaceDriver);  // Optional
 	void* moduleLocalStorage;
+
+	// Transmit policy state, kept by the core
+	UINT8 txHealthy;
+	UINT32 txPackets;
+	MRBFSFileNode* file_txPackets;
+	MRBFSFileNode* file_txStatus;
+
+	// Drivers call this when they lose (0) or regain (1) their port, so transmits fail over
+	void (*mrbfsInterfaceReportHealth)(struct MRBFSInterfaceDriver* mrbfsInterfaceDriver, int healthy);
 	
 } MRBFSInterfaceDriver;
 
+// One bridge section from the config - see mrbfs-bridge.c
+typedef struct
+{
+	char* ruleName;
+	UINT8 fromBus;
+	UINT8 toBus;
+	UINT32 srcMatch[8];    // Bitmaps of the source addresses, destination addresses and packet types forwarded
+	UINT32 destMatch[8];
+	UINT32 typeMatch[8];
+	UINT32 rateLimit;      // Packets per second, 0 for no limit
+	double tokens;
+	uint64_t lastRefillUsec;
+	pthread_mutex_t rateLock;
+	UINT32 forwarded;
+	UINT32 rateLimited;
+	UINT32 loopsBlocked;
+	MRBFSFileNode* file_forwarded;
+	MRBFSFileNode* file_rateLimited;
+	MRBFSFileNode* file_loopsBlocked;
+} MRBFSBridgeRule;
+
 typedef struct
 {
 	const char* clockNameStr;
@@ -196,6 +432,125 @@ typedef struct
 	int localTime;
 } MRBFSClock;
 
+// Change records for the watch stream files - one ring shared by every reader
+// Note: MRBFS_WATCH_RING_SIZE must be a power of 2
+#define MRBFS_WATCH_RING_SIZE     1024
+#define MRBFS_WATCH_RECORD_SZ     120
+
+typedef struct
+{
+	uint64_t seq;
+	UINT8 bus;
+	UINT8 address;
+	UINT8 len;
+	char text[MRBFS_WATCH_RECORD_SZ];
+} MRBFSWatchRecord;
+
+typedef struct
+{
+	pthread_mutex_t watchLock;
+	uint64_t nextSeq;
+	MRBFSWatchRecord records[MRBFS_WATCH_RING_SIZE];
+} MRBFSWatchRing;
+
+// What a watch file covers - address is -1 for a whole bus
+typedef struct
+{
+	int bus;
+	int address;
+	pthread_cond_t watchCond;  // This file's blocked readers wait here, under watchLock
+} MRBFSWatchFilter;
+
+// Per open() reader state, hung off fuse_file_info->fh
+typedef struct
+{
+	MRBFSWatchFilter* filter;
+	uint64_t cursor;
+} MRBFSWatchCursor;
+
+// Raw packet capture, one ring per bus - see mrbfs-capture.c
+// Note: MRBFS_CAPTURE_RING_SIZE must be a power of 2
+#define MRBFS_CAPTURE_RING_SIZE   4096
+#define MRBFS_CAPTURE_RX          0
+#define MRBFS_CAPTURE_TX          1
+
+typedef struct
+{
+	uint64_t seq;
+	UINT32 tsSec;
+	UINT32 tsUsec;
+	UINT8 direction;
+	UINT8 srcInterface;
+	UINT8 len;
+	UINT8 pkt[MRBFS_MAX_PACKET_LEN];
+} MRBFSCaptureRecord;
+
+typedef struct
+{
+	UINT8 bus;
+	pthread_mutex_t captureLock;
+	pthread_cond_t captureCond;
+	uint64_t nextSeq;
+	uint64_t writtenSeq;      // Next record the file writer wants
+	uint64_t dropped;         // Records the file writer lost to overruns
+	FILE* file;
+	char* filePath;
+	size_t fileBytes;
+	MRBFSFileNode* file_capture;
+	MRBFSCaptureRecord records[MRBFS_CAPTURE_RING_SIZE];
+} MRBFSCapture;
+
+// Per open() reader state for /busN/capture
+typedef struct
+{
+	MRBFSCapture* capture;
+	uint64_t cursor;
+	UINT8 headerSent;
+} MRBFSCaptureCursor;
+
+// Backing store for /snapshot.json (bus = -1) and /busN/snapshot.json
+typedef struct
+{
+	int bus;
+} MRBFSSnapshotFile;
+
+// Per open() state for a snapshot file - the document rendered for the current read pass
+typedef struct
+{
+	MRBFSSnapshotFile* snapshotFile;
+	char* json;           // Rebuilt at offset 0
+	size_t jsonLen;
+	size_t jsonSz;
+} MRBFSSnapshot;
+
+struct fuse_pollhandle;
+
+// Per open() state for the query file - the request written so far and the last response
+typedef struct
+{
+	char* request;
+	size_t requestLen;
+	size_t requestSz;
+	char* response;
+	size_t responseLen;
+	size_t responseSz;
+} MRBFSQuery;
+
+// Per open() state for every file, hung off fuse_file_info->fh
+typedef struct MRBFSOpenFile
+{
+	MRBFSFileNode* fileNode;
+	UINT32 changeSeen;             // fileNode->changeGeneration as of the last read
+	UINT8 polling;                 // On fileNode's poller list
+	struct fuse_pollhandle* pollHandle;
+	MRBFSWatchCursor* watchCursor; // Only for stream files
+	MRBFSQuery* query;             // Only for query files
+	MRBFSCaptureCursor* captureCursor; // Only for packet stream files
+	MRBFSHistoryCursor* historyCursor; // Only for history files
+	MRBFSSnapshot* snapshot;       // Only for snapshot files
+	struct MRBFSOpenFile* nextPoller;
+} MRBFSOpenFile;
+
 #define BUS_TX_INPUT_BUFFER_SZ  2048
 
 typedef struct
@@ -223,9 +578,30 @@ typedef struct
 	MRBFSBus* bus[MRBFS_MAX_BUS_NODES];
 	MRBFSFileNode* bus_filePktTransmit[MRBFS_MAX_BUS_NODES];
   	pthread_mutex_t masterLock;
+	MRBFSNodeModule* nodeModules;
+	pthread_mutex_t moduleLock;
 	MRBFSFileNode* rootNode;
 	pthread_mutex_t fsLock;
+	char* historyDirectory;
+	MRBFSWatchRing* watchRing;
+	MRBFSFileNode* bus_fileWatch[MRBFS_MAX_BUS_NODES];
+	pthread_mutex_t pollLock;
+	UINT32 pollersActive;
+	UINT8 kernelCache;
+	MRBFSCapture* busCapture[MRBFS_MAX_BUS_NODES];
+	char* captureDirectory;
+	size_t captureRotateBytes;
+	int captureKeep;
+	pthread_t captureThread;
+	UINT32 dedupWindowMs;
+	MRBFSFileNode* file_rxPackets;
+	MRBFSFileNode* file_rxDuplicates;
+	MRBFSBridgeRule* bridgeRules;
+	int bridgeRuleCount;
+	UINT32 bridgeLoopWindowMs;
 	pthread_t tickerThread;
+	int shutdownFd;
+	UINT32 shutdownTimeoutMs;
 
 	UINT8 terminate;
 	
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <confuse.h>
+#include "mrbfs.h"
+#include "mrbfs-log.h"
+#include "mrbfs-filesys.h"
+#include "mrbfs-watch.h"
+#include "mrbfs-poll.h"
+
+/* Watch streams
+
+ <node>/watch and /busN/watch let a consumer wait for changes instead of
+ polling mtimes.  read() blocks until something happens on that node or bus.
+ It then returns newline-delimited change records:
+
+   1700000000.123 /bus0/0x10-shed/temperature 41.2
+   1700000000.123 /bus0/0x10-shed packet FE 10 0E 5A 3C 53 ...
+
+ "value" records come from the same publish path as the history series.
+ "packet" records are emitted for every packet dispatched to a node.
+
+ Every record goes into one fixed ring, no matter how many watch files are
+ open.  Each open() gets its own cursor holding the next sequence number it
+ wants.  A reader only copies out the records that match its node or bus.  A reader that falls more than a ring behind gets a
+ "# lost N records" line and resumes at the oldest record still held.
+
+ Blocked readers wait on their watch file's own condition variable, so a
+ record only wakes readers of its node's watch file and its bus's.
+
+ A blocked reader holds a FUSE worker thread, so this needs the default
+ multithreaded loop (don't mount with -s).
+*/
+
+void mrbfsWatchInitialize()
+{
+	MRBFSWatchRing* watchRing = calloc(1, sizeof(MRBFSWatchRing));
+	pthread_mutexattr_t lockAttr;
+
+	if (NULL == watchRing)
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Calloc() failed on watch ring, watch files disabled");
+		return;
+	}
+
+	pthread_mutexattr_init(&lockAttr);
+	pthread_mutexattr_settype(&lockAttr, PTHREAD_MUTEX_ADAPTIVE_NP);
+	pthread_mutex_init(&watchRing->watchLock, &lockAttr);
+	pthread_mutexattr_destroy(&lockAttr);
+
+	gMrbfsConfig->watchRing = watchRing;
+}
+
+static void mrbfsWatchWake(MRBFSFileNode* watchFile)
+{
+	if (NULL != watchFile && NULL != watchFile->nodeLocalStorage)
+		pthread_cond_broadcast(&((MRBFSWatchFilter*)watchFile->nodeLocalStorage)->watchCond);
+}
+
+void mrbfsWatchPublish(UINT8 bus, UINT8 address, const char* fmt, ...)
+{
+	MRBFSWatchRing* watchRing = gMrbfsConfig->watchRing;
+	MRBFSFileNode* nodeWatchFile = NULL;
+	MRBFSWatchRecord* record;
+	char text[MRBFS_WATCH_RECORD_SZ];
+	struct timespec now;
+	va_list args;
+	int len;
+
+	if (NULL == watchRing)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	len = snprintf(text, sizeof(text), "%ld.%03ld ", (long)now.tv_sec, now.tv_nsec / 1000000);
+
+	va_start(args, fmt);
+	len += vsnprintf(text + len, sizeof(text) - len, fmt, args);
+	va_end(args);
+
+	// Always newline terminated, even if the record got truncated
+	if (len > sizeof(text) - 2)
+		len = sizeof(text) - 2;
+	text[len++] = '\n';
+
+	if (NULL != gMrbfsConfig->bus[bus] && NULL != gMrbfsConfig->bus[bus]->node[address])
+		nodeWatchFile = gMrbfsConfig->bus[bus]->node[address]->file_watch;
+
+	pthread_mutex_lock(&watchRing->watchLock);
+	record = &watchRing->records[watchRing->nextSeq & (MRBFS_WATCH_RING_SIZE-1)];
+	record->seq = watchRing->nextSeq++;
+	record->bus = bus;
+	record->address = address;
+	record->len = len;
+	memcpy(record->text, text, len);
+	mrbfsWatchWake(gMrbfsConfig->bus_fileWatch[bus]);
+	mrbfsWatchWake(nodeWatchFile);
+	pthread_mutex_unlock(&watchRing->watchLock);
+
+	// Wake up anyone poll()ing the watch files this record shows up in
+	mrbfsPollNotify(gMrbfsConfig->bus_fileWatch[bus]);
+	if (NULL != nodeWatchFile)
+		mrbfsPollNotify(nodeWatchFile);
+}
+
+void mrbfsWatchPublishPacket(MRBFSBusNode* mrbfsNode, MRBusPacket* rxPkt)
+{
+	char hexStr[MRBFS_MAX_PACKET_LEN * 3 + 1];
+	int i;
+
+	if (NULL == gMrbfsConfig->watchRing)
+		return;
+
+	hexStr[0] = 0;
+	for(i=0; i<rxPkt->len && i<MRBFS_MAX_PACKET_LEN; i++)
+		sprintf(hexStr + i*3, "%02X ", rxPkt->pkt[i]);
+	if (i > 0)
+		hexStr[i*3 - 1] = 0;
+
+	mrbfsWatchPublish(mrbfsNode->bus, mrbfsNode->address, "%s packet %s", mrbfsNode->path, hexStr);
+}
+
+// Readers only see what happens after they open
+MRBFSWatchCursor* mrbfsWatchOpen(MRBFSFileNode* mrbfsFileNode)
+{
+	MRBFSWatchFilter* filter = (MRBFSWatchFilter*)mrbfsFileNode->nodeLocalStorage;
+	MRBFSWatchCursor* cursor;
+
+	if (NULL == filter || NULL == gMrbfsConfig->watchRing)
+		return(NULL);
+
+	if (NULL == (cursor = calloc(1, sizeof(MRBFSWatchCursor))))
+		return(NULL);
+
+	cursor->filter = filter;
+
+	pthread_mutex_lock(&gMrbfsConfig->watchRing->watchLock);
+	cursor->cursor = gMrbfsConfig->watchRing->nextSeq;
+	pthread_mutex_unlock(&gMrbfsConfig->watchRing->watchLock);
+
+	return(cursor);
+}
+
+void mrbfsWatchRelease(MRBFSWatchCursor* cursor)
+{
+	free(cursor);
+}
+
+static int mrbfsWatchMatch(MRBFSWatchFilter* filter, MRBFSWatchRecord* record)
+{
+	if (filter->bus != record->bus)
+		return(0);
+	if (-1 != filter->address && filter->address != record->address)
+		return(0);
+	return(1);
+}
+
+// Non-blocking check for poll() - is there anything for this reader yet?
+int mrbfsWatchPending(MRBFSWatchCursor* cursor)
+{
+	MRBFSWatchRing* watchRing = gMrbfsConfig->watchRing;
+	uint64_t seq;
+	int pending = 0;
+
+	if (NULL == cursor || NULL == watchRing)
+		return(0);
+
+	pthread_mutex_lock(&watchRing->watchLock);
+	seq = cursor->cursor;
+	if (watchRing->nextSeq > MRBFS_WATCH_RING_SIZE && seq < watchRing->nextSeq - MRBFS_WATCH_RING_SIZE)
+		pending = 1;
+	for(; !pending && seq < watchRing->nextSeq; seq++)
+		pending = mrbfsWatchMatch(cursor->filter, &watchRing->records[seq & (MRBFS_WATCH_RING_SIZE-1)]);
+	pthread_mutex_unlock(&watchRing->watchLock);
+
+	return(pending);
+}
+
+int mrbfsWatchRead(MRBFSWatchCursor* cursor, char* buf, size_t size)
+{
+	MRBFSWatchRing* watchRing = gMrbfsConfig->watchRing;
+	size_t copied = 0;
+	int retval = 0;
+
+	if (NULL == cursor || NULL == watchRing)
+		return(-EBADF);
+
+	pthread_mutex_lock(&watchRing->watchLock);
+
+	while(1)
+	{
+		uint64_t oldestSeq = (watchRing->nextSeq > MRBFS_WATCH_RING_SIZE) ? watchRing->nextSeq - MRBFS_WATCH_RING_SIZE : 0;
+
+		if (cursor->cursor < oldestSeq)
+		{
+			char lostStr[64];
+			int lostLen = snprintf(lostStr, sizeof(lostStr), "# lost %llu records\n", (unsigned long long)(oldestSeq - cursor->cursor));
+			if (lostLen > size)
+				lostLen = size;
+			memcpy(buf, lostStr, lostLen);
+			copied = lostLen;
+			cursor->cursor = oldestSeq;
+		}
+
+		for(; cursor->cursor < watchRing->nextSeq; cursor->cursor++)
+		{
+			MRBFSWatchRecord* record = &watchRing->records[cursor->cursor & (MRBFS_WATCH_RING_SIZE-1)];
+			if (!mrbfsWatchMatch(cursor->filter, record))
+				continue;
+
+			if (copied + record->len > size)
+			{
+				// Leave it for the next read, unless it would never fit
+				if (0 != copied)
+					break;
+				memcpy(buf, record->text, size);
+				copied = size;
+				cursor->cursor++;
+				break;
+			}
+
+			memcpy(buf + copied, record->text, record->len);
+			copied += record->len;
+		}
+
+		if (0 != copied || gMrbfsConfig->terminate)
+			break;
+
+		if (fuse_interrupted())
+		{
+			retval = -EINTR;
+			break;
+		}
+
+		// Wake up periodically to notice interrupts and shutdown
+		{
+			struct timespec waitUntil;
+			clock_gettime(CLOCK_REALTIME, &waitUntil);
+			waitUntil.tv_sec += 1;
+			pthread_cond_timedwait(&cursor->filter->watchCond, &watchRing->watchLock, &waitUntil);
+		}
+	}
+
+	pthread_mutex_unlock(&watchRing->watchLock);
+
+	if (0 != retval)
+		return(retval);
+	return((int)copied);
+}
+
+MRBFSFileNode* mrbfsWatchAddFile(int bus, int address, const char* insertionPath)
+{
+	MRBFSWatchFilter* filter = calloc(1, sizeof(MRBFSWatchFilter));
+	MRBFSFileNode* fileNode = NULL;
+
+	if (NULL == filter)
+	{
+		mrbfsLogMessage(MRBFS_LOG_ERROR, "Calloc() failed on watch file at [%s]", insertionPath);
+		return(NULL);
+	}
+
+	filter->bus = bus;
+	filter->address = address;
+	pthread_cond_init(&filter->watchCond, NULL);
+
+	fileNode = mrbfsFilesystemAddFile("watch", FNODE_RO_VALUE_STREAM, insertionPath);
+	if (NULL == fileNode)
+	{
+		pthread_cond_destroy(&filter->watchCond);
+		free(filter);
+		return(NULL);
+	}
+
+	fileNode->nodeLocalStorage = (void*)filter;
+	return(fileNode);
+}
@@ -0,0 +1,13 @@
+#ifndef _MRBFS_WATCH_H
+#define _MRBFS_WATCH_H
+
+void mrbfsWatchInitialize();
+MRBFSFileNode* mrbfsWatchAddFile(int bus, int address, const char* insertionPath);
+void mrbfsWatchPublish(UINT8 bus, UINT8 address, const char* fmt, ...);
+void mrbfsWatchPublishPacket(MRBFSBusNode* mrbfsNode, MRBusPacket* rxPkt);
+MRBFSWatchCursor* mrbfsWatchOpen(MRBFSFileNode* mrbfsFileNode);
+int mrbfsWatchPending(MRBFSWatchCursor* cursor);
+int mrbfsWatchRead(MRBFSWatchCursor* cursor, char* buf, size_t size);
+void mrbfsWatchRelease(MRBFSWatchCursor* cursor);
+
+#endif
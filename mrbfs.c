@@ -20,6 +20,19 @@
 #include "mrbfs-log.h"
 #include "mrbfs-filesys.h"
 #include "mrbfs-cfg.h"
+#include "mrbfs-registry.h"
+#include "mrbfs-options.h"
+#include "mrbfs-history.h"
+#include "mrbfs-snapshot.h"
+#include "mrbfs-watch.h"
+#include "mrbfs-poll.h"
+#include "mrbfs-seqlock.h"
+#include "mrbfs-query.h"
+#include "mrbfs-capture.h"
+#include "mrbfs-dedup.h"
+#include "mrbfs-txpolicy.h"
+#include "mrbfs-bridge.h"
+#include "mrbfs-shutdown.h"
 
 
 // Globals
@@ -30,34 +43,10 @@ static void* mrbfsInit(struct fuse_conn_info *conn)
 	int err;
 }
 
-void mrbfsInterfacesDestroy()
-{
-	int i;
-	gMrbfsConfig->terminate = 1;
-	// Give the interfaces the chance to terminate gracefully
-	for(i = 0; i < gMrbfsConfig->mrbfsUsedInterfaces; i++)
-	{
-		gMrbfsConfig->mrbfsInterfaceDrivers[i]->terminate = 1;
-	}
-	
-	sleep(1);
-	
-	// Now just kill whatever's left
-	for(i = 0; i < gMrbfsConfig->mrbfsUsedInterfaces; i++)
-	{
-		pthread_cancel(gMrbfsConfig->mrbfsInterfaceDrivers[i]->interfaceThread);
-		// Deallocate its storate
-		free(gMrbfsConfig->mrbfsInterfaceDrivers[i]->interfaceName);
-		free(gMrbfsConfig->mrbfsInterfaceDrivers[i]->port);
-		free(gMrbfsConfig->mrbfsInterfaceDrivers[i]);
-	}
-	
-}
-
 static void mrbfsDestroy(void* v)
 {
+	mrbfsShutdown();
 //	mrbfsFilesystemDestroy();
-//	mrbfsInterfacesDestroy();
  //  cfg_free(gMrbfsConfig->cfgParms);	
 }
 
@@ -67,6 +56,8 @@ static struct fuse_operations mrbfsOperations =
 	.getattr	= mrbfsGetattr,
 	.readdir	= mrbfsReaddir,
 	.open		= mrbfsOpen,
+	.release	= mrbfsRelease,
+	.poll		= mrbfsPollFile,
 	.read		= mrbfsRead,
 	.write	= mrbfsWrite,
 	.truncate = mrbfsTruncate,
@@ -107,19 +98,15 @@ static int mrbfs_opt_proc(void *data, const char *arg, int key, struct fuse_args
 
 void mrbfsTicker()
 {
-	UINT32 i=0, busNumber=0, nodeNumber=0;
+	UINT32 busNumber=0, nodeNumber=0;
 	time_t currentTime=0;
 	char buffer[256];
 	struct tm timeLocal;
 	
 	while(!gMrbfsConfig->terminate)
 	{
-		usleep(10000);
-		i++;
-		if (i<100)
-			continue;
-
-		i=0;
+		if (mrbfsShutdownWait(1000))
+			break;
 		
 		// Fire off tick to everybody once a second
 		// Traverse all valid busses and nodes and issue a tick command if any of them have a tick handler registered
@@ -139,10 +126,17 @@ void mrbfsTicker()
 			for(nodeNumber=0; nodeNumber<MRBFS_MAX_BUS_NODES; nodeNumber++)
 			{
 				MRBFSBusNode* node = bus->node[nodeNumber];
-				if (NULL == node || NULL == node->mrbfsNodeTick)
+				UINT32 valueGeneration;
+				if (NULL == node || NULL == node->nodeDriver->mrbfsNodeTick)
 					continue;
 				mrbfsLogMessage(MRBFS_LOG_ANNOYING, "Trying to call tick function, bus=[%d], node=[%02X]", busNumber, nodeNumber);
-				(*node->mrbfsNodeTick)((MRBFSBusNode*)node, currentTime);
+				valueGeneration = __atomic_load_n(&node->valueGeneration, __ATOMIC_ACQUIRE);
+				mrbfsSeqLockWriteBegin(&node->valueSeq);
+				(*node->nodeDriver->mrbfsNodeTick)((MRBFSBusNode*)node, currentTime);
+				mrbfsSeqLockWriteEnd(&node->valueSeq);
+				// Timeouts and such change values outside of packet handling
+				if (valueGeneration != __atomic_load_n(&node->valueGeneration, __ATOMIC_ACQUIRE))
+					mrbfsPollNodeChanged(node);
 			}
 		}
 		mrbfsLogMessage(MRBFS_LOG_ANNOYING, "Finished tick at %s [%d]", buffer, currentTime);
@@ -158,10 +152,9 @@ void mrbfsStartTicker()
 	pthread_mutex_lock(&gMrbfsConfig->masterLock);
 	mrbfsLogMessage(MRBFS_LOG_INFO, "Lock acquired");	
 	// The ticker is a thread with a 1 second clock that calls all nodes with a tick() function once a second
+	// Left joinable so shutdown can wait for it
 	pthread_create(&gMrbfsConfig->tickerThread, NULL, (void*)&mrbfsTicker, NULL);
 	mrbfsLogMessage(MRBFS_LOG_INFO, "Ticker created");	
-	pthread_detach(gMrbfsConfig->tickerThread);
-	mrbfsLogMessage(MRBFS_LOG_INFO, "Ticker detached");	
 	pthread_mutex_unlock(&gMrbfsConfig->masterLock);
 	mrbfsLogMessage(MRBFS_LOG_INFO, "Released master lock - ticker running");	
 }
@@ -231,6 +224,8 @@ int main(int argc, char *argv[])
 		pthread_mutexattr_destroy(&lockAttr);		
 	}
 
+	mrbfsNodeModuleRegistryInitialize();
+
 	memset(&fuseConfig, 0, sizeof(MRBFSFuseConfig));
 	fuseConfig.logLevel = -1;
 	
@@ -257,6 +252,19 @@ int main(int argc, char *argv[])
 
 	// Okay, configuration file is loaded, start logging
 	mrbfsSingleInitLogging();
+
+	mrbfsShutdownInitialize();
+	// History paths are resolved now, before daemonizing changes our working directory
+	mrbfsHistoryInitialize();
+	mrbfsCaptureInitialize();
+
+	gMrbfsConfig->kernelCache = cfg_getbool(gMrbfsConfig->cfgParms, "kernel-cache");
+
+	// Cached reads stop at the kernel's idea of the file size, so it mustn't hold onto a stale
+	// one - a value that just got longer would read back cut short.  Inserted ahead of the
+	// command line so an explicit -o attr_timeout still wins.
+	if (gMrbfsConfig->kernelCache)
+		fuse_opt_insert_arg(&args, 1, "-oattr_timeout=0");
 	
 	// At this point, we've got our configuration and logging is active
 	// Log a startup message and get on with starting the filesystem
@@ -301,6 +309,12 @@ int main(int argc, char *argv[])
 	mrbfsLogMessage(MRBFS_LOG_INFO, "Starting MRBFS filesystem");
 	// Setup the initial filesystem
 	mrbfsFilesystemInitialize();
+	mrbfsSnapshotAddFile(-1, "/");
+	mrbfsQueryAddFile("/");
+	mrbfsDedupInitialize();
+	mrbfsWatchInitialize();
+	mrbfsPollInitialize();
+	mrbfsBridgeInitialize();
 
 	mrbfsLogMessage(MRBFS_LOG_INFO, "Starting MRBFS interfaces");
 	// Setup the interfaces
@@ -312,9 +326,11 @@ int main(int argc, char *argv[])
 	
 	mrbfsLogMessage(MRBFS_LOG_INFO, "Starting MRBFS 1 second ticker");	
 	mrbfsStartTicker();
+	mrbfsCaptureStart();
 
 	signal(SIGHUP, mrbfsSighup);
 	
+	mrbfsShutdownStartupComplete();
 	mrbfsLogMessage(MRBFS_LOG_INFO, "Starting MRBFS fuse main loop");
 	if (multithreaded)
 		res = fuse_loop_mt(fuse);
@@ -352,11 +368,22 @@ int mrbfsRemoveNode(MRBFSBus* bus, UINT8 nodeNumber)
 		return(0);
 
 	pthread_mutex_lock(&node->nodeLock);
-	
+
+	if (NULL != node->nodeDriver->mrbfsNodeDestroy)
+		(*node->nodeDriver->mrbfsNodeDestroy)(node);
+
+	mrbfsHistoryNodeRelease(node);
+	mrbfsSnapshotNodeRelease(node);
+
 	if (NULL != node->nodeName)
 		free(node->nodeName);
-	
-	// FIXME: Need to free the actual node module, but for now it'll just leak
+
+	mrbfsOptionTableFree(&node->nodeOptions);
+
+	// Drop our reference on the driver module - it's unloaded once the last node using it goes away
+	mrbfsNodeModuleRelease(node->nodeModule);
+	node->nodeModule = NULL;
+	node->nodeDriver = NULL;
 
 	pthread_mutex_unlock(&node->nodeLock);
 	free(node);
@@ -581,6 +608,7 @@ int mrbfsAddBus(UINT8 busNumber)
 			exit(1);
 		}
 		gMrbfsConfig->bus[busNumber]->bus = busNumber;
+		mrbfsTxPolicyConfigureBus(gMrbfsConfig->bus[busNumber]);
 
 		// Initialize the bus lock
 		pthread_mutexattr_init(&lockAttr);
@@ -603,6 +631,11 @@ int mrbfsAddBus(UINT8 busNumber)
 		gMrbfsConfig->bus_filePktTransmit[busNumber]->nodeLocalStorage = (void*)calloc(1, sizeof(MRBusFilePktTxLocalStorage));
 		((MRBusFilePktTxLocalStorage*)(gMrbfsConfig->bus_filePktTransmit[busNumber]->nodeLocalStorage))->bus = busNumber;
 		gMrbfsConfig->bus_filePktTransmit[busNumber]->value.valueStr = ((MRBusFilePktTxLocalStorage*)(gMrbfsConfig->bus_filePktTransmit[busNumber]->nodeLocalStorage))->inputBuffer;
+
+		// Add the bus-wide value snapshot and change stream
+		mrbfsSnapshotAddFile(busNumber, buffer);
+		gMrbfsConfig->bus_fileWatch[busNumber] = mrbfsWatchAddFile(busNumber, -1, buffer);
+		mrbfsCaptureAddBus(busNumber, buffer);
 	}
 	else
 	{
@@ -630,6 +663,18 @@ void mrbfsPacketReceive(MRBusPacket* rxPkt)
 		return;
 	}
 
+	// Everything seen on the bus is captured, including packets from nodes we don't know
+	mrbfsCapturePacket(MRBFS_CAPTURE_RX, rxPkt);
+
+	if (mrbfsDedupCheck(gMrbfsConfig->bus[rxPkt->bus], rxPkt))
+	{
+		mrbfsLogMessage(MRBFS_LOG_DEBUG, "Dropping packet for [%d/0x%02X] from interface %d, already received on another interface", rxPkt->bus, srcAddr, rxPkt->srcInterface);
+		return;
+	}
+
+	// Forwarded on to other buses whether or not there's a node driver for it here
+	mrbfsBridgePacket(rxPkt);
+
 	if (NULL == gMrbfsConfig->bus[rxPkt->bus]->node[srcAddr])
 	{
 		mrbfsLogMessage(MRBFS_LOG_INFO, "Received packet for [%d/0x%02X], which isn't set up", rxPkt->bus, srcAddr);
@@ -637,9 +682,17 @@ void mrbfsPacketReceive(MRBusPacket* rxPkt)
 		return;
 	}
 	
-	if (NULL != gMrbfsConfig->bus[rxPkt->bus]->node[srcAddr]->mrbfsNodeRxPacket)
+	if (NULL != gMrbfsConfig->bus[rxPkt->bus]->node[srcAddr]->nodeDriver->mrbfsNodeRxPacket)
 	{
-		int ret = (*gMrbfsConfig->bus[rxPkt->bus]->node[srcAddr]->mrbfsNodeRxPacket)(gMrbfsConfig->bus[rxPkt->bus]->node[srcAddr], rxPkt);
+		int ret;
+		// Readers see the values from before this packet or after it, never a mix
+		mrbfsSeqLockWriteBegin(&gMrbfsConfig->bus[rxPkt->bus]->node[srcAddr]->valueSeq);
+		ret = (*gMrbfsConfig->bus[rxPkt->bus]->node[srcAddr]->nodeDriver->mrbfsNodeRxPacket)(gMrbfsConfig->bus[rxPkt->bus]->node[srcAddr], rxPkt);
+		mrbfsSeqLockWriteEnd(&gMrbfsConfig->bus[rxPkt->bus]->node[srcAddr]->valueSeq);
+		// Any packet may have changed the node's values - snapshot.json re-renders it on next read
+		__atomic_add_fetch(&gMrbfsConfig->bus[rxPkt->bus]->node[srcAddr]->valueGeneration, 1, __ATOMIC_RELEASE);
+		mrbfsWatchPublishPacket(gMrbfsConfig->bus[rxPkt->bus]->node[srcAddr], rxPkt);
+		mrbfsPollNodeChanged(gMrbfsConfig->bus[rxPkt->bus]->node[srcAddr]);
 		mrbfsLogMessage(MRBFS_LOG_DEBUG, "Received packet for [%d/0x%02X] and processed, ret=%d", rxPkt->bus, srcAddr, ret);
 	}
 }
@@ -662,7 +715,7 @@ int mrbfsOpenInterfaces()
 		void* interfaceDriverHandle = NULL;
 		MRBFSInterfaceDriver* mrbfsInterfaceDriver = NULL;
 		int (*MRBFSInterfaceDriverVersionCheck)(int);
-		int ret;
+		int ret, interfaceOption;
 		cfg_t *cfgInterface = cfg_getnsec(gMrbfsConfig->cfgParms, "interface", i);
 		const char* interfaceName = cfg_title(cfgInterface);
 		
@@ -707,25 +760,23 @@ int mrbfsOpenInterfaces()
 		mrbfsInterfaceDriver->bus = cfg_getint(cfgInterface, "bus");
 		mrbfsInterfaceDriver->port = strdup(cfg_getstr(cfgInterface, "port"));
 		mrbfsInterfaceDriver->addr = strtol(cfg_getstr(cfgInterface, "interface-address"), NULL, 16);
+		if (0 != cfg_getint(cfgInterface, "bridge"))
+			mrbfsLogMessage(MRBFS_LOG_WARNING, "Interface [%s] - bridge option is ignored, use a bridge section", interfaceName);
 		mrbfsInterfaceDriver->mrbfsInterfacePacketTransmit = dlsym(interfaceDriverHandle, "mrbfsInterfacePacketTransmit");
 		mrbfsInterfaceDriver->mrbfsInterfaceDriverInit = dlsym(interfaceDriverHandle, "mrbfsInterfaceDriverInit");
+		mrbfsInterfaceDriver->mrbfsInterfaceTxQueueDepth = dlsym(interfaceDriverHandle, "mrbfsInterfaceTxQueueDepth");
 	
-		mrbfsInterfaceDriver->interfaceOptions = cfg_size(cfgInterface, "option");
-		if (mrbfsInterfaceDriver->interfaceOptions > 0)
+		mrbfsInterfaceDriver->interfaceOptions.options = cfg_size(cfgInterface, "option");
+		mrbfsInterfaceDriver->interfaceOptions.optionList = calloc(mrbfsInterfaceDriver->interfaceOptions.options, sizeof(MRBFSModuleOption));
+		for(interfaceOption=0; interfaceOption < mrbfsInterfaceDriver->interfaceOptions.options; interfaceOption++)
 		{
-			int interfaceOption=0;
-			mrbfsInterfaceDriver->interfaceOptionList = calloc(mrbfsInterfaceDriver->interfaceOptions, sizeof(MRBFSModuleOption));
-			for(interfaceOption=0; interfaceOption < mrbfsInterfaceDriver->interfaceOptions; interfaceOption++)
-			{
-				cfg_t *cfgInterfaceOption = cfg_getnsec(cfgInterface, "option", interfaceOption);
-				mrbfsInterfaceDriver->interfaceOptionList[i].key = strdup(cfg_title(cfgInterfaceOption));
-				mrbfsInterfaceDriver->interfaceOptionList[i].value = strdup(cfg_getstr(cfgInterfaceOption, "value"));
-			}	
-		}
-		else
-		{
-			mrbfsInterfaceDriver->interfaceOptions = 0;
+			cfg_t *cfgInterfaceOption = cfg_getnsec(cfgInterface, "option", interfaceOption);
+			const char* ptr = cfg_title(cfgInterfaceOption);
+			mrbfsInterfaceDriver->interfaceOptions.optionList[interfaceOption].key = strdup(ptr?:"");
+			ptr = cfg_getstr(cfgInterfaceOption, "value");
+			mrbfsInterfaceDriver->interfaceOptions.optionList[interfaceOption].value = strdup(ptr?:"");
 		}
+		mrbfsOptionTableBuild(&mrbfsInterfaceDriver->interfaceOptions, mrbfsInterfaceDriver->interfaceName, &mrbfsLogMessage);
 
 		mrbfsLogMessage(MRBFS_LOG_DEBUG, "Interface [%s] - setting up filesystem directory", interfaceName);
 		ret = asprintf(&mrbfsInterfaceDriver->path, "/interfaces/%s", mrbfsInterfaceDriver->interfaceName);
@@ -735,6 +786,7 @@ int mrbfsOpenInterfaces()
 		mrbfsInterfaceDriver->mrbfsLogMessage = &mrbfsLogMessage;
 		mrbfsInterfaceDriver->mrbfsPacketReceive = &mrbfsPacketReceive;
 		mrbfsInterfaceDriver->mrbfsFilesystemAddFile = &mrbfsFilesystemAddFile;		
+		mrbfsInterfaceDriver->shutdownFd = gMrbfsConfig->shutdownFd;
 		
 		mrbfsInterfaceDriver->mrbfsInterfaceDriverRun = dlsym(interfaceDriverHandle, "mrbfsInterfaceDriverRun");
 		if(NULL == mrbfsInterfaceDriver->mrbfsInterfaceDriverRun)
@@ -745,6 +797,8 @@ int mrbfsOpenInterfaces()
 	
 		mrbfsAddBus(mrbfsInterfaceDriver->bus);
 
+		mrbfsInterfaceDriver->interfaceId = gMrbfsConfig->mrbfsUsedInterfaces + 1;
+		mrbfsTxPolicyAddInterface(mrbfsInterfaceDriver);
 		gMrbfsConfig->mrbfsInterfaceDrivers[gMrbfsConfig->mrbfsUsedInterfaces++] = mrbfsInterfaceDriver;
 
 		mrbfsLogMessage(MRBFS_LOG_INFO, "Interface [%s] successfully set up in slot %d", mrbfsInterfaceDriver->interfaceName, gMrbfsConfig->mrbfsUsedInterfaces-1);
@@ -755,10 +809,13 @@ int mrbfsOpenInterfaces()
 			(*mrbfsInterfaceDriver->mrbfsInterfaceDriverInit)(mrbfsInterfaceDriver);
 		}
 
+		mrbfsOptionTableReportUnused(&mrbfsInterfaceDriver->interfaceOptions);
+
 
 		{
+			// Joined at shutdown
 			err = pthread_create(&mrbfsInterfaceDriver->interfaceThread, NULL, (void*)mrbfsInterfaceDriver->mrbfsInterfaceDriverRun, mrbfsInterfaceDriver);
-			pthread_detach(mrbfsInterfaceDriver->interfaceThread);
+			mrbfsInterfaceDriver->threadRunning = (0 == err);
 		}
 		if (err)
 		{
@@ -788,23 +845,10 @@ int mrbfsPacketTransmit(MRBusPacket* txPkt)
 		sprintf(buffer+3*i, "%02X ", txPkt->pkt[i]);
 	*(buffer+3*i-1) = ']';
 	mrbfsLogMessage(MRBFS_LOG_DEBUG, "mrbfsPacketTransmit starting - [%s", buffer);
+	mrbfsCapturePacket(MRBFS_CAPTURE_TX, txPkt);
 
-	for(i=0; i<gMrbfsConfig->mrbfsUsedInterfaces; i++)
-	{
-		if (NULL == gMrbfsConfig->mrbfsInterfaceDrivers[i]->mrbfsInterfacePacketTransmit)
-		{
-			mrbfsLogMessage(MRBFS_LOG_DEBUG, "Non-transmitting interface [%s], skipping", gMrbfsConfig->mrbfsInterfaceDrivers[i]->interfaceName);
-			continue;
-		}
-		else if (txPkt->bus == gMrbfsConfig->mrbfsInterfaceDrivers[i]->bus)
-		{
-			mrbfsLogMessage(MRBFS_LOG_DEBUG, "Transmit queueing pkt on Interface [%s], bus[%d]", gMrbfsConfig->mrbfsInterfaceDrivers[i]->interfaceName, txPkt->bus);
-			(*gMrbfsConfig->mrbfsInterfaceDrivers[i]->mrbfsInterfacePacketTransmit)(gMrbfsConfig->mrbfsInterfaceDrivers[i], txPkt);
-		}
-		else
-			mrbfsLogMessage(MRBFS_LOG_DEBUG, "Transmit skipping interface [%s], bus[%d]", gMrbfsConfig->mrbfsInterfaceDrivers[i]->interfaceName, txPkt->bus);
-	}
-	return(0);
+	// Which of the bus's interfaces get the packet is up to the bus's transmit policy
+	return(mrbfsTxPolicyTransmit(txPkt));
 }
 
 int mrbfsLoadNodes()
@@ -819,8 +863,7 @@ int mrbfsLoadNodes()
 		char* modulePath = NULL;
 		MRBFSBusNode* node = NULL;
 		char* fsPath = NULL;
-		void* nodeDriverHandle = NULL;
-		int (*mrbfsNodeDriverVersionCheck)(int);
+		MRBFSNodeModule* nodeModule = NULL;
 		int ret;
 
 		cfg_t *cfgNode = cfg_getnsec(gMrbfsConfig->cfgParms, "node", i);
@@ -840,35 +883,16 @@ int mrbfsLoadNodes()
 			mrbfsAddBus(bus);
 
 		ret = asprintf(&modulePath, "%s/%s", cfg_getstr(gMrbfsConfig->cfgParms, "module-directory"), cfg_getstr(cfgNode, "driver"));
-				
-		// First, test if the driver module exists
-		if (!fileExists(modulePath))
-		{
-			mrbfsLogMessage(MRBFS_LOG_ERROR, "Node [%s] - driver module [%s] not found at [%s]", nodeName, cfg_getstr(cfgNode, "driver"), modulePath);
-			free(modulePath);
-			continue;
-		}
 
-		// Test to make sure the dynamic linker can open it
-		if (NULL == (nodeDriverHandle= (void*)dlopen(modulePath, RTLD_LAZY))) 
-		{
-			mrbfsLogMessage(MRBFS_LOG_ERROR, "Node [%s] - driver module [%s] failed dlopen [%s]", nodeName, cfg_getstr(cfgNode, "driver"), NULL!=dlerror()?dlerror():"");
-			free(modulePath);
-			continue;
-		}
-
-		// Now do some cursory version checks
-		mrbfsNodeDriverVersionCheck = dlsym(nodeDriverHandle, "mrbfsNodeDriverVersionCheck");
-		if(NULL == mrbfsNodeDriverVersionCheck || !(*mrbfsNodeDriverVersionCheck)(MRBFS_NODE_DRIVER_VERSION))
+		// Modules are shared by every node using them, so this only dlopen's on first use
+		nodeModule = mrbfsNodeModuleAcquire(modulePath);
+		free(modulePath);
+		if (NULL == nodeModule)
 		{
-			mrbfsLogMessage(MRBFS_LOG_ERROR, "Node [%s] - module version check failed", nodeName);
+			mrbfsLogMessage(MRBFS_LOG_ERROR, "Node [%s] - driver module [%s] failed to load", nodeName, cfg_getstr(cfgNode, "driver"));
 			continue;
 		}
 
-		mrbfsLogMessage(MRBFS_LOG_DEBUG, "Node [%s] - dynamic library sanity checks pass", nodeName);
-		free(modulePath);
-
-
 		node = (MRBFSBusNode*)calloc(1, sizeof(MRBFSBusNode));
 		if (NULL == node)
 		{
@@ -892,32 +916,38 @@ int mrbfsLoadNodes()
 		node->nodeName = strdup(nodeName);
 		node->bus = bus;
 		node->address = address;
-		node->nodeDriverHandle = nodeDriverHandle;
+		node->nodeModule = nodeModule;
+		node->nodeDriver = &nodeModule->driver;
 		node->nodeLocalStorage = NULL;
 		ret = asprintf(&node->path, "%s/%s", fsPath, modulePath);
 		
 		node->mrbfsLogMessage = &mrbfsLogMessage;
 		node->mrbfsFilesystemAddFile = &mrbfsFilesystemAddFile;
 		node->mrbfsNodeTxPacket = &mrbfsPacketTransmit;
+		node->mrbfsHistoryAttach = &mrbfsHistoryAttach;
 
-		node->mrbfsNodeInit = dlsym(nodeDriverHandle, "mrbfsNodeInit");
-		node->mrbfsNodeDestroy = dlsym(nodeDriverHandle, "mrbfsNodeDestroy");
-		node->mrbfsNodeRxPacket = dlsym(nodeDriverHandle, "mrbfsNodeRxPacket");
-		node->mrbfsNodeTick = dlsym(nodeDriverHandle, "mrbfsNodeTick");		
 		node->baseFileNode = mrbfsFilesystemAddFile(modulePath, FNODE_DIR_NODE, fsPath);
+		node->file_watch = mrbfsWatchAddFile(bus, address, node->path);
 
-		node->nodeOptions = cfg_size(cfgNode, "option");
-		node->nodeOptionList = calloc(node->nodeOptions, sizeof(MRBFSModuleOption));
-		for(nodeOption=0; nodeOption < node->nodeOptions; nodeOption++)
+		node->nodeOptions.options = cfg_size(cfgNode, "option");
+		node->nodeOptions.optionList = calloc(node->nodeOptions.options, sizeof(MRBFSModuleOption));
+		for(nodeOption=0; nodeOption < node->nodeOptions.options; nodeOption++)
 		{
 			cfg_t *cfgNodeOption = cfg_getnsec(cfgNode, "option", nodeOption);
 			const char* ptr = cfg_title(cfgNodeOption);
-			node->nodeOptionList[nodeOption].key = strdup(ptr?:"");
+			node->nodeOptions.optionList[nodeOption].key = strdup(ptr?:"");
 			ptr = cfg_getstr(cfgNodeOption, "value");
-			node->nodeOptionList[nodeOption].value = strdup(ptr?:"");
+			node->nodeOptions.optionList[nodeOption].value = strdup(ptr?:"");
 		}
+		mrbfsOptionTableBuild(&node->nodeOptions, node->nodeName, &mrbfsLogMessage);
+
+		(*node->nodeDriver->mrbfsNodeInit)(node);
+
+		// Everything the driver created gets read through the node's seqlock
+		mrbfsSeqLockAttachTree(node->baseFileNode, &node->valueSeq);
 
-		(*node->mrbfsNodeInit)(node);
+		// Anything the driver didn't ask for during init is most likely a typo in the config
+		mrbfsOptionTableReportUnused(&node->nodeOptions);
 
 		pthread_mutex_lock(&gMrbfsConfig->bus[bus]->busLock);
 		gMrbfsConfig->bus[bus]->node[address] = node;
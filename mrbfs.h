@@ -7,5 +7,8 @@
 
 extern MRBFSConfig* gMrbfsConfig;
 
+int mrbfsPacketTransmit(MRBusPacket* txPkt);
+int mrbfsAddBus(UINT8 busNumber);
+
 #endif
 
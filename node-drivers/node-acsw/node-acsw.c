@@ -497,19 +497,17 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	mrbfsNode->nodeLocalStorage = (void*)nodeLocalStorage;
 
 	// Initialize pieces of the local storage and create the files our node will use to communicate with the user
-	nodeLocalStorage->timeout = atoi(mrbfsNodeOptionGet(mrbfsNode, "timeout", "none"));
+	nodeLocalStorage->timeout = mrbfsNodeOptionGetInt(mrbfsNode, "timeout", 0, 0, INT_MAX);
 	nodeLocalStorage->lastUpdated = 0;
 
-	nodeLocalStorage->suppressUnits = 0;
-	if (0 == strcmp(mrbfsNodeOptionGet(mrbfsNode, "suppress_units", "no"), "yes"))
-		nodeLocalStorage->suppressUnits = 1;
+	nodeLocalStorage->suppressUnits = mrbfsNodeOptionGetBool(mrbfsNode, "suppress_units", 0);
 
-	nodeLocalStorage->decimalPositions = atoi(mrbfsNodeOptionGet(mrbfsNode, "decimal_positions", "2"));
+	nodeLocalStorage->decimalPositions = mrbfsNodeOptionGetInt(mrbfsNode, "decimal_positions", 2, 0, 9);
 
 
-	nodeLocalStorage->outputsConnected = atoi(mrbfsNodeOptionGet(mrbfsNode, "outputs_connected", "4"));
-	nodeLocalStorage->inputsConnected = atoi(mrbfsNodeOptionGet(mrbfsNode, "inputs_connected", "4"));
-	nodeLocalStorage->inputsInverted = atoi(mrbfsNodeOptionGet(mrbfsNode, "inputs_inverted", "1"));
+	nodeLocalStorage->outputsConnected = mrbfsNodeOptionGetInt(mrbfsNode, "outputs_connected", 4, 0, MRB_ACSW_MAX_OUTPUTS);
+	nodeLocalStorage->inputsConnected = mrbfsNodeOptionGetInt(mrbfsNode, "inputs_connected", 4, 0, MRB_ACSW_MAX_INPUTS);
+	nodeLocalStorage->inputsInverted = mrbfsNodeOptionGetBool(mrbfsNode, "inputs_inverted", 1);
 	// File "rxCounter" - the rxCounter file node will be a simple read/write integer.  Writing a value to it will reset both
 	//  it and the rxPackets log file
 	nodeLocalStorage->file_rxCounter = (*mrbfsNode->mrbfsFilesystemAddFile)("rxCounter", FNODE_RW_VALUE_INT, mrbfsNode->path);
@@ -523,13 +521,6 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	nodeLocalStorage->file_rxPackets->value.valueStr = nodeLocalStorage->rxPacketStr;
 
 	// Initialize the input files
-	if (nodeLocalStorage->inputsConnected < 0 || nodeLocalStorage->inputsConnected > MRB_ACSW_MAX_INPUTS)
-	{
-		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Node [%s] - inputs_connected must be between 0-%d, not [%d] - defaulting to %d", 
-			mrbfsNode->nodeName, MRB_ACSW_MAX_OUTPUTS, nodeLocalStorage->inputsConnected, MRB_ACSW_MAX_INPUTS);
-		nodeLocalStorage->inputsConnected = MRB_ACSW_MAX_INPUTS;
-	}
-
 	for(i=0; i<nodeLocalStorage->inputsConnected; i++)
 	{
 		char inputDefaultFilename[32];
@@ -548,14 +539,6 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	}
 
 	// Initialize the output files
-	if (nodeLocalStorage->outputsConnected < 0 || nodeLocalStorage->outputsConnected > MRB_ACSW_MAX_INPUTS)
-	{
-		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Node [%s] - outputs_connected must be between 0-%d, not [%d] - defaulting to %d", 
-			mrbfsNode->nodeName, MRB_ACSW_MAX_OUTPUTS, nodeLocalStorage->outputsConnected, MRB_ACSW_MAX_OUTPUTS);
-		nodeLocalStorage->outputsConnected = MRB_ACSW_MAX_INPUTS;
-	}
-
-
 	for(i=0; i<nodeLocalStorage->outputsConnected; i++)
 	{
 		char outputDefaultFilename[32];
@@ -664,6 +647,7 @@ int mrbfsNodeTick(MRBFSBusNode* mrbfsNode, time_t currentTime)
 		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_INFO, "Node [%s] has timed out on receive, resetting files", mrbfsNode->nodeName);	
 		pthread_mutex_lock(&mrbfsNode->nodeLock);
 		nodeResetFilesNoData(mrbfsNode);
+		mrbfsNodeValuesChanged(mrbfsNode);
 		pthread_mutex_unlock(&mrbfsNode->nodeLock);
 	}
 	return(0);
@@ -197,9 +197,9 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 
 	// Initialize pieces of the local storage and create the files our node will use to communicate with the user
 	nodeLocalStorage->lastUpdated = 0;
-	nodeLocalStorage->timeout = atoi(mrbfsNodeOptionGet(mrbfsNode, "timeout", "none"));
-	nodeLocalStorage->suppressUnits = (0 == strcmp(mrbfsNodeOptionGet(mrbfsNode, "suppress_units", "no"), "yes"))?1:0;
-	nodeLocalStorage->decimalPositions = atoi(mrbfsNodeOptionGet(mrbfsNode, "decimal_positions", "2"));	
+	nodeLocalStorage->timeout = mrbfsNodeOptionGetInt(mrbfsNode, "timeout", 0, 0, INT_MAX);
+	nodeLocalStorage->suppressUnits = mrbfsNodeOptionGetBool(mrbfsNode, "suppress_units", 0);
+	nodeLocalStorage->decimalPositions = mrbfsNodeOptionGetInt(mrbfsNode, "decimal_positions", 2, 0, 9);	
 
 	// File "rxCounter" - the rxCounter file node will be a simple read/write integer.  Writing a value to it will reset both
 	//  it and the rxPackets log file
@@ -222,6 +222,10 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	nodeLocalStorage->file_busVoltage = (*mrbfsNode->mrbfsFilesystemAddFile)("mrbus_voltage", FNODE_RO_VALUE_STR, mrbfsNode->path);
 	nodeLocalStorage->file_busVoltage->value.valueStr = nodeLocalStorage->busVoltageValue;
 
+	// Record every value published to these files in <node>/history/, if history is configured
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_wiredPackets);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_wirelessPackets);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_busVoltage);
 
 	// Return 0 to indicate success
 	return (0);
@@ -270,6 +274,7 @@ int mrbfsNodeTick(MRBFSBusNode* mrbfsNode, time_t currentTime)
 		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_INFO, "Node [%s] has timed out on receive, resetting files", mrbfsNode->nodeName);	
 		pthread_mutex_lock(&mrbfsNode->nodeLock);
 		nodeResetFilesNoData(mrbfsNode);
+		mrbfsNodeValuesChanged(mrbfsNode);
 		pthread_mutex_unlock(&mrbfsNode->nodeLock);
 	}
 	return(0);
@@ -325,6 +330,7 @@ void populateVoltageFile(NodeLocalStorage* nodeLocalStorage, double busVoltage,
 {
 	snprintf(nodeLocalStorage->busVoltageValue, SENSOR_VALUE_BUFFER_SZ-1, "%.*f%s", nodeLocalStorage->decimalPositions, busVoltage, nodeLocalStorage->suppressUnits?"":" V\n" );
 	nodeLocalStorage->file_busVoltage->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_busVoltage, busVoltage);
 }
 
 unsigned int pktToUint32(unsigned char* pkt)
@@ -393,6 +399,8 @@ int mrbfsNodeRxPacket(MRBFSBusNode* mrbfsNode, MRBusPacket* rxPkt)
 			nodeLocalStorage->file_wirelessPackets->updateTime = currentTime;
 			nodeLocalStorage->file_wiredPackets->value.valueInt = pktToUint32(rxPkt->pkt + 6);
 			nodeLocalStorage->file_wirelessPackets->value.valueInt = pktToUint32(rxPkt->pkt + 10);
+			mrbfsNodeHistoryPublish(nodeLocalStorage->file_wiredPackets, (double)pktToUint32(rxPkt->pkt + 6));
+			mrbfsNodeHistoryPublish(nodeLocalStorage->file_wirelessPackets, (double)pktToUint32(rxPkt->pkt + 10));
 			populateVoltageFile(nodeLocalStorage, ((double)rxPkt->pkt[14])/10.0, currentTime);
 			break;			
 	}
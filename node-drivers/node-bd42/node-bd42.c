@@ -167,7 +167,7 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 
 	(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_INFO, "Node [%s] starting up with driver [%s]", mrbfsNode->nodeName, MRBFS_NODE_DRIVER_NAME);
 	
-	nodeOccupancyDetectorsConnected = atoi(mrbfsNodeOptionGet(mrbfsNode, "channels_connected", "4"));
+	nodeOccupancyDetectorsConnected = mrbfsNodeOptionGetInt(mrbfsNode, "channels_connected", 4, 0, MRB_BD42_MAX_CHANNELS);
 
 	nodeLocalStorage->pktsReceived = 0;
 	nodeLocalStorage->file_rxCounter = (*mrbfsNode->mrbfsFilesystemAddFile)("rxCounter", FNODE_RW_VALUE_INT, mrbfsNode->path);
@@ -183,13 +183,6 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	nodeLocalStorage->file_eepromNodeAddr->nodeLocalStorage = (void*)mrbfsNode;
 
 	// Initialize the occupancy files
-	if (nodeOccupancyDetectorsConnected < 0 || nodeOccupancyDetectorsConnected > MRB_BD42_MAX_CHANNELS)
-	{
-		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Node [%s] - channels_connected must be between 0-%d, not [%d] - defaulting to %d", 
-			mrbfsNode->nodeName, MRB_BD42_MAX_CHANNELS, nodeOccupancyDetectorsConnected, MRB_BD42_MAX_CHANNELS);
-		nodeOccupancyDetectorsConnected = MRB_BD42_MAX_CHANNELS;
-	}
-
 	for(i=0; i<nodeOccupancyDetectorsConnected; i++)
 	{
 		char occupancyDefaultFilename[32];
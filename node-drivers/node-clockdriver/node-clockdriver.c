@@ -309,7 +309,7 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	
 	nodeLocalStorage->file_txInterval = (*mrbfsNode->mrbfsFilesystemAddFile)("tx_interval", FNODE_RW_VALUE_INT, mrbfsNode->path);	
 	nodeLocalStorage->file_txInterval->mrbfsFileNodeWrite = &mrbfsFileNodeWrite;
-	nodeLocalStorage->file_txInterval->value.valueInt = atoi(mrbfsNodeOptionGet(mrbfsNode, "tx_interval", "5"));
+	nodeLocalStorage->file_txInterval->value.valueInt = mrbfsNodeOptionGetInt(mrbfsNode, "tx_interval", 5, 0, 3600);
 	nodeLocalStorage->file_txInterval->nodeLocalStorage = (void*)mrbfsNode;
 	
 	// Return 0 to indicate success
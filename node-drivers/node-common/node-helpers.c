@@ -16,49 +16,22 @@
 #include <time.h>
 #include "mrbfs-module.h"
 #include "mrbfs-pktqueue.h"
+#include "mrbfs-options.h"
 #include "node-helpers.h"
 
 MRBTemperatureUnits mrbfsNodeGetTemperatureUnits(MRBFSBusNode* mrbfsNode, const char* optionName)
 {
-	MRBTemperatureUnits tempUnits = MRB_TEMPERATURE_UNITS_C;
-	const char* unitsStr = mrbfsNodeOptionGet(mrbfsNode, optionName, "celsius");
-	if (0 == strcmp("celsius", unitsStr))
-		tempUnits = MRB_TEMPERATURE_UNITS_C;
-	else if (0 == strcmp("fahrenheit", unitsStr))
-		tempUnits = MRB_TEMPERATURE_UNITS_F;
-	else if (0 == strcmp("kelvin", unitsStr))
-		tempUnits = MRB_TEMPERATURE_UNITS_K;
-	else if (0 == strcmp("rankine", unitsStr))
-		tempUnits = MRB_TEMPERATURE_UNITS_R;
-
-	return(tempUnits);
+	// Order must match MRBTemperatureUnits
+	const char* const unitNames[] = { "celsius", "kelvin", "fahrenheit", "rankine", NULL };
+	return((MRBTemperatureUnits)mrbfsNodeOptionGetEnum(mrbfsNode, optionName, unitNames, MRB_TEMPERATURE_UNITS_C));
 }
 
 
 MRBPressureUnits mrbfsNodeGetPressureUnits(MRBFSBusNode* mrbfsNode, const char* optionName)
 {
-	const char* unitsStr = mrbfsNodeOptionGet(mrbfsNode, optionName, "kPa");
-	MRBPressureUnits pressureUnits = MRB_PRESSURE_KPA;
-	if (0 == strcmp("hPa", unitsStr))
-		pressureUnits = MRB_PRESSURE_HPA;
-	else if (0 == strcmp("kPa", unitsStr))
-		pressureUnits = MRB_PRESSURE_KPA;
-	else if (0 == strcmp("psi", unitsStr))
-		pressureUnits = MRB_PRESSURE_PSI;
-	else if (0 == strcmp("bar", unitsStr))
-		pressureUnits = MRB_PRESSURE_BAR;
-	else if (0 == strcmp("Pa", unitsStr))
-		pressureUnits = MRB_PRESSURE_PA;
-	else if (0 == strcmp("Torr", unitsStr))
-		pressureUnits = MRB_PRESSURE_TORR;
-	else if (0 == strcmp("inH2O", unitsStr))
-		pressureUnits = MRB_PRESSURE_IN_H2O;
-	else if (0 == strcmp("inHg", unitsStr))
-		pressureUnits = MRB_PRESSURE_IN_HG;
-	else if (0 == strcmp("atm", unitsStr))
-		pressureUnits = MRB_PRESSURE_STD_ATM;
-
-	return(pressureUnits);
+	// Order must match MRBPressureUnits
+	const char* const unitNames[] = { "hPa", "kPa", "psi", "bar", "Pa", "Torr", "inH2O", "inHg", "atm", NULL };
+	return((MRBPressureUnits)mrbfsNodeOptionGetEnum(mrbfsNode, optionName, unitNames, MRB_PRESSURE_KPA));
 }
 
 const char* mrbfsGetTemperatureDisplayUnits(MRBTemperatureUnits units)
@@ -217,16 +190,45 @@ MRBFSFileNode* mrbfsNodeCreateFile_RW_INT(MRBFSBusNode* mrbfsNode, const char* f
 
 const char* mrbfsNodeOptionGet(MRBFSBusNode* mrbfsNode, const char* nodeOptionKey, const char* defaultValue)
 {
-	int i;
-	(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Node [%s] - [%d] node options, looking for [%s]", mrbfsNode->nodeName, mrbfsNode->nodeOptions, nodeOptionKey);
+	return(mrbfsOptionGetStr(&mrbfsNode->nodeOptions, nodeOptionKey, defaultValue));
+}
 
-	for(i=0; i<mrbfsNode->nodeOptions; i++)
-	{
-		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_DEBUG, "Node [%s] - node option [%d], comparing key [%s] to [%s]", mrbfsNode->nodeName, mrbfsNode->nodeOptions, nodeOptionKey, mrbfsNode->nodeOptionList[i].key);
-		if (0 == strcmp(nodeOptionKey, mrbfsNode->nodeOptionList[i].key))
-			return(mrbfsNode->nodeOptionList[i].value);
-	}
-	return(defaultValue);
+int mrbfsNodeOptionGetInt(MRBFSBusNode* mrbfsNode, const char* nodeOptionKey, int defaultValue, int minValue, int maxValue)
+{
+	return(mrbfsOptionGetInt(&mrbfsNode->nodeOptions, nodeOptionKey, defaultValue, minValue, maxValue));
+}
+
+int mrbfsNodeOptionGetBool(MRBFSBusNode* mrbfsNode, const char* nodeOptionKey, int defaultValue)
+{
+	return(mrbfsOptionGetBool(&mrbfsNode->nodeOptions, nodeOptionKey, defaultValue));
+}
+
+int mrbfsNodeOptionGetEnum(MRBFSBusNode* mrbfsNode, const char* nodeOptionKey, const char* const* names, int defaultValue)
+{
+	return(mrbfsOptionGetEnum(&mrbfsNode->nodeOptions, nodeOptionKey, names, defaultValue));
+}
+
+// Starts recording history and rollups for every value published for valueFile
+// Returns NULL (and publishing becomes a no-op) if the node has opted out of both
+MRBFSHistorySeries* mrbfsNodeHistoryAttach(MRBFSBusNode* mrbfsNode, MRBFSFileNode* valueFile)
+{
+	if (NULL == valueFile || NULL == mrbfsNode->mrbfsHistoryAttach)
+		return(NULL);
+	return((*mrbfsNode->mrbfsHistoryAttach)(mrbfsNode, valueFile));
+}
+
+void mrbfsNodeHistoryPublish(MRBFSFileNode* valueFile, double value)
+{
+	if (NULL == valueFile || NULL == valueFile->history)
+		return;
+	(*valueFile->history->mrbfsHistoryPublish)(valueFile->history, value);
+}
+
+// Tells the core the node's values changed outside of a received packet (timeouts, etc.)
+// so cached renders like snapshot.json pick it up.  Packets received are already counted.
+void mrbfsNodeValuesChanged(MRBFSBusNode* mrbfsNode)
+{
+	__atomic_add_fetch(&mrbfsNode->valueGeneration, 1, __ATOMIC_RELEASE);
 }
 
 int mrbfsNodeQueueTransmitPacket(MRBFSBusNode* mrbfsNode, MRBusPacket* txPkt)
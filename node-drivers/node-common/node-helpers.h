@@ -1,6 +1,7 @@
 #ifndef NODE_HELPERS_H
 #define NODE_HELPERS_H
 
+#include <limits.h>
 #include "mrbfs-types.h"
 
 typedef enum
@@ -28,7 +29,13 @@ typedef enum
 typedef int (*mrbfsRxPktFilterCallback)(MRBusPacket* rxPkt, uint8_t srcAddress, void* otherFilterData);
 
 const char* mrbfsNodeOptionGet(MRBFSBusNode* mrbfsNode, const char* nodeOptionKey, const char* defaultValue);
+int mrbfsNodeOptionGetInt(MRBFSBusNode* mrbfsNode, const char* nodeOptionKey, int defaultValue, int minValue, int maxValue);
+int mrbfsNodeOptionGetBool(MRBFSBusNode* mrbfsNode, const char* nodeOptionKey, int defaultValue);
+int mrbfsNodeOptionGetEnum(MRBFSBusNode* mrbfsNode, const char* nodeOptionKey, const char* const* names, int defaultValue);
 int mrbfsNodeQueueTransmitPacket(MRBFSBusNode* mrbfsNode, MRBusPacket* txPkt);
+MRBFSHistorySeries* mrbfsNodeHistoryAttach(MRBFSBusNode* mrbfsNode, MRBFSFileNode* valueFile);
+void mrbfsNodeHistoryPublish(MRBFSFileNode* valueFile, double value);
+void mrbfsNodeValuesChanged(MRBFSBusNode* mrbfsNode);
 MRBTemperatureUnits mrbfsNodeGetTemperatureUnits(MRBFSBusNode* mrbfsNode, const char* optionName);
 MRBPressureUnits mrbfsNodeGetPressureUnits(MRBFSBusNode* mrbfsNode, const char* optionName);
 double mrbfsGetTempFrom16K(const UINT8* pktByte, MRBTemperatureUnits units);
@@ -369,23 +369,14 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	mrbfsNodeMutexInit(&nodeLocalStorage->rxFeedLock);
 
 	// Initialize pieces of the local storage and create the files our node will use to communicate with the user
-	nodeLocalStorage->timeout = atoi(mrbfsNodeOptionGet(mrbfsNode, "timeout", "none"));
+	nodeLocalStorage->timeout = mrbfsNodeOptionGetInt(mrbfsNode, "timeout", 0, 0, INT_MAX);
 	nodeLocalStorage->lastUpdated = 0;
 
-	nodeLocalStorage->decimalPositions = atoi(mrbfsNodeOptionGet(mrbfsNode, "decimal_positions", "2"));
-	nodeLocalStorage->suppressUnits = 0;
-	if (0 == strcmp(mrbfsNodeOptionGet(mrbfsNode, "suppress_units", "no"), "yes"))
-		nodeLocalStorage->suppressUnits = 1;
+	nodeLocalStorage->decimalPositions = mrbfsNodeOptionGetInt(mrbfsNode, "decimal_positions", 2, 0, 9);
+	nodeLocalStorage->suppressUnits = mrbfsNodeOptionGetBool(mrbfsNode, "suppress_units", 0);
 
-	nodeLocalStorage->channelsUsed = atoi(mrbfsNodeOptionGet(mrbfsNode, "channels_connected", "4"));
-	
 	// Limit channels to a sane range - 1-16
-	if (nodeLocalStorage->channelsUsed < 1 || nodeLocalStorage->channelsUsed > MRB_DCCM_MAX_CHANNELS)
-	{
-		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Node [%s] - channels_connected must be between 1-%d, not [%d] - defaulting to %d", 
-			mrbfsNode->nodeName, MRB_DCCM_MAX_CHANNELS, nodeLocalStorage->channelsUsed, MRB_DCCM_MAX_CHANNELS);
-		nodeLocalStorage->channelsUsed = MRB_DCCM_MAX_CHANNELS;
-	}	
+	nodeLocalStorage->channelsUsed = mrbfsNodeOptionGetInt(mrbfsNode, "channels_connected", 4, 1, MRB_DCCM_MAX_CHANNELS);
 	
 	for(i=0; i<nodeLocalStorage->channelsUsed; i++)
 	{
@@ -406,6 +397,9 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 
 		snprintf(channelTempFilename, sizeof(channelTempFilename)-1, "%s_current", channelFilename);
 		nodeLocalStorage->file_dccCurrent[i] = mrbfsNodeCreateFile_RO_STR(mrbfsNode, channelTempFilename, &nodeLocalStorage->dccCurrentValueStr[i], OUTPUT_VALUE_BUFFER_SZ);
+
+		mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_dccVoltage[i]);
+		mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_dccCurrent[i]);
 	}
 	
 	// File "rxCounter" - the rxCounter file node will be a simple read/write integer.  Writing a value to it will reset both
@@ -425,6 +419,7 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	nodeLocalStorage->file_eepromNodeAddr = mrbfsNodeCreateFile_RW_READBACK(mrbfsNode, "eepromNodeAddr", mrbfsFileNodeRead, mrbfsFileNodeWrite);
 
 	nodeLocalStorage->file_busVoltage = mrbfsNodeCreateFile_RO_STR(mrbfsNode, "mrbusVoltage", &nodeLocalStorage->busVoltageValue, OUTPUT_VALUE_BUFFER_SZ);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_busVoltage);
 
 	// Return 0 to indicate success
 	return (0);
@@ -473,6 +468,7 @@ int mrbfsNodeTick(MRBFSBusNode* mrbfsNode, time_t currentTime)
 		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_INFO, "Node [%s] has timed out on receive, resetting files", mrbfsNode->nodeName);	
 		pthread_mutex_lock(&mrbfsNode->nodeLock);
 		nodeResetFilesNoData(mrbfsNode);
+		mrbfsNodeValuesChanged(mrbfsNode);
 		pthread_mutex_unlock(&mrbfsNode->nodeLock);
 	}
 	return(0);
@@ -585,10 +581,14 @@ int mrbfsNodeRxPacket(MRBFSBusNode* mrbfsNode, MRBusPacket* rxPkt)
 			
 			for(i=subModule*4, j=0; i<MIN(nodeLocalStorage->channelsUsed, subModule*4+4); i++, j+=2)
 			{
-				snprintf(nodeLocalStorage->dccVoltageValueStr[i], OUTPUT_VALUE_BUFFER_SZ-1, "%.*f%s", nodeLocalStorage->decimalPositions, ((double)rxPkt->pkt[15+j])/10.0, nodeLocalStorage->suppressUnits?"":" V\n" );
-				snprintf(nodeLocalStorage->dccCurrentValueStr[i], OUTPUT_VALUE_BUFFER_SZ-1, "%.*f%s", nodeLocalStorage->decimalPositions, (double)((uint32_t)rxPkt->pkt[7+j] * 256 + rxPkt->pkt[7+j+1]) / 1000.0, nodeLocalStorage->suppressUnits?"":" I\n" );				
+				double dccVoltage = ((double)rxPkt->pkt[15+j])/10.0;
+				double dccCurrent = (double)((uint32_t)rxPkt->pkt[7+j] * 256 + rxPkt->pkt[7+j+1]) / 1000.0;
+				snprintf(nodeLocalStorage->dccVoltageValueStr[i], OUTPUT_VALUE_BUFFER_SZ-1, "%.*f%s", nodeLocalStorage->decimalPositions, dccVoltage, nodeLocalStorage->suppressUnits?"":" V\n" );
+				snprintf(nodeLocalStorage->dccCurrentValueStr[i], OUTPUT_VALUE_BUFFER_SZ-1, "%.*f%s", nodeLocalStorage->decimalPositions, dccCurrent, nodeLocalStorage->suppressUnits?"":" I\n" );				
 				nodeLocalStorage->file_dccVoltage[i]->updateTime = currentTime;
 				nodeLocalStorage->file_dccCurrent[i]->updateTime = currentTime;
+				mrbfsNodeHistoryPublish(nodeLocalStorage->file_dccVoltage[i], dccVoltage);
+				mrbfsNodeHistoryPublish(nodeLocalStorage->file_dccCurrent[i], dccCurrent);
 			}
 
 			if (rxPkt->pkt[MRBUS_PKT_LEN] >= 20)
@@ -596,6 +596,7 @@ int mrbfsNodeRxPacket(MRBFSBusNode* mrbfsNode, MRBusPacket* rxPkt)
 				nodeLocalStorage->lastUpdated = currentTime;			
 				snprintf(nodeLocalStorage->busVoltageValue, OUTPUT_VALUE_BUFFER_SZ-1, "%.*f%s", nodeLocalStorage->decimalPositions, ((double)rxPkt->pkt[19])/10.0, nodeLocalStorage->suppressUnits?"":" V\n" );
 				nodeLocalStorage->file_busVoltage->updateTime = currentTime;
+				mrbfsNodeHistoryPublish(nodeLocalStorage->file_busVoltage, ((double)rxPkt->pkt[19])/10.0);
 			}
 			
 			}
@@ -1020,14 +1020,12 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	mrbfsNodeMutexInit(&nodeLocalStorage->rxFeedLock);
 	
 	// Get configuration options from the file
-	nodeLocalStorage->timeout = atoi(mrbfsNodeOptionGet(mrbfsNode, "timeout", "none"));
-	nodeLocalStorage->decimalPositions = atoi(mrbfsNodeOptionGet(mrbfsNode, "decimal_positions", "2"));
-	nodeLocalStorage->suppressUnits = 0;
-	if (0 == strcmp(mrbfsNodeOptionGet(mrbfsNode, "suppress_units", "no"), "yes"))
-		nodeLocalStorage->suppressUnits = 1;
-	nodeLocalStorage->cacheSeconds = atoi(mrbfsNodeOptionGet(mrbfsNode, "cache_seconds", "10"));
-	nodeLocalStorage->zonesUsed = atoi(mrbfsNodeOptionGet(mrbfsNode, "zones_used", "16"));
-	nodeLocalStorage->programsUsed = atoi(mrbfsNodeOptionGet(mrbfsNode, "programs_used", "64"));
+	nodeLocalStorage->timeout = mrbfsNodeOptionGetInt(mrbfsNode, "timeout", 0, 0, INT_MAX);
+	nodeLocalStorage->decimalPositions = mrbfsNodeOptionGetInt(mrbfsNode, "decimal_positions", 2, 0, 9);
+	nodeLocalStorage->suppressUnits = mrbfsNodeOptionGetBool(mrbfsNode, "suppress_units", 0);
+	nodeLocalStorage->cacheSeconds = mrbfsNodeOptionGetInt(mrbfsNode, "cache_seconds", 10, 0, 3600);
+	nodeLocalStorage->zonesUsed = mrbfsNodeOptionGetInt(mrbfsNode, "zones_used", 16, 0, MRB_H2O_MAX_ZONES);
+	nodeLocalStorage->programsUsed = mrbfsNodeOptionGetInt(mrbfsNode, "programs_used", 64, 0, MRB_H2O_MAX_PROGRAMS);
 
 	nodeLocalStorage->lastUpdated = 0;
 
@@ -1041,13 +1039,6 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	nodeLocalStorage->file_rxPackets->value.valueStr = nodeLocalStorage->rxPacketStr;
 
 	// Initialize the 16 zones
-	if (nodeLocalStorage->zonesUsed < 0 || nodeLocalStorage->zonesUsed > MRB_H2O_MAX_ZONES)
-	{
-		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Node [%s] - zones_used must be between 0-%d, not [%d] - defaulting to %d", 
-			mrbfsNode->nodeName, MRB_H2O_MAX_ZONES, nodeLocalStorage->zonesUsed, MRB_H2O_MAX_ZONES);
-		nodeLocalStorage->zonesUsed = MRB_H2O_MAX_ZONES;
-	}
-
 	for(i=0; i<nodeLocalStorage->zonesUsed; i++)
 	{
 		char zoneDefaultFilename[32];
@@ -1069,13 +1060,6 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	nodeLocalStorage->file_activeZoneBitmask = mrbfsNodeCreateFile_RO_INT(mrbfsNode, "activeZoneBitmask");
 
 	// Initialize the 64 "program" files
-	if (nodeLocalStorage->programsUsed < 0 || nodeLocalStorage->programsUsed > MRB_H2O_MAX_PROGRAMS)
-	{
-		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_ERROR, "Node [%s] - programs_used must be between 0-%d, not [%d] - defaulting to %d", 
-			mrbfsNode->nodeName, MRB_H2O_MAX_PROGRAMS, nodeLocalStorage->programsUsed, MRB_H2O_MAX_PROGRAMS);
-		nodeLocalStorage->programsUsed = MRB_H2O_MAX_PROGRAMS;
-	}
-
 	for(i=0; i<nodeLocalStorage->programsUsed; i++)
 	{
 		char programDefaultFilename[32];
@@ -1147,6 +1131,7 @@ int mrbfsNodeTick(MRBFSBusNode* mrbfsNode, time_t currentTime)
 		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_INFO, "Node [%s] has timed out on receive, resetting files", mrbfsNode->nodeName);	
 		pthread_mutex_lock(&mrbfsNode->nodeLock);
 		nodeResetFilesNoData(mrbfsNode);
+		mrbfsNodeValuesChanged(mrbfsNode);
 		pthread_mutex_unlock(&mrbfsNode->nodeLock);
 	}
 	return(0);
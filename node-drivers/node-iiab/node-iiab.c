@@ -161,13 +161,11 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	mrbfsNodeMutexInit(&nodeLocalStorage->rxFeedLock);
 
 	// Initialize pieces of the local storage and create the files our node will use to communicate with the user
-	nodeLocalStorage->timeout = atoi(mrbfsNodeOptionGet(mrbfsNode, "timeout", "none"));
+	nodeLocalStorage->timeout = mrbfsNodeOptionGetInt(mrbfsNode, "timeout", 0, 0, INT_MAX);
 	nodeLocalStorage->lastUpdated = 0;
 
-	nodeLocalStorage->decimalPositions = atoi(mrbfsNodeOptionGet(mrbfsNode, "decimal_positions", "2"));
-	nodeLocalStorage->suppressUnits = 0;
-	if (0 == strcmp(mrbfsNodeOptionGet(mrbfsNode, "suppress_units", "no"), "yes"))
-		nodeLocalStorage->suppressUnits = 1;
+	nodeLocalStorage->decimalPositions = mrbfsNodeOptionGetInt(mrbfsNode, "decimal_positions", 2, 0, 9);
+	nodeLocalStorage->suppressUnits = mrbfsNodeOptionGetBool(mrbfsNode, "suppress_units", 0);
 
 	// File "rxCounter" - the rxCounter file node will be a simple read/write integer.  Writing a value to it will reset both
 	//  it and the rxPackets log file
@@ -534,6 +532,7 @@ int mrbfsNodeTick(MRBFSBusNode* mrbfsNode, time_t currentTime)
 		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_INFO, "Node [%s] has timed out on receive, resetting files", mrbfsNode->nodeName);	
 		pthread_mutex_lock(&mrbfsNode->nodeLock);
 		nodeResetFilesNoData(mrbfsNode);
+		mrbfsNodeValuesChanged(mrbfsNode);
 		pthread_mutex_unlock(&mrbfsNode->nodeLock);
 	}
 	return(0);
@@ -177,7 +177,6 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	NodeLocalStorage* nodeLocalStorage = calloc(1, sizeof(NodeLocalStorage));
 	int i;
 	int units = MRB_RTS_UNITS_C;
-	const char* unitsStr;
 
 	mrbfsNode->nodeLocalStorage = (void*)nodeLocalStorage;
 
@@ -196,23 +195,15 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	nodeLocalStorage->file_eepromNodeAddr->mrbfsFileNodeRead = &mrbfsFileNodeRead;
 	nodeLocalStorage->file_eepromNodeAddr->nodeLocalStorage = (void*)mrbfsNode;
 
-	nodeLocalStorage->suppressUnits = 0;
-	if (0 == strcmp(mrbfsNodeOptionGet(mrbfsNode, "suppress_units", "no"), "yes"))
-		nodeLocalStorage->suppressUnits = 1;
-
-	nodeLocalStorage->decimalPositions = atoi(mrbfsNodeOptionGet(mrbfsNode, "decimal_positions", "2"));
-
-	unitsStr = mrbfsNodeOptionGet(mrbfsNode, "temperature_units", "celsius");
-	if (0 == strcmp("celsius", unitsStr))
-		nodeLocalStorage->units = MRB_RTS_UNITS_C;
-	else if (0 == strcmp("fahrenheit", unitsStr))
-		nodeLocalStorage->units = MRB_RTS_UNITS_F;
-	else if (0 == strcmp("kelvin", unitsStr))
-		nodeLocalStorage->units = MRB_RTS_UNITS_K;
-	else if (0 == strcmp("rankine", unitsStr))
-		nodeLocalStorage->units = MRB_RTS_UNITS_R;
-	else
-		nodeLocalStorage->units = MRB_RTS_UNITS_C;
+	nodeLocalStorage->suppressUnits = mrbfsNodeOptionGetBool(mrbfsNode, "suppress_units", 0);
+
+	nodeLocalStorage->decimalPositions = mrbfsNodeOptionGetInt(mrbfsNode, "decimal_positions", 2, 0, 9);
+
+	{
+		// Order must match the MRB_RTS_UNITS_* values
+		const char* const unitsNames[] = { "celsius", "kelvin", "fahrenheit", "rankine", NULL };
+		nodeLocalStorage->units = mrbfsNodeOptionGetEnum(mrbfsNode, "temperature_units", unitsNames, MRB_RTS_UNITS_C);
+	}
 
 	nodeLocalStorage->file_busVoltage = (*mrbfsNode->mrbfsFilesystemAddFile)("mrbus_voltage", FNODE_RO_VALUE_STR, mrbfsNode->path);
 	nodeLocalStorage->busVoltageValue = calloc(1, TEMPERATURE_VALUE_BUFFER_SZ);
@@ -240,7 +231,10 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 		nodeLocalStorage->tempSensorValues[i] = calloc(1, TEMPERATURE_VALUE_BUFFER_SZ);
 		strcpy(nodeLocalStorage->tempSensorValues[i], "No Data\n");
 		nodeLocalStorage->tempSensorFiles[i]->value.valueStr = nodeLocalStorage->tempSensorValues[i];
+		mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->tempSensorFiles[i]);
 	}
+
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_busVoltage);
 	return (0);
 }
 
@@ -280,6 +274,7 @@ int mrbfsNodeRxPacket(MRBFSBusNode* mrbfsNode, MRBusPacket* rxPkt)
 			busVoltage = ((double)rxPkt->pkt[17])/10.0;
 			snprintf(nodeLocalStorage->busVoltageValue, TEMPERATURE_VALUE_BUFFER_SZ-1, "%.*f%s", nodeLocalStorage->decimalPositions, busVoltage, nodeLocalStorage->suppressUnits?"":" V\n" );
 			nodeLocalStorage->file_busVoltage->updateTime = currentTime;
+			mrbfsNodeHistoryPublish(nodeLocalStorage->file_busVoltage, busVoltage);
 
 			for(i=0; i<5; i++)
 			{
@@ -353,7 +348,9 @@ int mrbfsNodeRxPacket(MRBFSBusNode* mrbfsNode, MRBusPacket* rxPkt)
 							snprintf(nodeLocalStorage->tempSensorValues[i], TEMPERATURE_VALUE_BUFFER_SZ-1, "%.*f%s", nodeLocalStorage->decimalPositions, temperature, nodeLocalStorage->suppressUnits?"":" C\n" );
 							break;
 					}
-				
+
+					// Open and shorted sensors have no value to record
+					mrbfsNodeHistoryPublish(nodeLocalStorage->tempSensorFiles[i], temperature);
 				}
 				nodeLocalStorage->tempSensorFiles[i]->updateTime = currentTime;
 			}
@@ -197,6 +197,7 @@ int mrbfsNodeTick(MRBFSBusNode* mrbfsNode, time_t currentTime)
 		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_INFO, "Node [%s] has timed out on receive, resetting files", mrbfsNode->nodeName);	
 		pthread_mutex_lock(&mrbfsNode->nodeLock);
 		nodeResetFilesNoData(mrbfsNode);
+		mrbfsNodeValuesChanged(mrbfsNode);
 		pthread_mutex_unlock(&mrbfsNode->nodeLock);
 	}
 	return(0);
@@ -205,9 +206,7 @@ int mrbfsNodeTick(MRBFSBusNode* mrbfsNode, time_t currentTime)
 int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 {
 	NodeLocalStorage* nodeLocalStorage = calloc(1, sizeof(NodeLocalStorage));
-	const char* sensorPkgStr;
 	int i;
-	const char* unitsStr;
 	
 	mrbfsNode->nodeLocalStorage = (void*)nodeLocalStorage;
 
@@ -228,37 +227,32 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	nodeLocalStorage->file_eepromNodeAddr->mrbfsFileNodeRead = &mrbfsFileNodeRead;
 	nodeLocalStorage->file_eepromNodeAddr->nodeLocalStorage = (void*)mrbfsNode;
 	
-	nodeLocalStorage->suppressUnits = 0;
-	if (0 == strcmp(mrbfsNodeOptionGet(mrbfsNode, "suppress_units", "no"), "yes"))
-		nodeLocalStorage->suppressUnits = 1;
+	nodeLocalStorage->suppressUnits = mrbfsNodeOptionGetBool(mrbfsNode, "suppress_units", 0);
 
-	nodeLocalStorage->timeout = atoi(mrbfsNodeOptionGet(mrbfsNode, "timeout", "none"));
+	nodeLocalStorage->timeout = mrbfsNodeOptionGetInt(mrbfsNode, "timeout", 0, 0, INT_MAX);
 
-	nodeLocalStorage->decimalPositions = atoi(mrbfsNodeOptionGet(mrbfsNode, "decimal_positions", "2"));
+	nodeLocalStorage->decimalPositions = mrbfsNodeOptionGetInt(mrbfsNode, "decimal_positions", 2, 0, 9);
 
-	nodeLocalStorage->isWireless = 0;
-	if (0 == strcmp(mrbfsNodeOptionGet(mrbfsNode, "connection", "wired"), "wireless"))
-		nodeLocalStorage->isWireless = 1;
+	{
+		const char* const connectionNames[] = { "wired", "wireless", NULL };
+		nodeLocalStorage->isWireless = mrbfsNodeOptionGetEnum(mrbfsNode, "connection", connectionNames, 0);
+	}
 
 	nodeLocalStorage->tempUnits = mrbfsNodeGetTemperatureUnits(mrbfsNode, "temperature_units");
 	nodeLocalStorage->pressureUnits = mrbfsNodeGetPressureUnits(mrbfsNode, "pressure_units");
 
-	nodeLocalStorage->altitude = atoi(mrbfsNodeOptionGet(mrbfsNode, "altitude_meters", "-1"));
+	nodeLocalStorage->altitude = mrbfsNodeOptionGetInt(mrbfsNode, "altitude_meters", -1, -500, 9000);
 	
 
-	sensorPkgStr = mrbfsNodeOptionGet(mrbfsNode, "sensor_package", "DHT22");
-	if (0 == strcmp(sensorPkgStr, "DHT11"))
-		nodeLocalStorage->sensorPackage = SENSOR_DHT11;
-	else if (0 == strcmp(sensorPkgStr, "DHT22"))
-		nodeLocalStorage->sensorPackage = SENSOR_DHT22;
-	else if (0 == strcmp(sensorPkgStr, "TMP275"))
-		nodeLocalStorage->sensorPackage = SENSOR_TMP275;		
-	else if (0 == strcmp(sensorPkgStr, "HYT221"))
-		nodeLocalStorage->sensorPackage = SENSOR_HYT221;
-	else if (0 == strcmp(sensorPkgStr, "CPS150"))
-		nodeLocalStorage->sensorPackage = SENSOR_CPS150;
-	else
-		nodeLocalStorage->sensorPackage = SENSOR_UNKNOWN;
+	{
+		// Order must match THSensorPackage.  Unset means a DHT22, but a value that isn't
+		// recognised gets no sensor files rather than decoding someone else's packets as a DHT22's.
+		const char* const sensorPkgNames[] = { "unknown", "DHT11", "DHT22", "HYT221", "TMP275", "CPS150", NULL };
+		if (NULL == mrbfsNodeOptionGet(mrbfsNode, "sensor_package", NULL))
+			nodeLocalStorage->sensorPackage = SENSOR_DHT22;
+		else
+			nodeLocalStorage->sensorPackage = mrbfsNodeOptionGetEnum(mrbfsNode, "sensor_package", sensorPkgNames, SENSOR_UNKNOWN);
+	}
 
 	// Allocate all storage, even if not used
 	nodeLocalStorage->pressureSensorValue = calloc(1, TEMPERATURE_VALUE_BUFFER_SZ);	
@@ -302,6 +296,13 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	nodeLocalStorage->file_busVoltage = (*mrbfsNode->mrbfsFilesystemAddFile)(nodeLocalStorage->isWireless?"battery_voltage":"mrbus_voltage", FNODE_RO_VALUE_STR, mrbfsNode->path);
 	nodeLocalStorage->file_busVoltage->value.valueStr = nodeLocalStorage->busVoltageValue;
 
+	// Files that don't exist for this sensor package are NULL and skipped
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_tempSensor);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_relativeHumidity);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_pressureSensor);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_meanSeaLevelPressure);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_busVoltage);
+
 	nodeResetFilesNoData(mrbfsNode);
 	return (0);
 }
@@ -332,6 +333,7 @@ void populateTempFile(NodeLocalStorage* nodeLocalStorage, double temperature, ti
 	snprintf(nodeLocalStorage->tempSensorValue, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 		"%.*f%s", nodeLocalStorage->decimalPositions, temperature, unitsStr);
 	nodeLocalStorage->file_tempSensor->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_tempSensor, temperature);
 }
 
 void populateHumidityFile(NodeLocalStorage* nodeLocalStorage, double humidity, time_t currentTime)
@@ -342,6 +344,7 @@ void populateHumidityFile(NodeLocalStorage* nodeLocalStorage, double humidity, t
 	snprintf(nodeLocalStorage->relativeHumidityValue, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 		"%.*f%s", nodeLocalStorage->decimalPositions, humidity, unitsStr);
 	nodeLocalStorage->file_relativeHumidity->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_relativeHumidity, humidity);
 }
 
 // Temperature must be in degrees K
@@ -365,6 +368,7 @@ void populateMSLPFile(NodeLocalStorage* nodeLocalStorage, double pressure, doubl
 		snprintf(nodeLocalStorage->meanSeaLevelPressureValue, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 			"%.*f%s", nodeLocalStorage->decimalPositions, mrbfsGetPressureFromHPaDouble(mslp, nodeLocalStorage->pressureUnits), unitsStr);
 		nodeLocalStorage->file_meanSeaLevelPressure->updateTime = currentTime;
+		mrbfsNodeHistoryPublish(nodeLocalStorage->file_meanSeaLevelPressure, mrbfsGetPressureFromHPaDouble(mslp, nodeLocalStorage->pressureUnits));
 	}
 }
 
@@ -376,12 +380,14 @@ void populatePressureFile(NodeLocalStorage* nodeLocalStorage, double pressure, t
 	snprintf(nodeLocalStorage->pressureSensorValue, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 		"%.*f%s", nodeLocalStorage->decimalPositions, pressure, unitsStr);
 	nodeLocalStorage->file_pressureSensor->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_pressureSensor, pressure);
 }
 
 void populateVoltageFile(NodeLocalStorage* nodeLocalStorage, double busVoltage, time_t currentTime)
 {
 	snprintf(nodeLocalStorage->busVoltageValue, TEMPERATURE_VALUE_BUFFER_SZ-1, "%.*f%s", nodeLocalStorage->decimalPositions, busVoltage, nodeLocalStorage->suppressUnits?"":" V\n" );
 	nodeLocalStorage->file_busVoltage->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_busVoltage, busVoltage);
 }
 
 int mrbfsNodeRxPacket(MRBFSBusNode* mrbfsNode, MRBusPacket* rxPkt)
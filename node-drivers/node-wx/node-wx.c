@@ -208,6 +208,7 @@ int mrbfsNodeTick(MRBFSBusNode* mrbfsNode, time_t currentTime)
 		(*mrbfsNode->mrbfsLogMessage)(MRBFS_LOG_INFO, "Node [%s] has timed out on receive, resetting files", mrbfsNode->nodeName);	
 		pthread_mutex_lock(&mrbfsNode->nodeLock);
 		nodeResetFilesNoData(mrbfsNode);
+		mrbfsNodeValuesChanged(mrbfsNode);
 		pthread_mutex_unlock(&mrbfsNode->nodeLock);
 	}
 	return(0);
@@ -239,23 +240,22 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	nodeLocalStorage->file_eepromNodeAddr->mrbfsFileNodeRead = &mrbfsFileNodeRead;
 	nodeLocalStorage->file_eepromNodeAddr->nodeLocalStorage = (void*)mrbfsNode;
 	
-	nodeLocalStorage->suppressUnits = 0;
-	if (0 == strcmp(mrbfsNodeOptionGet(mrbfsNode, "suppress_units", "no"), "yes"))
-		nodeLocalStorage->suppressUnits = 1;
+	nodeLocalStorage->suppressUnits = mrbfsNodeOptionGetBool(mrbfsNode, "suppress_units", 0);
 
-	nodeLocalStorage->timeout = atoi(mrbfsNodeOptionGet(mrbfsNode, "timeout", "none"));
+	nodeLocalStorage->timeout = mrbfsNodeOptionGetInt(mrbfsNode, "timeout", 0, 0, INT_MAX);
 
-	nodeLocalStorage->decimalPositions = atoi(mrbfsNodeOptionGet(mrbfsNode, "decimal_positions", "2"));
+	nodeLocalStorage->decimalPositions = mrbfsNodeOptionGetInt(mrbfsNode, "decimal_positions", 2, 0, 9);
 
-	nodeLocalStorage->isWireless = 0;
-	if (0 == strcmp(mrbfsNodeOptionGet(mrbfsNode, "connection", "wired"), "wireless"))
-		nodeLocalStorage->isWireless = 1;
+	{
+		const char* const connectionNames[] = { "wired", "wireless", NULL };
+		nodeLocalStorage->isWireless = mrbfsNodeOptionGetEnum(mrbfsNode, "connection", connectionNames, 0);
+	}
 
 	nodeLocalStorage->tempUnits = mrbfsNodeGetTemperatureUnits(mrbfsNode, "temperature_units");
 	nodeLocalStorage->pressureUnits = mrbfsNodeGetPressureUnits(mrbfsNode, "pressure_units");
 	nodeLocalStorage->pressureUnitsMSL = mrbfsNodeGetPressureUnits(mrbfsNode, "mean_sea_level_pressure_units");
 
-	nodeLocalStorage->altitude = atoi(mrbfsNodeOptionGet(mrbfsNode, "altitude_meters", "-1"));
+	nodeLocalStorage->altitude = mrbfsNodeOptionGetInt(mrbfsNode, "altitude_meters", -1, -500, 9000);
 	
 
 	// Allocate all storage, even if not used
@@ -300,6 +300,18 @@ int mrbfsNodeInit(MRBFSBusNode* mrbfsNode)
 	nodeLocalStorage->file_busVoltage = (*mrbfsNode->mrbfsFilesystemAddFile)(nodeLocalStorage->isWireless?"battery_voltage":"mrbus_voltage", FNODE_RO_VALUE_STR, mrbfsNode->path);
 	nodeLocalStorage->file_busVoltage->value.valueStr = nodeLocalStorage->busVoltageValue;
 
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_tempSensor);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_tempSensor2);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_tempSensor3);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_tempSensor4);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_relativeHumidity);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_relativeHumidity2);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_pressureSensor);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_pressureSensor2);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_meanSeaLevelPressure);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_meanSeaLevelPressure2);
+	mrbfsNodeHistoryAttach(mrbfsNode, nodeLocalStorage->file_busVoltage);
+
 	nodeResetFilesNoData(mrbfsNode);
 	return (0);
 }
@@ -330,6 +342,7 @@ void populateTempFile(NodeLocalStorage* nodeLocalStorage, double temperature, ti
 	snprintf(nodeLocalStorage->tempSensorValue, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 		"%.*f%s", nodeLocalStorage->decimalPositions, temperature, unitsStr);
 	nodeLocalStorage->file_tempSensor->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_tempSensor, temperature);
 }
 
 void populateTempFile2(NodeLocalStorage* nodeLocalStorage, double temperature, time_t currentTime)
@@ -340,6 +353,7 @@ void populateTempFile2(NodeLocalStorage* nodeLocalStorage, double temperature, t
 	snprintf(nodeLocalStorage->tempSensorValue2, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 		"%.*f%s", nodeLocalStorage->decimalPositions, temperature, unitsStr);
 	nodeLocalStorage->file_tempSensor2->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_tempSensor2, temperature);
 }
 
 void populateTempFile3(NodeLocalStorage* nodeLocalStorage, double temperature, time_t currentTime)
@@ -350,6 +364,7 @@ void populateTempFile3(NodeLocalStorage* nodeLocalStorage, double temperature, t
 	snprintf(nodeLocalStorage->tempSensorValue3, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 		"%.*f%s", nodeLocalStorage->decimalPositions, temperature, unitsStr);
 	nodeLocalStorage->file_tempSensor3->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_tempSensor3, temperature);
 }
 
 void populateTempFile4(NodeLocalStorage* nodeLocalStorage, double temperature, time_t currentTime)
@@ -360,6 +375,7 @@ void populateTempFile4(NodeLocalStorage* nodeLocalStorage, double temperature, t
 	snprintf(nodeLocalStorage->tempSensorValue4, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 		"%.*f%s", nodeLocalStorage->decimalPositions, temperature, unitsStr);
 	nodeLocalStorage->file_tempSensor4->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_tempSensor4, temperature);
 }
 
 void populateHumidityFile(NodeLocalStorage* nodeLocalStorage, double humidity, time_t currentTime)
@@ -370,6 +386,7 @@ void populateHumidityFile(NodeLocalStorage* nodeLocalStorage, double humidity, t
 	snprintf(nodeLocalStorage->relativeHumidityValue, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 		"%.*f%s", nodeLocalStorage->decimalPositions, humidity, unitsStr);
 	nodeLocalStorage->file_relativeHumidity->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_relativeHumidity, humidity);
 }
 
 void populateHumidityFile2(NodeLocalStorage* nodeLocalStorage, double humidity, time_t currentTime)
@@ -380,6 +397,7 @@ void populateHumidityFile2(NodeLocalStorage* nodeLocalStorage, double humidity,
 	snprintf(nodeLocalStorage->relativeHumidityValue2, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 		"%.*f%s", nodeLocalStorage->decimalPositions, humidity, unitsStr);
 	nodeLocalStorage->file_relativeHumidity2->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_relativeHumidity2, humidity);
 }
 
 // Temperature must be in degrees K
@@ -403,6 +421,7 @@ void populateMSLPFile(NodeLocalStorage* nodeLocalStorage, double pressure, doubl
 		snprintf(nodeLocalStorage->meanSeaLevelPressureValue, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 			"%.*f%s", nodeLocalStorage->decimalPositions, mrbfsGetPressureFromHPaDouble(mslp, nodeLocalStorage->pressureUnitsMSL), unitsStr);
 		nodeLocalStorage->file_meanSeaLevelPressure->updateTime = currentTime;
+		mrbfsNodeHistoryPublish(nodeLocalStorage->file_meanSeaLevelPressure, mrbfsGetPressureFromHPaDouble(mslp, nodeLocalStorage->pressureUnitsMSL));
 	}
 }
 
@@ -424,6 +443,7 @@ void populateMSLPFile2(NodeLocalStorage* nodeLocalStorage, double pressure, doub
 		snprintf(nodeLocalStorage->meanSeaLevelPressureValue2, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 			"%.*f%s", nodeLocalStorage->decimalPositions, mrbfsGetPressureFromHPaDouble(mslp, nodeLocalStorage->pressureUnitsMSL), unitsStr);
 		nodeLocalStorage->file_meanSeaLevelPressure2->updateTime = currentTime;
+		mrbfsNodeHistoryPublish(nodeLocalStorage->file_meanSeaLevelPressure2, mrbfsGetPressureFromHPaDouble(mslp, nodeLocalStorage->pressureUnitsMSL));
 	}
 }
 
@@ -435,6 +455,7 @@ void populatePressureFile(NodeLocalStorage* nodeLocalStorage, double pressure, t
 	snprintf(nodeLocalStorage->pressureSensorValue, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 		"%.*f%s", nodeLocalStorage->decimalPositions, pressure, unitsStr);
 	nodeLocalStorage->file_pressureSensor->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_pressureSensor, pressure);
 }
 
 void populatePressureFile2(NodeLocalStorage* nodeLocalStorage, double pressure, time_t currentTime)
@@ -445,12 +466,14 @@ void populatePressureFile2(NodeLocalStorage* nodeLocalStorage, double pressure,
 	snprintf(nodeLocalStorage->pressureSensorValue2, TEMPERATURE_VALUE_BUFFER_SZ-1, 
 		"%.*f%s", nodeLocalStorage->decimalPositions, pressure, unitsStr);
 	nodeLocalStorage->file_pressureSensor2->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_pressureSensor2, pressure);
 }
 
 void populateVoltageFile(NodeLocalStorage* nodeLocalStorage, double busVoltage, time_t currentTime)
 {
 	snprintf(nodeLocalStorage->busVoltageValue, TEMPERATURE_VALUE_BUFFER_SZ-1, "%.*f%s", nodeLocalStorage->decimalPositions, busVoltage, nodeLocalStorage->suppressUnits?"":" V\n" );
 	nodeLocalStorage->file_busVoltage->updateTime = currentTime;
+	mrbfsNodeHistoryPublish(nodeLocalStorage->file_busVoltage, busVoltage);
 }
 
 int mrbfsNodeRxPacket(MRBFSBusNode* mrbfsNode, MRBusPacket* rxPkt)